@@ -211,6 +211,28 @@ TF1* PixInitFunc::weibullCdf(TH1 *h) {
 
 // ----------------------------------------------------------------------
 TF1* PixInitFunc::errScurve(TH1 *h) {
+  // -- setup function
+  TF1* f = (TF1*)gROOT->FindObject("PIF_err");
+  if (0 == f) {
+    f = new TF1("PIF_err", PIF_err, h->GetBinLowEdge(1), h->GetBinLowEdge(h->GetNbinsX()+1), 4);
+    f->SetParNames("step", "slope", "floor", "plateau");                       
+    f->SetNpx(1000);
+  }
+  return errScurve(h, f); 
+}
+
+// ----------------------------------------------------------------------
+TF1* PixInitFunc::errScurveFunction(const char *name) {
+  TF1 *f = new TF1(name, PIF_err, 0., 256., 4);
+  f->SetParNames("step", "slope", "floor", "plateau");                       
+  f->SetNpx(1000);
+  // -- private instance, not to be found by errScurve(TH1*)
+  gROOT->GetListOfFunctions()->Remove(f);
+  return f; 
+}
+
+// ----------------------------------------------------------------------
+TF1* PixInitFunc::errScurve(TH1 *h, TF1 *f) {
 
   fDoNotFit = false;
 
@@ -244,21 +266,11 @@ TF1* PixInitFunc::errScurve(TH1 *h) {
 
   double hi = h->FindLastBinAbove(0.9*h->GetMaximum());
 
-
-  // -- setup function
-  TF1* f = (TF1*)gROOT->FindObject("PIF_err");
-  if (0 == f) {
-    f = new TF1("PIF_err", PIF_err, h->GetBinLowEdge(1), h->GetBinLowEdge(h->GetNbinsX()+1), 4);
-    f->SetParNames("step", "slope", "floor", "plateau");                       
-    f->SetNpx(1000);
-    f->SetRange(lo, hi); 
-  } else {
-    f->ReleaseParameter(0);     
-    f->ReleaseParameter(1);     
-    f->ReleaseParameter(2);     
-    f->ReleaseParameter(3); 
-    f->SetRange(lo, hi); 
-  }
+  f->ReleaseParameter(0);     
+  f->ReleaseParameter(1);     
+  f->ReleaseParameter(2);     
+  f->ReleaseParameter(3); 
+  f->SetRange(lo, hi); 
   
   f->SetParameter(0, h->GetBinCenter((ibin+jbin)/2)); 
   f->SetParameter(1, 0.2); 
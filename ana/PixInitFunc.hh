@@ -23,6 +23,10 @@ public:
   bool doNotFit() {return fDoNotFit;}
 
   TF1* errScurve(TH1 *h); 
+  /// initialize the s-curve function f (from errScurveFunction) for h
+  TF1* errScurve(TH1 *h, TF1 *f); 
+  /// new s-curve function owned by the caller, not registered with gROOT
+  static TF1* errScurveFunction(const char *name); 
   TF1* xrayScan(TH1 *h); 
   TF1* weibullCdf(TH1 *h); 
   TF1* gpTanPol(TH1 *h); 
@@ -0,0 +1,342 @@
+#include "PixScurveFitter.hh"
+#include "PixInitFunc.hh"
+#include "PixUtil.hh"
+
+#include "TROOT.h"
+#include "TMath.h"
+#include "TList.h"
+#include "Fit/Fitter.h"
+#include "Fit/BinData.h"
+#include "Fit/DataRange.h"
+#include "HFitInterface.h"
+#include "Math/WrappedMultiTF1.h"
+#include "Math/Factory.h"
+#include "Math/Minimizer.h"
+
+#include "threading.h"
+
+#include <algorithm>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+  // -- work shared by all threads of one PixScurveFitter::fit() call
+  struct fitJob {
+    const vector<TH1*> *hists;
+    vector<scurveResult> *results;
+    size_t next;
+    pxar::mutex m;
+  };
+
+  struct fitWorker {
+    fitJob *job;
+    TF1 *f;
+  };
+
+  // -- fit() can be called from several threads at once (pipelined FullTest, one thread per
+  //    DUT). TF1 construction and deletion touch global ROOT lists and are serialized by this
+  //    process-wide mutex, which also guards the one-time setup and the function counter.
+  pxar::mutex gRootMutex;
+  unsigned int gNfunctions(0);
+
+  // -- one-time setup of ROOT for fits in several threads, call with gRootMutex locked
+  void initThreads() {
+    static bool done(false);
+    if (done) return;
+    PixUtil::enableThreads();
+    // -- load the minimizer plugin before the threads need it
+    ROOT::Math::Minimizer *min = ROOT::Math::Factory::CreateMinimizer(ROOT::Math::MinimizerOptions::DefaultMinimizerType());
+    delete min;
+    done = true;
+  }
+
+}
+
+
+// ----------------------------------------------------------------------
+PixScurveFitter::PixScurveFitter(unsigned int nthreads, method m) {
+  fNthreads = (nthreads > 0 ? nthreads : pxar::hardware_concurrency());
+  fMethod = m; 
+}
+
+
+// ----------------------------------------------------------------------
+vector<scurveResult> PixScurveFitter::fit(const vector<TH1*> &hists) {
+  vector<scurveResult> results(hists.size());
+  if (hists.empty()) return results;
+
+  // -- the estimate is cheap enough to run in this thread
+  if (kMoments == fMethod) {
+    for (unsigned int i = 0; i < hists.size(); ++i) results[i] = estimateScurve(hists[i]);
+    return results;
+  }
+
+  fitJob job;
+  job.hists = &hists;
+  job.results = &results;
+  job.next = 0;
+
+  // -- per-thread functions are created here, TF1 construction is not thread safe. The names 
+  //    are unique, also across concurrent calls: ROOT deletes a function of the same name.
+  unsigned int nthreads = static_cast<unsigned int>(min(static_cast<size_t>(fNthreads), hists.size()));
+  vector<fitWorker> workers(nthreads);
+  {
+    pxar::lock_guard lock(gRootMutex);
+    initThreads();
+    for (unsigned int i = 0; i < nthreads; ++i) {
+      workers[i].job = &job;
+      ostringstream name;
+      name << "PIF_err_fit" << gNfunctions++;
+      workers[i].f = PixInitFunc::errScurveFunction(name.str().c_str());
+    }
+  }
+
+  // -- the calling thread is worker 0
+  vector<pxar::thread*> threads;
+  for (unsigned int i = 1; i < nthreads; ++i) {
+    pxar::thread *t = new pxar::thread();
+    if (!t->start(&PixScurveFitter::worker, &workers[i])) {
+      delete t;
+      continue;
+    }
+    threads.push_back(t);
+  }
+  worker(&workers[0]);
+
+  for (unsigned int i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+  {
+    pxar::lock_guard lock(gRootMutex);
+    for (unsigned int i = 0; i < nthreads; ++i) delete workers[i].f;
+  }
+
+  return results;
+}
+
+
+// ----------------------------------------------------------------------
+void PixScurveFitter::worker(void *arg) {
+  fitWorker *w = static_cast<fitWorker*>(arg);
+  PixInitFunc pif;
+  while (1) {
+    size_t i(0);
+    {
+      pxar::lock_guard lock(w->job->m);
+      if (w->job->next >= w->job->hists->size()) break;
+      i = w->job->next++;
+    }
+    TH1 *h = (*w->job->hists)[i];
+    pif.errScurve(h, w->f);
+    (*w->job->results)[i] = fitScurve(h, w->f, pif.doNotFit());
+  }
+}
+
+
+// ----------------------------------------------------------------------
+scurveResult PixScurveFitter::fitScurve(TH1 *h, TF1 *f, bool doNotFit) {
+  scurveResult r;
+  f->GetRange(r.lo, r.hi);
+
+  if (doNotFit) {
+    r.threshold  = f->GetParameter(0);
+    r.thresholdE = 1.;
+    r.sigma      = 0.5;
+    r.sigmaE     = 0.5;
+  } else {
+    // -- chi2 fit in the function range, empty bins are skipped (as TH1::Fit)
+    ROOT::Fit::DataOptions opt;
+    ROOT::Fit::DataRange range(r.lo, r.hi);
+    ROOT::Fit::BinData data(opt, range);
+    ROOT::Fit::FillData(data, h);
+
+    ROOT::Math::WrappedMultiTF1 wf(*f, 1);
+    ROOT::Fit::Fitter fitter;
+    fitter.SetFunction(wf, false);
+    for (int ipar = 0; ipar < f->GetNpar(); ++ipar) {
+      double plo, phi;
+      f->GetParLimits(ipar, plo, phi);
+      if (plo*phi != 0. && plo >= phi) fitter.Config().ParSettings(ipar).Fix();
+    }
+    if (fitter.Fit(data)) {
+      const ROOT::Fit::FitResult &res = fitter.Result();
+      for (int ipar = 0; ipar < f->GetNpar(); ++ipar) {
+	f->SetParameter(ipar, res.Parameter(ipar));
+	f->SetParError(ipar, res.ParError(ipar));
+      }
+    }
+    r.threshold  = f->GetParameter(0);
+    r.thresholdE = f->GetParError(0);
+    r.sigma      = 1./(TMath::Sqrt(2.)*f->GetParameter(1));
+    r.sigmaE     = r.sigma * f->GetParError(1) / f->GetParameter(1);
+  }
+  for (int ipar = 0; ipar < 4; ++ipar) r.par[ipar] = f->GetParameter(ipar);
+
+  checkRange(h, r);
+  return r;
+}
+
+
+// ----------------------------------------------------------------------
+scurveResult PixScurveFitter::estimateScurve(int n, const double *x, const double *y, const double *ey) {
+  scurveResult r;
+  if (n < 2) return r;
+
+  double ymax(y[0]);
+  for (int i = 1; i < n; ++i) if (y[i] > ymax) ymax = y[i];
+  if (ymax <= 0.) return r;
+
+  // -- same start of the range as PixInitFunc::errScurve: 3 consecutive bins at zero
+  int ilo(0);
+  for (int i = 2; i < n-1; ++i) {
+    if (y[i-2] < 1 && y[i-1] < 1 && y[i] < 1) {
+      ilo = i-2;
+      break;
+    }
+  }
+
+  // -- start of the plateau: 2 consecutive bins above 90%
+  int ipl(n-1);
+  for (int i = ilo; i < n-1; ++i) {
+    if (y[i] > 0.9*ymax && y[i+1] > 0.9*ymax) {
+      ipl = i+1;
+      break;
+    }
+  }
+
+  // -- continue into the plateau by about the width of the rise (the tail
+  //    above 90% holds a sizeable part of the step), but not beyond an
+  //    efficiency drop at high values
+  int i10(ilo);
+  while (i10 < ipl && y[i10] < 0.1*ymax) ++i10;
+  int ihi = min(n-1, ipl + (ipl - i10) + 2);
+  for (int i = ipl; i <= ihi; ++i) {
+    if (y[i] < 0.5*ymax) {
+      ihi = i-1;
+      break;
+    }
+  }
+
+  // -- plateau level from the bins in the plateau window
+  double plateau(0.);
+  for (int i = ipl; i <= ihi; ++i) plateau += y[i];
+  plateau /= (ihi - ipl + 1);
+
+  double D = plateau - y[ilo];
+  r.lo = x[ilo];
+  r.hi = x[ihi];
+  if (D <= 0. || ihi <= ilo) return r;
+
+  // -- mean and variance of the step, located between the bin centers. The
+  //    remainder up to the plateau level is attributed to the last bin
+  double sum(0.), sum2(0.);
+  for (int i = ilo; i < ihi; ++i) {
+    double m = 0.5*(x[i] + x[i+1]);
+    double d = y[i+1] - y[i];
+    sum  += m*d;
+    sum2 += m*m*d;
+  }
+  sum  += x[ihi]*(plateau - y[ihi]);
+  sum2 += x[ihi]*x[ihi]*(plateau - y[ihi]);
+  double thr = sum/D;
+  double dx = x[ilo+1] - x[ilo];
+  double mom2 = sum2/D - thr*thr;
+  double var = mom2 - dx*dx/12.;
+
+  // -- error propagation with the bin errors, only the first order terms
+  double thrE2(0.), varE2(0.);
+  for (int j = ilo; j <= ihi; ++j) {
+    double mlo = (j > ilo ? 0.5*(x[j-1] + x[j]) - thr : 0.);
+    double mhi = (j < ihi ? 0.5*(x[j] + x[j+1]) - thr : 0.);
+    double dthr = (mlo - mhi)/D;
+    double dvar = (mlo*mlo - mhi*mhi)/D;
+    if (j == ilo) {
+      dthr = -mhi/D;
+      dvar = (mom2 - mhi*mhi)/D;
+    } else if (j == ihi) {
+      dthr = mlo/D;
+      dvar = (mlo*mlo - mom2)/D;
+    }
+    thrE2 += dthr*dthr*ey[j]*ey[j];
+    varE2 += dvar*dvar*ey[j]*ey[j];
+  }
+
+  r.threshold  = thr;
+  r.thresholdE = TMath::Sqrt(thrE2);
+  if (var < dx*dx/12.) {
+    // -- step within one bin, as in the fit
+    r.thresholdE = 1.;
+    r.sigma  = 0.5;
+    r.sigmaE = 0.5;
+    var = 0.;
+  } else {
+    // -- Erf slope par[1] = sqrt(2)*width, reported sigma is 1/(sqrt(2)*par[1])
+    double width = TMath::Sqrt(var);
+    r.sigma  = 1./(2.*width);
+    r.sigmaE = r.sigma*TMath::Sqrt(varE2)/(2.*var);
+  }
+
+  r.par[0] = thr;
+  r.par[1] = (var > 0. ? TMath::Sqrt(2.*var) : 1.e2);
+  r.par[2] = 1.;
+  r.par[3] = 0.5*ymax;
+  r.ok = true;
+  return r;
+}
+
+
+// ----------------------------------------------------------------------
+scurveResult PixScurveFitter::estimateScurve(TH1 *h) {
+  int n = h->GetNbinsX();
+  vector<double> x(n), y(n), ey(n);
+  for (int i = 0; i < n; ++i) {
+    x[i]  = h->GetBinCenter(i+1);
+    y[i]  = h->GetBinContent(i+1);
+    ey[i] = h->GetBinError(i+1);
+  }
+  scurveResult r = estimateScurve(n, &x[0], &y[0], &ey[0]);
+  checkRange(h, r);
+  return r;
+}
+
+
+// ----------------------------------------------------------------------
+void PixScurveFitter::checkRange(TH1 *h, scurveResult &r) {
+  r.thresholdN = h->FindLastBinAbove(0.5*h->GetMaximum());
+  r.ok = true;
+
+  if (r.threshold < h->GetBinLowEdge(1)) {
+    r.threshold  = 0.;
+    r.thresholdE = 0.;
+    r.sigma  = 0.;
+    r.sigmaE = 0.;
+    r.thresholdN = 0.;
+    r.ok = false;
+  } else if (r.threshold > h->GetBinLowEdge(h->GetNbinsX())) {
+    r.threshold  = h->GetBinLowEdge(h->GetNbinsX());
+    r.thresholdE = 0.;
+    r.sigma  = 0.;
+    r.sigmaE = 0.;
+    r.thresholdN = r.threshold;
+    r.ok = false;
+  }
+}
+
+
+// ----------------------------------------------------------------------
+void PixScurveFitter::attach(TH1 *h, const scurveResult &r) {
+  pxar::lock_guard lock(gRootMutex);
+  TObject *old = h->GetListOfFunctions()->FindObject("PIF_err");
+  if (old) {
+    h->GetListOfFunctions()->Remove(old);
+    delete old;
+  }
+  TF1 *f = PixInitFunc::errScurveFunction("PIF_err");
+  f->SetParameters(r.par);
+  f->SetRange(r.lo, r.hi);
+  f->SetParent(h);
+  h->GetListOfFunctions()->Add(f);
+}
@@ -0,0 +1,63 @@
+#ifndef PIXSCURVEFITTER_H
+#define PIXSCURVEFITTER_H
+
+#include "pxardllexport.h"
+
+#include <vector>
+
+#include "TH1.h"
+#include "TF1.h"
+
+/// result of one s-curve fit
+struct DLLEXPORT scurveResult {
+  scurveResult() : threshold(0.), thresholdE(0.), sigma(0.), sigmaE(0.), thresholdN(0.), ok(false) {
+    for (int i = 0; i < 4; ++i) par[i] = 0.;
+    lo = hi = 0.;
+  }
+  double threshold, thresholdE, sigma, sigmaE;
+  double thresholdN; ///< threshold where noise leads to loss of efficiency
+  bool ok;           ///< false if the threshold is outside of the histogram range
+  double par[4];     ///< fitted PIF_err parameters
+  double lo, hi;     ///< fit range
+};
+
+// ----------------------------------------------------------------------
+/// Fits the s-curves of many pixels concurrently on a pool of worker
+/// threads. Every worker has its own PixInitFunc and TF1, the fits run
+/// through ROOT::Fit::Fitter without touching the global ROOT fitter.
+/// Alternatively the non-iterative moment estimate can be used.
+/// fit() and attach() may be called from several threads at once.
+class DLLEXPORT PixScurveFitter {
+
+public:
+  enum method {kFit, kMoments};
+
+  /// nthreads = 0 uses one thread per core
+  PixScurveFitter(unsigned int nthreads = 0, method m = kFit);
+
+  /// fit all histograms, the results are returned in the same order. The
+  /// bin errors have to be set before.
+  std::vector<scurveResult> fit(const std::vector<TH1*> &hists);
+
+  /// fit one histogram with the function f already initialized by
+  /// PixInitFunc::errScurve; safe to call concurrently for different h and f
+  static scurveResult fitScurve(TH1 *h, TF1 *f, bool doNotFit);
+
+  /// non-iterative estimate from the mean and width of the derivative of
+  /// the efficiency curve, n bins with centers x, contents y and errors ey.
+  /// Fills threshold, sigma (same convention as the fit) and their errors.
+  static scurveResult estimateScurve(int n, const double *x, const double *y, const double *ey);
+  /// moment estimate for a histogram, including thresholdN and range checks
+  static scurveResult estimateScurve(TH1 *h);
+
+  /// attach a copy of the fitted function to the histogram for display
+  static void attach(TH1 *h, const scurveResult &r);
+
+private:
+  static void worker(void *);
+  static void checkRange(TH1 *h, scurveResult &r);
+  unsigned int fNthreads;
+  method fMethod;
+};
+
+#endif
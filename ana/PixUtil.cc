@@ -3,6 +3,13 @@
 #include "TMath.h"
 #include "TStyle.h"
 #include "TColor.h"
+#include "RVersion.h"
+#include "TMinuitMinimizer.h"
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,0,0)
+#include "TThread.h"
+#else
+#include "TROOT.h"
+#endif
 
 using namespace std;
 
@@ -51,3 +58,18 @@ double PixUtil::dBinomial(int in, int iN) {
   if (n == 0) return 0.3/TMath::Sqrt(N);
   return TMath::Sqrt(TMath::Abs(w*(1-w)/N));
 }
+
+
+// ----------------------------------------------------------------------
+void PixUtil::enableThreads() {
+  static bool done(false);
+  if (done) return;
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+  ROOT::EnableThreadSafety();
+#else
+  TThread::Initialize();
+#endif
+  // -- no shared static TMinuit instance, every minimizer gets its own
+  TMinuitMinimizer::UseStaticMinuit(false);
+  done = true;
+}
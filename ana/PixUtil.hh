@@ -13,6 +13,8 @@ public:
   static void replaceAll(std::string& str, const std::string& from, const std::string& to);
   static double dEff(int in, int iN); 
   static double dBinomial(int in, int iN);
+  // -- one-time setup of ROOT for histogramming and fitting in several threads
+  static void enableThreads();
 };
 
 #endif
@@ -7,6 +7,7 @@
 #include "log.h"
 #include "timer.h"
 #include "helper.h"
+#include "accumulator.h"
 #include "dictionaries.h"
 #include <algorithm>
 #include <fstream>
@@ -16,6 +17,34 @@
 
 using namespace pxar;
 
+// Attaches a trigger condenser to the HAL test functions for the lifetime of
+// the object, so it is also detached again when an exception is thrown:
+class condenserGuard {
+  hal * _hal;
+public:
+  condenserGuard(hal * h, triggerCondenser * condenser) : _hal(h) { _hal->SetTriggerCondenser(condenser); }
+  ~condenserGuard() { _hal->SetTriggerCondenser(NULL); }
+};
+
+// Remembers which pixels of the DUT are enabled for testing and restores this
+// state when going out of scope, also when an exception is thrown:
+class testPixelGuard {
+  dut * _dut;
+  std::vector< std::vector<pixelConfig> > _enabled;
+public:
+  testPixelGuard(dut * d) : _dut(d), _enabled() {
+    for(size_t roc = 0; roc < _dut->getNRocs(); roc++) { _enabled.push_back(_dut->getEnabledPixels(roc)); }
+  }
+  ~testPixelGuard() {
+    for(size_t roc = 0; roc < _enabled.size(); roc++) {
+      _dut->testAllPixels(false,static_cast<uint8_t>(roc));
+      for(std::vector<pixelConfig>::iterator px = _enabled[roc].begin(); px != _enabled[roc].end(); ++px) {
+	_dut->testPixel(px->column,px->row,true,static_cast<uint8_t>(roc));
+      }
+    }
+  }
+};
+
 api::api(std::string usbId, std::string logLevel) : 
   _daq_running(false), 
   _daq_buffersize(DTB_SOURCE_BUFFER_SIZE),
@@ -249,7 +278,7 @@ bool api::initDUT(uint8_t hubid,
 	(*pixIt).trim = 15;
       }
       // Push the pixelConfigs into the rocConfig:
-      newroc.pixels.push_back(*pixIt);
+      newroc.pixels.add(*pixIt);
     }
 
     // Done. Enable bit is already set by rocConfig constructor.
@@ -425,6 +454,16 @@ void api::Pon() {
 
 uint32_t api::getDefaultPGPeriod() { return _dut->pg_sum; }
 
+void api::setRpcProfiling(bool enable) {
+  if(!_hal->status()) {return;}
+  _hal->setRpcProfiling(enable);
+}
+
+void api::printRpcProfile() {
+  if(!_hal->status()) {return;}
+  _hal->printRpcProfile();
+}
+
 bool api::SignalProbe(std::string probe, std::string name) {
 
   if(!_hal->status()) {return false;}
@@ -524,8 +563,9 @@ bool api::setDAC(std::string dacName, uint8_t dacValue) {
 
   std::pair<std::map<uint8_t,uint8_t>::iterator,bool> ret;
   // Set the DAC for all active ROCs:
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit) {
+  std::vector<uint8_t> enabledRocs = _dut->getEnabledRocIDs();
+  std::map< uint8_t, std::map< uint8_t,uint8_t > > rocDacs;
+  for (std::vector<uint8_t>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit) {
 
     // Update the DUT DAC Value:
     ret = _dut->roc.at(static_cast<uint8_t>(rocit - enabledRocs.begin())).dacs.insert( std::make_pair(dacRegister,dacValue) );
@@ -537,9 +577,40 @@ bool api::setDAC(std::string dacName, uint8_t dacValue) {
       LOG(logDEBUGAPI) << "DAC \"" << dacName << "\" updated with value " << static_cast<int>(dacValue);
     }
 
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dacRegister,dacValue);
+    rocDacs[static_cast<uint8_t>(rocit - enabledRocs.begin())][dacRegister] = dacValue;
   }
 
+  // Program all ROCs in one go:
+  _hal->rocSetDACs(rocDacs);
+  return true;
+}
+
+bool api::setDACs(std::vector<std::pair<std::string,uint8_t> > dacPairs, uint8_t rocid) {
+
+  if(!status()) {return false;}
+
+  if(_dut->roc.size() <= rocid) {
+    LOG(logERROR) << "ROC " << rocid << " does not exist in the DUT!";
+    return false;
+  }
+
+  // Update the DUT DAC values (even if the ROC is disabled!) and collect them:
+  std::map<uint8_t,uint8_t> dacs;
+  for(std::vector<std::pair<std::string,uint8_t> >::iterator it = dacPairs.begin(); it != dacPairs.end(); ++it) {
+    // Get the register number and check the range from dictionary:
+    uint8_t dacRegister;
+    uint8_t dacValue = it->second;
+    if(!verifyRegister(it->first, dacRegister, dacValue, ROC_REG)) return false;
+
+    if(_dut->roc.at(rocid).dacs.find(dacRegister) == _dut->roc.at(rocid).dacs.end()) {
+      LOG(logWARNING) << "DAC \"" << it->first << "\" was not initialized. Created with value " << static_cast<int>(dacValue);
+    }
+    _dut->roc.at(rocid).dacs[dacRegister] = dacValue;
+    dacs[dacRegister] = dacValue;
+  }
+
+  // Program all DACs of this ROC in one go:
+  _hal->rocSetDACs(_dut->roc.at(rocid).i2c_address,dacs);
   return true;
 }
 
@@ -607,7 +678,18 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getPulseheightVsDAC(
 
 std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getPulseheightVsDAC(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers) {
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::vector<pixel> > >();}
+  // Run the scan into the compact container and convert to the nested format:
+  dacScanResult scan;
+  getPulseheightVsDAC(scan, dacName, dacStep, dacMin, dacMax, flags, nTriggers);
+  std::vector< std::pair<uint8_t, std::vector<pixel> > > result;
+  scan.toDacScan(result);
+  return result;
+}
+
+void api::getPulseheightVsDAC(dacScanResult & result, std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers) {
+
+  result.Clear();
+  if(!status()) {return;}
 
   // Check DAC range
   if(dacMin > dacMax) {
@@ -621,7 +703,7 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getPulseheightVsDAC(
   // Get the register number and check the range from dictionary:
   uint8_t dacRegister;
   if(!verifyRegister(dacName, dacRegister, dacMax, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::vector<pixel> > >();
+    return;
   }
 
   // Setup the correct _hal calls for this test
@@ -642,19 +724,119 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getPulseheightVsDAC(
   param.push_back(static_cast<int32_t>(dacStep));
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags);
+  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags, nTriggers, false);
   // repack data into the expected return format
-  std::vector< std::pair<uint8_t, std::vector<pixel> > > result = repackDacScanData(data,dacStep,dacMin,dacMax,nTriggers,flags,false);
+  repackDacScanData(data,dacStep,dacMin,dacMax,flags,result);
 
   // Reset the original value for the scanned DAC:
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
+  std::vector<uint8_t> enabledRocs = _dut->getEnabledRocIDs();
+  std::map< uint8_t, std::map< uint8_t,uint8_t > > resetDacs;
+  for (std::vector<uint8_t>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
     uint8_t oldDacValue = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dacName);
     LOG(logDEBUGAPI) << "Reset DAC \"" << dacName << "\" to original value " << static_cast<int>(oldDacValue);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dacRegister,oldDacValue);
+    resetDacs[static_cast<uint8_t>(rocit - enabledRocs.begin())][dacRegister] = oldDacValue;
   }
+  _hal->rocSetDACs(resetDacs);
+}
 
-  return result;
+void api::getPulseheightVsDACPoints(dacScanResult & result, std::string dacName, std::vector<uint8_t> dacValues, uint16_t flags, uint16_t nTriggers) {
+
+  // No second DAC to be set between the points:
+  getPulseheightVsDACPoints(result, dacName, dacValues, "", std::vector<uint8_t>(), flags, nTriggers);
+}
+
+void api::getPulseheightVsDACPoints(dacScanResult & result, std::string dac1name, std::vector<uint8_t> dac1values, std::string dac2name, std::vector<uint8_t> dac2values, uint16_t flags, uint16_t nTriggers) {
+
+  result.Clear();
+  if(!status()) {return;}
+
+  bool setDac2 = !dac2name.empty();
+  if(dac1values.empty()) {
+    LOG(logERROR) << "No DAC values given for DAC \"" << dac1name << "\".";
+    return;
+  }
+  if(setDac2 && dac2values.size() != dac1values.size()) {
+    LOG(logERROR) << "Number of values for DAC \"" << dac1name << "\" (" << dac1values.size()
+		  << ") and DAC \"" << dac2name << "\" (" << dac2values.size() << ") differ.";
+    return;
+  }
+
+  // Get the register numbers and check the ranges from dictionary:
+  uint8_t dac1register, dac2register = 0;
+  if(!verifyRegister(dac1name, dac1register, *std::max_element(dac1values.begin(), dac1values.end()), ROC_REG)) {
+    return;
+  }
+  if(setDac2 && !verifyRegister(dac2name, dac2register, *std::max_element(dac2values.begin(), dac2values.end()), ROC_REG)) {
+    return;
+  }
+
+  // Setup the correct _hal calls for this test
+  HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelDacScan;
+  HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelDacScan;
+  HalMemFnRocSerial     rocfn        = &hal::SingleRocAllPixelsDacScan;
+  HalMemFnRocParallel   multirocfn   = &hal::MultiRocAllPixelsDacScan;
+
+  // The trigger loops on the DTB scan a DAC range with fixed step size. Split
+  // the points into runs of equidistant rising DAC values with the same
+  // setting of the second DAC, every run is measured in one loop:
+  std::vector< std::vector<int32_t> > params;
+  std::vector< std::map<uint8_t,uint8_t> > dacs;
+  std::vector<size_t> first;
+  for(size_t i = 0; i < dac1values.size(); ) {
+    size_t n = 1;
+    uint8_t step = 1;
+    if(i+1 < dac1values.size() && dac1values.at(i+1) > dac1values.at(i) && (!setDac2 || dac2values.at(i+1) == dac2values.at(i))) {
+      step = static_cast<uint8_t>(dac1values.at(i+1) - dac1values.at(i));
+      for(n = 2; i+n < dac1values.size(); n++) {
+	if(dac1values.at(i+n) != dac1values.at(i+n-1) + step) break;
+	if(setDac2 && dac2values.at(i+n) != dac2values.at(i)) break;
+      }
+    }
+
+    std::vector<int32_t> param;
+    param.push_back(static_cast<int32_t>(dac1register));
+    param.push_back(static_cast<int32_t>(dac1values.at(i)));
+    param.push_back(static_cast<int32_t>(dac1values.at(i+n-1)));
+    param.push_back(static_cast<int32_t>(flags));
+    param.push_back(static_cast<int32_t>(nTriggers));
+    param.push_back(static_cast<int32_t>(step));
+    params.push_back(param);
+
+    if(setDac2) {
+      dacs.push_back(std::map<uint8_t,uint8_t>());
+      dacs.back()[dac2register] = dac2values.at(i);
+    }
+    first.push_back(i);
+    i += n;
+  }
+  LOG(logDEBUGAPI) << "Measuring " << dac1values.size() << " DAC points in " << params.size() << " loops.";
+
+  std::vector< std::vector<Event*> > data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, params, dacs, flags, nTriggers, false);
+
+  // Repack the data of every loop and append its points to the result:
+  dacScanResult loop;
+  for(size_t i = 0; i < params.size(); i++) {
+    uint8_t dacMin = static_cast<uint8_t>(params.at(i).at(1));
+    uint8_t dacMax = static_cast<uint8_t>(params.at(i).at(2));
+    uint8_t dacStep = static_cast<uint8_t>(params.at(i).at(5));
+    repackDacScanData(data.at(i),dacStep,dacMin,dacMax,flags,loop);
+    for(size_t pt = 0; pt < loop.size(); pt++) {
+      result.AddPoint(loop.dac1(pt), (setDac2 ? dac2values.at(first.at(i)+pt) : 0), loop.nPixels(pt));
+      result.AddPixels(result.size()-1, loop.begin(pt), loop.end(pt));
+    }
+  }
+
+  // Reset the original values for the DACs:
+  std::map< uint8_t, std::map< uint8_t,uint8_t > > resetDacs;
+  for (std::vector<rocConfig>::iterator rocit = _dut->roc.begin(); rocit != _dut->roc.end(); ++rocit){
+    if(!rocit->enable) continue;
+    LOG(logDEBUGAPI) << "Reset DAC \"" << dac1name << "\" to original value " << static_cast<int>(rocit->dacs[dac1register]);
+    resetDacs[rocit->i2c_address][dac1register] = rocit->dacs[dac1register];
+    if(!setDac2) continue;
+    LOG(logDEBUGAPI) << "Reset DAC \"" << dac2name << "\" to original value " << static_cast<int>(rocit->dacs[dac2register]);
+    resetDacs[rocit->i2c_address][dac2register] = rocit->dacs[dac2register];
+  }
+  _hal->rocSetDACs(resetDacs);
 }
 
 std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getEfficiencyVsDAC(std::string dacName, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers) {
@@ -665,7 +847,18 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getEfficiencyVsDAC(s
 
 std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getEfficiencyVsDAC(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers) {
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::vector<pixel> > >();}
+  // Run the scan into the compact container and convert to the nested format:
+  dacScanResult scan;
+  getEfficiencyVsDAC(scan, dacName, dacStep, dacMin, dacMax, flags, nTriggers);
+  std::vector< std::pair<uint8_t, std::vector<pixel> > > result;
+  scan.toDacScan(result);
+  return result;
+}
+
+void api::getEfficiencyVsDAC(dacScanResult & result, std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers) {
+
+  result.Clear();
+  if(!status()) {return;}
 
   // Check DAC range
   if(dacMin > dacMax) {
@@ -679,7 +872,7 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getEfficiencyVsDAC(s
   // Get the register number and check the range from dictionary:
   uint8_t dacRegister;
   if(!verifyRegister(dacName, dacRegister, dacMax, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::vector<pixel> > >();
+    return;
   }
 
   // Setup the correct _hal calls for this test
@@ -698,19 +891,19 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getEfficiencyVsDAC(s
   param.push_back(static_cast<int32_t>(dacStep));
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags);
+  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags, nTriggers, true);
   // repack data into the expected return format
-  std::vector< std::pair<uint8_t, std::vector<pixel> > > result = repackDacScanData(data,dacStep,dacMin,dacMax,nTriggers,flags,true);
+  repackDacScanData(data,dacStep,dacMin,dacMax,flags,result);
 
   // Reset the original value for the scanned DAC:
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
+  std::vector<uint8_t> enabledRocs = _dut->getEnabledRocIDs();
+  std::map< uint8_t, std::map< uint8_t,uint8_t > > resetDacs;
+  for (std::vector<uint8_t>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
     uint8_t oldDacValue = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dacName);
     LOG(logDEBUGAPI) << "Reset DAC \"" << dacName << "\" to original value " << static_cast<int>(oldDacValue);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dacRegister,oldDacValue);
+    resetDacs[static_cast<uint8_t>(rocit - enabledRocs.begin())][dacRegister] = oldDacValue;
   }
-
-  return result;
+  _hal->rocSetDACs(resetDacs);
 }
 
 std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getThresholdVsDAC(std::string dacName, std::string dac2name, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
@@ -783,20 +976,22 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getThresholdVsDAC(st
   param.push_back(static_cast<int32_t>(dac2step));
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags);
+  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags, nTriggers, true);
   // repack data into the expected return format
   std::vector< std::pair<uint8_t, std::vector<pixel> > > result = repackThresholdDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,threshold,nTriggers,flags);
 
   // Reset the original value for the scanned DAC:
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
+  std::vector<uint8_t> enabledRocs = _dut->getEnabledRocIDs();
+  std::map< uint8_t, std::map< uint8_t,uint8_t > > resetDacs;
+  for (std::vector<uint8_t>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
     uint8_t oldDac1Value = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac1name);
     uint8_t oldDac2Value = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac2name);
     LOG(logDEBUGAPI) << "Reset DAC \"" << dac1name << "\" to original value " << static_cast<int>(oldDac1Value);
     LOG(logDEBUGAPI) << "Reset DAC \"" << dac2name << "\" to original value " << static_cast<int>(oldDac2Value);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac1register,oldDac1Value);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac2register,oldDac2Value);
+    resetDacs[static_cast<uint8_t>(rocit - enabledRocs.begin())][dac1register] = oldDac1Value;
+    resetDacs[static_cast<uint8_t>(rocit - enabledRocs.begin())][dac2register] = oldDac2Value;
   }
+  _hal->rocSetDACs(resetDacs);
 
   return result;
 }
@@ -810,7 +1005,18 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api:
 
 std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api::getPulseheightVsDACDAC(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();}
+  // Run the scan into the compact container and convert to the nested format:
+  dacScanResult scan;
+  getPulseheightVsDACDAC(scan, dac1name, dac1step, dac1min, dac1max, dac2name, dac2step, dac2min, dac2max, flags, nTriggers);
+  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > result;
+  scan.toDacDacScan(result);
+  return result;
+}
+
+void api::getPulseheightVsDACDAC(dacScanResult & result, std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
+
+  result.Clear();
+  if(!status()) {return;}
 
   // Check DAC ranges
   if(dac1min > dac1max) {
@@ -831,10 +1037,10 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api:
   // Get the register number and check the range from dictionary:
   uint8_t dac1register, dac2register;
   if(!verifyRegister(dac1name, dac1register, dac1max, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();
+    return;
   }
   if(!verifyRegister(dac2name, dac2register, dac2max, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();
+    return;
   }
 
   // Setup the correct _hal calls for this test
@@ -857,22 +1063,22 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api:
   param.push_back(static_cast<int32_t>(dac2step));
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags);
+  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags, nTriggers, false);
   // repack data into the expected return format
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > result = repackDacDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,nTriggers,flags,false);
+  repackDacDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,flags,result);
 
   // Reset the original value for the scanned DAC:
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
+  std::vector<uint8_t> enabledRocs = _dut->getEnabledRocIDs();
+  std::map< uint8_t, std::map< uint8_t,uint8_t > > resetDacs;
+  for (std::vector<uint8_t>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
     uint8_t oldDac1Value = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac1name);
     uint8_t oldDac2Value = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac2name);
     LOG(logDEBUGAPI) << "Reset DAC \"" << dac1name << "\" to original value " << static_cast<int>(oldDac1Value);
     LOG(logDEBUGAPI) << "Reset DAC \"" << dac2name << "\" to original value " << static_cast<int>(oldDac2Value);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac1register,oldDac1Value);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac2register,oldDac2Value);
+    resetDacs[static_cast<uint8_t>(rocit - enabledRocs.begin())][dac1register] = oldDac1Value;
+    resetDacs[static_cast<uint8_t>(rocit - enabledRocs.begin())][dac2register] = oldDac2Value;
   }
-
-  return result;
+  _hal->rocSetDACs(resetDacs);
 }
 
 std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api::getEfficiencyVsDACDAC(std::string dac1name, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
@@ -883,7 +1089,18 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api:
 
 std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api::getEfficiencyVsDACDAC(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();}
+  // Run the scan into the compact container and convert to the nested format:
+  dacScanResult scan;
+  getEfficiencyVsDACDAC(scan, dac1name, dac1step, dac1min, dac1max, dac2name, dac2step, dac2min, dac2max, flags, nTriggers);
+  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > result;
+  scan.toDacDacScan(result);
+  return result;
+}
+
+void api::getEfficiencyVsDACDAC(dacScanResult & result, std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
+
+  result.Clear();
+  if(!status()) {return;}
 
   // Check DAC ranges
   if(dac1min > dac1max) {
@@ -904,10 +1121,10 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api:
   // Get the register number and check the range from dictionary:
   uint8_t dac1register, dac2register;
   if(!verifyRegister(dac1name, dac1register, dac1max, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();
+    return;
   }
   if(!verifyRegister(dac2name, dac2register, dac2max, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();
+    return;
   }
 
   // Setup the correct _hal calls for this test
@@ -930,22 +1147,22 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api:
   param.push_back(static_cast<int32_t>(dac2step));
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags);
+  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags, nTriggers, true);
   // repack data into the expected return format
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > result = repackDacDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,nTriggers,flags,true);
+  repackDacDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,flags,result);
 
   // Reset the original value for the scanned DAC:
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
+  std::vector<uint8_t> enabledRocs = _dut->getEnabledRocIDs();
+  std::map< uint8_t, std::map< uint8_t,uint8_t > > resetDacs;
+  for (std::vector<uint8_t>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
     uint8_t oldDac1Value = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac1name);
     uint8_t oldDac2Value = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac2name);
     LOG(logDEBUGAPI) << "Reset DAC \"" << dac1name << "\" to original value " << static_cast<int>(oldDac1Value);
     LOG(logDEBUGAPI) << "Reset DAC \"" << dac2name << "\" to original value " << static_cast<int>(oldDac2Value);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac1register,oldDac1Value);
-    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac2register,oldDac2Value);
+    resetDacs[static_cast<uint8_t>(rocit - enabledRocs.begin())][dac1register] = oldDac1Value;
+    resetDacs[static_cast<uint8_t>(rocit - enabledRocs.begin())][dac2register] = oldDac2Value;
   }
-
-  return result;
+  _hal->rocSetDACs(resetDacs);
 }
 
 std::vector<pixel> api::getPulseheightMap(uint16_t flags, uint16_t nTriggers) {
@@ -964,10 +1181,10 @@ std::vector<pixel> api::getPulseheightMap(uint16_t flags, uint16_t nTriggers) {
   param.push_back(static_cast<int32_t>(nTriggers));
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags);
+  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags, nTriggers, false);
 
   // Repacking of all data segments into one long map vector:
-  std::vector<pixel> result = repackMapData(data, nTriggers, flags,false);
+  std::vector<pixel> result = repackMapData(data, flags);
 
   return result;
 }
@@ -988,10 +1205,10 @@ std::vector<pixel> api::getEfficiencyMap(uint16_t flags, uint16_t nTriggers) {
   param.push_back(static_cast<int32_t>(nTriggers));
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags);
+  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags, nTriggers, true);
 
   // Repacking of all data segments into one long map vector:
-  std::vector<pixel> result = repackMapData(data, nTriggers, flags, true);
+  std::vector<pixel> result = repackMapData(data, flags);
 
   return result;
 }
@@ -1026,6 +1243,18 @@ std::vector<pixel> api::getThresholdMap(std::string dacName, uint8_t dacStep, ui
     return std::vector<pixel>();
   }
 
+  // Adaptive search, if requested and the DAC range is large enough to profit.
+  // The coarse step is chosen to minimize the number of coarse plus refinement
+  // points, i.e. about sqrt(N/2) fine steps for N points in the range:
+  if((flags & FLAG_ADAPTIVE_THRESHOLD) != 0) {
+    size_t npoints = static_cast<size_t>((dacMax-dacMin)/dacStep+1);
+    size_t factor = static_cast<size_t>(sqrt(npoints/2.0) + 0.5);
+    if(factor > 1) {
+      return adaptiveThresholdMap(dacRegister, dacStep, static_cast<uint8_t>(factor*dacStep), dacMin, dacMax, threshold, flags, nTriggers);
+    }
+    LOG(logDEBUGAPI) << "DAC range too small for adaptive threshold search, scanning all points.";
+  }
+
   // Setup the correct _hal calls for this test, a threshold map is a 1D dac scan:
   HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelDacScan;
   HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelDacScan;
@@ -1042,13 +1271,91 @@ std::vector<pixel> api::getThresholdMap(std::string dacName, uint8_t dacStep, ui
   param.push_back(static_cast<int32_t>(dacStep));
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
-  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags);
+  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags, nTriggers, true);
 
   // Repacking of all data segments into one long map vector:
   std::vector<pixel> result = repackThresholdMapData(data, dacStep, dacMin, dacMax, threshold, nTriggers, flags);
 
   return result;
 }
+
+std::vector<pixel> api::adaptiveThresholdMap(uint8_t dacRegister, uint8_t dacStep, uint8_t coarseStep, uint8_t dacMin, uint8_t dacMax, uint8_t threshold, uint16_t flags, uint16_t nTriggers) {
+
+  // Measure time:
+  timer t;
+
+  // The coarse scan runs over the full DUT, the refinement on single pixels:
+  HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelDacScan;
+  HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelDacScan;
+  HalMemFnRocSerial     rocfn        = &hal::SingleRocAllPixelsDacScan;
+  HalMemFnRocParallel   multirocfn   = &hal::MultiRocAllPixelsDacScan;
+
+  // Load the test parameters into vector, starting with the coarse step:
+  std::vector<int32_t> param;
+  param.push_back(static_cast<int32_t>(dacRegister));
+  param.push_back(static_cast<int32_t>(dacMin));
+  param.push_back(static_cast<int32_t>(dacMax));
+  param.push_back(static_cast<int32_t>(flags));
+  param.push_back(static_cast<int32_t>(nTriggers));
+  param.push_back(static_cast<int32_t>(coarseStep));
+
+  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags, nTriggers, true);
+  std::vector<pixel> coarse = repackThresholdMapData(data, coarseStep, dacMin, dacMax, threshold, nTriggers, flags);
+
+  // The threshold found with the fine step lies within one coarse step around
+  // the coarse threshold. Group the pixels by their coarse threshold, so every
+  // refinement window is scanned only once:
+  std::map<uint8_t, std::vector<pixel> > windows;
+  for(std::vector<pixel>::iterator px = coarse.begin(); px != coarse.end(); ++px) {
+    windows[static_cast<uint8_t>(px->getValue())].push_back(*px);
+  }
+  LOG(logDEBUGAPI) << "Coarse threshold scan with step size " << static_cast<int>(coarseStep)
+		   << " found " << coarse.size() << " pixels in " << windows.size() << " refinement windows.";
+
+  // The parallel pixel loops pulse the same pixels on all enabled ROCs:
+  bool parallel = (_dut->getNEnabledRocs() > 1) && ((flags & FLAG_FORCE_SERIAL) == 0);
+  std::vector<uint8_t> enabledRocs = _dut->getEnabledRocIDs();
+
+  std::vector<pixel> result;
+  result.reserve(coarse.size());
+  testPixelGuard restore(_dut);
+
+  for(std::map<uint8_t, std::vector<pixel> >::iterator win = windows.begin(); win != windows.end(); ++win) {
+    uint8_t lo = (win->first >= dacMin + coarseStep) ? static_cast<uint8_t>(win->first - coarseStep) : dacMin;
+    uint8_t hi = (dacMax - win->first > coarseStep) ? static_cast<uint8_t>(win->first + coarseStep) : dacMax;
+
+    // Only enable the pixels of this window for testing:
+    _dut->testAllPixels(false);
+    for(std::vector<pixel>::iterator px = win->second.begin(); px != win->second.end(); ++px) {
+      if(!parallel) { _dut->testPixel(px->column,px->row,true,px->roc_id); }
+      else {
+	for(std::vector<uint8_t>::iterator roc = enabledRocs.begin(); roc != enabledRocs.end(); ++roc) {
+	  _dut->testPixel(px->column,px->row,true,*roc);
+	}
+      }
+    }
+
+    param.at(1) = static_cast<int32_t>(lo);
+    param.at(2) = static_cast<int32_t>(hi);
+    param.at(5) = static_cast<int32_t>(dacStep);
+    data = expandLoop(pixelfn, multipixelfn, NULL, NULL, param, flags, nTriggers, true);
+    std::vector<pixel> fine = repackThresholdMapData(data, dacStep, lo, hi, threshold, nTriggers, static_cast<uint16_t>(flags & ~FLAG_NOSORT));
+
+    // Take the refined threshold of the pixels belonging to this window, keep
+    // the coarse one if the pixel did not respond in the window:
+    for(std::vector<pixel>::iterator px = win->second.begin(); px != win->second.end(); ++px) {
+      std::vector<pixel>::iterator found = std::lower_bound(fine.begin(), fine.end(), *px);
+      if(found != fine.end() && *found == *px) { result.push_back(*found); }
+      else { result.push_back(*px); }
+    }
+  }
+
+  // Sort the output map by ROC->col->row - just because we are so nice:
+  if((flags&FLAG_NOSORT) == 0) { std::sort(result.begin(),result.end()); }
+
+  LOG(logDEBUGAPI) << "Adaptive threshold search took " << t << "ms.";
+  return result;
+}
   
 int32_t api::getReadbackValue(std::string /*parameterName*/) {
 
@@ -1062,7 +1369,7 @@ int32_t api::getReadbackValue(std::string /*parameterName*/) {
 
 // DAQ functions
 
-bool api::daqStart() {
+bool api::daqStart(bool background) {
 
   if(!status()) {return false;}
   if(daqStatus()) {return false;}
@@ -1088,7 +1395,7 @@ bool api::daqStart() {
   if(!_dut->tbm.empty()) { type = _dut->tbm.at(0).type; }
 
   // And start the DAQ session:
-  _hal->daqStart(_dut->sig_delays[SIG_DESER160PHASE],type,_daq_buffersize);
+  _hal->daqStart(_dut->sig_delays[SIG_DESER160PHASE],type,_daq_buffersize,background);
 
   _daq_running = true;
   return true;
@@ -1121,7 +1428,8 @@ bool api::daqStatus(uint8_t & perFull) {
   }
 
   LOG(logDEBUGAPI) << "Everything alright, buffer size " << filled_buffer
-		   << "/" << _daq_buffersize;
+		   << "/" << _daq_buffersize
+		   << ", host buffer " << _hal->daqHostBufferStatus();
   return true;
 }
 
@@ -1184,8 +1492,10 @@ std::vector<rawEvent> api::daqGetRawEventBuffer() {
   std::vector<rawEvent*> buffer = _hal->daqAllRawEvents();
 
   // Dereference all vector entries and give data back:
+  data.reserve(buffer.size());
   for(std::vector<rawEvent*>::iterator it = buffer.begin(); it != buffer.end(); ++it) {
     data.push_back(**it);
+    delete *it;
   }
   return data;
 }
@@ -1194,17 +1504,26 @@ std::vector<Event> api::daqGetEventBuffer() {
 
   // Reading out all data from the DTB and returning the decoded Event buffer.
   // Select the right readout channels depending on the number of TBMs
+  eventArena buffer;
+  daqGetEventBuffer(buffer);
+
+  // Copy the Events out of the arena and give data back:
   std::vector<Event> data = std::vector<Event>();
-  std::vector<Event*> buffer = _hal->daqAllEvents();
+  data.reserve(buffer.size());
+  for(size_t i = 0; i < buffer.size(); i++) { data.push_back(buffer.GetEvent(i)); }
+  return data;
+}
 
-  // check the data for decoder errors and update our internal counter
-  getDecoderErrorCount(buffer);
+void api::daqGetEventBuffer(eventArena & events) {
 
-  // Dereference all vector entries and give data back:
-  for(std::vector<Event*>::iterator it = buffer.begin(); it != buffer.end(); ++it) {
-    data.push_back(**it);
-  }
-  return data;
+  // Drop the previous content but keep the allocated memory:
+  events.Clear();
+
+  // Reading out all data from the DTB and decoding it straight into the arena:
+  _hal->daqAllEvents(events);
+
+  // check the data for decoder errors and update our internal counter
+  getDecoderErrorCount(events);
 }
 
 Event api::daqGetEvent() {
@@ -1213,7 +1532,10 @@ Event api::daqGetEvent() {
   if(!daqStatus()) { return Event(); }
 
   // Return the next decoded Event from the FIFO buffer:
-  return (*_hal->daqEvent());
+  Event * evt = _hal->daqEvent();
+  Event data = *evt;
+  delete evt;
+  return data;
 }
 
 rawEvent api::daqGetRawEvent() {
@@ -1222,7 +1544,10 @@ rawEvent api::daqGetRawEvent() {
   if(!daqStatus()) { return rawEvent(); }
 
   // Return the next raw data record from the FIFO buffer:
-  return (*_hal->daqRawEvent());
+  rawEvent * evt = _hal->daqRawEvent();
+  rawEvent data = *evt;
+  delete evt;
+  return data;
 }
 
 uint32_t api::daqGetNDecoderErrors() {
@@ -1232,6 +1557,18 @@ uint32_t api::daqGetNDecoderErrors() {
 }
 
 
+bool api::daqRecord(std::string filename) {
+
+  if(!status()) {return false;}
+  if(_daq_running) {
+    LOG(logERROR) << "DAQ running, cannot change the raw data recording.";
+    return false;
+  }
+
+  _hal->daqRecord(filename);
+  return true;
+}
+
 bool api::daqStop() {
 
   if(!status()) {return false;}
@@ -1260,10 +1597,18 @@ bool api::daqStop() {
 }
 
 
-std::vector<Event*> api::expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPixelParallel multipixelfn, HalMemFnRocSerial rocfn, HalMemFnRocParallel multirocfn, std::vector<int32_t> param, uint16_t flags) {
-  
-  // pointer to vector to hold our data
-  std::vector<Event*> data = std::vector<Event*>();
+std::vector<Event*> api::expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPixelParallel multipixelfn, HalMemFnRocSerial rocfn, HalMemFnRocParallel multirocfn, std::vector<int32_t> param, uint16_t flags, uint16_t nTriggers, bool efficiency) {
+
+  // One single loop without additional DAC settings:
+  std::vector< std::vector<int32_t> > params(1,param);
+  std::vector< std::vector<Event*> > data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, params, std::vector< std::map<uint8_t,uint8_t> >(), flags, nTriggers, efficiency);
+  return data.front();
+} // expandLoop()
+
+std::vector< std::vector<Event*> > api::expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPixelParallel multipixelfn, HalMemFnRocSerial rocfn, HalMemFnRocParallel multirocfn, const std::vector< std::vector<int32_t> > & params, const std::vector< std::map<uint8_t,uint8_t> > & dacs, uint16_t flags, uint16_t nTriggers, bool efficiency) {
+
+  // vector to hold the data of every loop
+  std::vector< std::vector<Event*> > data(params.size());
 
   // Start test timer:
   timer t;
@@ -1279,6 +1624,58 @@ std::vector<Event*> api::expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPixelPa
   // Else just trim all the pixels:
   else { MaskAndTrim(true); }
 
+  std::vector<uint8_t> rocs_i2c = _dut->getEnabledRocI2Caddr();
+  try {
+    for(size_t i = 0; i < params.size(); i++) {
+
+      // Program the DACs requested for this loop on all enabled ROCs:
+      if(i < dacs.size() && !dacs.at(i).empty()) {
+	std::map< uint8_t, std::map< uint8_t,uint8_t > > rocDacs;
+	for(std::vector<uint8_t>::iterator roc = rocs_i2c.begin(); roc != rocs_i2c.end(); ++roc) { rocDacs[*roc] = dacs.at(i); }
+	_hal->rocSetDACs(rocDacs);
+      }
+
+      // Condense the triggers already while the HAL is reading out the data:
+      triggerCondenser condenser(nTriggers, efficiency);
+      condenserGuard attach(_hal, &condenser);
+
+      // Fold anything the HAL returned directly and collect the condensed Events:
+      std::vector<Event*> loopdata = expandLoopCalls(pixelfn, multipixelfn, rocfn, multirocfn, params.at(i), flags);
+      condenser.Fill(loopdata);
+      data.at(i) = condenser.Get();
+
+      // check that we ended up with data
+      if (data.at(i).empty()){
+	LOG(logCRITICAL) << "NO DATA FROM TEST FUNCTION -- are any TBMs/ROCs/PIXs enabled?!";
+	return data;
+      }
+
+      // update the internal decoder error count for this data sample
+      getDecoderErrorCount(data.at(i));
+    }
+  }
+  catch(...) {
+    // The data of the loops already finished is not handed out, clean up:
+    for(size_t i = 0; i < data.size(); i++) {
+      for(std::vector<Event*>::iterator it = data.at(i).begin(); it != data.at(i).end(); ++it) { delete *it; }
+    }
+    throw;
+  }
+
+  // Test is over, mask the whole device again:
+  MaskAndTrim(false);
+
+  // Print timer value:
+  LOG(logINFO) << "Test took " << t << "ms.";
+
+  return data;
+} // expandLoop()
+
+std::vector<Event*> api::expandLoopCalls(HalMemFnPixelSerial pixelfn, HalMemFnPixelParallel multipixelfn, HalMemFnRocSerial rocfn, HalMemFnRocParallel multirocfn, std::vector<int32_t> param, uint16_t flags) {
+
+  // pointer to vector to hold our data
+  std::vector<Event*> data = std::vector<Event*>();
+
   // Check if we might use parallel routine on whole module: more than one ROC
   // must be enabled and parallel execution not disabled by user
   if ((_dut->getNEnabledRocs() > 1) && ((flags & FLAG_FORCE_SERIAL) == 0)) {
@@ -1399,108 +1796,23 @@ std::vector<Event*> api::expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPixelPa
     }
   } // single roc fnc
 
-  // check that we ended up with data
-  if (data.empty()){
-    LOG(logCRITICAL) << "NO DATA FROM TEST FUNCTION -- are any TBMs/ROCs/PIXs enabled?!";
-    return data;
-  }
-  
-  // update the internal decoder error count for this data sample
-  getDecoderErrorCount(data);
-
-  // Test is over, mask the whole device again:
-  MaskAndTrim(false);
-
-  // Print timer value:
-  LOG(logINFO) << "Test took " << t << "ms.";
-
   return data;
-} // expandLoop()
-
-
-std::vector<Event*> api::condenseTriggers(std::vector<Event*> data, uint16_t nTriggers, bool efficiency) {
+} // expandLoopCalls()
 
-  std::vector<Event*> packed;
 
-  if(data.size()%nTriggers != 0) {
-    LOG(logCRITICAL) << "Data size does not correspond to " << nTriggers << " triggers! Aborting data processing!";
-    return packed;
-  }
-
-  for(std::vector<Event*>::iterator Eventit = data.begin(); Eventit!= data.end(); Eventit += nTriggers) {
-
-    Event * evt = new Event();
-    std::map<pixel,uint16_t> pxcount = std::map<pixel,uint16_t>();
-    std::map<pixel,double> pxmean = std::map<pixel,double>();
-    std::map<pixel,double> pxm2 = std::map<pixel,double>();
-
-    for(std::vector<Event*>::iterator it = Eventit; it != Eventit+nTriggers; ++it) {
-
-      // Loop over all contained pixels:
-      for(std::vector<pixel>::iterator pixit = (*it)->pixels.begin(); pixit != (*it)->pixels.end(); ++pixit) {
-
-	// Check if we have that particular pixel already in:
-	std::vector<pixel>::iterator px = std::find_if(evt->pixels.begin(),
-						       evt->pixels.end(),
-						       findPixelXY(pixit->column, pixit->row, pixit->roc_id));
-	// Pixel is known:
-	if(px != evt->pixels.end()) {
-	  if(efficiency) { px->setValue(px->getValue()+1); }
-	  else {
-	    // Calculate the variance incrementally:
-	    double delta = pixit->getValue() - pxmean[*px];
-	    pxmean[*px] += delta/pxcount[*px];
-	    pxm2[*px] += delta*(pixit->getValue() - pxmean[*px]);
-	    pxcount[*px]++;
-	  }
-	}
-	// Pixel is new:
-	else {
-	  if(efficiency) { pixit->setValue(1); }
-	  else { 
-	    // Initialize counters and temporary variables:
-	    pxcount.insert(std::make_pair(*pixit,1));
-	    pxmean.insert(std::make_pair(*pixit,0));
-	    pxm2.insert(std::make_pair(*pixit,0));
-	  }
-	  evt->pixels.push_back(*pixit);
-	}
-      }
-
-      // Delete the original data, not needed anymore:
-      delete *it;
-    }
-
-    // Calculate mean and variance for the pulse height depending on the
-    // number of triggers received:
-    if(!efficiency) {
-      for(std::vector<pixel>::iterator px = evt->pixels.begin(); px != evt->pixels.end(); ++px) {
-	px->setValue(pxmean[*px]); // The mean
-	px->setVariance(pxm2[*px]/(pxcount[*px] - 1)); // The variance
-      }
-    }
-    packed.push_back(evt);
-  }
-
-  return packed;
-}
-
-std::vector<pixel> api::repackMapData (std::vector<Event*> data, uint16_t nTriggers, uint16_t flags, bool efficiency) {
+std::vector<pixel> api::repackMapData (std::vector<Event*> data, uint16_t flags) {
 
   // Keep track of the pixel to be expected:
   uint8_t expected_column = 0, expected_row = 0;
 
   std::vector<pixel> result;
-  LOG(logDEBUGAPI) << "Simple Map Repack of " << data.size() << " data blocks, returning " << (efficiency ? "efficiency" : "averaged pulse height") << ".";
+  LOG(logDEBUGAPI) << "Simple Map Repack of " << data.size() << " data blocks.";
 
   // Measure time:
   timer t;
 
-  // First reduce triggers, we have #nTriggers Events which belong together:
-  std::vector<Event*> packed = condenseTriggers(data, nTriggers, efficiency);
-
-  // Loop over all Events we have:
-  for(std::vector<Event*>::iterator Eventit = packed.begin(); Eventit!= packed.end(); ++Eventit) {
+  // Loop over all Events we have, triggers have already been condensed:
+  for(std::vector<Event*>::iterator Eventit = data.begin(); Eventit!= data.end(); ++Eventit) {
     // For every Event, loop over all contained pixels:
     for(std::vector<pixel>::iterator pixit = (*Eventit)->pixels.begin(); pixit != (*Eventit)->pixels.end(); ++pixit) {
       if(((flags&FLAG_CHECK_ORDER) != 0) && (pixit->column != expected_column || pixit->row != expected_row)) {
@@ -1515,55 +1827,59 @@ std::vector<pixel> api::repackMapData (std::vector<Event*> data, uint16_t nTrigg
       if(expected_row >= ROC_NUMROWS) { expected_row = 0; expected_column++; }
       if(expected_column >= ROC_NUMCOLS) { expected_row = 0; expected_column = 0; }
     }
+
+    // Delete the condensed data, not needed anymore:
+    delete *Eventit;
   } // loop over Events
 
   // Sort the output map by ROC->col->row - just because we are so nice:
   if((flags&FLAG_NOSORT) == 0) { std::sort(result.begin(),result.end()); }
 
-  // Cleanup temporary data:
-  for(std::vector<Event*>::iterator it = packed.begin(); it != packed.end(); ++it) { delete *it; }
-
   LOG(logDEBUGAPI) << "Correctly repacked Map data for delivery.";
   LOG(logDEBUGAPI) << "Repacking took " << t << "ms.";
   return result;
 }
 
-std::vector< std::pair<uint8_t, std::vector<pixel> > > api::repackDacScanData (std::vector<Event*> data, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t nTriggers, uint16_t /*flags*/, bool efficiency){
+void api::repackDacScanData (std::vector<Event*> data, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t /*flags*/, dacScanResult & result){
 
-  std::vector< std::pair<uint8_t, std::vector<pixel> > > result;
+  result.Clear();
 
   // Measure time:
   timer t;
 
-  // First reduce triggers, we have #nTriggers Events which belong together:
-  std::vector<Event*> packed = condenseTriggers(data, nTriggers, efficiency);
-
-  if(packed.size() % static_cast<size_t>((dacMax-dacMin)/dacStep+1) != 0) {
-    LOG(logCRITICAL) << "Data size not as expected! " << packed.size() << " data blocks do not fit to " << static_cast<int>((dacMax-dacMin)/dacStep+1) << " DAC values!";
-    return result;
+  size_t npoints = static_cast<size_t>((dacMax-dacMin)/dacStep+1);
+  if(data.size() % npoints != 0) {
+    LOG(logCRITICAL) << "Data size not as expected! " << data.size() << " data blocks do not fit to " << static_cast<int>(npoints) << " DAC values!";
+    for(std::vector<Event*>::iterator it = data.begin(); it != data.end(); ++it) { delete *it; }
+    return;
   }
 
-  LOG(logDEBUGAPI) << "Packing DAC range " << static_cast<int>(dacMin) << " - " << static_cast<int>(dacMax) << " (step size " << static_cast<int>(dacStep) << "), data has " << packed.size() << " entries.";
+  LOG(logDEBUGAPI) << "Packing DAC range " << static_cast<int>(dacMin) << " - " << static_cast<int>(dacMax) << " (step size " << static_cast<int>(dacStep) << "), data has " << data.size() << " entries.";
+
+  // The data runs through the DAC range, potentially several rounds. Count
+  // the pixels per DAC value first, so they can be placed into their final
+  // position right away:
+  std::vector<size_t> npixels(npoints,0);
+  size_t total = 0;
+  for(size_t i = 0; i < data.size(); i++) {
+    npixels[i%npoints] += data[i]->pixels.size();
+    total += data[i]->pixels.size();
+  }
 
-  // Prepare the result vector
-  for(size_t dac = dacMin; dac <= dacMax; dac += dacStep) { result.push_back(std::make_pair(dac,std::vector<pixel>())); }
+  // Prepare the result
+  result.pixels.reserve(total);
+  size_t point = 0;
+  for(size_t dac = dacMin; dac <= dacMax; dac += dacStep) { result.AddPoint(static_cast<uint8_t>(dac),0,npixels[point++]); }
 
-  size_t currentDAC = dacMin;
-  // Loop over the packed data and separate into DAC ranges, potentially several rounds:
-  for(std::vector<Event*>::iterator Eventit = packed.begin(); Eventit!= packed.end(); ++Eventit) {
-    if(currentDAC > dacMax) { currentDAC = dacMin; }
-    result.at((currentDAC-dacMin)/dacStep).second.insert(result.at((currentDAC-dacMin)/dacStep).second.end(),
-					       (*Eventit)->pixels.begin(),
-					       (*Eventit)->pixels.end());
-    currentDAC += dacStep;
+  // Loop over the condensed data and separate into DAC ranges:
+  for(size_t i = 0; i < data.size(); i++) {
+    result.AddPixels(i%npoints, data[i]->pixels.begin(), data[i]->pixels.end());
+    // Delete the condensed data, not needed anymore:
+    delete data[i];
   }
-  
-  // Cleanup temporary data:
-  for(std::vector<Event*>::iterator it = packed.begin(); it != packed.end(); ++it) { delete *it; }
 
   LOG(logDEBUGAPI) << "Correctly repacked DacScan data for delivery.";
   LOG(logDEBUGAPI) << "Repacking took " << t << "ms.";
-  return result;
 }
 
 std::vector<pixel> api::repackThresholdMapData (std::vector<Event*> data, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t thresholdlevel, uint16_t nTriggers, uint16_t flags) {
@@ -1580,51 +1896,23 @@ std::vector<pixel> api::repackThresholdMapData (std::vector<Event*> data, uint8_
   timer t;
 
   // First, pack the data as it would be a regular Dac Scan:
-  std::vector<std::pair<uint8_t,std::vector<pixel> > > packed_dac = repackDacScanData(data, dacStep, dacMin, dacMax, nTriggers, flags, true);
-
-  // Efficiency map:
-  std::map<pixel,uint8_t> oldvalue;  
+  dacScanResult packed_dac;
+  repackDacScanData(data, dacStep, dacMin, dacMax, flags, packed_dac);
 
   // Then loop over all pixels and DAC settings, start from the back if we are looking for falling edge.
   // This ensures that we end up having the correct edge, even if the efficiency suddenly changes from 0 to max.
-  std::vector<std::pair<uint8_t,std::vector<pixel> > >::iterator it_start;
-  std::vector<std::pair<uint8_t,std::vector<pixel> > >::iterator it_end;
-  int increase_op;
-  if((flags&FLAG_RISING_EDGE) != 0) { it_start = packed_dac.begin(); it_end = packed_dac.end(); increase_op = 1; }
-  else { it_start = packed_dac.end()-1; it_end = packed_dac.begin()-1; increase_op = -1;  }
+  bool rising = ((flags&FLAG_RISING_EDGE) != 0);
+  thresholdSearch search(threshold);
 
-  for(std::vector<std::pair<uint8_t,std::vector<pixel> > >::iterator it = it_start; it != it_end; it += increase_op) {
+  for(size_t n = 0; n < packed_dac.size(); n++) {
+    size_t point = (rising ? n : packed_dac.size()-1-n);
+    uint8_t dac = packed_dac.dac1(point);
     // For every DAC value, loop over all pixels:
-    for(std::vector<pixel>::iterator pixit = it->second.begin(); pixit != it->second.end(); ++pixit) {
-      // Check if we have that particular pixel already in:
-      std::vector<pixel>::iterator px = std::find_if(result.begin(),
-						     result.end(),
-						     findPixelXY(pixit->column, pixit->row, pixit->roc_id));
-      // Pixel is known:
-      if(px != result.end()) {
-	// Calculate efficiency deltas and slope:
-	uint8_t delta_old = abs(oldvalue[*px] - threshold);
-	uint8_t delta_new = abs(pixit->getValue() - threshold);
-	bool positive_slope = (pixit->getValue()-oldvalue[*px] > 0 ? true : false);
-	// Check which value is closer to the threshold:
-	if(!positive_slope) continue; 
-	if(!(delta_new < delta_old)) continue; 
-
-	// Update the DAC threshold value for the pixel:
-	px->setValue(it->first);
-	// Update the oldvalue map:
-	oldvalue[*px] = pixit->getValue();
-      }
-      // Pixel is new, just adding it:
-      else {
-	// Store the pixel with original efficiency
-	oldvalue.insert(std::make_pair(*pixit,pixit->getValue()));
-	// Push pixel to result vector with current DAC as value field:
-	pixit->setValue(it->first);
-	result.push_back(*pixit);
-      }
+    for(std::vector<pixel>::const_iterator pixit = packed_dac.begin(point); pixit != packed_dac.end(point); ++pixit) {
+      search.Fill(*pixit, dac);
     }
   }
+  search.Get(result);
 
   // Sort the output map by ROC->col->row - just because we are so nice:
   if((flags&FLAG_NOSORT) == 0) { std::sort(result.begin(),result.end()); }
@@ -1649,65 +1937,35 @@ std::vector<std::pair<uint8_t,std::vector<pixel> > > api::repackThresholdDacScan
 
   // First, pack the data as it would be a regular DacDac Scan:
   //FIXME stepping size!
-  std::vector<std::pair<uint8_t,std::pair<uint8_t,std::vector<pixel> > > > packed_dacdac = repackDacDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,nTriggers,flags,true);
-
-  // Efficiency map:
-  std::map<uint8_t,std::map<pixel,uint8_t> > oldvalue;  
+  dacScanResult packed_dacdac;
+  repackDacDacScanData(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,flags,packed_dacdac);
 
   // Then loop over all pixels and DAC settings, start from the back if we are looking for falling edge.
   // This ensures that we end up having the correct edge, even if the efficiency suddenly changes from 0 to max.
-  std::vector<std::pair<uint8_t,std::pair<uint8_t,std::vector<pixel> > > >::iterator it_start;
-  std::vector<std::pair<uint8_t,std::pair<uint8_t,std::vector<pixel> > > >::iterator it_end;
-  int increase_op;
-  if((flags&FLAG_RISING_EDGE) != 0) { it_start = packed_dacdac.begin(); it_end = packed_dacdac.end(); increase_op = 1; }
-  else { it_start = packed_dacdac.end()-1; it_end = packed_dacdac.begin()-1; increase_op = -1;  }
-
-  for(std::vector<std::pair<uint8_t,std::pair<uint8_t,std::vector<pixel> > > >::iterator it = it_start; it != it_end; it += increase_op) {
-
-    // For every DAC/DAC entry, loop over all pixels:
-    for(std::vector<pixel>::iterator pixit = it->second.second.begin(); pixit != it->second.second.end(); ++pixit) {
-      
-      // Find the current DAC2 value in the result vector (simple replace for find_if):
-      std::vector<std::pair<uint8_t, std::vector<pixel> > >::iterator dac;
-      for(dac = result.begin(); dac != result.end(); ++dac) { if(it->second.first == dac->first) break; }
-
-      // Didn't find the DAC2 value:
-      if(dac == result.end()) {
-	result.push_back(std::make_pair(it->second.first,std::vector<pixel>()));
-	dac = result.end() - 1;
-	// Also add an entry for bookkeeping:
-	oldvalue.insert(std::make_pair(it->second.first,std::map<pixel,uint8_t>()));
-      }
-      
-      // Check if we have that particular pixel already in:
-      std::vector<pixel>::iterator px = std::find_if(dac->second.begin(),
-						     dac->second.end(),
-						     findPixelXY(pixit->column, pixit->row, pixit->roc_id));
-
-      // Pixel is known:
-      if(px != dac->second.end()) {
-	// Calculate efficiency deltas and slope:
-	uint8_t delta_old = abs(oldvalue[dac->first][*px] - threshold);
-	uint8_t delta_new = abs(pixit->getValue() - threshold);
-	bool positive_slope = (pixit->getValue() - oldvalue[dac->first][*px] > 0 ? true : false);
-	// Check which value is closer to the threshold:
-	if(!positive_slope) continue;
-	if(!(delta_new < delta_old)) continue;
-
-	// Update the DAC threshold value for the pixel:
-	px->setValue(it->first);
-	// Update the oldvalue map:
-	oldvalue[dac->first][*px] = pixit->getValue();
-      }
-      // Pixel is new, just adding it:
-      else {
-	// Store the pixel with original efficiency
-	oldvalue[dac->first].insert(std::make_pair(*pixit,pixit->getValue()));
-	// Push pixel to result vector with current DAC as value field:
-	pixit->setValue(it->first);
-	dac->second.push_back(*pixit);
+  bool rising = ((flags&FLAG_RISING_EDGE) != 0);
+
+  // Collect the points of every DAC2 value in search order. The DAC2 values
+  // themselves are ordered by the first of their points containing pixels:
+  std::vector< std::vector<size_t> > slices(256);
+  std::vector<uint8_t> order;
+  for(size_t n = 0; n < packed_dacdac.size(); n++) {
+    size_t point = (rising ? n : packed_dacdac.size()-1-n);
+    uint8_t dac2 = packed_dacdac.dac2(point);
+    if(packed_dacdac.nPixels(point) > 0 && std::find(order.begin(), order.end(), dac2) == order.end()) { order.push_back(dac2); }
+    slices[dac2].push_back(point);
+  }
+
+  // Search the edge along DAC1 separately for every DAC2 value:
+  thresholdSearch search(threshold);
+  for(std::vector<uint8_t>::iterator dac2 = order.begin(); dac2 != order.end(); ++dac2) {
+    search.Clear();
+    for(std::vector<size_t>::iterator point = slices[*dac2].begin(); point != slices[*dac2].end(); ++point) {
+      for(std::vector<pixel>::const_iterator pixit = packed_dacdac.begin(*point); pixit != packed_dacdac.end(*point); ++pixit) {
+	search.Fill(*pixit, packed_dacdac.dac1(*point));
       }
     }
+    result.push_back(std::make_pair(*dac2,std::vector<pixel>()));
+    search.Get(result.back().second);
   }
 
   // Sort the output map by DAC values and ROC->col->row - just because we are so nice:
@@ -1718,18 +1976,19 @@ std::vector<std::pair<uint8_t,std::vector<pixel> > > api::repackThresholdDacScan
   return result;
 }
 
-std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api::repackDacDacScanData (std::vector<Event*> data, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t nTriggers, uint16_t /*flags*/, bool efficiency) {
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > result;
+void api::repackDacDacScanData (std::vector<Event*> packed, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t /*flags*/, dacScanResult & result) {
+
+  result.Clear();
 
   // Measure time:
   timer t;
 
-  // First reduce triggers, we have #nTriggers Events which belong together:
-  std::vector<Event*> packed = condenseTriggers(data, nTriggers, efficiency);
-
-  if(packed.size() % static_cast<size_t>(((dac1max-dac1min)/dac1step+1)*((dac2max-dac2min)/dac2step+1)) != 0) {
-    LOG(logCRITICAL) << "Data size not as expected! " << packed.size() << " data blocks do not fit to " << static_cast<int>(((dac1max-dac1min)/dac1step+1)*((dac2max-dac2min)/dac2step+1)) << " DAC values!";
-    return result;
+  // Triggers have already been condensed, one Event per DAC/DAC setting:
+  size_t npoints = static_cast<size_t>(((dac1max-dac1min)/dac1step+1)*((dac2max-dac2min)/dac2step+1));
+  if(packed.size() % npoints != 0) {
+    LOG(logCRITICAL) << "Data size not as expected! " << packed.size() << " data blocks do not fit to " << static_cast<int>(npoints) << " DAC values!";
+    for(std::vector<Event*>::iterator it = packed.begin(); it != packed.end(); ++it) { delete *it; }
+    return;
   }
 
   LOG(logDEBUGAPI) << "Packing DAC range [" << static_cast<int>(dac1min) << " - " << static_cast<int>(dac1max) 
@@ -1738,32 +1997,28 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api:
 		   << ", step size " << static_cast<int>(dac2step)
 		   << "], data has " << packed.size() << " entries.";
 
-  // Prepare the result vector
+  // The data runs through the DAC/DAC range with DAC2 running fastest,
+  // potentially several rounds. Count the pixels per DAC/DAC setting first,
+  // so they can be placed into their final position right away:
+  std::vector<size_t> npixels(npoints,0);
+  size_t total = 0;
+  for(size_t i = 0; i < packed.size(); i++) {
+    npixels[i%npoints] += packed[i]->pixels.size();
+    total += packed[i]->pixels.size();
+  }
+
+  // Prepare the result
+  result.pixels.reserve(total);
+  size_t point = 0;
   for(size_t dac1 = dac1min; dac1 <= dac1max; dac1 += dac1step) {
-    std::pair<uint8_t,std::vector<pixel> > dacpair;
     for(size_t dac2 = dac2min; dac2 <= dac2max; dac2 += dac2step) {
-      dacpair = std::make_pair(dac2,std::vector<pixel>());
-      result.push_back(std::make_pair(dac1,dacpair));
+      result.AddPoint(static_cast<uint8_t>(dac1),static_cast<uint8_t>(dac2),npixels[point++]);
     }
   }
 
-  size_t current1dac = dac1min;
-  size_t current2dac = dac2min;
-
-  // Loop over the packed data and separeate into DAC ranges, potentially several rounds:
-  int i = 0;
-  for(std::vector<Event*>::iterator Eventit = packed.begin(); Eventit!= packed.end(); ++Eventit) {
-    if(current2dac > dac2max) {
-      current2dac = dac2min;
-      current1dac += dac1step;
-    }
-    if(current1dac > dac1max) { current1dac = dac1min; }
-
-    result.at((current1dac-dac1min)/dac1step*((dac2max-dac2min)/dac2step+1) + (current2dac-dac2min)/dac2step).second.second.insert(result.at((current1dac-dac1min)/dac1step*((dac2max-dac2min)/dac2step+1) + (current2dac-dac2min)/dac2step).second.second.end(),
-												       (*Eventit)->pixels.begin(),
-												       (*Eventit)->pixels.end());
-    i++;
-    current2dac += dac2step;
+  // Loop over the packed data and separate into DAC ranges:
+  for(size_t i = 0; i < packed.size(); i++) {
+    result.AddPixels(i%npoints, packed[i]->pixels.begin(), packed[i]->pixels.end());
   }
   
   // Cleanup temporary data:
@@ -1771,18 +2026,28 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api:
 
   LOG(logDEBUGAPI) << "Correctly repacked DacDacScan data for delivery.";
   LOG(logDEBUGAPI) << "Repacking took " << t << "ms.";
-  return result;
 }
 
 // Update mask and trim bits for the full DUT in NIOS structs:
 void api::MaskAndTrimNIOS() {
 
-  // First transmit all configured I2C addresses:
-  _hal->SetupI2CValues(_dut->getRocI2Caddr());
+  // First transmit all configured I2C addresses, the trim data has to be
+  // resent if they changed:
+  if(_hal->SetupI2CValues(_dut->getRocI2Caddr())) {
+    for (std::vector<rocConfig>::iterator rocit = _dut->roc.begin(); rocit != _dut->roc.end(); ++rocit) {
+      rocit->pixels_dirty = true;
+    }
+  }
   
-  // Now run over all existing ROCs and transmit the pixel trim/mask data:
+  // Now run over all existing ROCs and transmit the pixel trim/mask data
+  // of those changed since the last upload:
   for (std::vector<rocConfig>::iterator rocit = _dut->roc.begin(); rocit != _dut->roc.end(); ++rocit) {
+    if(!rocit->pixels_dirty) {
+      LOG(logDEBUGAPI) << "Trim/mask data for ROC@I2C " << static_cast<int>(rocit->i2c_address) << " unchanged, not sent.";
+      continue;
+    }
     _hal->SetupTrimValues(rocit->i2c_address,rocit->pixels);
+    rocit->pixels_dirty = false;
   }
 }
 
@@ -1800,7 +2065,7 @@ void api::MaskAndTrim(bool trim, std::vector<rocConfig>::iterator rocit) {
   // This ROC is supposed to be trimmed as configured, so let's trim it:
   if(trim) {
     LOG(logDEBUGAPI) << "ROC@I2C " << static_cast<int>(rocit->i2c_address) << " features "
-		     << static_cast<int>(std::count_if(rocit->pixels.begin(),rocit->pixels.end(),configMaskSet(true)))
+		     << static_cast<int>(rocit->pixels.nMasked())
 		     << " masked pixels.";
     LOG(logDEBUGAPI) << "Unmasking and trimming ROC@I2C " << static_cast<int>(rocit->i2c_address) << " in one go.";
     _hal->RocSetMask(rocit->i2c_address,false,rocit->pixels);
@@ -1823,8 +2088,8 @@ void api::SetCalibrateBits(bool enable) {
     // Check if the signal has to be turned on or off:
     if(enable) {
       // Loop over all pixels in this ROC and set the Cal bit:
-      for(std::vector<pixelConfig>::iterator pxit = rocit->pixels.begin(); pxit != rocit->pixels.end(); ++pxit) {
-	if(pxit->enable == true) { _hal->PixelSetCalibrate(rocit->i2c_address,pxit->column,pxit->row,0); }
+      for(size_t i = 0; i < pixelStore::npixels; i++) {
+	if(rocit->pixels.enabled(i)) { _hal->PixelSetCalibrate(rocit->i2c_address,pixelStore::column(i),pixelStore::row(i),0); }
       }
 
     }
@@ -1976,6 +2241,15 @@ void api::getDecoderErrorCount(std::vector<Event*> &data){
   }
 }
 
+void api::getDecoderErrorCount(const eventArena &events){
+  // check the data for any decoding errors (stored in the events as counters)
+  _ndecode_errors_lastdaq = 0; // reset counter
+  for(size_t i = 0; i < events.size(); i++) { _ndecode_errors_lastdaq += events.numDecoderErrors(i); }
+  if (_ndecode_errors_lastdaq){
+    LOG(logCRITICAL) << "A total of " << _ndecode_errors_lastdaq << " pixels could not be decoded in this DAQ readout.";
+  }
+}
+
 void api::setClockSource(uint8_t src) 
 { 
   LOG(logDEBUGAPI) << "Set Clock Source " << static_cast<int>(src) ;  
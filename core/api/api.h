@@ -82,6 +82,13 @@ typedef unsigned char uint8_t;
  */
 #define FLAG_FORCE_UNMASKED   0x0100
 
+/** Flag to search the pixel thresholds of getThresholdMap adaptively: the DAC range is
+ *  scanned with a coarse step first, the edge of every pixel is then refined with the
+ *  requested step in a narrow window around it. This needs only a fraction of the
+ *  calibrate injections of the full scan.
+ */
+#define FLAG_ADAPTIVE_THRESHOLD 0x0200
+
 
 /** Define a macro for calls to member functions through pointers 
  *  to member functions (used in the loop expansion routines).
@@ -326,6 +333,22 @@ namespace pxar {
       */
     bool SignalProbe(std::string probe, std::string name);
 
+    /** Switch the profiling of the RPC calls to the DTB on or off.
+     *
+     *  While switched on, the number of calls, their latency (total, mean,
+     *  percentiles and maximum), the bytes sent and received and the number
+     *  of USB flushes are collected per RPC command. Switching on clears the
+     *  previous profile. Compiling with ENABLE_RPC_PROFILING switches it on
+     *  from the start.
+     */
+    void setRpcProfiling(bool enable);
+
+    /** Print the RPC profile collected so far to the log (level INFO),
+     *  sorted by the total time spent in each RPC command. An active
+     *  profile is also printed when the testboard connection is closed.
+     */
+    void printRpcProfile();
+
 
     // TEST functions
 
@@ -345,6 +368,14 @@ namespace pxar {
      */
     bool setDAC(std::string dacName, uint8_t dacValue);
 
+    /** Set several DAC values on the DUT for one specific ROC
+     *
+     *  DACs are provided as vector of name/value pairs, as returned by
+     *  dut::getDACs(). Only DACs differing from the device state are
+     *  written, all of them in one USB transfer.
+     */
+    bool setDACs(std::vector<std::pair<std::string,uint8_t> > dacPairs, uint8_t rocid);
+
     /** Get the valid range of a given DAC
      */
     uint8_t getDACRange(std::string dacName);
@@ -393,6 +424,41 @@ namespace pxar {
      */
     std::vector< std::pair<uint8_t, std::vector<pixel> > > getPulseheightVsDAC(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTrigger);
 
+    /** Method to scan a DAC range and measure the pulse height
+     *
+     *  Same as above, but fills the compact pxar::dacScanResult container
+     *  instead of returning nested vectors. The second DAC value of all
+     *  points is zero.
+     *
+     *  If the readout of the DTB is corrupt, a pxar::DataMissingEvent is thrown.
+     */
+    void getPulseheightVsDAC(dacScanResult & result, std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers);
+
+    /** Method to measure the pulse height at a list of DAC values
+     *
+     *  Fills the compact pxar::dacScanResult container with one point per
+     *  entry of dacValues, in the given order. The DAC values need not be
+     *  equidistant. Consecutive rising values with constant step size are
+     *  measured in one trigger loop on the DTB, the masking and trimming of
+     *  the DUT is done only once for all points. The second DAC value of all
+     *  points is zero.
+     *
+     *  If the readout of the DTB is corrupt, a pxar::DataMissingEvent is thrown.
+     */
+    void getPulseheightVsDACPoints(dacScanResult & result, std::string dacName, std::vector<uint8_t> dacValues, uint16_t flags, uint16_t nTriggers);
+
+    /** Method to measure the pulse height at a list of DAC value pairs
+     *
+     *  Same as above, but before measuring point i the second DAC is set to
+     *  dac2values[i], e.g. to switch the Vcal range with "ctrlreg" between
+     *  the points. Both lists must have the same length, the second DAC
+     *  value is stored with every point. Both DACs are reset to their
+     *  configured values afterwards.
+     *
+     *  If the readout of the DTB is corrupt, a pxar::DataMissingEvent is thrown.
+     */
+    void getPulseheightVsDACPoints(dacScanResult & result, std::string dac1name, std::vector<uint8_t> dac1values, std::string dac2name, std::vector<uint8_t> dac2values, uint16_t flags, uint16_t nTriggers);
+
     /** Method to scan a DAC range and measure the efficiency
      *
      *  Returns a vector of pairs containing set dac value and pixels,
@@ -415,6 +481,16 @@ namespace pxar {
      */
     std::vector< std::pair<uint8_t, std::vector<pixel> > > getEfficiencyVsDAC(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers);
 
+    /** Method to scan a DAC range and measure the efficiency
+     *
+     *  Same as above, but fills the compact pxar::dacScanResult container
+     *  instead of returning nested vectors. The second DAC value of all
+     *  points is zero.
+     *
+     *  If the readout of the DTB is corrupt, a pxar::DataMissingEvent is thrown.
+     */
+    void getEfficiencyVsDAC(dacScanResult & result, std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers);
+
     /** Method to scan a DAC range and measure the pixel threshold
      *
      *  Returns a vector of pairs containing set dac value and pixels,
@@ -496,6 +572,17 @@ namespace pxar {
      */
     std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > getPulseheightVsDACDAC(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers);
 
+    /** Method to scan a 2D DAC-Range (DAC1 vs. DAC2) and measure the
+     *  pulse height
+     *
+     *  Same as above, but fills the compact pxar::dacScanResult container
+     *  instead of returning one pixel vector per DAC/DAC setting. Large
+     *  scans should prefer this version.
+     *
+     *  If the readout of the DTB is corrupt, a pxar::DataMissingEvent is thrown.
+     */
+    void getPulseheightVsDACDAC(dacScanResult & result, std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers);
+
     /** Method to scan a 2D DAC-Range (DAC1 vs. DAC2) and measure the efficiency
      *
      *  Returns a vector containing pairs of DAC1 values and pais of DAC2
@@ -521,6 +608,16 @@ namespace pxar {
      */
     std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > getEfficiencyVsDACDAC(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers);
 
+    /** Method to scan a 2D DAC-Range (DAC1 vs. DAC2) and measure the efficiency
+     *
+     *  Same as above, but fills the compact pxar::dacScanResult container
+     *  instead of returning one pixel vector per DAC/DAC setting. Large
+     *  scans should prefer this version.
+     *
+     *  If the readout of the DTB is corrupt, a pxar::DataMissingEvent is thrown.
+     */
+    void getEfficiencyVsDACDAC(dacScanResult & result, std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers);
+
     /** Method to get a map of the pulse height
      *
      *  Returns a vector of pixels, with the value of the pxar::pixel struct being
@@ -613,8 +710,14 @@ namespace pxar {
      *  which are changed after calling this function will not be written to
      *  the devices, so make sure to mask/unmask and set test bits for all
      *  pixels in question before calling pxar::daqStart()!
+     *
+     *  With "background" set, a readout thread continuously moves the recorded
+     *  data from the DTB to host memory while the pattern generator keeps
+     *  triggering. Complete Events can be collected at any time using
+     *  pxar::daqGetEventBuffer() or pxar::daqGetEvent() without halting the
+     *  trigger loop.
      */
-    bool daqStart();
+    bool daqStart(bool background = false);
 
     /** Function to get back the DAQ status
      *
@@ -665,6 +768,15 @@ namespace pxar {
      */
     bool daqStop();
 
+    /** Function to record the raw data stream of all following DAQ sessions
+     *  and test loops to disk, one file per DAQ channel named
+     *  <filename>_ch<channel>.dat. Every data block read from the testboard
+     *  is written as is, the files can be replayed offline through the
+     *  decoding pipes using pxar::dtbFileSource. An empty filename stops the
+     *  recording. Can only be called while no DAQ session is running.
+     */
+    bool daqRecord(std::string filename);
+
     /** Function to return the full currently available raw event buffer from
      *  the testboard RAM. No decoding is performed, the data stream is just
      *  split into single pxar::rawEvent objects. This function returns the
@@ -684,6 +796,13 @@ namespace pxar {
      */
     std::vector<Event> daqGetEventBuffer();
 
+    /** Function to decode the full currently available buffer from the
+     *  testboard RAM directly into the pxar::eventArena provided. The arena
+     *  is cleared first but keeps its memory, so reusing the same arena for
+     *  consecutive readouts avoids any per-Event allocation.
+     */
+    void daqGetEventBuffer(eventArena & events);
+
     /** Function that returns the number of pixel decoding errors found in the
      *  last (non-raw) DAQ readout.
      */
@@ -712,36 +831,54 @@ namespace pxar {
      *  will check for the most efficient way to carry out a test requested by
      *  the user, i.e. select the full-ROC test instead of the pixel-by-pixel
      *  function, all depending on the configuration of the DUT.
+     *
+     *  All consecutive nTriggers Events are merged into one pxar::Event while
+     *  the HAL is still reading out, returning either the number of hits
+     *  (efficiency) or mean and variance of the pulse height per pixel.
      */
-    std::vector<Event*> expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPixelParallel multipixelfn, HalMemFnRocSerial rocfn, HalMemFnRocParallel multirocfn, std::vector<int32_t> param, uint16_t flags = 0);
+    std::vector<Event*> expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPixelParallel multipixelfn, HalMemFnRocSerial rocfn, HalMemFnRocParallel multirocfn, std::vector<int32_t> param, uint16_t flags, uint16_t nTriggers, bool efficiency);
 
-    /** Merges all consecutive triggers into one pxar::Event. This function deletes the original event data after
-     *  merging! 
+    /** Same as above for a sequence of loops sharing the masking and
+     *  trimming of the DUT. Before loop i the ROC DACs in dacs[i] (if given)
+     *  are programmed on all enabled ROCs. Returns the condensed Events of
+     *  every loop separately.
      */
-    std::vector<Event*> condenseTriggers(std::vector<Event*> data, uint16_t nTriggers, bool efficiency);
-    
+    std::vector< std::vector<Event*> > expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPixelParallel multipixelfn, HalMemFnRocSerial rocfn, HalMemFnRocParallel multirocfn, const std::vector< std::vector<int32_t> > & params, const std::vector< std::map<uint8_t,uint8_t> > & dacs, uint16_t flags, uint16_t nTriggers, bool efficiency);
+
+    /** Calls the HAL methods for one loop as selected by expandLoop, the
+     *  DUT has to be masked and trimmed already.
+     */
+    std::vector<Event*> expandLoopCalls(HalMemFnPixelSerial pixelfn, HalMemFnPixelParallel multipixelfn, HalMemFnRocSerial rocfn, HalMemFnRocParallel multirocfn, std::vector<int32_t> param, uint16_t flags);
+
     /** Repacks map data from (possibly) several ROCs into one long vector
-     *  of pixels.
+     *  of pixels. Expects condensed data and deletes it.
      */
-    std::vector<pixel> repackMapData (std::vector<Event*> data, uint16_t nTriggers, uint16_t flags, bool efficiency);
+    std::vector<pixel> repackMapData (std::vector<Event*> data, uint16_t flags);
 
     /** Repacks map data from (possibly) several ROCs into one long vector
      *  of pixels and returns the threshold value.
      */
     std::vector<pixel> repackThresholdMapData (std::vector<Event*> data, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t thresholdlevel, uint16_t nTriggers, uint16_t flags);
 
-    /** Repacks DAC scan data into pairs of DAC values with fired pxar::pixel vectors.
+    /** Threshold map search for FLAG_ADAPTIVE_THRESHOLD: scans the DAC range
+     *  with coarseStep and refines the threshold of every pixel with dacStep
+     *  within one coarse step around the edge found.
+     */
+    std::vector<pixel> adaptiveThresholdMap(uint8_t dacRegister, uint8_t dacStep, uint8_t coarseStep, uint8_t dacMin, uint8_t dacMax, uint8_t threshold, uint16_t flags, uint16_t nTriggers);
+
+    /** Repacks DAC scan data into a pxar::dacScanResult holding the fired
+     *  pixels per DAC value. Expects condensed data and deletes it.
      */
-    std::vector< std::pair<uint8_t, std::vector<pixel> > > repackDacScanData (std::vector<Event*> data, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t nTriggers, uint16_t flags, bool efficiency);
+    void repackDacScanData (std::vector<Event*> data, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, dacScanResult & result);
 
     /** Repacks DAC scan data into pairs of DAC values with fired pxar::pixel vectors and return the threshold value.
      */
     std::vector<std::pair<uint8_t,std::vector<pixel> > > repackThresholdDacScanData (std::vector<Event*> data, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint8_t thresholdlevel, uint16_t nTriggers, uint16_t flags);
 
-    /** repacks (2D) DAC-DAC scan data into pairs of DAC values with
-     *  vectors of the fired pixels.
+    /** repacks (2D) DAC-DAC scan data into a pxar::dacScanResult holding
+     *  the fired pixels per DAC/DAC setting. Expects condensed data and deletes it.
      */
-    std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > repackDacDacScanData (std::vector<Event*> data, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t nTriggers, uint16_t flags, bool efficiency);
+    void repackDacDacScanData (std::vector<Event*> data, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, dacScanResult & result);
 
     /** Helper function for conversion from string to register value
      *
@@ -822,6 +959,7 @@ namespace pxar {
      *  with the number found in the data sample passed to the function
      */
     void getDecoderErrorCount(std::vector<Event*> &data);
+    void getDecoderErrorCount(const eventArena &events);
 
     /** Status of the DAQ
      */
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "datatypes.h"
 #include "log.h"
 #include "exceptions.h"
@@ -32,4 +33,99 @@ namespace pxar {
     }
   }
 
+  void pixelStore::clear() {
+    for(size_t i = 0; i < npixels; i++) { _trim[i] = 15; }
+    for(size_t i = 0; i < nwords; i++) { _present[i] = _mask[i] = _enable[i] = 0; }
+    _npresent = _nmasked = _nenabled = 0;
+  }
+
+  bool pixelStore::assign(uint32_t * bits, size_t i, bool value, size_t & count) {
+    if(test(bits,i) == value) return false;
+    bits[i >> 5] ^= (1u << (i & 31));
+    if(value) count++;
+    else count--;
+    return true;
+  }
+
+  void pixelStore::add(const pixelConfig & px) {
+    size_t i = index(px.column,px.row);
+    if(i >= npixels) {
+      LOG(logWARNING) << "Pixel at column " << static_cast<int>(px.column) << " and row " << static_cast<int>(px.row) << " is outside of the ROC, ignored.";
+      return;
+    }
+    assign(_present,i,true,_npresent);
+    assign(_mask,i,px.mask,_nmasked);
+    assign(_enable,i,px.enable,_nenabled);
+    _trim[i] = px.trim;
+  }
+
+  pixelConfig pixelStore::get(size_t i) const {
+    pixelConfig px(column(i),row(i),_trim[i]);
+    px.roc_id = 0;
+    px.mask = masked(i);
+    px.enable = enabled(i);
+    return px;
+  }
+
+  bool pixelStore::setTrim(size_t i, uint8_t trim) {
+    if(_trim[i] == trim) return false;
+    _trim[i] = trim;
+    return true;
+  }
+
+  bool pixelStore::setMask(size_t i, bool mask) { return assign(_mask,i,mask,_nmasked); }
+
+  bool pixelStore::setEnable(size_t i, bool enable) { return assign(_enable,i,enable,_nenabled); }
+
+  bool pixelStore::setMaskAll(bool mask) {
+    if(mask ? (_nmasked == _npresent) : (_nmasked == 0)) return false;
+    for(size_t w = 0; w < nwords; w++) { _mask[w] = (mask ? _present[w] : 0); }
+    _nmasked = (mask ? _npresent : 0);
+    return true;
+  }
+
+  bool pixelStore::setEnableAll(bool enable) {
+    if(enable ? (_nenabled == _npresent) : (_nenabled == 0)) return false;
+    for(size_t w = 0; w < nwords; w++) { _enable[w] = (enable ? _present[w] : 0); }
+    _nenabled = (enable ? _npresent : 0);
+    return true;
+  }
+
+  std::vector<pixelConfig> pixelStore::getPixels() const {
+    std::vector<pixelConfig> result;
+    result.reserve(_npresent);
+    for(size_t i = 0; i < npixels; i++) {
+      if(present(i)) result.push_back(get(i));
+    }
+    return result;
+  }
+
+  void dacScanResult::AddPixels(size_t i, std::vector<pixel>::const_iterator first, std::vector<pixel>::const_iterator last) {
+    point & pt = points.at(i);
+    size_t n = static_cast<size_t>(last - first);
+    if(pt.length + n > pt.reserved) {
+      throw pxarException("Too many pixels for DAC scan point");
+    }
+    std::copy(first, last, pixels.begin() + pt.offset + pt.length);
+    pt.length += static_cast<uint32_t>(n);
+  }
+
+  void dacScanResult::toDacScan(std::vector< std::pair<uint8_t, std::vector<pixel> > > & result) const {
+    result.clear();
+    result.reserve(points.size());
+    for(size_t i = 0; i < points.size(); i++) {
+      result.push_back(std::make_pair(points[i].dac1, std::vector<pixel>()));
+      result.back().second.assign(begin(i), end(i));
+    }
+  }
+
+  void dacScanResult::toDacDacScan(std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & result) const {
+    result.clear();
+    result.reserve(points.size());
+    for(size_t i = 0; i < points.size(); i++) {
+      result.push_back(std::make_pair(points[i].dac1, std::make_pair(points[i].dac2, std::vector<pixel>())));
+      result.back().second.second.assign(begin(i), end(i));
+    }
+  }
+
 } // namespace pxar
@@ -22,6 +22,7 @@ typedef unsigned char uint8_t;
 #include <map>
 #include <limits>
 #include <cmath>
+#include "constants.h"
 
 namespace pxar {
 
@@ -69,7 +70,7 @@ namespace pxar {
 
     /** Member function to get the signal variance for this pixel hit
      */
-    double getVariance() { return expandFloat(_variance); };
+    double getVariance() const { return expandFloat(_variance); };
 
     /** Member function to set the signal variance for this pixel hit
      */
@@ -77,7 +78,7 @@ namespace pxar {
 
     /** Member function to get the value stored for this pixel hit
      */
-    double getValue() { 
+    double getValue() const { 
       return static_cast<double>(_mean);
     };
 
@@ -136,7 +137,7 @@ namespace pxar {
     /** Helper function to expand 16bit fixed-width integer value to
      *  floating point value with precision roughly ~10^-4
      */
-    double expandFloat(uint16_t input) {
+    double expandFloat(uint16_t input) const {
       return static_cast<double>(input)/std::numeric_limits<uint16_t>::max();
     }
 
@@ -172,6 +173,164 @@ namespace pxar {
   };
 
 
+  /** Class to store a sequence of Events in contiguous memory
+   *
+   *  The pixels of all Events are stored back to back in one vector, each
+   *  Event is described by a small record holding header, trailer, number
+   *  of decoder errors and the position of its pixels. Clearing the arena
+   *  keeps the allocated memory, so reusing it for subsequent readouts does
+   *  not allocate anymore.
+   */
+  class DLLEXPORT eventArena {
+  public:
+  eventArena() : pixels(), records(), pending(0) {}
+
+    /** Number of Events stored
+     */
+    size_t size() const { return records.size(); }
+    bool empty() const { return records.empty(); }
+
+    /** Remove all Events, keeping the allocated memory
+     */
+    void Clear() { pixels.clear(); records.clear(); pending = 0; }
+
+    /** Access to the header, trailer and decoder error count of Event i
+     */
+    uint16_t header(size_t i) const { return records[i].header; }
+    uint16_t trailer(size_t i) const { return records[i].trailer; }
+    uint16_t numDecoderErrors(size_t i) const { return records[i].errors; }
+
+    /** Access to the pixels of Event i
+     */
+    size_t nPixels(size_t i) const { return records[i].length; }
+    std::vector<pixel>::const_iterator begin(size_t i) const { return pixels.begin() + records[i].offset; }
+    std::vector<pixel>::const_iterator end(size_t i) const { return pixels.begin() + records[i].offset + records[i].length; }
+
+    /** Return a copy of Event i as stand-alone pxar::Event
+     */
+    Event GetEvent(size_t i) const {
+      Event evt;
+      evt.header = records[i].header;
+      evt.trailer = records[i].trailer;
+      evt.numDecoderErrors = records[i].errors;
+      evt.pixels.assign(begin(i), end(i));
+      return evt;
+    }
+
+    // Functions used to fill the arena, pixels added between StartEvent()
+    // and FinishEvent() belong to the same Event:
+    void StartEvent() { pending = pixels.size(); }
+    void AddPixel(const pixel & px) { pixels.push_back(px); }
+    void FinishEvent(uint16_t header, uint16_t trailer, uint16_t errors) {
+      record rec;
+      rec.header = header;
+      rec.trailer = trailer;
+      rec.errors = errors;
+      rec.offset = static_cast<uint32_t>(pending);
+      rec.length = static_cast<uint32_t>(pixels.size() - pending);
+      records.push_back(rec);
+      pending = pixels.size();
+    }
+    /** Drop the pixels of an Event started but not finished
+     */
+    void DiscardEvent() { pixels.resize(pending); }
+
+    /** Contiguous pixel storage of all Events
+     */
+    std::vector<pixel> pixels;
+
+  private:
+    struct record {
+      uint16_t header;
+      uint16_t trailer;
+      uint16_t errors;
+      uint32_t offset;
+      uint32_t length;
+    };
+    std::vector<record> records;
+    size_t pending;
+  };
+
+
+  /** Class to store the result of a (2D) DAC scan in contiguous memory
+   *
+   *  The pixels of all DAC points are stored back to back in one vector,
+   *  each point is described by its DAC values and the position of its
+   *  pixels. For one-dimensional scans the second DAC value is zero. Points
+   *  are kept in scan order, i.e. the second DAC runs fastest. When all
+   *  points contain the same pixels (e.g. a fully responding ROC) the
+   *  storage is a dense [dac1][dac2][pixel] array.
+   *
+   *  Use swap() to hand over results without copying the pixel data, the
+   *  toDacScan() and toDacDacScan() adapters convert to the nested vector
+   *  types returned by the pxar::api DAC scan functions.
+   */
+  class DLLEXPORT dacScanResult {
+  public:
+  dacScanResult() : pixels(), points() {}
+
+    /** Number of DAC points stored
+     */
+    size_t size() const { return points.size(); }
+    bool empty() const { return points.empty(); }
+
+    /** Remove all points, keeping the allocated memory
+     */
+    void Clear() { pixels.clear(); points.clear(); }
+
+    /** Exchange the content with another result without copying
+     */
+    void swap(dacScanResult & other) { pixels.swap(other.pixels); points.swap(other.points); }
+
+    /** Access to the DAC values of point i
+     */
+    uint8_t dac1(size_t i) const { return points[i].dac1; }
+    uint8_t dac2(size_t i) const { return points[i].dac2; }
+
+    /** Access to the pixels of point i
+     */
+    size_t nPixels(size_t i) const { return points[i].length; }
+    std::vector<pixel>::const_iterator begin(size_t i) const { return pixels.begin() + points[i].offset; }
+    std::vector<pixel>::const_iterator end(size_t i) const { return pixels.begin() + points[i].offset + points[i].length; }
+
+    // Functions used to fill the result. Every point reserves its final
+    // number of pixels, which are then added in one or several blocks:
+    void AddPoint(uint8_t dac1, uint8_t dac2, size_t npixels) {
+      point pt;
+      pt.dac1 = dac1;
+      pt.dac2 = dac2;
+      pt.offset = points.empty() ? 0 : points.back().offset + points.back().reserved;
+      pt.length = 0;
+      pt.reserved = static_cast<uint32_t>(npixels);
+      points.push_back(pt);
+      pixels.resize(pt.offset + pt.reserved);
+    }
+    void AddPixels(size_t i, std::vector<pixel>::const_iterator first, std::vector<pixel>::const_iterator last);
+
+    /** Convert to the DAC scan format (DAC value, pixels), using the first DAC value
+     */
+    void toDacScan(std::vector< std::pair<uint8_t, std::vector<pixel> > > & result) const;
+
+    /** Convert to the DAC-DAC scan format (DAC1 value, (DAC2 value, pixels))
+     */
+    void toDacDacScan(std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & result) const;
+
+    /** Contiguous pixel storage of all points
+     */
+    std::vector<pixel> pixels;
+
+  private:
+    struct point {
+      uint8_t dac1;
+      uint8_t dac2;
+      uint32_t offset;
+      uint32_t length;
+      uint32_t reserved;
+    };
+    std::vector<point> points;
+  };
+
+
   /** Class to store raw evet data records containing a list of flags to indicate the 
    *  Event status as well as a vector of uint16_t data records containing the actual
    *  Event data in undecoded raw format.
@@ -234,19 +393,95 @@ namespace pxar {
     bool enable;
   };
 
+  /** Class for the pixel configuration of one ROC
+   *
+   *  Trim values are kept in an array, the mask and enable flags in bit
+   *  fields, all indexed by column*ROC_NUMROWS + row. Pixels not supplied
+   *  with the configuration are not present and count as masked. The number
+   *  of present, masked and enabled pixels is kept up to date.
+   */
+  class DLLEXPORT pixelStore {
+  public:
+    pixelStore() { clear(); }
+
+    /** Number of pixels on a ROC, number of 32bit words of one bit field */
+    enum { npixels = ROC_NUMCOLS*ROC_NUMROWS, nwords = (npixels+31)/32 };
+
+    /** Position of a pixel in the store, npixels if outside of the ROC
+     */
+    static size_t index(uint8_t column, uint8_t row) {
+      if(column >= ROC_NUMCOLS || row >= ROC_NUMROWS) return npixels;
+      return static_cast<size_t>(column)*ROC_NUMROWS + row;
+    }
+    static uint8_t column(size_t i) { return static_cast<uint8_t>(i/ROC_NUMROWS); }
+    static uint8_t row(size_t i) { return static_cast<uint8_t>(i%ROC_NUMROWS); }
+
+    /** Remove all pixels
+     */
+    void clear();
+
+    /** Add a pixel, replacing an earlier configuration of the same pixel
+     */
+    void add(const pixelConfig & px);
+
+    bool present(size_t i) const { return i < npixels && test(_present,i); }
+    bool masked(size_t i) const { return test(_mask,i); }
+    bool enabled(size_t i) const { return test(_enable,i); }
+    uint8_t trim(size_t i) const { return _trim[i]; }
+
+    /** Configuration of a present pixel
+     */
+    pixelConfig get(size_t i) const;
+
+    /** Modify one present pixel, returns true if the value changed
+     */
+    bool setTrim(size_t i, uint8_t trim);
+    bool setMask(size_t i, bool mask);
+    bool setEnable(size_t i, bool enable);
+
+    /** Modify all present pixels, returns true if any value changed
+     */
+    bool setMaskAll(bool mask);
+    bool setEnableAll(bool enable);
+
+    /** Number of present, masked and enabled pixels
+     */
+    size_t size() const { return _npresent; }
+    size_t nMasked() const { return _nmasked; }
+    size_t nEnabled() const { return _nenabled; }
+
+    /** All present pixels in order of the index
+     */
+    std::vector<pixelConfig> getPixels() const;
+
+  private:
+    static bool test(const uint32_t * bits, size_t i) { return (bits[i >> 5] >> (i & 31)) & 1; }
+    static bool assign(uint32_t * bits, size_t i, bool value, size_t & count);
+
+    uint8_t _trim[npixels];
+    uint32_t _present[nwords];
+    uint32_t _mask[nwords];
+    uint32_t _enable[nwords];
+    size_t _npresent;
+    size_t _nmasked;
+    size_t _nenabled;
+  };
+
   /** Class for ROC states
    *
    *  Contains a DAC map for the ROC programming settings, a type flag, enable switch
-   *  and a vector of pixelConfigs.
+   *  and the pixelStore of its pixels. The dirty flag marks changes of mask or trim
+   *  bits not yet uploaded to the testboard.
    */
   class DLLEXPORT rocConfig {
   public:
-  rocConfig() : pixels(), dacs(), type(0), enable(true) {}
-    std::vector< pixelConfig > pixels;
+  rocConfig() : pixels(), dacs(), type(0), enable(true), pixels_dirty(true) {}
+    pixelStore pixels;
     std::map< uint8_t,uint8_t > dacs;
     uint8_t type;
     uint8_t i2c_address;
     bool enable;
+    bool pixels_dirty;
   };
 
   /** Class for TBM states
@@ -43,12 +43,12 @@ void dut::info() {
 
 size_t dut::getNEnabledPixels(uint8_t rocid) {
   if (!_initialized || rocid >= roc.size()) return 0;
-  return std::count_if(roc.at(rocid).pixels.begin(),roc.at(rocid).pixels.end(),configEnableSet(true));
+  return roc.at(rocid).pixels.nEnabled();
 }
 
 size_t dut::getNMaskedPixels(uint8_t rocid) {
   if (!_initialized || rocid >= roc.size()) return 0;
-  return std::count_if(roc.at(rocid).pixels.begin(),roc.at(rocid).pixels.end(),configMaskSet(true));
+  return roc.at(rocid).pixels.nMasked();
 }
 
 size_t dut::getNEnabledRocs() {
@@ -88,8 +88,13 @@ std::vector< pixelConfig > dut::getEnabledPixels(size_t rocid) {
   if (!status() || !(rocid < roc.size())) return result;
 
   // Search for pixels that have enable set
-  for (std::vector<pixelConfig>::iterator it = roc.at(rocid).pixels.begin(); it != roc.at(rocid).pixels.end(); ++it){
-    if (it->enable) result.push_back(*it);
+  const pixelStore & pixels = roc.at(rocid).pixels;
+  result.reserve(pixels.nEnabled());
+  for (size_t i = 0; i < pixelStore::npixels; i++) {
+    if (pixels.enabled(i)) {
+      result.push_back(pixels.get(i));
+      result.back().roc_id = static_cast<uint8_t>(rocid);
+    }
   }
   return result;
 }
@@ -104,8 +109,8 @@ std::vector< bool > dut::getEnabledColumns(size_t roci2c) {
   for(std::vector<rocConfig>::iterator rocit = roc.begin(); rocit != roc.end(); ++rocit){
     if(rocit->i2c_address == roci2c) {
       // Search for pixels that have enable set
-      for(std::vector<pixelConfig>::iterator it = rocit->pixels.begin(); it != rocit->pixels.end(); ++it){
-	if (it->enable) result.at((*it).column) = true;
+      for(size_t i = 0; i < pixelStore::npixels; i++) {
+	if (rocit->pixels.enabled(i)) result.at(pixelStore::column(i)) = true;
       }
     }
   }
@@ -172,24 +177,16 @@ std::vector< tbmConfig > dut::getEnabledTbms() {
 }
 
 bool dut::getPixelEnabled(uint8_t column, uint8_t row) {
-  std::vector<pixelConfig>::iterator it = std::find_if(roc.at(0).pixels.begin(),
-						       roc.at(0).pixels.end(),
-						       findPixelXY(column,row));
-  if(it != roc.at(0).pixels.end())
-    return it->enable;
+  size_t i = pixelStore::index(column,row);
+  if(roc.at(0).pixels.present(i))
+    return roc.at(0).pixels.enabled(i);
   return false;
 }
 
 bool dut::getAllPixelEnable(){
  if (!status()) return false;
- // search for pixels that DO NOT have enable set
- std::vector<pixelConfig>::iterator it = std::find_if(roc.at(0).pixels.begin(),
-						      roc.at(0).pixels.end(),
-						      configEnableSet(false));
- if(it != roc.at(0).pixels.end())
-   return false; // found a disabled pixel
- else
-   return true; // all pixels are enabled
+ // check for pixels that DO NOT have enable set
+ return (roc.at(0).pixels.nEnabled() == roc.at(0).pixels.size());
 }
 
 
@@ -212,12 +209,11 @@ pixelConfig dut::getPixelConfig(size_t rocid, uint8_t column, uint8_t row) {
   pixelConfig result; // initialized with 0 by constructor
   if (!status()) return result;
   // find pixel with specified column and row
-  std::vector<pixelConfig>::iterator it = std::find_if(roc.at(rocid).pixels.begin(),
-						       roc.at(rocid).pixels.end(),
-						       findPixelXY(column,row));
+  size_t i = pixelStore::index(column,row);
   // if pixel found, set result accordingly
-  if(it != roc.at(rocid).pixels.end()){
-    result = *it;
+  if(roc.at(rocid).pixels.present(i)){
+    result = roc.at(rocid).pixels.get(i);
+    result.roc_id = static_cast<uint8_t>(rocid);
   }
   return result;
 }
@@ -304,15 +300,12 @@ void dut::setTBMEnable(size_t tbmId, bool enable) {
 void dut:: maskPixel(uint8_t column, uint8_t row, bool mask) {
 
   if(status()) {
+    size_t i = pixelStore::index(column,row);
     // Loop over all ROCs
     for (std::vector<rocConfig>::iterator rocit = roc.begin() ; rocit != roc.end(); ++rocit){
-      // Find pixel with specified column and row
-      std::vector<pixelConfig>::iterator it = std::find_if(rocit->pixels.begin(),
-							   rocit->pixels.end(),
-							   findPixelXY(column,row));
-      // Set enable bit
-      if(it != rocit->pixels.end()) {
-	it->mask = mask;
+      // Set mask:
+      if(rocit->pixels.present(i)) {
+	if(rocit->pixels.setMask(i,mask)) { rocit->pixels_dirty = true; }
       } else {
 	LOG(logWARNING) << "Pixel at column " << static_cast<int>(column) << " and row " << static_cast<int>(row) << " not found for ROC " << static_cast<int>(rocit - roc.begin()) << "!" ;
       }
@@ -323,13 +316,10 @@ void dut:: maskPixel(uint8_t column, uint8_t row, bool mask) {
 void dut:: maskPixel(uint8_t column, uint8_t row, bool mask, uint8_t rocid) {
 
   if(status() && rocid < roc.size()) {
-    // Find pixel with specified column and row
-    std::vector<pixelConfig>::iterator it = std::find_if(roc.at(rocid).pixels.begin(),
-							 roc.at(rocid).pixels.end(),
-							 findPixelXY(column,row));
+    size_t i = pixelStore::index(column,row);
     // Set mask:
-    if(it != roc.at(rocid).pixels.end()){
-      it->mask = mask;
+    if(roc.at(rocid).pixels.present(i)){
+      if(roc.at(rocid).pixels.setMask(i,mask)) { roc.at(rocid).pixels_dirty = true; }
     } else {
       LOG(logWARNING) << "Pixel at column " << static_cast<int>(column) << " and row " << static_cast<int>(row) << " not found for ROC " << static_cast<int>(rocid)<< "!" ;
     }
@@ -339,15 +329,12 @@ void dut:: maskPixel(uint8_t column, uint8_t row, bool mask, uint8_t rocid) {
 void dut::testPixel(uint8_t column, uint8_t row, bool enable) {
 
   if(status()) {
+    size_t i = pixelStore::index(column,row);
     // Loop over all ROCs
     for (std::vector<rocConfig>::iterator rocit = roc.begin() ; rocit != roc.end(); ++rocit){
-      // Find pixel with specified column and row
-      std::vector<pixelConfig>::iterator it = std::find_if(rocit->pixels.begin(),
-							   rocit->pixels.end(),
-							   findPixelXY(column,row));
       // Set enable bit
-      if(it != rocit->pixels.end()) {
-	it->enable = enable;
+      if(rocit->pixels.present(i)) {
+	rocit->pixels.setEnable(i,enable);
       } else {
 	LOG(logWARNING) << "Pixel at column " << static_cast<int>(column) << " and row " << static_cast<int>(row) << " not found for ROC " << static_cast<int>(rocit - roc.begin())<< "!" ;
       }
@@ -358,13 +345,10 @@ void dut::testPixel(uint8_t column, uint8_t row, bool enable) {
 void dut::testPixel(uint8_t column, uint8_t row, bool enable, uint8_t rocid) {
 
   if(status() && rocid < roc.size()) {
-    // Find pixel with specified column and row
-    std::vector<pixelConfig>::iterator it = std::find_if(roc.at(rocid).pixels.begin(),
-							 roc.at(rocid).pixels.end(),
-							 findPixelXY(column,row));
-    // Set mask:
-    if(it != roc.at(rocid).pixels.end()){
-      it->enable = enable;
+    size_t i = pixelStore::index(column,row);
+    // Set enable bit
+    if(roc.at(rocid).pixels.present(i)){
+      roc.at(rocid).pixels.setEnable(i,enable);
     } else {
       LOG(logWARNING) << "Pixel at column " << static_cast<int>(column) << " and row " << static_cast<int>(row) << " not found for ROC " << static_cast<int>(rocid)<< "!" ;
     }
@@ -377,10 +361,7 @@ void dut::maskAllPixels(bool mask) {
     LOG(logDEBUGAPI) << "Set mask bit to " << static_cast<int>(mask) << " for all pixels on all ROCs.";
     // Loop over all ROCs
     for (std::vector<rocConfig>::iterator rocit = roc.begin() ; rocit != roc.end(); ++rocit){
-      // loop over all pixel, set enable according to parameter
-      for (std::vector<pixelConfig>::iterator pixelit = rocit->pixels.begin() ; pixelit != rocit->pixels.end(); ++pixelit){
-	pixelit->mask = mask;
-      }
+      if(rocit->pixels.setMaskAll(mask)) { rocit->pixels_dirty = true; }
     }
   }
 }
@@ -389,10 +370,7 @@ void dut::maskAllPixels(bool mask, uint8_t rocid) {
 
   if(status() && rocid < roc.size()) {
     LOG(logDEBUGAPI) << "Set mask bit to " << static_cast<int>(mask) << " for all pixels on ROC " << static_cast<int>(rocid);
-    // loop over all pixel, set enable according to parameter
-    for (std::vector<pixelConfig>::iterator pixelit = roc.at(rocid).pixels.begin() ; pixelit != roc.at(rocid).pixels.end(); ++pixelit){
-      pixelit->mask = mask;
-    }
+    if(roc.at(rocid).pixels.setMaskAll(mask)) { roc.at(rocid).pixels_dirty = true; }
   }
 }
 
@@ -400,10 +378,7 @@ void dut::testAllPixels(bool enable, uint8_t rocid) {
 
   if(status() && rocid < roc.size()) {
     LOG(logDEBUGAPI) << "Set enable bit to " << static_cast<int>(enable) << " for all pixels on ROC " << static_cast<int>(rocid);
-    // loop over all pixel, set enable according to parameter
-    for (std::vector<pixelConfig>::iterator pixelit = roc.at(rocid).pixels.begin() ; pixelit != roc.at(rocid).pixels.end(); ++pixelit){
-      pixelit->enable = enable;
-    }
+    roc.at(rocid).pixels.setEnableAll(enable);
   }
 }
 
@@ -413,43 +388,25 @@ void dut::testAllPixels(bool enable) {
     LOG(logDEBUGAPI) << "Set enable bit to " << static_cast<int>(enable) << " for all pixels on all ROCs";
     // Loop over all ROCs
     for (std::vector<rocConfig>::iterator rocit = roc.begin() ; rocit != roc.end(); ++rocit){
-      // loop over all pixel, set enable according to parameter
-      for (std::vector<pixelConfig>::iterator pixelit = rocit->pixels.begin() ; pixelit != rocit->pixels.end(); ++pixelit){
-	pixelit->enable = enable;
-      }
+      rocit->pixels.setEnableAll(enable);
     }
   }
 }
 
 bool dut::updateTrimBits(pixelConfig trimming, uint8_t rocid) {
-
-  if(status() && rocid < roc.size()) {
-
-    // Find the pixel in the given ROC pixels vector:
-    std::vector<pixelConfig>::iterator px = std::find_if(roc.at(rocid).pixels.begin(),
-							 roc.at(rocid).pixels.end(),
-							 findPixelXY(trimming.column,trimming.row));
-    // Pixel was not found:
-    if(px == roc.at(0).pixels.end()) return false;
-    // Pixel was found, set the new trimming values:
-    px->trim = trimming.trim;
-    return true;
-  }
-  else { return false; }
+  return updateTrimBits(trimming.column, trimming.row, trimming.trim, rocid);
 }
 
 bool dut::updateTrimBits(uint8_t column, uint8_t row, uint8_t trim, uint8_t rocid) {
 
   if(status() && rocid < roc.size()) {
 
-    // Find the pixel in the given ROC pixels vector:
-    std::vector<pixelConfig>::iterator px = std::find_if(roc.at(rocid).pixels.begin(),
-							 roc.at(rocid).pixels.end(),
-							 findPixelXY(column,row));
+    // Find the pixel in the given ROC:
+    size_t i = pixelStore::index(column,row);
     // Pixel was not found:
-    if(px == roc.at(0).pixels.end()) return false;
+    if(!roc.at(rocid).pixels.present(i)) return false;
     // Pixel was found, set the new trimming values:
-    px->trim = trim;
+    if(roc.at(rocid).pixels.setTrim(i,trim)) { roc.at(rocid).pixels_dirty = true; }
     return true;
   }
   else { return false; }
@@ -460,15 +417,7 @@ bool dut::updateTrimBits(std::vector<pixelConfig> trimming, uint8_t rocid) {
   if(status() && rocid < roc.size()) {
     // Loop over all trimbit pixelConfigs we got as parameter:
     for (std::vector<pixelConfig>::iterator it = trimming.begin(); it != trimming.end(); ++it){
-
-      // Find the pixel in the given ROC pixels vector:
-      std::vector<pixelConfig>::iterator px = std::find_if(roc.at(rocid).pixels.begin(),
-							   roc.at(rocid).pixels.end(),
-							   findPixelXY(it->column,it->row));
-      // Pixel was not found:
-      if(px == roc.at(0).pixels.end()) return false;
-      // Pixel was found, set the new trimming values:
-      px->trim = it->trim;
+      if(!updateTrimBits(it->column, it->row, it->trim, rocid)) return false;
     }
     return true;
   }
@@ -2,27 +2,246 @@
 #include "helper.h"
 #include "constants.h"
 #include "exceptions.h"
+#include <algorithm>
+#include <cstring>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace pxar {
 
+  void dtbHostBuffer::Reset(bool tbm_present, uint32_t capacity) {
+    pxar::lock_guard lock(m);
+    ring.resize(capacity);
+    written = committed = consumed = 0;
+    boundaries.clear();
+    // DESER400 Events end with the TBM trailer, DESER160 Events with the end marker:
+    if(tbm_present) { endmask = 0xe000; endvalue = 0xc000; }
+    else { endmask = 0x4000; endvalue = 0x4000; }
+  }
+
+  void dtbHostBuffer::Clear() {
+    pxar::lock_guard lock(m);
+    std::vector<uint16_t>().swap(ring);
+    written = committed = consumed = 0;
+    boundaries.clear();
+    active = false;
+  }
+
+  uint32_t dtbHostBuffer::GetFreeSize() {
+    pxar::lock_guard lock(m);
+    return static_cast<uint32_t>(ring.size() - (written - consumed));
+  }
+
+  uint32_t dtbHostBuffer::GetSize() {
+    pxar::lock_guard lock(m);
+    return static_cast<uint32_t>(written - consumed);
+  }
+
+  void dtbHostBuffer::Write(const std::vector<uint16_t> &data) {
+    pxar::lock_guard lock(m);
+    if(data.size() > ring.size() - (written - consumed)) throw dsBufferOverflow();
+
+    // Copy the block, wrapping around the end of the ring if necessary:
+    size_t start = written%ring.size();
+    size_t first = std::min(data.size(), ring.size() - start);
+    std::copy(data.begin(), data.begin() + first, ring.begin() + start);
+    std::copy(data.begin() + first, data.end(), ring.begin());
+
+    // Remember where complete Events end:
+    for(size_t i = 0; i < data.size(); i++) {
+      if((data[i] & endmask) == endvalue) boundaries.push_back(written + i + 1);
+    }
+    written += data.size();
+  }
+
+  uint32_t dtbHostBuffer::GetPendingEvents() {
+    pxar::lock_guard lock(m);
+    return static_cast<uint32_t>(boundaries.size());
+  }
+
+  void dtbHostBuffer::Commit(uint32_t nevents) {
+    pxar::lock_guard lock(m);
+    if(nevents == 0 || boundaries.empty()) return;
+    nevents = std::min(nevents, static_cast<uint32_t>(boundaries.size()));
+    committed = boundaries[nevents-1];
+    boundaries.erase(boundaries.begin(), boundaries.begin() + nevents);
+  }
+
+  void dtbHostBuffer::CommitAll() {
+    pxar::lock_guard lock(m);
+    committed = written;
+    boundaries.clear();
+  }
+
+  uint32_t dtbHostBuffer::Read(std::vector<uint16_t> &data, uint32_t maxsize) {
+    pxar::lock_guard lock(m);
+    size_t n = std::min(static_cast<uint64_t>(maxsize), committed - consumed);
+    data.resize(n);
+    if(n == 0) return 0;
+
+    size_t start = consumed%ring.size();
+    size_t first = std::min(n, ring.size() - start);
+    std::copy(ring.begin() + start, ring.begin() + start + first, data.begin());
+    std::copy(ring.begin(), ring.begin() + (n - first), data.begin() + first);
+    consumed += n;
+    return static_cast<uint32_t>(n);
+  }
+
+  namespace {
+    const char recordMagic[8] = {'P','X','A','R','R','A','W','\0'};
+  }
+
+  bool dtbRecorder::Open(const std::string & filename, uint8_t channel, bool tbm_present, uint8_t devicetype) {
+    Close();
+    file = fopen(filename.c_str(), "wb");
+    if(!file) {
+      LOG(logERROR) << "Could not open file " << filename << " for recording.";
+      return false;
+    }
+    name = filename;
+    words = 0;
+    iobuffer.resize(DTB_RECORD_IOBUFFER);
+    setvbuf(file, &iobuffer[0], _IOFBF, iobuffer.size());
+
+    char header[DTB_RECORD_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, recordMagic, sizeof(recordMagic));
+    uint16_t version = DTB_RECORD_VERSION;
+    memcpy(header + 8, &version, sizeof(version));
+    header[10] = static_cast<char>(channel);
+    header[11] = static_cast<char>(devicetype);
+    header[12] = tbm_present ? 1 : 0;
+    if(fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+      LOG(logERROR) << "Could not write to file " << filename << ", recording stopped.";
+      Close();
+      return false;
+    }
+
+    LOG(logDEBUGPIPES) << "Recording channel " << static_cast<int>(channel) << " to " << filename;
+    return true;
+  }
+
+  void dtbRecorder::Write(const std::vector<uint16_t> &data) {
+    if(!file || data.empty()) return;
+    if(fwrite(&data[0], sizeof(uint16_t), data.size(), file) != data.size()) {
+      LOG(logERROR) << "Could not write to file " << name << ", recording stopped.";
+      Close();
+      return;
+    }
+    words += data.size();
+  }
+
+  void dtbRecorder::Close() {
+    if(!file) return;
+    fclose(file);
+    file = NULL;
+    LOG(logDEBUGPIPES) << "Recorded " << words << " words to " << name;
+    std::vector<char>().swap(iobuffer);
+  }
+
+  dtbFileSource::dtbFileSource(const std::string & filename)
+    : data(NULL), size(0), pos(0), lastSample(0x4000), channel(0), devicetype(0), tbm_present(false), mapping(NULL), mappedsize(0) {
+
+#ifdef WIN32
+    mapHandle = NULL;
+    fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(fileHandle == INVALID_HANDLE_VALUE) { throw dsFileError("Could not open file " + filename); }
+    LARGE_INTEGER filesize;
+    if(!GetFileSizeEx(fileHandle, &filesize)) {
+      Unmap();
+      throw dsFileError("Could not read file " + filename);
+    }
+    mappedsize = static_cast<size_t>(filesize.QuadPart);
+    if(mappedsize >= DTB_RECORD_HEADER_SIZE) {
+      mapHandle = CreateFileMapping(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+      if(mapHandle) { mapping = MapViewOfFile(mapHandle, FILE_MAP_READ, 0, 0, 0); }
+    }
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0) { throw dsFileError("Could not open file " + filename); }
+    struct stat info;
+    if(fstat(fd, &info) != 0) {
+      close(fd);
+      throw dsFileError("Could not read file " + filename);
+    }
+    mappedsize = static_cast<size_t>(info.st_size);
+    if(mappedsize >= DTB_RECORD_HEADER_SIZE) {
+      mapping = mmap(NULL, mappedsize, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(mapping == MAP_FAILED) { mapping = NULL; }
+      // The data is read sequentially from start to end:
+      else { madvise(mapping, mappedsize, MADV_SEQUENTIAL); }
+    }
+    // The mapping stays valid after closing the descriptor:
+    close(fd);
+#endif
+
+    if(!mapping) {
+      Unmap();
+      throw dsFileError("Could not map file " + filename);
+    }
+
+    const char * header = static_cast<const char*>(mapping);
+    uint16_t version;
+    memcpy(&version, header + 8, sizeof(version));
+    if(memcmp(header, recordMagic, sizeof(recordMagic)) != 0 || version != DTB_RECORD_VERSION) {
+      Unmap();
+      throw dsFileError("File " + filename + " is no recorded DTB data file");
+    }
+    channel = static_cast<uint8_t>(header[10]);
+    devicetype = static_cast<uint8_t>(header[11]);
+    tbm_present = (header[12] != 0);
+
+    data = reinterpret_cast<const uint16_t*>(header + DTB_RECORD_HEADER_SIZE);
+    size = (mappedsize - DTB_RECORD_HEADER_SIZE)/sizeof(uint16_t);
+    LOG(logDEBUGPIPES) << "Replaying " << size << " words of channel " << static_cast<int>(channel) << " from " << filename;
+  }
+
+  void dtbFileSource::Unmap() {
+#ifdef WIN32
+    if(mapping) { UnmapViewOfFile(mapping); }
+    if(mapHandle) { CloseHandle(mapHandle); }
+    if(fileHandle != INVALID_HANDLE_VALUE) { CloseHandle(fileHandle); }
+    mapHandle = NULL;
+    fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if(mapping) { munmap(mapping, mappedsize); }
+#endif
+    mapping = NULL;
+    data = NULL;
+    size = pos = 0;
+  }
+
   uint16_t dtbSource::FillBuffer() {
     pos = 0;
-    do {
-      dtbState = tb->Daq_Read(buffer, DTB_SOURCE_BLOCK_SIZE, dtbRemainingSize, channel);
-      /*
-	if (dtbRemainingSize < 100000) {
-	if      (dtbRemainingSize > 1000) mDelay(  1);
-	else if (dtbRemainingSize >    0) mDelay( 10);
-	else                              mDelay(100);
-	}
-	LOG(logDEBUGPIPES) << "Buffer size: " << buffer.size();
-      */
+
+    // Serve data already fetched by the asynchronous readout thread first:
+    if(!hostBuffer || hostBuffer->Read(buffer, DTB_SOURCE_BLOCK_SIZE) == 0) {
+      // While the readout thread is running it is the only one reading the DTB:
+      if(hostBuffer && hostBuffer->IsActive()) throw dsBufferEmpty();
+
+      do {
+	dtbState = tb->Daq_Read(buffer, DTB_SOURCE_BLOCK_SIZE, dtbRemainingSize, channel);
+	/*
+	  if (dtbRemainingSize < 100000) {
+	  if      (dtbRemainingSize > 1000) mDelay(  1);
+	  else if (dtbRemainingSize >    0) mDelay( 10);
+	  else                              mDelay(100);
+	  }
+	  LOG(logDEBUGPIPES) << "Buffer size: " << buffer.size();
+	*/
     
-      if (buffer.size() == 0) {
-	if (stopAtEmptyData) throw dsBufferEmpty();
-	if (dtbState) throw dsBufferOverflow();
-      }
-    } while (buffer.size() == 0);
+	if (buffer.size() == 0) {
+	  if (stopAtEmptyData) throw dsBufferEmpty();
+	  if (dtbState) throw dsBufferOverflow();
+	}
+      } while (buffer.size() == 0);
+
+      if(recorder) { recorder->Write(buffer); }
+    }
 
     LOG(logDEBUGPIPES) << "----------------";
     LOG(logDEBUGPIPES) << "Channel " << static_cast<int>(channel) << (tbm_present ? " DESER400 " : " DESER160 ");
@@ -105,92 +324,109 @@ namespace pxar {
     return &record;
   }
 
+  namespace {
+
+    // Lookup tables for the translation of the 24bit raw pixel word into
+    // column and row. The address is coded in base 6: two digits for the
+    // double column (bits 23-18) and three for the pixel within it (bits
+    // 17-9). The upper digits are covered by one table indexed by the first
+    // 12bit word, the lowest row digit by a second small one. Index 1 holds
+    // the inverted row address of the PSI46DIG.
+    struct addressTable {
+      // Indexed by raw bits 23-12:
+      int16_t rowbase[2][4096];
+      uint8_t column[4096];
+      // Indexed by raw bits 11-9:
+      uint8_t rowsub[2][8];
+      uint8_t colbit[2][8];
+
+      addressTable() {
+	for(unsigned int inv = 0; inv < 2; inv++) {
+	  for(unsigned int hi = 0; hi < 4096; hi++) {
+	    unsigned int c = ((hi >> 9) & 7)*6 + ((hi >> 6) & 7);
+	    unsigned int r2 = (hi >> 3) & 7, r1 = hi & 7;
+	    if(inv) { r2 ^= 7; r1 ^= 7; }
+	    // r2*36 + r1*6 is always even, the lowest digit alone decides
+	    // on the column parity:
+	    rowbase[inv][hi] = static_cast<int16_t>(80 - (r2*36 + r1*6)/2);
+	    column[hi] = static_cast<uint8_t>(2*c);
+	  }
+	  for(unsigned int lo = 0; lo < 8; lo++) {
+	    unsigned int r0 = inv ? (lo ^ 7) : lo;
+	    rowsub[inv][lo] = static_cast<uint8_t>(r0/2);
+	    colbit[inv][lo] = static_cast<uint8_t>(r0 & 1);
+	  }
+	}
+      }
+    };
+
+    const addressTable addresses;
+
+    // Decode one raw pixel word and append it to the pixel storage,
+    // returns false for invalid pulse height fill bit or address:
+    inline bool decodePixel(uint32_t raw, uint8_t roc, unsigned int inv, std::vector<pixel> & pixels) {
+      if(raw & 0x10) return false;
+      unsigned int hi = (raw >> 12) & 0x0fff;
+      unsigned int lo = (raw >> 9) & 0x7;
+      int row = addresses.rowbase[inv][hi] - addresses.rowsub[inv][lo];
+      unsigned int column = addresses.column[hi] + addresses.colbit[inv][lo];
+      if(row < 0 || row >= ROC_NUMROWS || column >= ROC_NUMCOLS) return false;
+      pixels.push_back(pixel(roc, static_cast<uint8_t>(column), static_cast<uint8_t>(row),
+			     static_cast<double>((raw & 0x0f) + ((raw >> 1) & 0xf0))));
+      return true;
+    }
+  }
+
   Event* dtbEventDecoder::DecodeDeser400() {
 
     roc_Event.Clear();
     rawEvent *sample = Get();
+    std::vector<pixel> & pixels = (arena ? arena->pixels : roc_Event.pixels);
 
-    unsigned int raw = 0;
-    unsigned int pos = 0;
-    unsigned int size = sample->GetSize();
-    uint16_t v;
-
-    // Get the right ROC id, channel 0: 0-7, channel 1: 8-15
-    int16_t roc_n = -1 + GetChannel() * 8;
+    // Unchecked access to the words, the position is checked explicitly:
+    const size_t size = sample->data.size();
+    const uint16_t * words = (size > 0 ? &sample->data[0] : NULL);
+    size_t pos = 0;
 
     // Check if ROC has inverted pixel address (ROC_PSI46DIG):
-    bool invertedAddress = ( GetDeviceType() == ROC_PSI46DIG ? true : false );
-    
-
-    // --- decode TBM header ---------------------------------
-
-    // H1
-    v = (pos < size) ? (*sample)[pos++] : 0x6000; //MDD_ERROR_MARKER;
-    //if ((v & 0xe000) != 0xa000) roc_Event.error |= 0x0800;
-    raw = (v & 0x00ff) << 8;
+    const unsigned int inv = (GetDeviceType() == ROC_PSI46DIG ? 1 : 0);
 
-    // H2
-    v = (pos < size) ? (*sample)[pos++] : 0x6000; //MDD_ERROR_MARKER;
-    //if ((v & 0xe000) != 0x8000) roc_Event.error |= 0x0400;
-    raw += v & 0x00ff;
+    // Get the right ROC id, channel 0: 0-7, channel 1: 8-15
+    int16_t roc_n = -1 + GetChannel() * 8;
 
-    roc_Event.header = raw;
+    // --- decode TBM header (H1, H2) ------------------------
+    uint16_t v = (pos < size) ? words[pos++] : 0x6000; //MDD_ERROR_MARKER;
+    uint16_t raw = (v & 0x00ff) << 8;
+    v = (pos < size) ? words[pos++] : 0x6000;
+    roc_Event.header = raw + (v & 0x00ff);
 
     // --- decode ROC data -----------------------------------
-
-    // while ROC header
-    v = (pos < size) ? (*sample)[pos++] : 0x6000; //MDD_ERROR_MARKER;
-    while ((v & 0xe000) == 0x4000) { // ROC Header
-
-      // Count ROC Headers up:
+    v = (pos < size) ? words[pos++] : 0x6000;
+    bool tbm = false;
+    while (!tbm && (v & 0xe000) == 0x4000) { // ROC Header
       roc_n++;
 
-      v = (pos < size) ? (*sample)[pos++] : 0x6000; //MDD_ERROR_MARKER;
+      v = (pos < size) ? words[pos++] : 0x6000;
       while ((v & 0xe000) <= 0x2000) { // R0 ... R1
-
-	for (unsigned int i = 0; i <= 1; i++) {
-	  if ((v >> 13) != i) { // R<i>
-	    //px_error |= (1<<i);
-	    if (v & 0x8000) { // TBM header/trailer
-	      //pixel.error = 0x1fff;
-	      //roc.error |= 0x0001;
-	      //roc.pixel.push_back(pixel);
-	      //x.roc.push_back(roc);
-	      v = (pos < size) ? (*sample)[pos++] : 0x6000; //MDD_ERROR_MARKER;
-	      goto trailer;
-	    }
-	  }
-	  raw = (raw << 12) + (v & 0x0fff);
-	  v = (pos < size) ? (*sample)[pos++] : 0x6000; //MDD_ERROR_MARKER;
-	}
-
-	try {
-	  pixel pix(raw,static_cast<uint8_t>(roc_n),invertedAddress);
-	  roc_Event.pixels.push_back(pix);
-	}
-	catch(DataDecoderError /*&e*/){
-	  // decoding of raw address lead to invalid address
-	  roc_Event.numDecoderErrors++; // keep track of number of such errors
-	}
+	// First pixel word needs R0 marker, second one R1:
+	if ((v >> 13) != 0 && (v & 0x8000)) { tbm = true; break; }
+	uint32_t pix = v & 0x0fff;
+	v = (pos < size) ? words[pos++] : 0x6000;
+	if ((v >> 13) != 1 && (v & 0x8000)) { tbm = true; break; }
+	pix = (pix << 12) + (v & 0x0fff);
+	v = (pos < size) ? words[pos++] : 0x6000;
+
+	// Invalid addresses are counted, not thrown:
+	if(!decodePixel(pix, static_cast<uint8_t>(roc_n), inv, pixels)) { roc_Event.numDecoderErrors++; }
       }
-      //if (roc.error) x.error |= 0x0001;
-      //x.roc.push_back(roc);
     }
+    // Unexpected TBM header/trailer: skip the word as before
+    if(tbm) { v = (pos < size) ? words[pos++] : 0x6000; }
 
-    // --- decode TBM trailer --------------------------------
-  trailer:
-    raw = 0;
-
-    // T1
-    //if ((v & 0xe000) != 0xe000) roc_Event.error |= 0x0080;
+    // --- decode TBM trailer (T1, T2) -----------------------
     raw = (v & 0x00ff) << 8;
-
-    // T2
-    v = (pos < size) ? (*sample)[pos++] : 0x6000; //MDD_ERROR_MARKER;
-    //if ((v & 0xe000) != 0xc000) roc_Event.error |= 0x0040;
-    raw += v & 0x00ff;
-
-    roc_Event.trailer = raw;
+    v = (pos < size) ? words[pos++] : 0x6000;
+    roc_Event.trailer = raw + (v & 0x00ff);
 
     LOG(logDEBUGPIPES) << roc_Event;
     return &roc_Event;
@@ -199,27 +435,21 @@ namespace pxar {
   Event* dtbEventDecoder::DecodeDeser160() {
 
     roc_Event.Clear();
+    rawEvent *sample = Get();
+    std::vector<pixel> & pixels = (arena ? arena->pixels : roc_Event.pixels);
 
     // Check if ROC has inverted pixel address (ROC_PSI46DIG):
-    bool invertedAddress = ( GetDeviceType() == ROC_PSI46DIG ? true : false );
+    const unsigned int inv = (GetDeviceType() == ROC_PSI46DIG ? 1 : 0);
 
-    rawEvent *sample = Get();
-    unsigned int n = sample->GetSize();
+    const size_t n = sample->data.size();
     if (n > 0) {
-      if (n > 1) roc_Event.pixels.reserve((n-1)/2);
-      roc_Event.header = (*sample)[0];
-      unsigned int pos = 1;
-      while (pos < n-1) {
-	uint32_t raw = (*sample)[pos++] << 12;
-	raw += (*sample)[pos++];
-	try{
-	  pixel pix(raw,invertedAddress);
-	  roc_Event.pixels.push_back(pix);
-	}
-	catch(DataDecoderError /*&e*/){
-	  // decoding of raw address lead to invalid address
-	  roc_Event.numDecoderErrors++; // keep track of number of such errors
-	}
+      const uint16_t * words = &sample->data[0];
+      if (n > 1) pixels.reserve(pixels.size() + (n-1)/2);
+      roc_Event.header = words[0];
+      for (size_t pos = 1; pos + 1 < n; pos += 2) {
+	uint32_t raw = (static_cast<uint32_t>(words[pos]) << 12) + words[pos+1];
+	// Single ROC, invalid addresses are counted, not thrown:
+	if(!decodePixel(raw, 0, inv, pixels)) { roc_Event.numDecoderErrors++; }
       }
     }
 
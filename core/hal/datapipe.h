@@ -2,8 +2,13 @@
 #define PXAR_DATAPIPE_H
 
 #include <stdexcept>
+#include <deque>
+#include <string>
+#include <cstdio>
 #include "datatypes.h"
 #include "rpc_calls.h"
+#include "constants.h"
+#include "threading.h"
 
 namespace pxar {
 
@@ -99,6 +104,137 @@ namespace pxar {
   dsBufferEmpty() : dataPipeException("Buffer empty") {}
   };
 
+  class dsFileError : public dataPipeException {
+  public:
+  dsFileError(const std::string & message) : dataPipeException(message.c_str()) {}
+  };
+
+  // Recorded raw data files start with a header of DTB_RECORD_HEADER_SIZE
+  // bytes: the magic "PXARRAW" (8 bytes including the terminating zero),
+  // the format version (16bit), the DAQ channel, the device type and the
+  // TBM flag (one byte each) and three bytes of padding. The 16bit data
+  // words of the channel follow in host byte order, exactly as returned
+  // by Daq_Read.
+
+  // Recorder writing all data blocks read from one DAQ channel to a file.
+  // Blocks are appended through a large stdio buffer so the readout is not
+  // slowed down by small writes. Not thread-safe, each channel has its
+  // own recorder which is only written by the thread reading the channel.
+  class dtbRecorder {
+  public:
+  dtbRecorder() : file(NULL), words(0) {}
+    ~dtbRecorder() { Close(); }
+
+    // Create the file and write the header describing the channel:
+    bool Open(const std::string & filename, uint8_t channel, bool tbm_present, uint8_t devicetype);
+    // Append one block, on write errors the recording is stopped:
+    void Write(const std::vector<uint16_t> &data);
+    // Flush and close the file:
+    void Close();
+
+    bool IsOpen() { return file != NULL; }
+    uint64_t GetSize() { return words; }
+
+  private:
+    FILE * file;
+    std::string name;
+    std::vector<char> iobuffer;
+    uint64_t words;
+
+    dtbRecorder(const dtbRecorder&);
+    dtbRecorder& operator=(const dtbRecorder&);
+  };
+
+  // Data source replaying a file written by dtbRecorder. The file is
+  // mapped into memory and handed to the pipe word by word, channel,
+  // device type and TBM flag are taken from the file header.
+  class dtbFileSource : public dataSource<uint16_t> {
+    const uint16_t * data;
+    size_t size;
+    size_t pos;
+    uint16_t lastSample;
+    uint8_t channel;
+    uint8_t devicetype;
+    bool tbm_present;
+
+    // --- memory mapping of the file
+    void * mapping;
+    size_t mappedsize;
+#ifdef WIN32
+    HANDLE fileHandle;
+    HANDLE mapHandle;
+#endif
+
+    // --- virtual data access methods
+    uint16_t Read() {
+      if(pos >= size) throw dsBufferEmpty();
+      return (lastSample = data[pos++]);
+    }
+    uint16_t ReadLast() { return lastSample; }
+    bool ReadState() { return tbm_present; }
+    uint8_t ReadChannel() { return channel; }
+    uint8_t ReadDeviceType() { return devicetype; }
+
+    void Unmap();
+    dtbFileSource(const dtbFileSource&);
+    dtbFileSource& operator=(const dtbFileSource&);
+  public:
+    // Map the file, throws dsFileError if it cannot be read or is no
+    // recorded raw data file:
+    dtbFileSource(const std::string & filename);
+    ~dtbFileSource() { Unmap(); }
+
+    // Start again from the first word of the file:
+    void Rewind() { pos = 0; lastSample = 0x4000; }
+
+    // --- file information
+    size_t GetSize() { return size; }
+    size_t GetPosition() { return pos; }
+    uint8_t GetChannel() { return channel; }
+    uint8_t GetDeviceType() { return devicetype; }
+    bool GetTbmPresent() { return tbm_present; }
+  };
+
+  // Host-side ring buffer for one DAQ channel, filled by the asynchronous
+  // readout thread of the HAL and drained by the dtbSource of that channel.
+  // Data is only handed out up to the end of the last committed Event, so
+  // the splitter never sees a partial Event while triggers are running.
+  class dtbHostBuffer {
+  public:
+    dtbHostBuffer() : written(0), committed(0), consumed(0), endmask(0x4000), endvalue(0x4000), active(false) {}
+
+    // Allocate the ring and clear all data. Selects the Event end marker
+    // of DESER400 (TBM trailer) or DESER160 data:
+    void Reset(bool tbm_present, uint32_t capacity = DTB_HOST_BUFFER_SIZE);
+    // Drop all data and release the memory:
+    void Clear();
+
+    // --- producer side (readout thread)
+    uint32_t GetFreeSize();
+    void Write(const std::vector<uint16_t> &data);
+    uint32_t GetPendingEvents();
+    void Commit(uint32_t nevents);
+    void CommitAll();
+
+    // --- consumer side (dtbSource)
+    uint32_t Read(std::vector<uint16_t> &data, uint32_t maxsize);
+    uint32_t GetSize();
+
+    // The readout thread owns the DTB channel while the buffer is active:
+    void SetActive(bool state) { active = state; }
+    bool IsActive() { return active; }
+
+  private:
+    pxar::mutex m;
+    std::vector<uint16_t> ring;
+    // Absolute word counters, positions in the ring are taken modulo its size:
+    uint64_t written, committed, consumed;
+    // End positions of complete but not yet committed Events:
+    std::deque<uint64_t> boundaries;
+    uint16_t endmask, endvalue;
+    volatile bool active;
+  };
+
   // DTB data source class
   class dtbSource : public dataSource<uint16_t> {
     volatile bool stopAtEmptyData;
@@ -111,6 +247,8 @@ namespace pxar {
     bool connected;
     bool tbm_present;
     uint8_t devicetype;
+    dtbHostBuffer * hostBuffer;
+    dtbRecorder * recorder;
 
     // --- data buffer
     uint16_t lastSample;
@@ -141,10 +279,16 @@ namespace pxar {
     }
   public:
   dtbSource(CTestboard * src, uint8_t daqchannel, bool module, uint8_t roctype, bool endlessStream)
-    : stopAtEmptyData(endlessStream), tb(src), channel(daqchannel), connected(true), tbm_present(module), devicetype(roctype), lastSample(0x4000), pos(0) {}
-  dtbSource() : connected(false) {}
+    : stopAtEmptyData(endlessStream), tb(src), channel(daqchannel), connected(true), tbm_present(module), devicetype(roctype), hostBuffer(NULL), recorder(NULL), lastSample(0x4000), pos(0) {}
+  dtbSource() : connected(false), hostBuffer(NULL), recorder(NULL) {}
     bool isConnected() { return connected; }
 
+    // Read data from the host-side buffer of the asynchronous readout first:
+    void SetHostBuffer(dtbHostBuffer * host) { hostBuffer = host; }
+
+    // Write all blocks read from the DTB to the recorder, NULL to detach:
+    void SetRecorder(dtbRecorder * rec) { recorder = rec; }
+
     // --- control and status
     uint8_t  GetState() { return dtbState; }
     uint32_t GetRemainingSize() { return dtbRemainingSize; }
@@ -169,12 +313,13 @@ namespace pxar {
 
     bool nextStartDetected;
   public:
-    dtbEventSplitter() {}
+    dtbEventSplitter() : nextStartDetected(false) {}
   };
 
   // DTB data decoding class
   class dtbEventDecoder : public dataPipe<rawEvent*, Event*> {
     Event roc_Event;
+    eventArena * arena;
     Event* Read() {
       if(GetState()) return DecodeDeser400();
       else return DecodeDeser160();
@@ -184,8 +329,17 @@ namespace pxar {
     uint8_t ReadChannel() { return GetChannel(); }
     uint8_t ReadDeviceType() { return GetDeviceType(); }
 
+    // Table-driven decoders, invalid pixels are counted in the Event's
+    // numDecoderErrors. Pixels are stored either in the returned Event
+    // or the attached arena:
     Event* DecodeDeser160();
     Event* DecodeDeser400();
+  public:
+  dtbEventDecoder() : arena(NULL) {}
+
+    // Write decoded pixels directly into the arena instead of the returned
+    // Event, pass NULL to detach:
+    void SetArena(eventArena * events) { arena = events; }
   };
 }
 #endif
@@ -3,16 +3,560 @@
 #include "timer.h"
 #include "helper.h"
 #include "constants.h"
+#include "threading.h"
 #include <fstream>
+#include <sstream>
+#include <map>
+#include <cmath>
 #include <stdlib.h>
 
 using namespace pxar;
 
+/* The dummy HAL simulates a DUT instead of talking to a testboard. Every
+   pixel gets a threshold, noise, gain and pedestal drawn from a model
+   which can be tuned with a configuration file given in the environment
+   variable PXAR_DUMMYDTB (lines of "key value", see dummyConfig for the
+   keys and defaults). The response depends on the DACs programmed
+   (Vcal, CtrlReg, VthrComp, Vtrim, CalDel) and on the trim and mask bits.
+
+   The test functions deliver their Events in chunks through the same
+   arena and trigger condenser as the real HAL. The free-running DAQ
+   encodes the simulated hits into the DTB data format and reads them back
+   through the regular splitter and decoder pipes. Every hal instance
+   simulates a DUT of its own. */
+
+namespace {
+
+  // Number of Events generated per simulated readout cycle of the test loops:
+  const size_t dummyChunkEvents = 65536;
+
+  const double dummyPi = 3.14159265358979323846;
+  const double dummySqrt2 = 1.41421356237309504880;
+
+  // Small and fast random number generator (xorshift64*), rand() would
+  // dominate the time needed to simulate large tests:
+  class dummyRandom {
+  public:
+    dummyRandom() : state(1), cached(false), gauss(0) {}
+    void Seed(uint32_t seed) {
+      state = (static_cast<uint64_t>(seed) << 32) ^ 0x9e3779b97f4a7c15ULL;
+      cached = false;
+    }
+    uint32_t Next() {
+      state ^= state >> 12;
+      state ^= state << 25;
+      state ^= state >> 27;
+      return static_cast<uint32_t>((state*0x2545f4914f6cdd1dULL) >> 32);
+    }
+    // Uniform in [0,1):
+    double Uniform() { return Next()*(1.0/4294967296.0); }
+    // Standard normal distribution (Box-Muller):
+    double Gauss() {
+      if(cached) { cached = false; return gauss; }
+      double u1 = 1.0 - Uniform(), u2 = Uniform();
+      double r = std::sqrt(-2.0*std::log(u1));
+      gauss = r*std::sin(2*dummyPi*u2);
+      cached = true;
+      return r*std::cos(2*dummyPi*u2);
+    }
+    // Poisson distribution for small means:
+    unsigned int Poisson(double mean) {
+      double limit = std::exp(-mean), p = Uniform();
+      unsigned int n = 0;
+      while(p > limit) { p *= Uniform(); n++; }
+      return n;
+    }
+  private:
+    uint64_t state;
+    bool cached;
+    double gauss;
+  };
+
+  // Complementary error function (Abramowitz & Stegun 7.1.26), erfc is
+  // not available on all supported compilers:
+  double dummyErfc(double x) {
+    double z = std::fabs(x);
+    double t = 1.0/(1.0 + 0.3275911*z);
+    double y = t*(0.254829592 + t*(-0.284496736 + t*(1.421413741 + t*(-1.453152027 + t*1.061405429))))*std::exp(-z*z);
+    return (x >= 0) ? y : 2.0 - y;
+  }
+
+  // Parameters of the simulated DUT:
+  struct dummyConfig {
+    dummyConfig() :
+      seed(42),
+      threshold(60), thresholdSpread(3), thresholdSlope(0.7), vthrCompRef(50), trimScale(0.02),
+      noise(1.5), noiseSpread(0.3),
+      gain(0.5), gainSpread(0.05), pedestal(30), pedestalSpread(5), phNoise(1.0),
+      calDelMin(40), calDelMax(120),
+      deadFraction(0), hotFraction(0), hotRate(0.01),
+      hitRate(0), hitCharge(150) {}
+
+    uint32_t seed;          // seed of the random number generator
+    double threshold;       // mean threshold in Vcal DAC units, untrimmed at VthrComp = vthrCompRef
+    double thresholdSpread; // pixel-to-pixel spread of the threshold
+    double thresholdSlope;  // threshold change per VthrComp DAC unit (higher VthrComp, lower threshold)
+    double vthrCompRef;
+    double trimScale;       // threshold reduction per trim bit and Vtrim DAC unit
+    double noise;           // width of the s-curves in Vcal DAC units
+    double noiseSpread;
+    double gain;            // pulse height per Vcal DAC unit
+    double gainSpread;
+    double pedestal;        // pulse height at zero charge
+    double pedestalSpread;
+    double phNoise;         // event-to-event pulse height fluctuation
+    double calDelMin;       // CalDel range in which the calibrate signal is in time
+    double calDelMax;
+    double deadFraction;    // fraction of pixels never responding
+    double hotFraction;     // fraction of pixels firing randomly when unmasked
+    double hotRate;         // probability of a hot pixel to fire per trigger
+    double hitRate;         // mean number of particle hits per ROC and trigger in the free-running DAQ
+    double hitCharge;       // mean charge of particle hits in Vcal DAC units
+
+    void Read(const std::string & filename) {
+      std::ifstream file(filename.c_str());
+      if(!file.is_open()) {
+	LOG(logERROR) << "Could not open dummy DTB configuration " << filename << ", using defaults.";
+	return;
+      }
+      std::string line;
+      while(std::getline(file, line)) {
+	if(line.empty() || line[0] == '#') continue;
+	std::istringstream is(line);
+	std::string key;
+	double value;
+	if(!(is >> key >> value)) continue;
+	if(key == "seed") seed = static_cast<uint32_t>(value);
+	else if(key == "threshold") threshold = value;
+	else if(key == "thresholdSpread") thresholdSpread = value;
+	else if(key == "thresholdSlope") thresholdSlope = value;
+	else if(key == "vthrCompRef") vthrCompRef = value;
+	else if(key == "trimScale") trimScale = value;
+	else if(key == "noise") noise = value;
+	else if(key == "noiseSpread") noiseSpread = value;
+	else if(key == "gain") gain = value;
+	else if(key == "gainSpread") gainSpread = value;
+	else if(key == "pedestal") pedestal = value;
+	else if(key == "pedestalSpread") pedestalSpread = value;
+	else if(key == "phNoise") phNoise = value;
+	else if(key == "calDelMin") calDelMin = value;
+	else if(key == "calDelMax") calDelMax = value;
+	else if(key == "deadFraction") deadFraction = value;
+	else if(key == "hotFraction") hotFraction = value;
+	else if(key == "hotRate") hotRate = value;
+	else if(key == "hitRate") hitRate = value;
+	else if(key == "hitCharge") hitCharge = value;
+	else { LOG(logWARNING) << "Unknown dummy DTB parameter " << key; }
+      }
+      LOG(logINFO) << "Read dummy DTB configuration from " << filename;
+    }
+  };
+
+  enum { pixelNormal, pixelDead, pixelHot };
+
+  struct dummyPixel {
+    float threshold;
+    float noise;
+    float gain;
+    float pedestal;
+    uint8_t trim;
+    uint8_t type;
+    bool masked;
+    bool calibrate;
+  };
+
+  struct dummyRoc {
+    uint8_t type;
+    uint8_t dacs[256];
+    std::vector<dummyPixel> pixels; // index column*ROC_NUMROWS + row
+    std::vector<uint16_t> hot;      // indices of the hot pixels
+  };
+
+  // Expected response of one pixel to the calibrate signal:
+  struct dummyResponse {
+    double efficiency;
+    double pulseheight;
+  };
+
+  class dummyDut {
+  public:
+    dummyConfig config;
+    dummyRandom random;
+
+    void Configure() {
+      config = dummyConfig();
+      const char * filename = getenv("PXAR_DUMMYDTB");
+      if(filename) { config.Read(filename); }
+      random.Seed(config.seed);
+      rocs.clear();
+    }
+
+    // Access a ROC, its pixels are generated on first use:
+    dummyRoc & Roc(uint8_t i2c) {
+      std::map<uint8_t,dummyRoc>::iterator it = rocs.find(i2c);
+      if(it != rocs.end()) return it->second;
+
+      dummyRoc & roc = rocs[i2c];
+      roc.type = 0;
+      for(size_t i = 0; i < 256; i++) { roc.dacs[i] = 0; }
+      roc.dacs[ROC_DAC_Vtrim] = 0;
+      roc.dacs[ROC_DAC_VthrComp] = static_cast<uint8_t>(config.vthrCompRef);
+      roc.dacs[ROC_DAC_Vcal] = 200;
+      roc.dacs[ROC_DAC_CalDel] = static_cast<uint8_t>((config.calDelMin + config.calDelMax)/2);
+
+      roc.pixels.resize(ROC_NUMCOLS*ROC_NUMROWS);
+      for(size_t i = 0; i < roc.pixels.size(); i++) {
+	dummyPixel & px = roc.pixels[i];
+	px.threshold = static_cast<float>(config.threshold + config.thresholdSpread*random.Gauss());
+	px.noise = static_cast<float>(std::max(0.1, config.noise + config.noiseSpread*random.Gauss()));
+	px.gain = static_cast<float>(config.gain + config.gainSpread*random.Gauss());
+	px.pedestal = static_cast<float>(config.pedestal + config.pedestalSpread*random.Gauss());
+	px.trim = 15;
+	px.masked = true;
+	px.calibrate = false;
+	double r = random.Uniform();
+	if(r < config.deadFraction) { px.type = pixelDead; }
+	else if(r < config.deadFraction + config.hotFraction) {
+	  px.type = pixelHot;
+	  roc.hot.push_back(static_cast<uint16_t>(i));
+	}
+	else { px.type = pixelNormal; }
+      }
+      return roc;
+    }
+
+    // Response of a pixel to the calibrate signal for the given DAC settings:
+    dummyResponse Response(const dummyPixel & px, const uint8_t * dacs) {
+      dummyResponse r;
+      double charge = dacs[ROC_DAC_Vcal]*((dacs[ROC_DAC_CtrlReg] & 0x04) ? 7 : 1);
+      double threshold = px.threshold
+	- config.thresholdSlope*(dacs[ROC_DAC_VthrComp] - config.vthrCompRef)
+	- config.trimScale*(15 - px.trim)*dacs[ROC_DAC_Vtrim];
+      bool intime = (dacs[ROC_DAC_CalDel] >= config.calDelMin && dacs[ROC_DAC_CalDel] <= config.calDelMax);
+
+      if(px.type == pixelDead || !intime) { r.efficiency = 0; }
+      else { r.efficiency = 0.5*dummyErfc((threshold - charge)/(dummySqrt2*px.noise)); }
+      r.pulseheight = px.pedestal + px.gain*charge;
+      return r;
+    }
+
+    // Random pulse height around the expected one, limited to the 8bit range:
+    uint16_t PulseHeight(double mean) {
+      double ph = mean + config.phNoise*random.Gauss();
+      if(ph < 0) return 0;
+      if(ph > 255) return 255;
+      return static_cast<uint16_t>(ph + 0.5);
+    }
+
+    std::map<uint8_t,dummyRoc> rocs;
+  };
+
+  /** Simulation of one of the trigger loops running on the NIOS: the
+   *  pixels (all or one) are calibrated one after the other, for each of
+   *  them up to two DACs are scanned and nTriggers are sent for every
+   *  setting. All ROCs given are triggered in parallel.
+   */
+  class dummyLoop {
+  public:
+    dummyLoop(dummyDut & simulated, std::vector<uint8_t> rocids, uint16_t loopflags, uint16_t nTriggers)
+      : dut(simulated), rocs(rocids), flags(loopflags), ntrig(nTriggers > 0 ? nTriggers : 1), allPixels(true),
+	pixelIndex(0), step1(0), step2(0), trigger(0), response(rocids.size()) {
+      for(size_t i = 0; i < 2; i++) { dacreg[i] = 0; dacmin[i] = 0; dacstep[i] = 1; nsteps[i] = 1; }
+    }
+
+    // Only calibrate this pixel instead of all:
+    void SetPixel(uint8_t column, uint8_t row) {
+      allPixels = false;
+      pixelIndex = column*ROC_NUMROWS + row;
+    }
+
+    // Scan a DAC register, axis 0 is the outer loop:
+    void SetScan(size_t axis, uint8_t reg, uint8_t min, uint8_t max, uint8_t step) {
+      dacreg[axis] = reg;
+      dacmin[axis] = min;
+      dacstep[axis] = (step > 0 ? step : 1);
+      nsteps[axis] = (max >= min) ? (max - min)/dacstep[axis] + 1 : 1;
+    }
+
+    size_t Expected() {
+      return (allPixels ? ROC_NUMCOLS*ROC_NUMROWS : 1)*nsteps[0]*nsteps[1]*ntrig;
+    }
+
+    /** Generate the next chunk of Events into the arena, returns true
+     *  once the loop is finished
+     */
+    bool Run(eventArena & events) {
+      size_t npixels = allPixels ? ROC_NUMCOLS*ROC_NUMROWS : pixelIndex + 1;
+      bool unmasked = (flags & FLAG_FORCE_UNMASKED) != 0;
+
+      for(size_t n = 0; n < dummyChunkEvents; n++) {
+	if(pixelIndex >= npixels) return true;
+	uint8_t column = static_cast<uint8_t>(pixelIndex/ROC_NUMROWS);
+	uint8_t row = static_cast<uint8_t>(pixelIndex%ROC_NUMROWS);
+
+	// New loop setting, update the expected response of all ROCs:
+	if(trigger == 0) {
+	  for(size_t r = 0; r < rocs.size(); r++) {
+	    dummyRoc & roc = dut.Roc(rocs[r]);
+	    uint8_t dacs[256];
+	    std::copy(roc.dacs, roc.dacs + 256, dacs);
+	    if(nsteps[0] > 1 || dacreg[0] != 0) { dacs[dacreg[0]] = static_cast<uint8_t>(dacmin[0] + step1*dacstep[0]); }
+	    if(nsteps[1] > 1 || dacreg[1] != 0) { dacs[dacreg[1]] = static_cast<uint8_t>(dacmin[1] + step2*dacstep[1]); }
+	    response[r] = dut.Response(roc.pixels[pixelIndex], dacs);
+	  }
+	}
+
+	events.StartEvent();
+	for(size_t r = 0; r < rocs.size(); r++) {
+	  if(dut.random.Uniform() < response[r].efficiency) {
+	    uint16_t ph = dut.PulseHeight(response[r].pulseheight);
+	    // Introduce some address encoding issues:
+	    if((flags&FLAG_CHECK_ORDER) != 0 && column == 0 && row == 1) { events.AddPixel(pixel(rocs[r],column,row+1,ph)); } // PX 0,1 answers as PX 0,2
+	    else if((flags&FLAG_CHECK_ORDER) != 0 && column == 0 && row == 2) { } // PX 0,2 is dead
+	    else { events.AddPixel(pixel(rocs[r],column,row,ph)); }
+	  }
+	  // Hot pixels only show up if the ROC has not been masked for the test:
+	  if(unmasked) {
+	    dummyRoc & roc = dut.Roc(rocs[r]);
+	    for(std::vector<uint16_t>::iterator hot = roc.hot.begin(); hot != roc.hot.end(); ++hot) {
+	      if(roc.pixels[*hot].masked || dut.random.Uniform() >= dut.config.hotRate) continue;
+	      events.AddPixel(pixel(rocs[r],static_cast<uint8_t>(*hot/ROC_NUMROWS),static_cast<uint8_t>(*hot%ROC_NUMROWS),dut.PulseHeight(roc.pixels[*hot].pedestal)));
+	    }
+	  }
+	}
+	events.FinishEvent(0x07f8,0,0);
+
+	// Advance the loop counters, innermost first:
+	if(++trigger < ntrig) continue;
+	trigger = 0;
+	if(++step2 < nsteps[1]) continue;
+	step2 = 0;
+	if(++step1 < nsteps[0]) continue;
+	step1 = 0;
+	pixelIndex++;
+      }
+      return pixelIndex >= npixels;
+    }
+
+  private:
+    dummyDut & dut;
+    std::vector<uint8_t> rocs;
+    uint16_t flags;
+    uint16_t ntrig;
+    bool allPixels;
+    uint8_t dacreg[2], dacmin[2], dacstep[2];
+    size_t nsteps[2];
+    size_t pixelIndex, step1, step2, trigger;
+    std::vector<dummyResponse> response;
+  };
+
+  /** Free-running DAQ of the simulated DUT. Triggered Events are encoded
+   *  into the DTB data format (DESER160 or DESER400 with TBM) and stored
+   *  in a buffer standing in for the DTB RAM, which is read through the
+   *  regular splitter and decoder.
+   */
+  class dummyDaq : public dataSource<uint16_t> {
+  public:
+    dummyDaq(dummyDut & simulated) : dut(simulated), running(false), tbm(false), devicetype(0), pos(0), last(0x4000), counter(0), period(0), loopTriggers(0), loopTimer(NULL) {}
+    ~dummyDaq() { delete loopTimer; }
+
+    void Start(bool module, uint8_t roctype) {
+      Clear();
+      running = true;
+      tbm = module;
+      devicetype = roctype;
+    }
+
+    void Stop() {
+      StopLoop();
+      running = false;
+    }
+
+    void Clear() {
+      StopLoop();
+      buffer.clear();
+      pos = 0;
+      last = 0x4000;
+      counter = 0;
+    }
+
+    void StartLoop(uint16_t loopperiod) {
+      StopLoop();
+      period = (loopperiod > 0 ? loopperiod : 1);
+      loopTriggers = 0;
+      loopTimer = new timer();
+    }
+
+    void StopLoop() {
+      Update();
+      delete loopTimer;
+      loopTimer = NULL;
+    }
+
+    // Send the triggers of the pattern generator loop since the last call,
+    // the loop runs at 40MHz clock cycles per period:
+    void Update() {
+      if(!loopTimer) return;
+      uint64_t total = loopTimer->get()*40000/period;
+      if(total > loopTriggers) {
+	Trigger(static_cast<uint32_t>(total - loopTriggers));
+	loopTriggers = total;
+      }
+    }
+
+    void Trigger(uint32_t nTrig) {
+      if(!running) return;
+
+      // Expected response of all calibrated pixels, the DACs do not change
+      // while triggering:
+      std::vector<std::vector<std::pair<uint16_t,dummyResponse> > > calibrated(dut.rocs.size());
+      size_t r = 0;
+      for(std::map<uint8_t,dummyRoc>::iterator roc = dut.rocs.begin(); roc != dut.rocs.end(); ++roc, ++r) {
+	for(size_t i = 0; i < roc->second.pixels.size(); i++) {
+	  const dummyPixel & px = roc->second.pixels[i];
+	  if(px.calibrate && !px.masked) { calibrated[r].push_back(std::make_pair(static_cast<uint16_t>(i),dut.Response(px, roc->second.dacs))); }
+	}
+      }
+
+      std::vector<uint16_t> hits;
+      for(uint32_t trg = 0; trg < nTrig; trg++) {
+	// Keep the size of the DTB RAM:
+	if(buffer.size() - pos > DTB_SOURCE_BUFFER_SIZE) {
+	  LOG(logWARNING) << "Dummy DAQ buffer full, dropping " << (nTrig - trg) << " triggers.";
+	  break;
+	}
+	if(pos > 0 && pos == buffer.size()) { buffer.clear(); pos = 0; }
+
+	if(tbm) {
+	  buffer.push_back(0xa000 | (counter & 0xff));
+	  buffer.push_back(0x8000);
+	}
+	// Without TBM only a single ROC can be read out:
+	r = 0;
+	for(std::map<uint8_t,dummyRoc>::iterator roc = dut.rocs.begin(); roc != dut.rocs.end() && (tbm || r == 0); ++roc, ++r) {
+	  hits.clear();
+	  for(std::vector<std::pair<uint16_t,dummyResponse> >::iterator px = calibrated[r].begin(); px != calibrated[r].end(); ++px) {
+	    if(dut.random.Uniform() < px->second.efficiency) {
+	      hits.push_back(px->first);
+	      hits.push_back(dut.PulseHeight(px->second.pulseheight));
+	    }
+	  }
+	  for(std::vector<uint16_t>::iterator hot = roc->second.hot.begin(); hot != roc->second.hot.end(); ++hot) {
+	    if(roc->second.pixels[*hot].masked || dut.random.Uniform() >= dut.config.hotRate) continue;
+	    hits.push_back(*hot);
+	    hits.push_back(dut.PulseHeight(roc->second.pixels[*hot].pedestal));
+	  }
+	  for(unsigned int n = dut.random.Poisson(dut.config.hitRate); n > 0; n--) {
+	    uint16_t i = static_cast<uint16_t>(dut.random.Next()%(ROC_NUMCOLS*ROC_NUMROWS));
+	    const dummyPixel & px = roc->second.pixels[i];
+	    if(px.masked || px.type == pixelDead) continue;
+	    double charge = dut.config.hitCharge*(1 + 0.2*dut.random.Gauss());
+	    hits.push_back(i);
+	    hits.push_back(dut.PulseHeight(px.pedestal + px.gain*std::max(charge,0.)));
+	  }
+	  Encode(hits, roc->second.type == ROC_PSI46DIG);
+	}
+	if(tbm) {
+	  buffer.push_back(0xe000);
+	  buffer.push_back(0xc000 | (counter & 0xff));
+	}
+	counter++;
+      }
+    }
+
+    // Number of words not yet read:
+    uint32_t GetSize() {
+      Update();
+      return static_cast<uint32_t>(buffer.size() - pos);
+    }
+
+  private:
+    // Append the ROC header and pixel hits (index, pulse height pairs):
+    void Encode(const std::vector<uint16_t> & hits, bool invert) {
+      if(tbm) { buffer.push_back(0x4000 | 0x07f8); }
+      else { buffer.push_back((hits.empty() ? 0xc000 : 0x8000) | 0x07f8); }
+
+      for(size_t i = 0; i < hits.size(); i += 2) {
+	unsigned int column = hits[i]/ROC_NUMROWS, row = hits[i]%ROC_NUMROWS, ph = hits[i+1];
+	unsigned int c = column/2;
+	unsigned int r = 2*(80 - row) + (column & 1);
+	unsigned int r2 = r/36, r1 = (r/6)%6, r0 = r%6;
+	if(invert) { r2 ^= 7; r1 ^= 7; r0 ^= 7; }
+	uint32_t raw = ((c/6) << 21) | ((c%6) << 18) | (r2 << 15) | (r1 << 12) | (r0 << 9) | ((ph & 0xf0) << 1) | (ph & 0x0f);
+	if(tbm) {
+	  buffer.push_back(0x0000 | ((raw >> 12) & 0x0fff));
+	  buffer.push_back(0x2000 | (raw & 0x0fff));
+	}
+	else {
+	  buffer.push_back((raw >> 12) & 0x0fff);
+	  // The last word of the Event carries the end marker:
+	  buffer.push_back(((i + 2 == hits.size()) ? 0x4000 : 0) | (raw & 0x0fff));
+	}
+      }
+    }
+
+    uint16_t Read() {
+      if(pos >= buffer.size()) Update();
+      if(pos >= buffer.size()) throw dsBufferEmpty();
+      return (last = buffer[pos++]);
+    }
+    uint16_t ReadLast() { return last; }
+    bool ReadState() { return tbm; }
+    uint8_t ReadChannel() { return 0; }
+    uint8_t ReadDeviceType() { return devicetype; }
+
+    dummyDut & dut;
+    bool running;
+    bool tbm;
+    uint8_t devicetype;
+    std::vector<uint16_t> buffer;
+    size_t pos;
+    uint16_t last;
+    uint32_t counter;
+    uint16_t period;
+    uint64_t loopTriggers;
+    timer * loopTimer;
+  };
+
+  // The simulated DUT and DAQ of every hal instance:
+  struct dummySetup {
+    dummySetup() : source(dut) {}
+    dummyDut dut;
+    dummyDaq source;
+  };
+
+  pxar::mutex dummySetupsMutex;
+  std::map<const hal*,dummySetup*> dummySetups;
+
+  dummySetup & setup(const hal * h) {
+    pxar::lock_guard lock(dummySetupsMutex);
+    dummySetup *& s = dummySetups[h];
+    if(!s) s = new dummySetup();
+    return *s;
+  }
+
+  void releaseSetup(const hal * h) {
+    pxar::lock_guard lock(dummySetupsMutex);
+    std::map<const hal*,dummySetup*>::iterator s = dummySetups.find(h);
+    if(s == dummySetups.end()) return;
+    delete s->second;
+    dummySetups.erase(s);
+  }
+
+  dummyDut & dummy(const hal * h) { return setup(h).dut; }
+  dummyDaq & daq(const hal * h) { return setup(h).source; }
+
+}
+
 hal::hal(std::string /*name*/) :
   _initialized(false),
   _compatible(false),
   tbmtype(0),
-  deser160phase(4)
+  deser160phase(4),
+  rocType(0),
+  condenser(NULL),
+  nEventsRead(0),
+  readoutRunning(false)
 {
   // Print the useful SW/FW versioning info:
   PrintInfo();
@@ -22,9 +566,14 @@ hal::hal(std::string /*name*/) :
     // Set compatibility flag
     _compatible = true;
   }
+
+  // Set up the simulated DUT:
+  dummy(this).Configure();
+  daq(this).Clear();
 }
 
 hal::~hal() {
+  releaseSetup(this);
 }
 
 bool hal::status() {
@@ -47,7 +596,7 @@ uint32_t hal::GetHashForStringVector(const std::vector<std::string> & v)
 }
 
 void hal::initTestboard(std::map<uint8_t,uint8_t> /*sig_delays*/, std::vector<std::pair<uint16_t,uint8_t> > /*pg_setup*/, uint16_t /*delaysum*/, double /*va*/, double /*vd*/, double /*ia*/, double /*id*/) {
-  
+
   // We are ready for operations now, mark the HAL as initialized:
   _initialized = true;
 }
@@ -69,11 +618,14 @@ bool hal::flashTestboard(std::ifstream& /*flashFile*/) {
 void hal::initTBMCore(uint8_t /*tbmId*/, std::map< uint8_t,uint8_t > /*regVector*/) {
 }
 
-void hal::initROC(uint8_t /*rocId*/, uint8_t /*roctype*/, std::map< uint8_t,uint8_t > /*dacVector*/) {
+void hal::initROC(uint8_t rocId, uint8_t roctype, std::map< uint8_t,uint8_t > dacVector) {
+  rocType = roctype;
+  dummy(this).Roc(rocId).type = roctype;
+  rocSetDACs(rocId,dacVector);
 }
 
 void hal::PrintInfo() {
-  LOG(logINFO) << "DTB startup information" << std::endl 
+  LOG(logINFO) << "DTB startup information" << std::endl
 	       << "--- DTB info------------------------------------------" << std::endl
 	       << " DUMMY DUMMY DUMMY " << std::endl
 	       << "------------------------------------------------------";
@@ -122,12 +674,20 @@ void hal::setTBvd(double /*VD*/) {
 }
 
 
-bool hal::rocSetDACs(uint8_t /*rocId*/, std::map< uint8_t, uint8_t > /*dacPairs*/) {
+bool hal::rocSetDACs(uint8_t rocId, std::map< uint8_t, uint8_t > dacPairs) {
+  dummyRoc & roc = dummy(this).Roc(rocId);
+  for(std::map<uint8_t,uint8_t>::iterator it = dacPairs.begin(); it != dacPairs.end(); ++it) { roc.dacs[it->first] = it->second; }
   // Everything went all right:
   return true;
 }
 
-bool hal::rocSetDAC(uint8_t /*rocId*/, uint8_t /*dacId*/, uint8_t /*dacValue*/) {
+bool hal::rocSetDACs(std::map< uint8_t, std::map< uint8_t, uint8_t > > rocDacs) {
+  for(std::map< uint8_t, std::map<uint8_t,uint8_t> >::iterator it = rocDacs.begin(); it != rocDacs.end(); ++it) { rocSetDACs(it->first,it->second); }
+  return true;
+}
+
+bool hal::rocSetDAC(uint8_t rocId, uint8_t dacId, uint8_t dacValue) {
+  dummy(this).Roc(rocId).dacs[dacId] = dacValue;
   return true;
 }
 
@@ -140,374 +700,366 @@ bool hal::tbmSetReg(uint8_t /*regId*/, uint8_t /*regValue*/) {
   return true;
 }
 
-void hal::RocSetMask(uint8_t /*rocid*/, bool /*mask*/, std::vector<pixelConfig> /*pixels*/) {
+void hal::RocSetMask(uint8_t rocid, bool mask, const pixelStore & pixels) {
+  dummyRoc & roc = dummy(this).Roc(rocid);
+  for(std::vector<dummyPixel>::iterator px = roc.pixels.begin(); px != roc.pixels.end(); ++px) { px->masked = true; }
+  if(mask) return;
+
+  // Unmask and trim the pixels given:
+  for(size_t i = 0; i < pixelStore::npixels; i++) {
+    if(!pixels.present(i)) continue;
+    roc.pixels[i].masked = pixels.masked(i);
+    roc.pixels[i].trim = pixels.trim(i);
+  }
 }
 
 void hal::AllColumnsSetEnable(uint8_t /*rocid*/, bool /*enable*/) {
 }
 
-void hal::PixelSetCalibrate(uint8_t /*rocid*/, uint8_t /*column*/, uint8_t /*row*/, uint16_t /*flags*/) {
+void hal::PixelSetCalibrate(uint8_t rocid, uint8_t column, uint8_t row, uint16_t /*flags*/) {
+  if(column >= ROC_NUMCOLS || row >= ROC_NUMROWS) return;
+  dummy(this).Roc(rocid).pixels[column*ROC_NUMROWS + row].calibrate = true;
 }
 
-void hal::RocClearCalibrate(uint8_t /*rocid*/) {
+void hal::RocClearCalibrate(uint8_t rocid) {
+  dummyRoc & roc = dummy(this).Roc(rocid);
+  for(std::vector<dummyPixel>::iterator px = roc.pixels.begin(); px != roc.pixels.end(); ++px) { px->calibrate = false; }
 }
 
-void hal::SetupTrimValues(unsigned char, std::vector<pxar::pixelConfig, std::allocator<pxar::pixelConfig> >) {
+void hal::SetupTrimValues(uint8_t roci2c, const pixelStore & pixels) {
+  dummyRoc & roc = dummy(this).Roc(roci2c);
+  for(size_t i = 0; i < pixelStore::npixels; i++) {
+    if(pixels.present(i)) { roc.pixels[i].trim = pixels.trim(i); }
+  }
 }
 
-void hal::SetupI2CValues(std::vector<unsigned char, std::allocator<unsigned char> >) {
+bool hal::SetupI2CValues(std::vector<uint8_t> roci2cs) {
+  if(roci2cs == niosI2cAddresses) { return false; }
+  niosI2cAddresses = roci2cs;
+  return true;
 }
 
 // ---------------- TEST FUNCTIONS ----------------------
 
+void hal::collectEvents(std::vector<Event*> &data, eventArena &events) {
+
+  nEventsRead += events.size();
+
+  // Fold the chunk into the condensed result right away if requested:
+  if(condenser != NULL) { condenser->Fill(events); }
+  else {
+    data.reserve(data.size() + events.size());
+    for(size_t i = 0; i < events.size(); i++) { data.push_back(new Event(events.GetEvent(i))); }
+  }
+
+  // Recycle the arena for the next readout cycle:
+  events.Clear();
+}
+
 std::vector<Event*> hal::MultiRocAllPixelsCalibrate(std::vector<uint8_t> rocids, std::vector<int32_t> parameter) {
 
-  uint32_t flags = static_cast<uint32_t>(parameter.at(0));
+  uint16_t flags = static_cast<uint16_t>(parameter.at(0));
   uint16_t nTriggers = static_cast<uint16_t>(parameter.at(1));
 
-  LOG(logDEBUGHAL) << "Expecting " << nTriggers*ROC_NUMROWS*ROC_NUMCOLS << " events.";
-  std::vector<Event*> data;
+  dummyLoop loop(dummy(this), rocids, flags, nTriggers);
+  LOG(logDEBUGHAL) << "Expecting " << loop.Expected() << " events.";
 
-  for(size_t i = 0; i < ROC_NUMCOLS; i++) {
-    for(size_t j = 0; j < ROC_NUMROWS; j++) {
-      for(size_t k = 0; k < nTriggers; k++) {
-	Event* evt = new Event();
-	for(std::vector<uint8_t>::iterator roc = rocids.begin(); roc != rocids.end(); ++roc) {
-	  // Introduce some address encoding issues:
-	  if((flags&FLAG_CHECK_ORDER) != 0 && i == 0 && j == 1) { evt->pixels.push_back(pixel(*roc,i,j+1,90)); } // PX 0,1 answers as PX 0,2
-	  else if((flags&FLAG_CHECK_ORDER) != 0 && i == 0 && j == 2) { } // PX 0,2 is dead
-	  else { evt->pixels.push_back(pixel(*roc,i,j,90)); }
-	}
-	data.push_back(evt);
-      }
-    }
+  nEventsRead = 0;
+  std::vector<Event*> data;
+  bool done = false;
+  while(!done) {
+    done = loop.Run(readoutEvents);
+    collectEvents(data,readoutEvents);
   }
 
-  LOG(logDEBUGHAL) << "Readout size: " << data.size() << " Events.";
+  LOG(logDEBUGHAL) << "Readout size: " << nEventsRead << " Events.";
   return data;
 }
 
 std::vector<Event*> hal::MultiRocOnePixelCalibrate(std::vector<uint8_t> rocids, uint8_t column, uint8_t row, std::vector<int32_t> parameter) {
 
-  // uint32_t flags = static_cast<uint32_t>(parameter.at(0));
+  uint16_t flags = static_cast<uint16_t>(parameter.at(0));
   uint16_t nTriggers = static_cast<uint16_t>(parameter.at(1));
 
-  LOG(logDEBUGHAL) << "Expecting " << nTriggers << " events.";
-  std::vector<Event*> data;
+  dummyLoop loop(dummy(this), rocids, flags, nTriggers);
+  loop.SetPixel(column, row);
+  LOG(logDEBUGHAL) << "Expecting " << loop.Expected() << " events.";
 
-  for(size_t k = 0; k < nTriggers; k++) {
-    Event* evt = new Event();
-    for(std::vector<uint8_t>::iterator roc = rocids.begin(); roc != rocids.end(); ++roc) {
-      evt->pixels.push_back(pixel(*roc,column,row,90));
-    }
-    data.push_back(evt);
+  nEventsRead = 0;
+  std::vector<Event*> data;
+  bool done = false;
+  while(!done) {
+    done = loop.Run(readoutEvents);
+    collectEvents(data,readoutEvents);
   }
 
-  LOG(logDEBUGHAL) << "Readout size: " << data.size() << " Events.";
-
+  LOG(logDEBUGHAL) << "Readout size: " << nEventsRead << " Events.";
   return data;
 }
 
 std::vector<Event*> hal::SingleRocAllPixelsCalibrate(uint8_t rocid, std::vector<int32_t> parameter) {
 
-  uint32_t flags = static_cast<uint32_t>(parameter.at(0));
+  uint16_t flags = static_cast<uint16_t>(parameter.at(0));
   uint16_t nTriggers = static_cast<uint16_t>(parameter.at(1));
 
-  LOG(logDEBUGHAL) << "Expecting " << nTriggers*ROC_NUMROWS*ROC_NUMCOLS << " events.";
-  std::vector<Event*> data;
+  dummyLoop loop(dummy(this), std::vector<uint8_t>(1,rocid), flags, nTriggers);
+  LOG(logDEBUGHAL) << "Expecting " << loop.Expected() << " events.";
 
-  // Initialize rand():
-  srand (time(NULL));
-    
-  for(size_t i = 0; i < ROC_NUMCOLS; i++) {
-    for(size_t j = 0; j < ROC_NUMROWS; j++) {
-      for(size_t k = 0; k < nTriggers; k++) {
-	Event* evt = new Event();
-	// Generate a slightly random pulse height between 90 and 100:
-	uint16_t pulseheight = rand() % 2 + 90;
-	// Introduce some address encoding issues:
-	if((flags&FLAG_CHECK_ORDER) != 0 && i == 0 && j == 1) { evt->pixels.push_back(pixel(rocid,i,j+1,pulseheight));} // PX 0,1 answers as PX 0,2
-	else if((flags&FLAG_CHECK_ORDER) != 0 && i == 0 && j == 2) { } // PX 0,2 is dead
-	else { evt->pixels.push_back(pixel(rocid,i,j,pulseheight)); }
-	data.push_back(evt);
-      }
-    }
+  nEventsRead = 0;
+  std::vector<Event*> data;
+  bool done = false;
+  while(!done) {
+    done = loop.Run(readoutEvents);
+    collectEvents(data,readoutEvents);
   }
 
-  LOG(logDEBUGHAL) << "Readout size: " << data.size() << " Events.";
-
+  LOG(logDEBUGHAL) << "Readout size: " << nEventsRead << " Events.";
   return data;
 }
 
 std::vector<Event*> hal::SingleRocOnePixelCalibrate(uint8_t rocid, uint8_t column, uint8_t row, std::vector<int32_t> parameter) {
 
-  // int32_t flags = parameter.at(0);
+  uint16_t flags = static_cast<uint16_t>(parameter.at(0));
   uint16_t nTriggers = static_cast<uint16_t>(parameter.at(1));
 
-  LOG(logDEBUGHAL) << "Expecting " << nTriggers << " events.";
-  std::vector<Event*> data;
+  dummyLoop loop(dummy(this), std::vector<uint8_t>(1,rocid), flags, nTriggers);
+  loop.SetPixel(column, row);
+  LOG(logDEBUGHAL) << "Expecting " << loop.Expected() << " events.";
 
-  for(size_t k = 0; k < nTriggers; k++) {
-    Event* evt = new Event();
-    evt->pixels.push_back(pixel(rocid,column,row,90));
-    data.push_back(evt);
+  nEventsRead = 0;
+  std::vector<Event*> data;
+  bool done = false;
+  while(!done) {
+    done = loop.Run(readoutEvents);
+    collectEvents(data,readoutEvents);
   }
 
-  LOG(logDEBUGHAL) << "Readout size: " << data.size() << " Events.";
-
+  LOG(logDEBUGHAL) << "Readout size: " << nEventsRead << " Events.";
   return data;
 }
 
 
 std::vector<Event*> hal::MultiRocAllPixelsDacScan(std::vector<uint8_t> rocids, std::vector<int32_t> parameter) {
 
+  uint8_t dacreg = static_cast<uint8_t>(parameter.at(0));
   uint8_t dacmin = static_cast<uint8_t>(parameter.at(1));
   uint8_t dacmax = static_cast<uint8_t>(parameter.at(2));
+  uint16_t flags = static_cast<uint16_t>(parameter.at(3));
   uint16_t nTriggers = static_cast<uint16_t>(parameter.at(4));
+  uint8_t dacstep = static_cast<uint8_t>(parameter.at(5));
 
-  LOG(logDEBUGHAL) << "Expecting " << static_cast<size_t>(dacmax-dacmin+1)*nTriggers*ROC_NUMROWS*ROC_NUMCOLS << " events.";
-  std::vector<Event*> data;
-
-  uint8_t dachalf = static_cast<uint8_t>(dacmax-dacmin)/2;
+  dummyLoop loop(dummy(this), rocids, flags, nTriggers);
+  loop.SetScan(0, dacreg, dacmin, dacmax, dacstep);
+  LOG(logDEBUGHAL) << "Expecting " << loop.Expected() << " events.";
 
-  for(size_t i = 0; i < ROC_NUMCOLS; i++) {
-    for(size_t j = 0; j < ROC_NUMROWS; j++) {
-      for(size_t dac = 0; dac < static_cast<uint8_t>(dacmax-dacmin+1); dac++) {
-	for(size_t k = 0; k < nTriggers; k++) {
-	  Event* evt = new Event();
-	  for(std::vector<uint8_t>::iterator roc = rocids.begin(); roc != rocids.end(); ++roc) {
-	    // Mimic some edge adt 50% of the DAC range:
-	    if(dac > dachalf) evt->pixels.push_back(pixel(*roc,i,j,90));
-	  }
-	  data.push_back(evt);
-	}
-      }
-    }
+  nEventsRead = 0;
+  std::vector<Event*> data;
+  bool done = false;
+  while(!done) {
+    done = loop.Run(readoutEvents);
+    collectEvents(data,readoutEvents);
   }
 
-  LOG(logDEBUGHAL) << "Readout size: " << data.size() << " Events.";
-
+  LOG(logDEBUGHAL) << "Readout size: " << nEventsRead << " Events.";
   return data;
 }
 
 std::vector<Event*> hal::MultiRocOnePixelDacScan(std::vector<uint8_t> rocids, uint8_t column, uint8_t row, std::vector<int32_t> parameter) {
 
+  uint8_t dacreg = static_cast<uint8_t>(parameter.at(0));
   uint8_t dacmin = static_cast<uint8_t>(parameter.at(1));
   uint8_t dacmax = static_cast<uint8_t>(parameter.at(2));
+  uint16_t flags = static_cast<uint16_t>(parameter.at(3));
   uint16_t nTriggers = static_cast<uint16_t>(parameter.at(4));
+  uint8_t dacstep = static_cast<uint8_t>(parameter.at(5));
 
-  LOG(logDEBUGHAL) << "Expecting " << static_cast<size_t>(dacmax-dacmin+1)*nTriggers << " events.";
-  std::vector<Event*> data;
-
-  uint8_t dachalf = static_cast<uint8_t>(dacmax-dacmin)/2;
+  dummyLoop loop(dummy(this), rocids, flags, nTriggers);
+  loop.SetPixel(column, row);
+  loop.SetScan(0, dacreg, dacmin, dacmax, dacstep);
+  LOG(logDEBUGHAL) << "Expecting " << loop.Expected() << " events.";
 
-  for(size_t dac = 0; dac < static_cast<uint8_t>(dacmax-dacmin+1); dac++) {
-    for(size_t k = 0; k < nTriggers; k++) {
-      Event* evt = new Event();
-      for(std::vector<uint8_t>::iterator roc = rocids.begin(); roc != rocids.end(); ++roc) {
-	// Mimic some edge adt 50% of the DAC range:
-	if(dac > dachalf) evt->pixels.push_back(pixel(*roc,column,row,90));
-      }
-      data.push_back(evt);
-    }
+  nEventsRead = 0;
+  std::vector<Event*> data;
+  bool done = false;
+  while(!done) {
+    done = loop.Run(readoutEvents);
+    collectEvents(data,readoutEvents);
   }
 
-  LOG(logDEBUGHAL) << "Readout size: " << data.size() << " Events.";
-
+  LOG(logDEBUGHAL) << "Readout size: " << nEventsRead << " Events.";
   return data;
 }
 
 std::vector<Event*> hal::SingleRocAllPixelsDacScan(uint8_t rocid, std::vector<int32_t> parameter) {
 
+  uint8_t dacreg = static_cast<uint8_t>(parameter.at(0));
   uint8_t dacmin = static_cast<uint8_t>(parameter.at(1));
   uint8_t dacmax = static_cast<uint8_t>(parameter.at(2));
+  uint16_t flags = static_cast<uint16_t>(parameter.at(3));
   uint16_t nTriggers = static_cast<uint16_t>(parameter.at(4));
+  uint8_t dacstep = static_cast<uint8_t>(parameter.at(5));
 
-  LOG(logDEBUGHAL) << "Expecting " << static_cast<size_t>(dacmax-dacmin+1)*nTriggers*ROC_NUMROWS*ROC_NUMCOLS << " events.";
-  std::vector<Event*> data;
-
-  uint8_t dachalf = static_cast<uint8_t>(dacmax-dacmin)/2;
+  dummyLoop loop(dummy(this), std::vector<uint8_t>(1,rocid), flags, nTriggers);
+  loop.SetScan(0, dacreg, dacmin, dacmax, dacstep);
+  LOG(logDEBUGHAL) << "Expecting " << loop.Expected() << " events.";
 
-  for(size_t i = 0; i < ROC_NUMCOLS; i++) {
-    for(size_t j = 0; j < ROC_NUMROWS; j++) {
-      for(size_t dac = 0; dac < static_cast<uint8_t>(dacmax-dacmin+1); dac++) {
-	for(size_t k = 0; k < nTriggers; k++) {
-	  Event* evt = new Event();
-	  // Mimic some edge adt 50% of the DAC range:
-	  if(dac > dachalf) evt->pixels.push_back(pixel(rocid,i,j,90));
-	  data.push_back(evt);
-	}
-      }
-    }
+  nEventsRead = 0;
+  std::vector<Event*> data;
+  bool done = false;
+  while(!done) {
+    done = loop.Run(readoutEvents);
+    collectEvents(data,readoutEvents);
   }
 
-  LOG(logDEBUGHAL) << "Readout size: " << data.size() << " Events.";
-
+  LOG(logDEBUGHAL) << "Readout size: " << nEventsRead << " Events.";
   return data;
 }
 
 std::vector<Event*> hal::SingleRocOnePixelDacScan(uint8_t rocid, uint8_t column, uint8_t row, std::vector<int32_t> parameter) {
 
+  uint8_t dacreg = static_cast<uint8_t>(parameter.at(0));
   uint8_t dacmin = static_cast<uint8_t>(parameter.at(1));
   uint8_t dacmax = static_cast<uint8_t>(parameter.at(2));
+  uint16_t flags = static_cast<uint16_t>(parameter.at(3));
   uint16_t nTriggers = static_cast<uint16_t>(parameter.at(4));
+  uint8_t dacstep = static_cast<uint8_t>(parameter.at(5));
 
-  LOG(logDEBUGHAL) << "Expecting " << static_cast<size_t>(dacmax-dacmin+1)*nTriggers << " events.";
-  std::vector<Event*> data;
-
-  uint8_t dachalf = static_cast<uint8_t>(dacmax-dacmin)/2;
+  dummyLoop loop(dummy(this), std::vector<uint8_t>(1,rocid), flags, nTriggers);
+  loop.SetPixel(column, row);
+  loop.SetScan(0, dacreg, dacmin, dacmax, dacstep);
+  LOG(logDEBUGHAL) << "Expecting " << loop.Expected() << " events.";
 
-  for(size_t dac = 0; dac < static_cast<uint8_t>(dacmax-dacmin+1); dac++) {
-    for(size_t k = 0; k < nTriggers; k++) {
-      Event* evt = new Event();
-      // Mimic some edge adt 50% of the DAC range:
-      if(dac > dachalf) evt->pixels.push_back(pixel(rocid,column,row,90));
-      data.push_back(evt);
-    }
+  nEventsRead = 0;
+  std::vector<Event*> data;
+  bool done = false;
+  while(!done) {
+    done = loop.Run(readoutEvents);
+    collectEvents(data,readoutEvents);
   }
 
-  LOG(logDEBUGHAL) << "Readout size: " << data.size() << " Events.";
-
+  LOG(logDEBUGHAL) << "Readout size: " << nEventsRead << " Events.";
   return data;
 }
 
 std::vector<Event*> hal::MultiRocAllPixelsDacDacScan(std::vector<uint8_t> rocids, std::vector<int32_t> parameter) {
 
+  uint8_t dac1reg = static_cast<uint8_t>(parameter.at(0));
   uint8_t dac1min = static_cast<uint8_t>(parameter.at(1));
   uint8_t dac1max = static_cast<uint8_t>(parameter.at(2));
+  uint8_t dac2reg = static_cast<uint8_t>(parameter.at(3));
   uint8_t dac2min = static_cast<uint8_t>(parameter.at(4));
   uint8_t dac2max = static_cast<uint8_t>(parameter.at(5));
+  uint16_t flags = static_cast<uint16_t>(parameter.at(6));
   uint16_t nTriggers = static_cast<uint16_t>(parameter.at(7));
+  uint8_t dac1step = static_cast<uint8_t>(parameter.at(8));
+  uint8_t dac2step = static_cast<uint8_t>(parameter.at(9));
 
-  LOG(logDEBUGHAL) << "Expecting " << static_cast<size_t>(dac2max-dac2min+1)*static_cast<size_t>(dac1max-dac1min+1)*nTriggers*ROC_NUMROWS*ROC_NUMCOLS << " events.";
-  std::vector<Event*> data;
+  dummyLoop loop(dummy(this), rocids, flags, nTriggers);
+  loop.SetScan(0, dac1reg, dac1min, dac1max, dac1step);
+  loop.SetScan(1, dac2reg, dac2min, dac2max, dac2step);
+  LOG(logDEBUGHAL) << "Expecting " << loop.Expected() << " events.";
 
-  // Create a working band:
-  uint8_t dacquat = static_cast<uint8_t>(dac1max-dac1min)/4;
-
-  for(size_t i = 0; i < ROC_NUMCOLS; i++) {
-    for(size_t j = 0; j < ROC_NUMROWS; j++) {
-      for(size_t dac1 = 0; dac1 < static_cast<uint8_t>(dac1max-dac1min+1); dac1++) {
-	for(size_t dac2 = 0; dac2 < static_cast<uint8_t>(dac2max-dac2min+1); dac2++) {
-	  for(size_t k = 0; k < nTriggers; k++) {
-	    Event* evt = new Event();
-	    for(std::vector<uint8_t>::iterator roc = rocids.begin(); roc != rocids.end(); ++roc) {
-	      // Mimic some working band of the two DACs:
-	      if(dac2 < static_cast<uint8_t>(dac1*1.2+dacquat) && dac2 > static_cast<uint8_t>(dac1*0.8-dacquat)) {
-		evt->pixels.push_back(pixel(*roc,i,j,90));
-	      }
-	    }
-	    data.push_back(evt);
-	  }
-	}
-      }
-    }
+  nEventsRead = 0;
+  std::vector<Event*> data;
+  bool done = false;
+  while(!done) {
+    done = loop.Run(readoutEvents);
+    collectEvents(data,readoutEvents);
   }
 
-  LOG(logDEBUGHAL) << "Readout size: " << data.size() << " Events.";
-
+  LOG(logDEBUGHAL) << "Readout size: " << nEventsRead << " Events.";
   return data;
 }
 
 std::vector<Event*> hal::MultiRocOnePixelDacDacScan(std::vector<uint8_t> rocids, uint8_t column, uint8_t row, std::vector<int32_t> parameter) {
 
+  uint8_t dac1reg = static_cast<uint8_t>(parameter.at(0));
   uint8_t dac1min = static_cast<uint8_t>(parameter.at(1));
   uint8_t dac1max = static_cast<uint8_t>(parameter.at(2));
+  uint8_t dac2reg = static_cast<uint8_t>(parameter.at(3));
   uint8_t dac2min = static_cast<uint8_t>(parameter.at(4));
   uint8_t dac2max = static_cast<uint8_t>(parameter.at(5));
+  uint16_t flags = static_cast<uint16_t>(parameter.at(6));
   uint16_t nTriggers = static_cast<uint16_t>(parameter.at(7));
+  uint8_t dac1step = static_cast<uint8_t>(parameter.at(8));
+  uint8_t dac2step = static_cast<uint8_t>(parameter.at(9));
 
-  LOG(logDEBUGHAL) << "Expecting " << static_cast<size_t>(dac2max-dac2min+1)*static_cast<size_t>(dac1max-dac1min+1)*nTriggers << " events.";
-  std::vector<Event*> data;
+  dummyLoop loop(dummy(this), rocids, flags, nTriggers);
+  loop.SetPixel(column, row);
+  loop.SetScan(0, dac1reg, dac1min, dac1max, dac1step);
+  loop.SetScan(1, dac2reg, dac2min, dac2max, dac2step);
+  LOG(logDEBUGHAL) << "Expecting " << loop.Expected() << " events.";
 
-  // Create a working band:
-  uint8_t dacquat = static_cast<uint8_t>(dac1max-dac1min)/4;
-
-  for(size_t dac1 = 0; dac1 < static_cast<uint8_t>(dac1max-dac1min+1); dac1++) {
-    for(size_t dac2 = 0; dac2 < static_cast<uint8_t>(dac2max-dac2min+1); dac2++) {
-      for(size_t k = 0; k < nTriggers; k++) {
-	Event* evt = new Event();
-	for(std::vector<uint8_t>::iterator roc = rocids.begin(); roc != rocids.end(); ++roc) {
-	  // Mimic some working band of the two DACs:
-	  if(dac2 < static_cast<uint8_t>(dac1*1.2+dacquat) && dac2 > static_cast<uint8_t>(dac1*0.8-dacquat)) {
-	    evt->pixels.push_back(pixel(*roc,column,row,90));
-	  }
-	}
-	data.push_back(evt);
-      }
-    }
+  nEventsRead = 0;
+  std::vector<Event*> data;
+  bool done = false;
+  while(!done) {
+    done = loop.Run(readoutEvents);
+    collectEvents(data,readoutEvents);
   }
 
-  LOG(logDEBUGHAL) << "Readout size: " << data.size() << " Events.";
-
+  LOG(logDEBUGHAL) << "Readout size: " << nEventsRead << " Events.";
   return data;
 }
 
 std::vector<Event*> hal::SingleRocAllPixelsDacDacScan(uint8_t rocid, std::vector<int32_t> parameter) {
 
+  uint8_t dac1reg = static_cast<uint8_t>(parameter.at(0));
   uint8_t dac1min = static_cast<uint8_t>(parameter.at(1));
   uint8_t dac1max = static_cast<uint8_t>(parameter.at(2));
+  uint8_t dac2reg = static_cast<uint8_t>(parameter.at(3));
   uint8_t dac2min = static_cast<uint8_t>(parameter.at(4));
   uint8_t dac2max = static_cast<uint8_t>(parameter.at(5));
+  uint16_t flags = static_cast<uint16_t>(parameter.at(6));
   uint16_t nTriggers = static_cast<uint16_t>(parameter.at(7));
+  uint8_t dac1step = static_cast<uint8_t>(parameter.at(8));
+  uint8_t dac2step = static_cast<uint8_t>(parameter.at(9));
 
-  LOG(logDEBUGHAL) << "Expecting " << static_cast<size_t>(dac2max-dac2min+1)*static_cast<size_t>(dac1max-dac1min+1)*nTriggers*ROC_NUMROWS*ROC_NUMCOLS << " events.";
-  std::vector<Event*> data;
+  dummyLoop loop(dummy(this), std::vector<uint8_t>(1,rocid), flags, nTriggers);
+  loop.SetScan(0, dac1reg, dac1min, dac1max, dac1step);
+  loop.SetScan(1, dac2reg, dac2min, dac2max, dac2step);
+  LOG(logDEBUGHAL) << "Expecting " << loop.Expected() << " events.";
 
-  // Create a working band:
-  uint8_t dacquat = static_cast<uint8_t>(dac1max-dac1min)/4;
-
-  for(size_t i = 0; i < ROC_NUMCOLS; i++) {
-    for(size_t j = 0; j < ROC_NUMROWS; j++) {
-      for(size_t dac1 = 0; dac1 < static_cast<uint8_t>(dac1max-dac1min+1); dac1++) {
-	for(size_t dac2 = 0; dac2 < static_cast<uint8_t>(dac2max-dac2min+1); dac2++) {
-	  for(size_t k = 0; k < nTriggers; k++) {
-	    Event* evt = new Event();
-	    // Mimic some working band of the two DACs:
-	    if(dac2 < static_cast<uint8_t>(dac1*1.2+dacquat) && dac2 > static_cast<uint8_t>(dac1*0.8-dacquat)) {
-	      evt->pixels.push_back(pixel(rocid,i,j,90));
-	    }
-	    data.push_back(evt);
-	  }
-	}
-      }
-    }
+  nEventsRead = 0;
+  std::vector<Event*> data;
+  bool done = false;
+  while(!done) {
+    done = loop.Run(readoutEvents);
+    collectEvents(data,readoutEvents);
   }
 
-  LOG(logDEBUGHAL) << "Readout size: " << data.size() << " Events.";
-
+  LOG(logDEBUGHAL) << "Readout size: " << nEventsRead << " Events.";
   return data;
 }
 
 std::vector<Event*> hal::SingleRocOnePixelDacDacScan(uint8_t rocid, uint8_t column, uint8_t row, std::vector<int32_t> parameter) {
 
+  uint8_t dac1reg = static_cast<uint8_t>(parameter.at(0));
   uint8_t dac1min = static_cast<uint8_t>(parameter.at(1));
   uint8_t dac1max = static_cast<uint8_t>(parameter.at(2));
+  uint8_t dac2reg = static_cast<uint8_t>(parameter.at(3));
   uint8_t dac2min = static_cast<uint8_t>(parameter.at(4));
   uint8_t dac2max = static_cast<uint8_t>(parameter.at(5));
+  uint16_t flags = static_cast<uint16_t>(parameter.at(6));
   uint16_t nTriggers = static_cast<uint16_t>(parameter.at(7));
+  uint8_t dac1step = static_cast<uint8_t>(parameter.at(8));
+  uint8_t dac2step = static_cast<uint8_t>(parameter.at(9));
 
-  LOG(logDEBUGHAL) << "Expecting " << static_cast<size_t>(dac2max-dac2min+1)*static_cast<size_t>(dac1max-dac1min+1)*nTriggers << " events.";
-  std::vector<Event*> data;
-
-  // Create a working band:
-  uint8_t dacquat = static_cast<uint8_t>(dac1max-dac1min)/4;
+  dummyLoop loop(dummy(this), std::vector<uint8_t>(1,rocid), flags, nTriggers);
+  loop.SetPixel(column, row);
+  loop.SetScan(0, dac1reg, dac1min, dac1max, dac1step);
+  loop.SetScan(1, dac2reg, dac2min, dac2max, dac2step);
+  LOG(logDEBUGHAL) << "Expecting " << loop.Expected() << " events.";
 
-  for(size_t dac1 = 0; dac1 < static_cast<uint8_t>(dac1max-dac1min+1); dac1++) {
-    for(size_t dac2 = 0; dac2 < static_cast<uint8_t>(dac2max-dac2min+1); dac2++) {
-      for(size_t k = 0; k < nTriggers; k++) {
-	Event* evt = new Event();
-	// Mimic some working band of the two DACs:
-	if(dac2 < static_cast<uint8_t>(dac1*1.2+dacquat) && dac2 > static_cast<uint8_t>(dac1*0.8-dacquat)) {
-	  evt->pixels.push_back(pixel(rocid,column,row,90));
-	}
-	data.push_back(evt);
-      }
-    }
+  nEventsRead = 0;
+  std::vector<Event*> data;
+  bool done = false;
+  while(!done) {
+    done = loop.Run(readoutEvents);
+    collectEvents(data,readoutEvents);
   }
 
-  LOG(logDEBUGHAL) << "Readout size: " << data.size() << " Events.";
-
+  LOG(logDEBUGHAL) << "Readout size: " << nEventsRead << " Events.";
   return data;
 }
 
@@ -520,7 +1072,7 @@ void hal::HVon() {
 
 void hal::HVoff() {
 }
- 
+
 void hal::Pon() {
   // Wait a little and let the power switch do its job:
   mDelay(300);
@@ -545,53 +1097,141 @@ void hal::SignalProbeA1(uint8_t /*signal*/) {
 void hal::SignalProbeA2(uint8_t /*signal*/) {
 }
 
+void hal::setRpcProfiling(bool /*enable*/) {
+}
+
+void hal::printRpcProfile() {
+  LOG(logINFO) << "No RPC calls to profile with the dummy HAL.";
+}
+
 void hal::SetClockSource(uint8_t src) {
 }
 
 void hal::SetClockStretch(uint8_t /*src*/, uint16_t /*delay*/, uint16_t /*width*/) {
 }
 
-void hal::daqStart(uint8_t /*deser160phase*/, uint8_t /*nTBMs*/, uint32_t /*buffersize*/) {}
+void hal::daqStart(uint8_t /*deser160phase*/, uint8_t tbmtype, uint32_t /*buffersize*/, bool /*readout*/) {
+
+  // All ROCs are read out through channel 0 of the simulated DTB:
+  daq(this).Start(tbmtype != 0x00, rocType);
+  daq(this) >> splitter0;
+}
 
 Event* hal::daqEvent() {
 
   Event* current_Event = new Event();
 
+  dataSink<Event*> Eventpump0;
+  splitter0 >> decoder0 >> Eventpump0;
+
+  try { *current_Event = *Eventpump0.Get(); }
+  catch (dsBufferEmpty &) { LOG(logDEBUGHAL) << "Finished readout."; }
+  catch (dataPipeException &e) { LOG(logERROR) << e.what(); }
+
   return current_Event;
 }
 
 std::vector<Event*> hal::daqAllEvents() {
 
+  daqAllEvents(readoutEvents);
+
   std::vector<Event*> evt;
+  evt.reserve(readoutEvents.size());
+  for(size_t i = 0; i < readoutEvents.size(); i++) { evt.push_back(new Event(readoutEvents.GetEvent(i))); }
+  readoutEvents.Clear();
+
   return evt;
 }
 
+void hal::daqAllEvents(eventArena & events) {
+
+  dataSink<Event*> Eventpump0;
+  splitter0 >> decoder0 >> Eventpump0;
+  decoder0.SetArena(&events);
+
+  try {
+    while(1) {
+      events.StartEvent();
+      Event* evt = Eventpump0.Get();
+      events.FinishEvent(evt->header, evt->trailer, evt->numDecoderErrors);
+    }
+  }
+  catch (dsBufferEmpty &) {
+    events.DiscardEvent();
+    LOG(logDEBUGHAL) << "Finished readout.";
+  }
+  catch (dataPipeException &e) {
+    events.DiscardEvent();
+    LOG(logERROR) << e.what();
+  }
+  decoder0.SetArena(NULL);
+}
+
 rawEvent* hal::daqRawEvent() {
 
   rawEvent* current_Event = new rawEvent();
+
+  dataSink<rawEvent*> rawpump0;
+  splitter0 >> rawpump0;
+
+  try { *current_Event = *rawpump0.Get(); }
+  catch (dsBufferEmpty &) { LOG(logDEBUGHAL) << "Finished readout."; }
+  catch (dataPipeException &e) { LOG(logERROR) << e.what(); }
+
   return current_Event;
 }
 
 std::vector<rawEvent*> hal::daqAllRawEvents() {
 
   std::vector<rawEvent*> raw;
+
+  dataSink<rawEvent*> rawpump0;
+  splitter0 >> rawpump0;
+
+  try { while(1) { raw.push_back(new rawEvent(*rawpump0.Get())); } }
+  catch (dsBufferEmpty &) { LOG(logDEBUGHAL) << "Finished readout."; }
+  catch (dataPipeException &e) { LOG(logERROR) << e.what(); }
+
   return raw;
 }
 
 std::vector<uint16_t> hal::daqBuffer() {
-  
+
   std::vector<uint16_t> raw;
+
+  dataSink<uint16_t> rawpump0;
+  daq(this) >> rawpump0;
+
+  try { while(1) { raw.push_back(rawpump0.Get()); } }
+  catch (dsBufferEmpty &) { LOG(logDEBUGHAL) << "Finished readout."; }
+
   return raw;
 }
 
-void hal::daqTrigger(uint32_t /*nTrig*/, uint16_t /*period*/) {}
+void hal::daqTrigger(uint32_t nTrig, uint16_t /*period*/) {
+  LOG(logDEBUGHAL) << "Triggering " << nTrig << "x";
+  daq(this).Trigger(nTrig);
+}
+
+void hal::daqTriggerLoop(uint16_t period) {
+  LOG(logDEBUGHAL) << "Trigger loop every " << period << " clock cycles started.";
+  daq(this).StartLoop(period);
+}
+
+void hal::daqTriggerLoopHalt() {
+  daq(this).StopLoop();
+}
 
-void hal::daqTriggerLoop(uint16_t /*period*/) {}
+uint32_t hal::daqBufferStatus() { return daq(this).GetSize(); }
 
-void hal::daqTriggerLoopHalt() {}
+uint32_t hal::daqHostBufferStatus() { return 0; }
 
-uint32_t hal::daqBufferStatus() { return 0; }
+void hal::daqStop() {
+  daq(this).Stop();
+}
 
-void hal::daqStop() {}
+void hal::daqClear() {
+  daq(this).Clear();
+}
 
-void hal::daqClear() {}
+void hal::daqRecord(std::string /*filename*/) {}
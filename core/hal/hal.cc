@@ -5,6 +5,7 @@
 #include "config.h"
 #include "constants.h"
 #include <fstream>
+#include <sstream>
 #include <algorithm>
 
 using namespace pxar;
@@ -16,7 +17,10 @@ hal::hal(std::string name) :
   _compatible(false),
   tbmtype(0x00),
   deser160phase(4),
-  rocType(0)
+  rocType(0),
+  condenser(NULL),
+  nEventsRead(0),
+  readoutRunning(false)
 {
 
   // Get a new CTestboard class instance:
@@ -67,6 +71,9 @@ hal::hal(std::string name) :
 
 hal::~hal() {
   // Shut down and close the testboard connection on destruction of HAL object:
+
+  // Make sure the DAQ readout thread is not accessing the testboard anymore:
+  daqStopReadout();
   
   // Turn High Voltage off:
   _testboard->HVoff();
@@ -255,6 +262,11 @@ void hal::initTBMCore(uint8_t type, std::map< uint8_t,uint8_t > regVector) {
   _testboard->mod_Addr(hubId);
   _testboard->Flush();
 
+  // The TBM state is unknown before programming, write all registers:
+  for(std::map< uint8_t,uint8_t >::iterator it = regVector.begin(); it != regVector.end(); ++it) {
+    tbmRegisterCache.erase(std::make_pair(hubId,it->first));
+  }
+
   // Program all registers according to the configuration data:
   LOG(logDEBUGHAL) << "Setting register vector for TBM Core "
 		   << ((regVector.begin()->first&0xF0) == 0xE0 ? "alpha" : "beta") << ".";
@@ -270,6 +282,11 @@ void hal::initROC(uint8_t roci2c, uint8_t type, std::map< uint8_t,uint8_t > dacV
   // FIXME
   rocType = type;
 
+  // The ROC state is unknown before programming, write all DACs:
+  for(std::map< uint8_t,uint8_t >::iterator it = dacVector.begin(); it != dacVector.end(); ++it) {
+    rocForgetDAC(std::vector<uint8_t>(1,roci2c),it->first);
+  }
+
   // Programm all DAC registers according to the configuration data:
   LOG(logDEBUGHAL) << "Setting DAC vector for ROC@I2C " << static_cast<int>(roci2c) << ".";
   rocSetDACs(roci2c,dacVector);
@@ -449,32 +466,67 @@ void hal::setTBvd(double VD) {
 }
 
 
-bool hal::rocSetDACs(uint8_t roci2c, std::map< uint8_t, uint8_t > dacPairs) {
+size_t hal::rocQueueDACs(uint8_t roci2c, const std::map< uint8_t, uint8_t > & dacPairs) {
 
-  // Make sure we are writing to the correct ROC by setting the I2C address:
-  _testboard->roc_I2cAddr(roci2c);
+  size_t queued = 0;
+  for(std::map< uint8_t,uint8_t >::const_iterator it = dacPairs.begin(); it != dacPairs.end(); ++it) {
+    std::pair<uint8_t,uint8_t> reg = std::make_pair(roci2c,it->first);
 
-  // Iterate over all DAC id/value pairs and set the DAC
-  for(std::map< uint8_t,uint8_t >::iterator it = dacPairs.begin(); it != dacPairs.end(); ++it) {
-    LOG(logDEBUGHAL) << "Set DAC" << static_cast<int>(it->first) << " to " << static_cast<int>(it->second);
+    // The ROC already holds this value, no need to write it again:
+    std::map< std::pair<uint8_t,uint8_t>, uint8_t >::iterator cached = rocRegisterCache.find(reg);
+    if(cached != rocRegisterCache.end() && cached->second == it->second) continue;
+
+    // Make sure we are writing to the correct ROC by setting the I2C address,
+    // only once for all DACs of this ROC:
+    if(queued == 0) { _testboard->roc_I2cAddr(roci2c); }
+
+    LOG(logDEBUGHAL) << "ROC@I2C " << static_cast<size_t>(roci2c) 
+		     << ": Set DAC" << static_cast<int>(it->first) << " to " << static_cast<int>(it->second);
     _testboard->roc_SetDAC(it->first,it->second);
+    rocRegisterCache[reg] = it->second;
+    queued++;
   }
+  return queued;
+}
 
-  // Send all queued commands to the testboard:
-  _testboard->Flush();
+void hal::rocForgetDAC(const std::vector<uint8_t> & roci2cs, uint8_t dacId) {
+  for(std::vector<uint8_t>::const_iterator it = roci2cs.begin(); it != roci2cs.end(); ++it) {
+    rocRegisterCache.erase(std::make_pair(*it,dacId));
+  }
+}
+
+bool hal::rocSetDACs(uint8_t roci2c, std::map< uint8_t, uint8_t > dacPairs) {
+
+  // Send all queued commands to the testboard, if any:
+  size_t queued = rocQueueDACs(roci2c,dacPairs);
+  if(queued > 0) { _testboard->Flush(); }
+
+  LOG(logDEBUGHAL) << "ROC@I2C " << static_cast<size_t>(roci2c) << ": "
+		   << queued << " of " << dacPairs.size() << " DACs written.";
   // Everything went all right:
   return true;
 }
 
-bool hal::rocSetDAC(uint8_t roci2c, uint8_t dacId, uint8_t dacValue) {
+bool hal::rocSetDACs(std::map< uint8_t, std::map< uint8_t, uint8_t > > rocDacs) {
 
-  // Make sure we are writing to the correct ROC by setting the I2C address:
-  _testboard->roc_I2cAddr(roci2c);
+  size_t queued = 0, requested = 0;
+  for(std::map< uint8_t, std::map< uint8_t,uint8_t > >::iterator it = rocDacs.begin(); it != rocDacs.end(); ++it) {
+    queued += rocQueueDACs(it->first,it->second);
+    requested += it->second.size();
+  }
 
-  LOG(logDEBUGHAL) << "ROC@I2C " << static_cast<size_t>(roci2c) 
-		   << ": Set DAC" << static_cast<int>(dacId) << " to " << static_cast<int>(dacValue);
-  _testboard->roc_SetDAC(dacId,dacValue);
-  _testboard->Flush();
+  // Send the commands for all ROCs in one go:
+  if(queued > 0) { _testboard->Flush(); }
+
+  LOG(logDEBUGHAL) << queued << " of " << requested << " DACs written on " << rocDacs.size() << " ROCs.";
+  return true;
+}
+
+bool hal::rocSetDAC(uint8_t roci2c, uint8_t dacId, uint8_t dacValue) {
+
+  std::map< uint8_t, uint8_t > dacPairs;
+  dacPairs[dacId] = dacValue;
+  if(rocQueueDACs(roci2c,dacPairs) > 0) { _testboard->Flush(); }
   return true;
 }
 
@@ -494,6 +546,11 @@ bool hal::tbmSetRegs(std::map< uint8_t, uint8_t > regPairs) {
 
 bool hal::tbmSetReg(uint8_t regId, uint8_t regValue) {
 
+  // The TBM already holds this value, no need to write it again:
+  std::pair<uint8_t,uint8_t> reg = std::make_pair(hubId,regId);
+  std::map< std::pair<uint8_t,uint8_t>, uint8_t >::iterator cached = tbmRegisterCache.find(reg);
+  if(cached != tbmRegisterCache.end() && cached->second == regValue) return true;
+
   // Make sure we are writing to the correct TBM by setting the module's hub id:
   _testboard->mod_Addr(hubId);
 
@@ -504,33 +561,35 @@ bool hal::tbmSetReg(uint8_t regId, uint8_t regValue) {
 
   // Set this register on the correct TBM core:
   _testboard->tbm_Set(regId,regValue);
+  tbmRegisterCache[reg] = regValue;
   return true;
 }
 
-void hal::SetupI2CValues(std::vector<uint8_t> roci2cs) {
+bool hal::SetupI2CValues(std::vector<uint8_t> roci2cs) {
+
+  // The NIOS storage already holds these addresses:
+  if(roci2cs == niosI2cAddresses) { return false; }
 
   LOG(logDEBUGHAL) << "Writing the following available I2C devices into NIOS storage:";
   LOG(logDEBUGHAL) << listVector(roci2cs);
 
   // Write all ROC I2C addresses to the NIOS storage:
   _testboard->SetI2CAddresses(roci2cs);
-
+  niosI2cAddresses = roci2cs;
+  return true;
 }
 
-void hal::SetupTrimValues(uint8_t roci2c, std::vector<pixelConfig> pixels) {
-
-  // Prepare the trim vector containing both mask bit and trim bits:
-  std::vector<uint8_t> trim;
+void hal::SetupTrimValues(uint8_t roci2c, const pixelStore & pixels) {
 
-  // Set the default to "masked" (everything >15 is interpreted as such):
-  for(size_t i = 0; i < ROC_NUMCOLS*ROC_NUMROWS; i++) { trim.push_back(20); }
+  // Prepare the trim vector containing both mask bit and trim bits, the
+  // pixel store uses the same column*ROC_NUMROWS + row ordering:
+  std::vector<uint8_t> trim(pixelStore::npixels);
 
-  // Write the information from the pixel configs:
-  for(std::vector<pixelConfig>::iterator pxIt = pixels.begin(); pxIt != pixels.end(); ++pxIt) {
-    size_t position = pxIt->column*ROC_NUMROWS + pxIt->row;
-    // trim values larger than 15 are interpreted as masked:
-    if(pxIt->mask) trim[position] = 20;
-    else trim[position] = pxIt->trim;
+  // Trim values larger than 15 are interpreted as masked, this is the
+  // default for pixels without configuration:
+  for(size_t i = 0; i < pixelStore::npixels; i++) {
+    if(!pixels.present(i) || pixels.masked(i)) trim[i] = 20;
+    else trim[i] = pixels.trim(i);
   }
 
   LOG(logDEBUGHAL) << "Updating NIOS trimming & masking configuration for ROC with I2C address " 
@@ -539,7 +598,13 @@ void hal::SetupTrimValues(uint8_t roci2c, std::vector<pixelConfig> pixels) {
   _testboard->SetTrimValues(roci2c,trim);
 }
 
-void hal::RocSetMask(uint8_t roci2c, bool mask, std::vector<pixelConfig> pixels) {
+void hal::RocSetMask(uint8_t roci2c, bool mask, const pixelStore & pixels) {
+
+  // Nothing changed on this ROC since it was last masked:
+  if(mask && rocsMasked.count(roci2c)) {
+    LOG(logDEBUGHAL) << "ROC@I2C " << static_cast<int>(roci2c) << " is fully masked already.";
+    return;
+  }
 
   _testboard->roc_I2cAddr(roci2c);
 
@@ -550,19 +615,16 @@ void hal::RocSetMask(uint8_t roci2c, bool mask, std::vector<pixelConfig> pixels)
 
     // Mask the PUC and detach all DC from their readout (both done on NIOS):
     _testboard->roc_Chip_Mask();
+    rocsMasked.insert(roci2c);
   }
   else {
     // Prepare configuration of the pixels, linearize vector:
-    std::vector<int16_t> trim;
-
-    // Set the default to "masked":
-    for(size_t i = 0; i < ROC_NUMCOLS*ROC_NUMROWS; i++) { trim.push_back(-1); }
-    
-    // Write the information from the pixel configs:
-    for(std::vector<pixelConfig>::iterator pxIt = pixels.begin(); pxIt != pixels.end(); ++pxIt) {
-      size_t position = pxIt->column*ROC_NUMROWS + pxIt->row;
-      if(pxIt->mask) trim[position] = -1;
-      else trim[position] = pxIt->trim;
+    std::vector<int16_t> trim(pixelStore::npixels);
+
+    // Write the information from the pixel configs, the default is "masked":
+    for(size_t i = 0; i < pixelStore::npixels; i++) {
+      if(!pixels.present(i) || pixels.masked(i)) trim[i] = -1;
+      else trim[i] = pixels.trim(i);
     }
 
     // We really want to program that full thing with correct mask/trim bits:
@@ -570,6 +632,7 @@ void hal::RocSetMask(uint8_t roci2c, bool mask, std::vector<pixelConfig> pixels)
 
     // Trim the whole ROC:
     _testboard->TrimChip(trim);
+    rocsMasked.erase(roci2c);
   }
 }
 
@@ -624,6 +687,21 @@ void hal::estimateDataVolume(uint32_t events, uint8_t nROCs, uint8_t tbmtype) {
 
 // ---------------- TEST FUNCTIONS ----------------------
 
+void hal::collectEvents(std::vector<Event*> &data, eventArena &events) {
+
+  nEventsRead += events.size();
+
+  // Fold the chunk into the condensed result right away if requested:
+  if(condenser != NULL) { condenser->Fill(events); }
+  else {
+    data.reserve(data.size() + events.size());
+    for(size_t i = 0; i < events.size(); i++) { data.push_back(new Event(events.GetEvent(i))); }
+  }
+
+  // Recycle the arena for the next readout cycle:
+  events.Clear();
+}
+
 std::vector<Event*> hal::MultiRocAllPixelsCalibrate(std::vector<uint8_t> roci2cs, std::vector<int32_t> parameter) {
 
   uint16_t flags = static_cast<uint16_t>(parameter.at(0));
@@ -638,6 +716,9 @@ std::vector<Event*> hal::MultiRocAllPixelsCalibrate(std::vector<uint8_t> roci2cs
   LOG(logDEBUGHAL) << "Expecting " << expected << " events.";
   estimateDataVolume(expected, roci2cs.size(), tbmtype);
 
+  // The loop trims and unmasks the pixels of its ROCs:
+  for(std::vector<uint8_t>::iterator it = roci2cs.begin(); it != roci2cs.end(); ++it) { rocsMasked.erase(*it); }
+
   // Prepare for data acquisition:
   daqStart(deser160phase,tbmtype);
   timer t;
@@ -645,25 +726,19 @@ std::vector<Event*> hal::MultiRocAllPixelsCalibrate(std::vector<uint8_t> roci2cs
   // Call the RPC command containing the trigger loop:
   bool done = false;
   std::vector<Event*> data = std::vector<Event*>();
-  std::vector<Event*> tmpdata = std::vector<Event*>();
   while(!done) {
-    // Delete previously read events:
-    tmpdata.clear();
-
     done = _testboard->LoopMultiRocAllPixelsCalibrate(roci2cs, nTriggers, flags);
     LOG(logDEBUGHAL) << "Loop " << (done ? "finished" : "interrupted") << " (" << t << "ms), reading " << daqBufferStatus() << " words...";
-    tmpdata = daqAllEvents();
-    LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
-    data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+    loopPipelineNext(data,done);
   }
-  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << nEventsRead << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
   daqStop();
   daqClear();
 
   // check for missing events
-  int missing = expected - data.size();
+  int missing = expected - nEventsRead;
   if(missing != 0) { 
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -690,6 +765,9 @@ std::vector<Event*> hal::MultiRocOnePixelCalibrate(std::vector<uint8_t> roci2cs,
   LOG(logDEBUGHAL) << "Expecting " << nTriggers << " events.";
   estimateDataVolume(nTriggers, roci2cs.size(), tbmtype);
 
+  // The loop trims and unmasks the pixels of its ROCs:
+  for(std::vector<uint8_t>::iterator it = roci2cs.begin(); it != roci2cs.end(); ++it) { rocsMasked.erase(*it); }
+
   // Prepare for data acquisition:
   daqStart(deser160phase,tbmtype);
   timer t;
@@ -697,25 +775,19 @@ std::vector<Event*> hal::MultiRocOnePixelCalibrate(std::vector<uint8_t> roci2cs,
   // Call the RPC command containing the trigger loop:
   bool done = false;
   std::vector<Event*> data = std::vector<Event*>();
-  std::vector<Event*> tmpdata = std::vector<Event*>();
   while(!done) {
-    // Delete previously read events:
-    tmpdata.clear();
-
     done = _testboard->LoopMultiRocOnePixelCalibrate(roci2cs, column, row, nTriggers, flags);
     LOG(logDEBUGHAL) << "Loop " << (done ? "finished" : "interrupted") << " (" << t << "ms), reading " << daqBufferStatus() << " words...";
-    tmpdata = daqAllEvents();
-    LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
-    data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+    loopPipelineNext(data,done);
   }
-  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << nEventsRead << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
   daqStop();
   daqClear();
 
   // We expect one Event per trigger, all ROCs are triggered in parallel:
-  int missing = nTriggers - data.size();
+  int missing = nTriggers - nEventsRead;
   if(missing != 0) { 
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events."; 
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -741,6 +813,9 @@ std::vector<Event*> hal::SingleRocAllPixelsCalibrate(uint8_t roci2c, std::vector
   LOG(logDEBUGHAL) << "Expecting " << expected << " events.";
   estimateDataVolume(expected, 1, tbmtype);
 
+  // The loop trims and unmasks the pixels of its ROCs:
+  rocsMasked.erase(roci2c);
+
   // Prepare for data acquisition:
   daqStart(deser160phase,tbmtype);
   timer t;
@@ -748,28 +823,19 @@ std::vector<Event*> hal::SingleRocAllPixelsCalibrate(uint8_t roci2c, std::vector
   // Call the RPC command containing the trigger loop:
   bool done = false;
   std::vector<Event*> data = std::vector<Event*>();
-  std::vector<Event*> tmpdata = std::vector<Event*>();
   while(!done) {
-    // Delete previously read events:
-    tmpdata.clear();
-
     done = _testboard->LoopSingleRocAllPixelsCalibrate(roci2c, nTriggers, flags);
-    uint32_t words = daqBufferStatus();
-    LOG(logDEBUGHAL) << "Loop " << (done ? "finished" : "interrupted") << " (" << t << "ms), reading " << words << " words...";
-    timer t2;
-    tmpdata = daqAllEvents();
-    LOG(logDEBUGHAL) << "USB transfer speed: " << static_cast<double>(words)*2000/(1024*1024)/t2.get() << "MB/s";
-    LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
-    data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+    LOG(logDEBUGHAL) << "Loop " << (done ? "finished" : "interrupted") << " (" << t << "ms), reading " << daqBufferStatus() << " words...";
+    loopPipelineNext(data,done);
   }
-  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << nEventsRead << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
   daqStop();
   daqClear();
 
   // check for missing events
-  int missing = expected - data.size();
+  int missing = expected - nEventsRead;
   if(missing != 0) { 
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -794,6 +860,9 @@ std::vector<Event*> hal::SingleRocOnePixelCalibrate(uint8_t roci2c, uint8_t colu
   LOG(logDEBUGHAL) << "Expecting " << nTriggers << " events.";
   estimateDataVolume(nTriggers, 1, tbmtype);
 
+  // The loop trims and unmasks the pixels of its ROCs:
+  rocsMasked.erase(roci2c);
+
  // Prepare for data acquisition:
   daqStart(deser160phase,tbmtype);
   timer t;
@@ -801,25 +870,19 @@ std::vector<Event*> hal::SingleRocOnePixelCalibrate(uint8_t roci2c, uint8_t colu
   // Call the RPC command containing the trigger loop:
   bool done = false;
   std::vector<Event*> data = std::vector<Event*>();
-  std::vector<Event*> tmpdata = std::vector<Event*>();
   while(!done) {
-    // Delete previously read events:
-    tmpdata.clear();
-
     done = _testboard->LoopSingleRocOnePixelCalibrate(roci2c, column, row, nTriggers, flags);
     LOG(logDEBUGHAL) << "Loop " << (done ? "finished" : "interrupted") << " (" << t << "ms), reading " << daqBufferStatus() << " words...";
-    tmpdata = daqAllEvents();
-    LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
-    data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+    loopPipelineNext(data,done);
   }
-  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << nEventsRead << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
   daqStop();
   daqClear();
 
   // We are expecting one Event per trigger:
-  int missing = nTriggers - data.size();
+  int missing = nTriggers - nEventsRead;
   if(missing != 0) { 
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -856,6 +919,12 @@ std::vector<Event*> hal::MultiRocAllPixelsDacScan(std::vector<uint8_t> roci2cs,
   LOG(logDEBUGHAL) << "Expecting " << expected << " events.";
   estimateDataVolume(expected, roci2cs.size(), tbmtype);
 
+  // The loop leaves the scanned DAC at the last scan value:
+  rocForgetDAC(roci2cs,dacreg);
+
+  // The loop trims and unmasks the pixels of its ROCs:
+  for(std::vector<uint8_t>::iterator it = roci2cs.begin(); it != roci2cs.end(); ++it) { rocsMasked.erase(*it); }
+
  // Prepare for data acquisition:
   daqStart(deser160phase,tbmtype);
   timer t;
@@ -863,25 +932,19 @@ std::vector<Event*> hal::MultiRocAllPixelsDacScan(std::vector<uint8_t> roci2cs,
   // Call the RPC command containing the trigger loop:
   bool done = false;
   std::vector<Event*> data = std::vector<Event*>();
-  std::vector<Event*> tmpdata = std::vector<Event*>();
   while(!done) {
-    // Delete previously read events:
-    tmpdata.clear();
-
     done = _testboard->LoopMultiRocAllPixelsDacScan(roci2cs, nTriggers, flags, dacreg, dacstep, dacmin, dacmax);
     LOG(logDEBUGHAL) << "Loop " << (done ? "finished" : "interrupted") << " (" << t << "ms), reading " << daqBufferStatus() << " words...";
-    tmpdata = daqAllEvents();
-    LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
-    data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+    loopPipelineNext(data,done);
   }
-  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << nEventsRead << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
   daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected - data.size();
+  int missing = expected - nEventsRead;
   if(missing != 0) { 
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -919,6 +982,12 @@ std::vector<Event*> hal::MultiRocOnePixelDacScan(std::vector<uint8_t> roci2cs, u
   LOG(logDEBUGHAL) << "Expecting " << expected << " events.";
   estimateDataVolume(expected, roci2cs.size(), tbmtype);
 
+  // The loop leaves the scanned DAC at the last scan value:
+  rocForgetDAC(roci2cs,dacreg);
+
+  // The loop trims and unmasks the pixels of its ROCs:
+  for(std::vector<uint8_t>::iterator it = roci2cs.begin(); it != roci2cs.end(); ++it) { rocsMasked.erase(*it); }
+
  // Prepare for data acquisition:
   daqStart(deser160phase,tbmtype);
   timer t;
@@ -926,25 +995,19 @@ std::vector<Event*> hal::MultiRocOnePixelDacScan(std::vector<uint8_t> roci2cs, u
   // Call the RPC command containing the trigger loop:
   bool done = false;
   std::vector<Event*> data = std::vector<Event*>();
-  std::vector<Event*> tmpdata = std::vector<Event*>();
   while(!done) {
-    // Delete previously read events:
-    tmpdata.clear();
-
     done = _testboard->LoopMultiRocOnePixelDacScan(roci2cs, column, row, nTriggers, flags, dacreg, dacstep, dacmin, dacmax);
     LOG(logDEBUGHAL) << "Loop " << (done ? "finished" : "interrupted") << " (" << t << "ms), reading " << daqBufferStatus() << " words...";
-    tmpdata = daqAllEvents();
-    LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
-    data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+    loopPipelineNext(data,done);
   }
-  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << nEventsRead << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
   daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected - data.size();
+  int missing = expected - nEventsRead;
   if(missing != 0) { 
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -978,6 +1041,12 @@ std::vector<Event*> hal::SingleRocAllPixelsDacScan(uint8_t roci2c, std::vector<i
   LOG(logDEBUGHAL) << "Expecting " << expected << " events.";
   estimateDataVolume(expected, 1, tbmtype);
 
+  // The loop leaves the scanned DAC at the last scan value:
+  rocForgetDAC(std::vector<uint8_t>(1,roci2c),dacreg);
+
+  // The loop trims and unmasks the pixels of its ROCs:
+  rocsMasked.erase(roci2c);
+
  // Prepare for data acquisition:
   daqStart(deser160phase,tbmtype);
   timer t;
@@ -985,25 +1054,19 @@ std::vector<Event*> hal::SingleRocAllPixelsDacScan(uint8_t roci2c, std::vector<i
   // Call the RPC command containing the trigger loop:
   bool done = false;
   std::vector<Event*> data = std::vector<Event*>();
-  std::vector<Event*> tmpdata = std::vector<Event*>();
   while(!done) {
-    // Delete previously read events:
-    tmpdata.clear();
-
     done = _testboard->LoopSingleRocAllPixelsDacScan(roci2c, nTriggers, flags, dacreg, dacstep, dacmin, dacmax);
     LOG(logDEBUGHAL) << "Loop " << (done ? "finished" : "interrupted") << " (" << t << "ms), reading " << daqBufferStatus() << " words...";
-    tmpdata = daqAllEvents();
-    LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
-    data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+    loopPipelineNext(data,done);
   }
-  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << nEventsRead << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
   daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected - data.size();
+  int missing = expected - nEventsRead;
   if(missing != 0) { 
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -1037,6 +1100,12 @@ std::vector<Event*> hal::SingleRocOnePixelDacScan(uint8_t roci2c, uint8_t column
   LOG(logDEBUGHAL) << "Expecting " << expected << " events.";
   estimateDataVolume(expected, 1, tbmtype);
 
+  // The loop leaves the scanned DAC at the last scan value:
+  rocForgetDAC(std::vector<uint8_t>(1,roci2c),dacreg);
+
+  // The loop trims and unmasks the pixels of its ROCs:
+  rocsMasked.erase(roci2c);
+
   // Prepare for data acquisition:
   daqStart(deser160phase,tbmtype);
   timer t;
@@ -1044,25 +1113,19 @@ std::vector<Event*> hal::SingleRocOnePixelDacScan(uint8_t roci2c, uint8_t column
   // Call the RPC command containing the trigger loop:
   bool done = false;
   std::vector<Event*> data = std::vector<Event*>();
-  std::vector<Event*> tmpdata = std::vector<Event*>();
   while(!done) {
-    // Delete previously read events:
-    tmpdata.clear();
-
     done = _testboard->LoopSingleRocOnePixelDacScan(roci2c, column, row, nTriggers, flags, dacreg, dacstep, dacmin, dacmax);
     LOG(logDEBUGHAL) << "Loop " << (done ? "finished" : "interrupted") << " (" << t << "ms), reading " << daqBufferStatus() << " words...";
-    tmpdata = daqAllEvents();
-    LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
-    data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+    loopPipelineNext(data,done);
   }
-  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << nEventsRead << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
   daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected - data.size();
+  int missing = expected - nEventsRead;
   if(missing != 0) { 
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -1106,6 +1169,13 @@ std::vector<Event*> hal::MultiRocAllPixelsDacDacScan(std::vector<uint8_t> roci2c
   LOG(logDEBUGHAL) << "Expecting " << expected << " events.";
   estimateDataVolume(expected, roci2cs.size(), tbmtype);
 
+  // The loop leaves the scanned DACs at the last scan value:
+  rocForgetDAC(roci2cs,dac1reg);
+  rocForgetDAC(roci2cs,dac2reg);
+
+  // The loop trims and unmasks the pixels of its ROCs:
+  for(std::vector<uint8_t>::iterator it = roci2cs.begin(); it != roci2cs.end(); ++it) { rocsMasked.erase(*it); }
+
   // Prepare for data acquisition:
   daqStart(deser160phase,tbmtype);
   timer t;
@@ -1113,25 +1183,19 @@ std::vector<Event*> hal::MultiRocAllPixelsDacDacScan(std::vector<uint8_t> roci2c
   // Call the RPC command containing the trigger loop:
   bool done = false;
   std::vector<Event*> data = std::vector<Event*>();
-  std::vector<Event*> tmpdata = std::vector<Event*>();
   while(!done) {
-    // Delete previously read events:
-    tmpdata.clear();
-
     done = _testboard->LoopMultiRocAllPixelsDacDacScan(roci2cs, nTriggers, flags, dac1reg, dac1step, dac1min, dac1max, dac2reg, dac2step, dac2min, dac2max);
     LOG(logDEBUGHAL) << "Loop " << (done ? "finished" : "interrupted") << " (" << t << "ms), reading " << daqBufferStatus() << " words...";
-    tmpdata = daqAllEvents();
-    LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
-    data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+    loopPipelineNext(data,done);
   }
-  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << nEventsRead << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
   daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected - data.size();
+  int missing = expected - nEventsRead;
   if(missing != 0) { 
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -1178,6 +1242,13 @@ std::vector<Event*> hal::MultiRocOnePixelDacDacScan(std::vector<uint8_t> roci2cs
   LOG(logDEBUGHAL) << "Expecting " << expected << " events.";
   estimateDataVolume(expected, roci2cs.size(), tbmtype);
 
+  // The loop leaves the scanned DACs at the last scan value:
+  rocForgetDAC(roci2cs,dac1reg);
+  rocForgetDAC(roci2cs,dac2reg);
+
+  // The loop trims and unmasks the pixels of its ROCs:
+  for(std::vector<uint8_t>::iterator it = roci2cs.begin(); it != roci2cs.end(); ++it) { rocsMasked.erase(*it); }
+
   // Prepare for data acquisition:
   daqStart(deser160phase,tbmtype);
   timer t;
@@ -1185,25 +1256,19 @@ std::vector<Event*> hal::MultiRocOnePixelDacDacScan(std::vector<uint8_t> roci2cs
   // Call the RPC command containing the trigger loop:
   bool done = false;
   std::vector<Event*> data = std::vector<Event*>();
-  std::vector<Event*> tmpdata = std::vector<Event*>();
   while(!done) {
-    // Delete previously read events:
-    tmpdata.clear();
-
     done = _testboard->LoopMultiRocOnePixelDacDacScan(roci2cs, column, row, nTriggers, flags, dac1reg, dac1step, dac1min, dac1max, dac2reg, dac2step, dac2min, dac2max);
     LOG(logDEBUGHAL) << "Loop " << (done ? "finished" : "interrupted") << " (" << t << "ms), reading " << daqBufferStatus() << " words...";
-    tmpdata = daqAllEvents();
-    LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
-    data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+    loopPipelineNext(data,done);
   }
-  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << nEventsRead << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
   daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected - data.size();
+  int missing = expected - nEventsRead;
   if(missing != 0) { 
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -1246,6 +1311,13 @@ std::vector<Event*> hal::SingleRocAllPixelsDacDacScan(uint8_t roci2c, std::vecto
   LOG(logDEBUGHAL) << "Expecting " << expected << " events.";
   estimateDataVolume(expected, 1, tbmtype);
 
+  // The loop leaves the scanned DACs at the last scan value:
+  rocForgetDAC(std::vector<uint8_t>(1,roci2c),dac1reg);
+  rocForgetDAC(std::vector<uint8_t>(1,roci2c),dac2reg);
+
+  // The loop trims and unmasks the pixels of its ROCs:
+  rocsMasked.erase(roci2c);
+
   // Prepare for data acquisition:
   daqStart(deser160phase,tbmtype);
   timer t;
@@ -1253,25 +1325,19 @@ std::vector<Event*> hal::SingleRocAllPixelsDacDacScan(uint8_t roci2c, std::vecto
   // Call the RPC command containing the trigger loop:
   bool done = false;
   std::vector<Event*> data = std::vector<Event*>();
-  std::vector<Event*> tmpdata = std::vector<Event*>();
   while(!done) {
-    // Delete previously read events:
-    tmpdata.clear();
-
     done = _testboard->LoopSingleRocAllPixelsDacDacScan(roci2c, nTriggers, flags, dac1reg, dac1step, dac1min, dac1max, dac2reg, dac2step, dac2min, dac2max);
     LOG(logDEBUGHAL) << "Loop " << (done ? "finished" : "interrupted") << " (" << t << "ms), reading " << daqBufferStatus() << " words...";
-    tmpdata = daqAllEvents();
-    LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
-    data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+    loopPipelineNext(data,done);
   }
-  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << nEventsRead << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
   daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected - data.size();
+  int missing = expected - nEventsRead;
   if(missing != 0) { 
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -1314,6 +1380,13 @@ std::vector<Event*> hal::SingleRocOnePixelDacDacScan(uint8_t roci2c, uint8_t col
   LOG(logDEBUGHAL) << "Expecting " << expected << " events.";
   estimateDataVolume(expected, 1, tbmtype);
 
+  // The loop leaves the scanned DACs at the last scan value:
+  rocForgetDAC(std::vector<uint8_t>(1,roci2c),dac1reg);
+  rocForgetDAC(std::vector<uint8_t>(1,roci2c),dac2reg);
+
+  // The loop trims and unmasks the pixels of its ROCs:
+  rocsMasked.erase(roci2c);
+
   // Prepare for data acquisition:
   daqStart(deser160phase,tbmtype);
   timer t;
@@ -1321,25 +1394,19 @@ std::vector<Event*> hal::SingleRocOnePixelDacDacScan(uint8_t roci2c, uint8_t col
   // Call the RPC command containing the trigger loop:
   bool done = false;
   std::vector<Event*> data = std::vector<Event*>();
-  std::vector<Event*> tmpdata = std::vector<Event*>();
   while(!done) {
-    // Delete previously read events:
-    tmpdata.clear();
-
     done = _testboard->LoopSingleRocOnePixelDacDacScan(roci2c, column, row, nTriggers, flags, dac1reg, dac1step, dac1min, dac1max, dac2reg, dac2step, dac2min, dac2max);
     LOG(logDEBUGHAL) << "Loop " << (done ? "finished" : "interrupted") << " (" << t << "ms), reading " << daqBufferStatus() << " words...";
-    tmpdata = daqAllEvents();
-    LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
-    data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+    loopPipelineNext(data,done);
   }
-  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << nEventsRead << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
   daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
-  int missing = expected - data.size();
+  int missing = expected - nEventsRead;
   if(missing != 0) { 
     LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
     // serious runtime issue as data is invalid and cannot be recovered at this point:
@@ -1377,6 +1444,11 @@ void hal::Pon() {
   _testboard->Pon();
   _testboard->Flush();
 
+  // All chips come up with their power-on register values:
+  rocRegisterCache.clear();
+  tbmRegisterCache.clear();
+  rocsMasked.clear();
+
   // Wait a little and let the power switch do its job:
   mDelay(300);
 }
@@ -1385,6 +1457,11 @@ void hal::Poff() {
   // Turn off DUT power and execute (flush):
   _testboard->Poff();
   _testboard->Flush();
+
+  // Register contents are lost:
+  rocRegisterCache.clear();
+  tbmRegisterCache.clear();
+  rocsMasked.clear();
 }
 
 
@@ -1415,6 +1492,18 @@ void hal::SignalProbeA2(uint8_t signal) {
   _testboard->Flush();
 }
 
+void hal::setRpcProfiling(bool enable) {
+  LOG(logDEBUGHAL) << "Switching RPC profiling " << (enable ? "on" : "off") << ".";
+  _testboard->SetProfiling(enable);
+}
+
+void hal::printRpcProfile() {
+  if(!_testboard->IsProfiling()) {
+    LOG(logWARNING) << "RPC profiling is switched off, profile may be incomplete.";
+  }
+  _testboard->PrintProfile();
+}
+
 void hal::SetClockSource(uint8_t src) {
 	_testboard->SetClockSource(src);
 	_testboard->uDelay(100);
@@ -1429,9 +1518,16 @@ void hal::SetClockStretch(uint8_t src, uint16_t delay, uint16_t width) {
 }
 
 
-void hal::daqStart(uint8_t deser160phase, uint8_t tbmtype, uint32_t buffersize) {
+void hal::daqStart(uint8_t deser160phase, uint8_t tbmtype, uint32_t buffersize, bool readout) {
 
   LOG(logDEBUGHAL) << "Starting new DAQ session.";
+  nEventsRead = 0;
+
+  // A test function might have left with an exception while decoding:
+  loopPipelineStop();
+
+  // Test loops and triggers may leave pixels unmasked:
+  rocsMasked.clear();
 
   // Split the total buffer size when having more than one channel
   if(tbmtype != 0x00) { buffersize /= (tbmtype == TBM_09 ? 4 : 2); }
@@ -1490,6 +1586,224 @@ void hal::daqStart(uint8_t deser160phase, uint8_t tbmtype, uint32_t buffersize)
   _testboard->Daq_Start(0);
   _testboard->uDelay(100);
   _testboard->Flush();
+
+  // Attach the raw data recorders, files stay open across DAQ sessions:
+  if(!recordFile.empty()) {
+    dtbSource * sources[4] = {&src0, &src1, &src2, &src3};
+    for(uint8_t channel = 0; channel < 4; channel++) {
+      if(!sources[channel]->isConnected()) continue;
+      if(!recorder[channel].IsOpen()) {
+	std::stringstream name;
+	name << recordFile << "_ch" << static_cast<int>(channel) << ".dat";
+	recorder[channel].Open(name.str(), channel, (tbmtype != 0x00), rocType);
+      }
+      if(recorder[channel].IsOpen()) { sources[channel]->SetRecorder(&recorder[channel]); }
+    }
+  }
+
+  if(readout) {
+    // Prepare the host buffers for all open channels and hook them into the pipes:
+    dtbSource * sources[4] = {&src0, &src1, &src2, &src3};
+    for(uint8_t channel = 0; channel < 4; channel++) {
+      if(!sources[channel]->isConnected()) continue;
+      hostbuffer[channel].Reset(tbmtype != 0x00);
+      hostbuffer[channel].SetActive(true);
+      sources[channel]->SetHostBuffer(&hostbuffer[channel]);
+    }
+
+    readoutRunning = true;
+    readoutLog.Capture();
+    if(readoutThread.start(&hal::daqReadoutThread, this)) {
+      LOG(logDEBUGHAL) << "Started background DAQ readout thread.";
+    }
+    else {
+      LOG(logERROR) << "Could not start DAQ readout thread, falling back to direct readout.";
+      readoutRunning = false;
+      for(uint8_t channel = 0; channel < 4; channel++) { hostbuffer[channel].SetActive(false); }
+    }
+  }
+}
+
+void hal::daqReadoutThread(void * instance) {
+  static_cast<hal*>(instance)->readoutLog.Apply();
+  static_cast<hal*>(instance)->daqReadoutLoop();
+}
+
+void hal::daqReadoutLoop() {
+
+  dtbSource * sources[4] = {&src0, &src1, &src2, &src3};
+  std::vector<uint16_t> block;
+  bool overflow = false;
+
+  try {
+    while(readoutRunning) {
+      bool idle = true;
+      uint32_t complete = 0xffffffff;
+
+      for(uint8_t channel = 0; channel < 4; channel++) {
+	if(!sources[channel]->isConnected()) continue;
+
+	// Leave the data in the DTB RAM if the host buffer cannot take a full block:
+	if(hostbuffer[channel].GetFreeSize() >= DTB_SOURCE_BLOCK_SIZE) {
+	  uint32_t remaining = 0;
+	  uint8_t state = _testboard->Daq_Read(block, DTB_SOURCE_BLOCK_SIZE, remaining, channel);
+	  if(state && !overflow) {
+	    LOG(logERROR) << "DAQ overflow on channel " << static_cast<int>(channel)
+			  << " (state " << static_cast<int>(state) << "), data might be lost.";
+	    overflow = true;
+	  }
+	  if(!block.empty()) {
+	    hostbuffer[channel].Write(block);
+	    recorder[channel].Write(block);
+	    idle = false;
+	  }
+	  if(remaining > 0) { idle = false; }
+	}
+	complete = std::min(complete, hostbuffer[channel].GetPendingEvents());
+      }
+
+      // Only hand out Events that have been fully read on every channel:
+      for(uint8_t channel = 0; channel < 4; channel++) {
+	if(sources[channel]->isConnected()) { hostbuffer[channel].Commit(complete); }
+      }
+
+      // Nothing to do, don't hog the USB connection:
+      if(idle) { mDelay(1); }
+    }
+  }
+  catch(CRpcError &e) {
+    LOG(logCRITICAL) << "DAQ readout thread terminated by RPC error:";
+    e.What();
+  }
+  catch(dataPipeException &e) {
+    LOG(logCRITICAL) << "DAQ readout thread terminated: " << e.what();
+  }
+  readoutRunning = false;
+}
+
+void hal::daqStopReadout() {
+
+  if(!readoutThread.joinable()) return;
+
+  readoutRunning = false;
+  readoutThread.join();
+
+  // Release everything read so far, the remaining data in the DTB RAM
+  // is then read directly by the data pipes:
+  for(uint8_t channel = 0; channel < 4; channel++) {
+    hostbuffer[channel].CommitAll();
+    hostbuffer[channel].SetActive(false);
+  }
+  LOG(logDEBUGHAL) << "Stopped background DAQ readout thread.";
+}
+
+void hal::loopPipelineStart() {
+
+  // Hook the host buffers of all open channels into the pipes:
+  dtbSource * sources[4] = {&src0, &src1, &src2, &src3};
+  for(uint8_t channel = 0; channel < 4; channel++) {
+    if(!sources[channel]->isConnected()) continue;
+    hostbuffer[channel].Reset(tbmtype != 0x00);
+    hostbuffer[channel].SetActive(true);
+    sources[channel]->SetHostBuffer(&hostbuffer[channel]);
+  }
+}
+
+bool hal::loopPipelineFetch() {
+
+  dtbSource * sources[4] = {&src0, &src1, &src2, &src3};
+  std::vector<uint16_t> block;
+  bool empty = true;
+  uint32_t complete = 0xffffffff;
+
+  for(uint8_t channel = 0; channel < 4; channel++) {
+    if(!sources[channel]->isConnected()) continue;
+
+    // Leave the data in the DTB RAM if the host buffer cannot take a full block:
+    uint32_t remaining = 1;
+    while(remaining > 0 && hostbuffer[channel].GetFreeSize() >= DTB_SOURCE_BLOCK_SIZE) {
+      _testboard->Daq_Read(block, DTB_SOURCE_BLOCK_SIZE, remaining, channel);
+      if(block.empty()) break;
+      hostbuffer[channel].Write(block);
+      recorder[channel].Write(block);
+    }
+    if(remaining > 0) { empty = false; }
+    complete = std::min(complete, hostbuffer[channel].GetPendingEvents());
+  }
+
+  // The loop stops between triggers, so all data is complete once the RAM
+  // is empty. Otherwise only release Events complete in all channels:
+  for(uint8_t channel = 0; channel < 4; channel++) {
+    if(!sources[channel]->isConnected()) continue;
+    if(empty) { hostbuffer[channel].CommitAll(); }
+    else { hostbuffer[channel].Commit(complete); }
+  }
+  return empty;
+}
+
+void hal::loopPipelineThread(void * instance) {
+  hal * h = static_cast<hal*>(instance);
+  h->pipelineLog.Apply();
+  try { h->daqAllEvents(h->readoutEvents); }
+  catch(CRpcError &e) { h->pipelineError = e; }
+  // Nothing may escape the thread, the caller rethrows after the join:
+  catch(std::exception &e) { h->pipelineFailure = e.what(); }
+  catch(...) { h->pipelineFailure = "unknown exception"; }
+}
+
+void hal::loopPipelineNext(std::vector<Event*> &data, bool done) {
+
+  // A loop finishing in one go is decoded directly from the DTB RAM:
+  if(!hostbuffer[0].IsActive()) {
+    if(done) {
+      daqAllEvents(readoutEvents);
+      LOG(logDEBUGHAL) << readoutEvents.size() << " events read.";
+      collectEvents(data,readoutEvents);
+      return;
+    }
+    loopPipelineStart();
+  }
+
+  // Collect the Events decoded while the DTB was running the loop:
+  if(pipelineThread.joinable()) {
+    pipelineThread.join();
+    if(pipelineError.error != CRpcError::OK) { throw pipelineError; }
+    if(!pipelineFailure.empty()) { throw pxarException("Decoding during the trigger loop failed: " + pipelineFailure); }
+    LOG(logDEBUGHAL) << readoutEvents.size() << " events decoded during the loop.";
+    collectEvents(data,readoutEvents);
+  }
+
+  // Move the data to the host, decoding right away if the host buffers fill up:
+  timer t;
+  while(!loopPipelineFetch()) {
+    daqAllEvents(readoutEvents);
+    collectEvents(data,readoutEvents);
+  }
+  LOG(logDEBUGHAL) << "Fetched DTB data in " << t << "ms.";
+
+  // Decode in the background while the DTB continues with the loop:
+  if(!done) {
+    pipelineError = CRpcError();
+    pipelineFailure.clear();
+    pipelineLog.Capture();
+    if(pipelineThread.start(&hal::loopPipelineThread, this)) return;
+  }
+
+  daqAllEvents(readoutEvents);
+  LOG(logDEBUGHAL) << readoutEvents.size() << " events read (" << t << "ms).";
+  collectEvents(data,readoutEvents);
+}
+
+void hal::loopPipelineStop() {
+
+  if(pipelineThread.joinable()) {
+    pipelineThread.join();
+    readoutEvents.Clear();
+  }
+
+  // The readout thread releases the host buffers itself:
+  if(readoutThread.joinable()) return;
+  for(uint8_t channel = 0; channel < 4; channel++) { hostbuffer[channel].SetActive(false); }
 }
 
 Event* hal::daqEvent() {
@@ -1529,40 +1843,134 @@ Event* hal::daqEvent() {
 
 std::vector<Event*> hal::daqAllEvents() {
 
+  daqAllEvents(readoutEvents);
+
   std::vector<Event*> evt;
+  evt.reserve(readoutEvents.size());
+  for(size_t i = 0; i < readoutEvents.size(); i++) { evt.push_back(new Event(readoutEvents.GetEvent(i))); }
+  readoutEvents.Clear();
 
-  dataSink<Event*> Eventpump0, Eventpump1, Eventpump2, Eventpump3;
-  splitter0 >> decoder0 >> Eventpump0;
+  return evt;
+}
 
-  if(src1.isConnected()) { splitter1 >> decoder1 >> Eventpump1; }
-  if(src2.isConnected()) { splitter2 >> decoder2 >> Eventpump2; }
-  if(src3.isConnected()) { splitter3 >> decoder3 >> Eventpump3; }
+void hal::daqDecodeThread(void * job) {
+  static_cast<decodeJob*>(job)->log.Apply();
+  static_cast<decodeJob*>(job)->Run();
+}
+
+void hal::decodeJob::Run() {
+
+  dataSink<Event*> Eventpump;
+  (*splitter) >> (*decoder) >> Eventpump;
+  decoder->SetArena(events);
 
-  // FIXME check carefully: in principle we expect the same number of triggers
-  // (==Events) on each pipe. Throw a critical if difference is found?
   try {
     while(1) {
-      // Read the next Event from each of the pipes:
-      Event* current_Event = new Event(*Eventpump0.Get());
-      if(src1.isConnected()) {
-	Event* tmp = Eventpump1.Get(); 
-	current_Event->pixels.insert(current_Event->pixels.end(), tmp->pixels.begin(), tmp->pixels.end());
-      }
-      if(src2.isConnected()) {
-	Event* tmp = Eventpump2.Get(); 
-	current_Event->pixels.insert(current_Event->pixels.end(), tmp->pixels.begin(), tmp->pixels.end());
-      }
-      if(src3.isConnected()) {
-	Event* tmp = Eventpump3.Get(); 
-	current_Event->pixels.insert(current_Event->pixels.end(), tmp->pixels.begin(), tmp->pixels.end());
-      }
-      evt.push_back(current_Event);
+      // The decoder writes the pixels directly into the arena:
+      events->StartEvent();
+      Event* current_Event = Eventpump.Get();
+      events->FinishEvent(current_Event->header, current_Event->trailer, current_Event->numDecoderErrors);
     }
   }
-  catch (dsBufferEmpty &) { LOG(logDEBUGHAL) << "Finished readout."; }
-  catch (dataPipeException &e) { LOG(logERROR) << e.what(); }
+  catch (dsBufferEmpty &) { events->DiscardEvent(); }
+  catch (dataPipeException &e) {
+    events->DiscardEvent();
+    message = e.what();
+  }
+  catch (CRpcError &e) {
+    events->DiscardEvent();
+    rpcerror = e;
+  }
+  // Nothing may escape a worker thread, hand everything else to the caller:
+  catch (std::exception &e) {
+    events->DiscardEvent();
+    failure = e.what();
+  }
+  catch (...) {
+    events->DiscardEvent();
+    failure = "unknown exception";
+  }
+  decoder->SetArena(NULL);
+}
 
-  return evt;
+void hal::daqAllEvents(eventArena & events) {
+
+  dtbSource * sources[4] = {&src0, &src1, &src2, &src3};
+  dtbEventSplitter * splitters[4] = {&splitter0, &splitter1, &splitter2, &splitter3};
+  dtbEventDecoder * decoders[4] = {&decoder0, &decoder1, &decoder2, &decoder3};
+
+  // Channel 0 is always read, the others if they have been opened:
+  size_t channels[4];
+  size_t nchannels = 0;
+  for(size_t ch = 0; ch < 4; ch++) {
+    if(ch == 0 || sources[ch]->isConnected()) { channels[nchannels++] = ch; }
+  }
+
+  // Set up one decoding job per channel. A single channel is decoded
+  // straight into the output arena, several channels into their own
+  // arenas which are merged afterwards:
+  for(size_t i = 0; i < nchannels; i++) {
+    decodeJob & job = decodeJobs[i];
+    job.splitter = splitters[channels[i]];
+    job.decoder = decoders[channels[i]];
+    job.message.clear();
+    job.rpcerror = CRpcError();
+    job.failure.clear();
+    job.log.Capture();
+    if(nchannels > 1) { channelEvents[i].Clear(); job.events = &channelEvents[i]; }
+    else { job.events = &events; }
+  }
+
+  // Decode the additional channels in worker threads and the first one in
+  // this thread. Run the job here if a thread could not be started:
+  for(size_t i = 1; i < nchannels; i++) {
+    if(!decodeThreads[i].start(&hal::daqDecodeThread, &decodeJobs[i])) { decodeJobs[i].Run(); }
+  }
+  decodeJobs[0].Run();
+  for(size_t i = 1; i < nchannels; i++) { decodeThreads[i].join(); }
+
+  for(size_t i = 0; i < nchannels; i++) {
+    if(!decodeJobs[i].message.empty()) { LOG(logERROR) << "Channel " << channels[i] << ": " << decodeJobs[i].message; }
+  }
+  for(size_t i = 0; i < nchannels; i++) {
+    if(decodeJobs[i].rpcerror.error != CRpcError::OK) { throw decodeJobs[i].rpcerror; }
+  }
+  for(size_t i = 0; i < nchannels; i++) {
+    if(!decodeJobs[i].failure.empty()) {
+      std::ostringstream msg;
+      msg << "Decoding of channel " << channels[i] << " failed: " << decodeJobs[i].failure;
+      throw pxarException(msg.str());
+    }
+  }
+
+  if(nchannels == 1) {
+    LOG(logDEBUGHAL) << "Finished readout.";
+    return;
+  }
+
+  // Every channel is expected to deliver one Event per trigger:
+  size_t nevents = channelEvents[0].size();
+  for(size_t i = 1; i < nchannels; i++) { nevents = std::min(nevents, channelEvents[i].size()); }
+  for(size_t i = 0; i < nchannels; i++) {
+    if(channelEvents[i].size() != nevents) {
+      LOG(logERROR) << "Channel " << channels[i] << " delivered " << channelEvents[i].size()
+		    << " Events, other channels " << nevents << ". Dropping "
+		    << (channelEvents[i].size() - nevents) << " unmatched Events.";
+    }
+  }
+
+  // Merge the channels Event by Event in trigger order, the header and
+  // trailer are taken from the first channel:
+  for(size_t evt = 0; evt < nevents; evt++) {
+    events.StartEvent();
+    uint32_t errors = 0;
+    for(size_t i = 0; i < nchannels; i++) {
+      events.pixels.insert(events.pixels.end(), channelEvents[i].begin(evt), channelEvents[i].end(evt));
+      errors += channelEvents[i].numDecoderErrors(evt);
+    }
+    events.FinishEvent(channelEvents[0].header(evt), channelEvents[0].trailer(evt), static_cast<uint16_t>(std::min(errors, static_cast<uint32_t>(0xffff))));
+  }
+  LOG(logDEBUGHAL) << "Finished readout, merged " << nevents << " Events from " << nchannels << " channels.";
 }
 
 rawEvent* hal::daqRawEvent() {
@@ -1693,10 +2101,27 @@ void hal::daqTriggerLoopHalt() {
 
 uint32_t hal::daqBufferStatus() {
 
+  // Query all DAQ channels in one round trip:
+  rpcBatch batch;
+  std::vector<rpcReply<uint32_t> > sizes(8);
+  for(uint8_t channel = 0; channel < 8; channel++) {
+    _testboard->Daq_GetSize(channel, batch, sizes.at(channel));
+  }
+  _testboard->Collect(batch);
+
   uint32_t buffered_data = 0;
   // Summing up data words in all DAQ channels:
   for(uint8_t channel = 0; channel < 8; channel++) {
-    buffered_data += _testboard->Daq_GetSize(channel);
+    buffered_data += sizes.at(channel).Get();
+  }
+  return buffered_data;
+}
+
+uint32_t hal::daqHostBufferStatus() {
+
+  uint32_t buffered_data = 0;
+  for(uint8_t channel = 0; channel < 4; channel++) {
+    buffered_data += hostbuffer[channel].GetSize();
   }
   return buffered_data;
 }
@@ -1715,11 +2140,35 @@ void hal::daqStop() {
   _testboard->uDelay(100);
   _testboard->Flush();
 
+  // Stop the background readout, all data is still available via the pipes:
+  daqStopReadout();
+  loopPipelineStop();
+
   LOG(logDEBUGHAL) << "Stopped DAQ session.";
 }
 
+void hal::daqRecord(std::string filename) {
+
+  // Close the files of a previous recording:
+  for(uint8_t channel = 0; channel < 4; channel++) {
+    if(recorder[channel].IsOpen()) {
+      LOG(logDEBUGHAL) << "Recorded " << recorder[channel].GetSize() << " words of channel " << static_cast<int>(channel) << ".";
+    }
+    recorder[channel].Close();
+  }
+
+  recordFile = filename;
+  if(recordFile.empty()) { LOG(logDEBUGHAL) << "Raw data recording stopped."; }
+  else { LOG(logDEBUGHAL) << "Recording raw data of the next DAQ sessions to " << recordFile << "_ch*.dat"; }
+}
+
 void hal::daqClear() {
 
+  // Stop the background readout and drop the data it has fetched:
+  daqStopReadout();
+  loopPipelineStop();
+  for(uint8_t channel = 0; channel < 4; channel++) { hostbuffer[channel].Clear(); }
+
   // Disconnect the data pipe from the DTB:
   src0 = dtbSource();
   src1 = dtbSource();
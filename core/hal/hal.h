@@ -4,7 +4,9 @@
 #include "rpc_calls.h"
 #include "api.h"
 #include "datapipe.h"
+#include "accumulator.h"
 #include "constants.h"
+#include <set>
 
 namespace pxar {
 
@@ -92,6 +94,11 @@ namespace pxar {
      */
     bool rocSetDACs(uint8_t roci2c, std::map< uint8_t, uint8_t > dacPairs);
 
+    /** Set DACs on several ROCs at once, provided as map of ROC I2C address to
+     *  DAC id/value pairs. All writes are sent in one USB transfer.
+     */
+    bool rocSetDACs(std::map< uint8_t, std::map< uint8_t, uint8_t > > rocDacs);
+
     /** Set a register on a specific TBM tbmId
      */
     bool tbmSetReg(uint8_t regId, uint8_t regValue);
@@ -150,6 +157,16 @@ namespace pxar {
     void SignalProbeA2(uint8_t signal);
 
 
+    // RPC profiling:
+    /** Switch the per-command profiling of the testboard RPC calls on or off
+     */
+    void setRpcProfiling(bool enable);
+
+    /** Write the RPC profile collected so far to the log
+     */
+    void printRpcProfile();
+
+
     // TEST COMMANDS
 
     /** Function to return Module maps of calibration pulses
@@ -243,10 +260,19 @@ namespace pxar {
     std::vector<Event*> SingleRocOnePixelDacDacScan(uint8_t roci2c, uint8_t column, uint8_t row, std::vector<int32_t> parameter);
 
 
+    /** Attach a trigger condenser to the test functions above: the Events
+     *  read out are folded into it chunk by chunk while the trigger loop is
+     *  still running and are not returned. Pass NULL to detach it again.
+     */
+    void SetTriggerCondenser(triggerCondenser * cond) { condenser = cond; }
+
+
     // DAQ functions:
-    /** Starting a new data acquisition session
+    /** Starting a new data acquisition session. If requested, a background
+     *  thread continuously moves the recorded data from the DTB RAM to host
+     *  memory until daqStop() is called.
      */
-    void daqStart(uint8_t deser160phase, uint8_t tbmtype, uint32_t buffersize = DTB_SOURCE_BUFFER_SIZE);
+    void daqStart(uint8_t deser160phase, uint8_t tbmtype, uint32_t buffersize = DTB_SOURCE_BUFFER_SIZE, bool readout = false);
 
     /** Firing the pattern generator nTrig times with the programmed patterns
      */
@@ -265,10 +291,15 @@ namespace pxar {
      */
     void daqStop();
 
-    /**
+    /** Returns the number of data words currently stored in the DTB RAM
      */
     uint32_t daqBufferStatus();
 
+    /** Returns the number of data words fetched by the background readout
+     *  thread and not yet read out from host memory
+     */
+    uint32_t daqHostBufferStatus();
+
     /** Reading just the DTB buffer and returning
      */
     std::vector<uint16_t> daqBuffer();
@@ -289,27 +320,41 @@ namespace pxar {
      */
     std::vector<Event*> daqAllEvents();
 
+    /** Read all remaining decoded Events from the FIFO buffer and append
+     *  them to the given arena, no memory is allocated per Event
+     */
+    void daqAllEvents(eventArena & events);
+
     /** Clears the DAQ buffer on the DTB, deletes all previously taken and not yet read out data!
      */
     void daqClear();
 
+    /** Record all raw data blocks read from the DTB in the following DAQ
+     *  sessions, one file per DAQ channel named <filename>_ch<channel>.dat.
+     *  The files can be replayed through the data pipes using
+     *  pxar::dtbFileSource. An empty filename stops the recording.
+     */
+    void daqRecord(std::string filename);
+
 
     // Functions to access NIOS storage of trim values:
 
-    /** Set the available I2C device addresses
+    /** Set the available I2C device addresses. The list is only sent when
+     *  it differs from the one last sent, returns true if it was sent.
      */
-    void SetupI2CValues(std::vector<uint8_t> roci2cs);
+    bool SetupI2CValues(std::vector<uint8_t> roci2cs);
 
     /** Set all trim bits for the ROC with specified I2C address
      */
-    void SetupTrimValues(uint8_t roci2c, std::vector<pixelConfig> pixels);
+    void SetupTrimValues(uint8_t roci2c, const pixelStore & pixels);
 
 
     // Functions to set bits somewhere on the ROC:
 
-    /** Mask all pixels on a specific ROC I2C address
+    /** Mask all pixels on a specific ROC I2C address. Masking is skipped
+     *  if the ROC is known to be fully masked already.
      */
-    void RocSetMask(uint8_t roci2c, bool mask, std::vector<pixelConfig> pixels = std::vector<pixelConfig>());
+    void RocSetMask(uint8_t roci2c, bool mask, const pixelStore & pixels = pixelStore());
 
     /** Set the Calibrate bit and CALS setting of a pixel
      */
@@ -348,6 +393,51 @@ namespace pxar {
     uint8_t rocType;
     uint8_t hubId;
 
+    /** Shadow copies of the last value written to each ROC DAC, keyed by
+     *  I2C address and DAC id, and to each TBM register, keyed by hub id and
+     *  register id. Writes of the value already held are skipped.
+     */
+    std::map< std::pair<uint8_t,uint8_t>, uint8_t > rocRegisterCache;
+    std::map< std::pair<uint8_t,uint8_t>, uint8_t > tbmRegisterCache;
+
+    /** I2C addresses last sent to the NIOS storage
+     */
+    std::vector<uint8_t> niosI2cAddresses;
+
+    /** ROCs known to have all pixels masked. Cleared when power is cycled
+     *  and in daqStart, every test loop removes its ROCs before the loop
+     *  RPC is called since the loop trims and unmasks their pixels.
+     */
+    std::set<uint8_t> rocsMasked;
+
+    /** Queue the DAC writes for one ROC without flushing, skipping all
+     *  values already held by the ROC. Returns the number of DACs queued.
+     */
+    size_t rocQueueDACs(uint8_t roci2c, const std::map< uint8_t, uint8_t > & dacPairs);
+
+    /** Forget the cached value of a DAC on the given ROCs, e.g. after the
+     *  DAC has been scanned by a test loop on the testboard
+     */
+    void rocForgetDAC(const std::vector<uint8_t> & roci2cs, uint8_t dacId);
+
+    /** Condenser receiving the test function data, if attached
+     */
+    triggerCondenser * condenser;
+
+    /** Number of Events read out by the test functions in this DAQ session
+     */
+    size_t nEventsRead;
+
+    /** Hand the Events read in one loop cycle either to the attached
+     *  trigger condenser or append them to the data vector. The arena
+     *  is cleared afterwards.
+     */
+    void collectEvents(std::vector<Event*> &data, eventArena &events);
+
+    /** Readout arena of the test functions, recycled between loop cycles
+     */
+    eventArena readoutEvents;
+
     /** Print the info block with software and firmware versions,
      *  MAC and USB ids etc. read from the connected testboard
      */
@@ -416,6 +506,100 @@ namespace pxar {
     dtbEventDecoder decoder2;
     dtbEventDecoder decoder3;
 
+    // Asynchronous DAQ readout: host memory buffers for all channels and
+    // the thread moving data from the DTB into them
+    dtbHostBuffer hostbuffer[4];
+    pxar::thread readoutThread;
+    volatile bool readoutRunning;
+
+    /** Log output of the thread starting a worker thread, taken over by
+     *  the worker so its messages go to the same stream with the same tag
+     */
+    struct threadLog {
+      threadLog() : stream(NULL), tag(NULL) {}
+      void Capture() { stream = SetLogOutput::ThreadStream(); tag = SetLogOutput::ThreadTag(); }
+      void Apply() const { SetLogOutput::ThreadStream() = stream; SetLogOutput::ThreadTag() = tag; }
+      FILE* stream;
+      const char* tag;
+    };
+    threadLog readoutLog;
+
+    // Raw data recording of all DAQ channels, enabled by daqRecord():
+    std::string recordFile;
+    dtbRecorder recorder[4];
+
+    /** Entry point of the background readout thread
+     */
+    static void daqReadoutThread(void * instance);
+
+    /** Loop reading data blocks from all open DAQ channels into the host
+     *  buffers, only releasing Events which are complete in all channels
+     */
+    void daqReadoutLoop();
+
+    /** Stop and join the background readout thread, makes all data fetched
+     *  so far available to the data pipes
+     */
+    void daqStopReadout();
+
+    /** Decoding of one DAQ channel into an arena, run in parallel for
+     *  all connected channels by daqAllEvents
+     */
+    struct decodeJob {
+      decodeJob() : splitter(NULL), decoder(NULL), events(NULL), message(), rpcerror(), failure(), log() {}
+      void Run();
+      dtbEventSplitter * splitter;
+      dtbEventDecoder * decoder;
+      eventArena * events;
+      // Errors are stored and reported by the calling thread:
+      std::string message;
+      CRpcError rpcerror;
+      // Any other exception, rethrown as pxarException after the join:
+      std::string failure;
+      threadLog log;
+    };
+    decodeJob decodeJobs[4];
+    pxar::thread decodeThreads[4];
+    eventArena channelEvents[4];
+
+    /** Entry point of the per-channel decoding threads
+     */
+    static void daqDecodeThread(void * job);
+
+    /** Called by the test functions after each return of the trigger
+     *  loop RPC. The data of an interrupted loop is moved to the host
+     *  buffers and decoded in the background while the DTB already
+     *  continues with the loop. The Events of the previous cycle are
+     *  collected first, once the loop is done everything is collected.
+     */
+    void loopPipelineNext(std::vector<Event*> &data, bool done);
+
+    /** Hook the host buffers into the pipes, done when a trigger loop
+     *  is interrupted for the first time in a DAQ session
+     */
+    void loopPipelineStart();
+
+    /** Wait for a running background decoding and deactivate the host
+     *  buffers, called by daqStop()
+     */
+    void loopPipelineStop();
+
+    /** Read the DTB RAM of all open channels into the host buffers until
+     *  either the RAM is empty or the host buffers are full. Returns
+     *  true if all data has been fetched.
+     */
+    bool loopPipelineFetch();
+
+    /** Entry point of the background decoding thread
+     */
+    static void loopPipelineThread(void * instance);
+
+    pxar::thread pipelineThread;
+    CRpcError pipelineError;
+    // Any other exception of the decoding thread, rethrown after the join:
+    std::string pipelineFailure;
+    threadLog pipelineLog;
+
   };
 }
 #endif
@@ -116,6 +116,43 @@ void rpc_Receive(CRpcIo &rpc_io, string &x)
 }
 
 
+// === batch ================================================================
+
+void rpcBatch::Expect(uint16_t cmd, uint8_t size, rpcReplyBase &reply)
+{
+	pending p;
+	p.cmd = cmd;
+	p.size = size;
+	p.reply = &reply;
+	m_pending.push_back(p);
+}
+
+
+void rpcBatch::Collect(CRpcIo &rpc_io)
+{
+	if (m_out.Size()) rpc_io.Write(m_out.Data(), m_out.Size());
+	rpc_io.Flush();
+	m_out.Clear();
+
+	try
+	{
+		rpcMessage msg;
+		for (unsigned int i=0; i<m_pending.size(); i++)
+		{
+			msg.Receive(rpc_io);
+			msg.Check(m_pending[i].cmd, m_pending[i].size);
+			m_pending[i].reply->Decode(msg);
+		}
+	}
+	catch (CRpcError &)
+	{
+		m_pending.clear();
+		throw;
+	}
+	m_pending.clear();
+}
+
+
 // === tools ================================================================
 
 void rpc_TranslateCallName(const string &in, string &out)
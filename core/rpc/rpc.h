@@ -12,13 +12,13 @@
 
 #include "rpc_io.h"
 #include "rpc_error.h"
+#include "rpc_profile.h"
 #include "log.h"
 
-#ifdef ENABLE_RPC_PROFILING
-#define RPC_PROFILING PROFILING LOG(pxar::logDEBUGRPC) << "called.";
-#else
-#define RPC_PROFILING LOG(pxar::logDEBUGRPC) << "called.";
-#endif
+// Measures the call if profiling is switched on (see CTestboard::SetProfiling),
+// ENABLE_RPC_PROFILING switches it on from the start. The command is taken
+// from rpc_GetCallId:
+#define RPC_PROFILING CRpcCallProfile rpc_callProfile(rpc_profile); LOG(pxar::logDEBUGRPC) << "called.";
 
 #ifdef ENABLE_MULTITHREADING
 #include <boost/thread.hpp>
@@ -26,8 +26,10 @@
 #define RPC_THREAD_LOCK boost::lock_guard<boost::mutex> lock(m_sync);
 #define RPC_THREAD_UNLOCK
 #else
-#define RPC_THREAD
-#define RPC_THREAD_LOCK
+// Serialize RPC calls so the DAQ readout thread can share the connection:
+#include "threading.h"
+#define RPC_THREAD pxar::mutex m_sync;
+#define RPC_THREAD_LOCK pxar::lock_guard lock(m_sync);
 #define RPC_THREAD_UNLOCK
 #endif
 
@@ -51,10 +53,13 @@ extern const char rpc_timestamp[];
 	static const unsigned int rpc_cmdListSize; \
 	static const char *rpc_cmdName[]; \
 	int *rpc_cmdId; \
+	CRpcProfile rpc_profile; \
 	void rpc_Clear() { for ( unsigned int i=2; i<rpc_cmdListSize; i++) rpc_cmdId[i] = -1; rpc_cmdId[0] = 0; rpc_cmdId[1] = 1; } \
 	void rpc_Connect(CRpcIo &port) { rpc_io = &port; rpc_Clear(); } \
 	uint16_t rpc_GetCallId(uint16_t x) \
 	{ \
+		CRpcCallProfile *call = CRpcCallProfile::Current(); \
+		if (call) call->SetCommand(x); \
 		int id = rpc_cmdId[x]; \
 		if (id >= 0) return id; \
 		string name(rpc_cmdName[x]); \
@@ -64,7 +69,7 @@ extern const char rpc_timestamp[];
 	} \
 	friend class CRpcError;
 
-#define RPC_INIT rpc_io = &RpcIoNull; rpc_cmdId = new int[rpc_cmdListSize]; rpc_Clear();
+#define RPC_INIT rpc_io = &RpcIoNull; rpc_cmdId = new int[rpc_cmdListSize]; rpc_Clear(); rpc_profile.Init(rpc_cmdName, rpc_cmdListSize);
 
 #define RPC_EXIT delete[] rpc_cmdId;
 
@@ -187,6 +192,79 @@ inline void rpc_Send(CRpcIo &rpc_io, const string &x)
 void rpc_Receive(CRpcIo &rpc_io, string &x);
 
 
+// === batch ================================================================
+
+// Collects outgoing messages in memory so a batch can be handed to the
+// port in one piece:
+class CRpcIoBuffer : public CRpcIo
+{
+	vector<uint8_t> m_buffer;
+public:
+	void Write(const void *buffer, uint32_t size)
+	{ const uint8_t *p = (const uint8_t*)buffer; m_buffer.insert(m_buffer.end(), p, p + size); }
+	void Flush() {}
+	void Clear() { m_buffer.clear(); }
+	void Read(void * /*buffer*/, uint32_t /*size*/) { throw CRpcError(CRpcError::READ_ERROR); }
+	void Close() {}
+
+	const uint8_t* Data() const { return m_buffer.empty() ? 0 : &(m_buffer[0]); }
+	uint32_t Size() const { return m_buffer.size(); }
+};
+
+
+inline void rpc_Get(rpcMessage &msg, bool &x)     { x = msg.Get_BOOL(); }
+inline void rpc_Get(rpcMessage &msg, int8_t &x)   { x = msg.Get_INT8(); }
+inline void rpc_Get(rpcMessage &msg, uint8_t &x)  { x = msg.Get_UINT8(); }
+inline void rpc_Get(rpcMessage &msg, int16_t &x)  { x = msg.Get_INT16(); }
+inline void rpc_Get(rpcMessage &msg, uint16_t &x) { x = msg.Get_UINT16(); }
+inline void rpc_Get(rpcMessage &msg, int32_t &x)  { x = msg.Get_INT32(); }
+inline void rpc_Get(rpcMessage &msg, uint32_t &x) { x = msg.Get_UINT32(); }
+
+
+class rpcReplyBase
+{
+public:
+	virtual ~rpcReplyBase() {}
+	virtual void Decode(rpcMessage &msg) = 0;
+};
+
+
+// Return value of a call queued in an rpcBatch, filled by rpcBatch::Collect:
+template <class T>
+class rpcReply : public rpcReplyBase
+{
+	T m_value;
+	bool m_valid;
+public:
+	rpcReply() : m_value(), m_valid(false) {}
+	bool Valid() const { return m_valid; }
+	T Get() const { if (!m_valid) throw CRpcError(CRpcError::READ_ERROR); return m_value; }
+	void Decode(rpcMessage &msg) { rpc_Get(msg, m_value); m_valid = true; }
+};
+
+
+// Queue of calls sent to the DTB in one transfer. The replies are read back
+// in call order by rpcBatch::Collect:
+class rpcBatch
+{
+	struct pending
+	{
+		uint16_t cmd;
+		uint8_t size;
+		rpcReplyBase *reply;
+	};
+
+	CRpcIoBuffer m_out;
+	vector<pending> m_pending;
+public:
+	CRpcIo& Io() { return m_out; }
+	void Expect(uint16_t cmd, uint8_t size, rpcReplyBase &reply);
+	unsigned int Size() const { return m_pending.size(); }
+	void Clear() { m_out.Clear(); m_pending.clear(); }
+	void Collect(CRpcIo &rpc_io);
+};
+
+
 // === tools ================================================================
 
 void rpc_TranslateCallName(const string &in, string &out);
@@ -9,14 +9,36 @@ class CTestboard
 	RPC_THREAD
 
 	CUSB usb;
+	CRpcIoProfile rpc_profileIo;
 
 public:
 	CRpcIo& GetIo() { return *rpc_io; }
 
 	CTestboard() { 
 	  RPC_INIT rpc_io = &usb;
+#ifdef ENABLE_RPC_PROFILING
+	  SetProfiling(true);
+#endif
+	}
+	~CTestboard() {
+	  if (rpc_profile.IsEnabled()) rpc_profile.Print();
+	  RPC_EXIT
 	}
-	~CTestboard() { RPC_EXIT }
+
+	// Collect call counts, latencies, transferred bytes and flushes per
+	// RPC command. Switching on clears the previous profile.
+	void SetProfiling(bool enable) {
+	  RPC_THREAD_LOCK
+	  if (enable) {
+	    rpc_profile.Clear();
+	    rpc_profileIo.Attach(usb);
+	    rpc_io = &rpc_profileIo;
+	  }
+	  else rpc_io = &usb;
+	  rpc_profile.Enable(enable);
+	}
+	bool IsProfiling() { return rpc_profile.IsEnabled(); }
+	void PrintProfile() { rpc_profile.Print(); }
 
 	int32_t GetHostRpcCallCount() { return rpc_cmdListSize; }
 	bool GetHostRpcCallName(int32_t id, stringR &callName) { callName = rpc_cmdName[id]; return true; }
@@ -42,6 +64,26 @@ public:
 
 	bool RpcLink() {
 
+	  // Resolve all unknown call ids in one batch, only the ones left
+	  // over are requested one by one below:
+	  try {
+	    rpcBatch batch;
+	    std::vector<rpcReply<int32_t> > ids(rpc_cmdListSize);
+	    for (unsigned short i = 2; i < rpc_cmdListSize; i++) {
+	      if (rpc_cmdId[i] >= 0) continue;
+	      string name(rpc_cmdName[i]);
+	      GetRpcCallId(name, batch, ids[i]);
+	    }
+	    Collect(batch);
+	    for (unsigned short i = 2; i < rpc_cmdListSize; i++) {
+	      if (ids[i].Valid()) rpc_cmdId[i] = ids[i].Get();
+	    }
+	  }
+	  catch (CRpcError &) {
+	    LOG(pxar::logDEBUGRPC) << "Batched call id lookup failed, resolving ids one by one.";
+	    rpc_io->Clear();
+	  }
+
 	  bool error = false;
 	  for (unsigned short i = 2; i < rpc_cmdListSize; i++) {
 	    try { rpc_GetCallId(i); }
@@ -59,6 +101,35 @@ public:
 	}
 
 
+	// === batched calls =====================================================
+	// The calls below only queue their request in the batch, the return
+	// values are available from the rpcReply after Collect(batch).
+
+	void Collect(rpcBatch &batch) {
+	  CRpcCallProfile rpc_callProfile(rpc_profile);
+	  rpc_callProfile.SetCommand(rpc_cmdListSize);
+	  RPC_THREAD_LOCK
+	  batch.Collect(*rpc_io);
+	}
+
+	void GetRpcCallId(string &callName, rpcBatch &batch, rpcReply<int32_t> &id) {
+	  rpcMessage msg;
+	  msg.Create(1);
+	  msg.Send(batch.Io());
+	  rpc_Send(batch.Io(), callName);
+	  batch.Expect(1, 4, id);
+	}
+
+	void Daq_GetSize(uint8_t channel, rpcBatch &batch, rpcReply<uint32_t> &size) {
+	  uint16_t callId = rpc_GetCallId(67);
+	  rpcMessage msg;
+	  msg.Create(callId);
+	  msg.Put_UINT8(channel);
+	  msg.Send(batch.Io());
+	  batch.Expect(callId, 4, size);
+	}
+
+
 	// === DTB connection ====================================================
 
 	inline bool Open(string &name, bool init=true) {
@@ -93,8 +164,8 @@ public:
 	const char * ConnectionError()
 	{ return usb.GetErrorMsg(usb.GetLastError()); }
 
-	void Flush() { rpc_io->Flush(); }
-	void Clear() { rpc_io->Clear(); }
+	void Flush() { RPC_THREAD_LOCK rpc_io->Flush(); }
+	void Clear() { RPC_THREAD_LOCK rpc_io->Clear(); }
 
 
 	// === DTB identification ================================================
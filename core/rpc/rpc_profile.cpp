@@ -0,0 +1,202 @@
+// rpc_profile.cpp
+
+#include "rpc_profile.h"
+#include <algorithm>
+#include <exception>
+#include <cstdio>
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+
+// === profile ==============================================================
+
+void CRpcCallStats::Clear()
+{
+	calls = errors = time = maxTime = 0;
+	sent = received = flushes = 0;
+	latency.assign(CRpcProfile::nBuckets, 0);
+}
+
+
+void CRpcProfile::Init(const char *names[], unsigned int count)
+{
+	std::vector<std::string> shortNames;
+	for (unsigned int i=0; i<count; i++)
+	{
+		std::string name(names[i]);
+		shortNames.push_back(name.substr(0, name.find('$')));
+	}
+	// Overloaded commands keep their signature to tell them apart:
+	m_names = shortNames;
+	for (unsigned int i=0; i<count; i++)
+		for (unsigned int j=0; j<count; j++)
+			if (i != j && shortNames[i] == shortNames[j]) { m_names[i] = names[i]; break; }
+	m_names.push_back("(batch)");
+	m_stats.assign(m_names.size(), CRpcCallStats());
+}
+
+
+void CRpcProfile::Clear()
+{
+	pxar::lock_guard lock(m_mutex);
+	for (unsigned int i=0; i<m_stats.size(); i++) m_stats[i].Clear();
+}
+
+
+void CRpcProfile::Record(uint16_t cmd, uint64_t time, bool error, uint64_t sent, uint64_t received, uint64_t flushes)
+{
+	pxar::lock_guard lock(m_mutex);
+	if (cmd >= m_stats.size()) return;
+	CRpcCallStats &s = m_stats[cmd];
+	s.calls++;
+	if (error) s.errors++;
+	s.time += time;
+	if (time > s.maxTime) s.maxTime = time;
+	s.sent += sent;
+	s.received += received;
+	s.flushes += flushes;
+	s.latency[Bucket(time)]++;
+}
+
+
+// Exact below 8 us, above four buckets per power of two:
+unsigned int CRpcProfile::Bucket(uint64_t time)
+{
+	if (time < 8) return static_cast<unsigned int>(time);
+	unsigned int e = 3;
+	while ((time >> (e+1)) != 0) e++;
+	unsigned int bucket = 8 + (e-3)*4 + static_cast<unsigned int>((time >> (e-2)) & 3);
+	return std::min(bucket, nBuckets-1);
+}
+
+
+uint64_t CRpcProfile::BucketLow(unsigned int bucket)
+{
+	if (bucket < 8) return bucket;
+	unsigned int e = 3 + (bucket-8)/4;
+	return static_cast<uint64_t>(4 + (bucket-8)%4) << (e-2);
+}
+
+
+uint64_t CRpcProfile::BucketWidth(unsigned int bucket)
+{
+	if (bucket < 8) return 1;
+	return static_cast<uint64_t>(1) << (1 + (bucket-8)/4);
+}
+
+
+double CRpcProfile::Percentile(uint16_t cmd, double fraction)
+{
+	pxar::lock_guard lock(m_mutex);
+	if (cmd >= m_stats.size()) return 0;
+	return Percentile(m_stats[cmd], fraction);
+}
+
+
+double CRpcProfile::Percentile(const CRpcCallStats &s, double fraction)
+{
+	if (s.calls == 0) return 0;
+	double target = fraction*s.calls;
+	double sum = 0;
+	for (unsigned int b=0; b<nBuckets; b++)
+	{
+		if (s.latency[b] == 0) continue;
+		if (sum + s.latency[b] >= target)
+		{ // interpolate within the bucket
+			double x = BucketLow(b) + BucketWidth(b)*(target - sum)/s.latency[b];
+			return std::min(x, static_cast<double>(s.maxTime));
+		}
+		sum += s.latency[b];
+	}
+	return static_cast<double>(s.maxTime);
+}
+
+
+class CRpcProfileOrder
+{
+	const std::vector<CRpcCallStats> &m_stats;
+public:
+	CRpcProfileOrder(const std::vector<CRpcCallStats> &stats) : m_stats(stats) {}
+	bool operator()(unsigned int a, unsigned int b) const { return m_stats[a].time > m_stats[b].time; }
+};
+
+
+void CRpcProfile::Print()
+{
+	std::vector<CRpcCallStats> stats;
+	{
+		pxar::lock_guard lock(m_mutex);
+		stats = m_stats;
+	}
+
+	std::vector<unsigned int> order;
+	CRpcCallStats total;
+	for (unsigned int i=0; i<stats.size(); i++)
+	{
+		if (stats[i].calls == 0) continue;
+		order.push_back(i);
+		total.calls += stats[i].calls;
+		total.errors += stats[i].errors;
+		total.time += stats[i].time;
+		total.sent += stats[i].sent;
+		total.received += stats[i].received;
+		total.flushes += stats[i].flushes;
+	}
+	std::sort(order.begin(), order.end(), CRpcProfileOrder(stats));
+
+	char line[256];
+	LOG(pxar::logINFO) << "RPC profile, times in ms (total) and us, sorted by total time:";
+	sprintf(line, "%-32s %8s %6s %10s %9s %9s %9s %9s %9s %11s %11s %8s",
+		"command", "calls", "errors", "total", "mean", "p50", "p90", "p99", "max", "sent", "received", "flushes");
+	LOG(pxar::logINFO) << line;
+	for (unsigned int k=0; k<order.size(); k++)
+	{
+		unsigned int i = order[k];
+		const CRpcCallStats &s = stats[i];
+		sprintf(line, "%-32s %8lu %6lu %10.1f %9.1f %9.1f %9.1f %9.1f %9lu %11lu %11lu %8lu",
+			m_names[i].substr(0, 32).c_str(),
+			static_cast<unsigned long>(s.calls), static_cast<unsigned long>(s.errors),
+			s.time/1000., static_cast<double>(s.time)/s.calls,
+			Percentile(s, 0.5), Percentile(s, 0.9), Percentile(s, 0.99),
+			static_cast<unsigned long>(s.maxTime),
+			static_cast<unsigned long>(s.sent), static_cast<unsigned long>(s.received),
+			static_cast<unsigned long>(s.flushes));
+		LOG(pxar::logINFO) << line;
+	}
+	sprintf(line, "%-32s %8lu %6lu %10.1f %9s %9s %9s %9s %9s %11lu %11lu %8lu",
+		"total", static_cast<unsigned long>(total.calls), static_cast<unsigned long>(total.errors),
+		total.time/1000., "", "", "", "", "",
+		static_cast<unsigned long>(total.sent), static_cast<unsigned long>(total.received),
+		static_cast<unsigned long>(total.flushes));
+	LOG(pxar::logINFO) << line;
+}
+
+
+uint64_t CRpcProfile::Now()
+{
+#ifdef WIN32
+	static LARGE_INTEGER frequency = { 0 };
+	if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+	LARGE_INTEGER count;
+	QueryPerformanceCounter(&count);
+	return static_cast<uint64_t>(count.QuadPart*1000000.0/frequency.QuadPart);
+#else
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return static_cast<uint64_t>(tv.tv_sec)*1000000 + tv.tv_usec;
+#endif
+}
+
+
+CRpcCallProfile::~CRpcCallProfile()
+{
+	if (!m_active) return;
+	uint64_t time = CRpcProfile::Now() - m_start;
+	Current() = m_outer;
+	if (m_cmd < 0) return;
+	m_profile.Record(static_cast<uint16_t>(m_cmd), time, std::uncaught_exception(), sent, received, flushes);
+}
@@ -0,0 +1,132 @@
+// rpc_profile.h
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "rpc_io.h"
+#include "log.h"
+#include "threading.h"
+
+
+// === profile ==============================================================
+
+// Statistics of one RPC command, filled by CRpcProfile::Record:
+class CRpcCallStats
+{
+public:
+	uint64_t calls;     // number of calls
+	uint64_t errors;    // calls left with an exception
+	uint64_t time;      // summed latency in us
+	uint64_t maxTime;   // longest call in us
+	uint64_t sent;      // bytes written to the DTB
+	uint64_t received;  // bytes read from the DTB
+	uint64_t flushes;   // flushes of the USB buffer
+	std::vector<uint32_t> latency; // calls per latency bucket, see CRpcProfile::Bucket
+
+	CRpcCallStats() { Clear(); }
+	void Clear();
+};
+
+
+// Call counts, latencies and transferred bytes per RPC command of one
+// testboard. Latencies are histogrammed in buckets of a quarter octave
+// for the percentiles. The last entry collects the batched calls.
+class CRpcProfile
+{
+	bool m_enabled;
+	std::vector<std::string> m_names;
+	std::vector<CRpcCallStats> m_stats;
+	mutable pxar::mutex m_mutex;
+public:
+	static const unsigned int nBuckets = 136;
+
+	CRpcProfile() : m_enabled(false) {}
+	void Init(const char *names[], unsigned int count);
+	// The switch is read by the DAQ readout thread, too:
+	bool IsEnabled() const { pxar::lock_guard lock(m_mutex); return m_enabled; }
+	void Enable(bool enable) { pxar::lock_guard lock(m_mutex); m_enabled = enable; }
+	void Clear();
+
+	void Record(uint16_t cmd, uint64_t time, bool error, uint64_t sent, uint64_t received, uint64_t flushes);
+	// Latency in us below which the fraction of the calls of cmd finished:
+	double Percentile(uint16_t cmd, double fraction);
+	static double Percentile(const CRpcCallStats &stats, double fraction);
+	// Write the statistics of all called commands to the log:
+	void Print();
+
+	static unsigned int Bucket(uint64_t time);
+	static uint64_t BucketLow(unsigned int bucket);
+	static uint64_t BucketWidth(unsigned int bucket);
+	// Monotonic time in us:
+	static uint64_t Now();
+};
+
+
+// Measures one RPC call, see RPC_PROFILING. Calls made while measuring
+// another one (e.g. resolving the call id) are measured separately. Calls
+// whose command was never set are not recorded.
+class CRpcCallProfile
+{
+	CRpcProfile &m_profile;
+	int32_t m_cmd;
+	bool m_active;
+	uint64_t m_start;
+	CRpcCallProfile *m_outer;
+public:
+	uint64_t sent, received, flushes;
+
+	explicit CRpcCallProfile(CRpcProfile &profile)
+		: m_profile(profile), m_cmd(-1), m_active(profile.IsEnabled()), m_start(0), m_outer(0),
+		  sent(0), received(0), flushes(0)
+	{
+		if (!m_active) return;
+		m_outer = Current();
+		Current() = this;
+		m_start = CRpcProfile::Now();
+	}
+	~CRpcCallProfile();
+
+	void SetCommand(uint16_t cmd) { m_cmd = cmd; }
+
+	// Innermost call measured in this thread, 0 if none:
+	static CRpcCallProfile*& Current()
+	{
+		static PXAR_THREAD_LOCAL CRpcCallProfile* current = 0;
+		return current;
+	}
+};
+
+
+// Passes everything on to the USB connection and counts the bytes and
+// flushes of the call measured in the calling thread:
+class CRpcIoProfile : public CRpcIo
+{
+	CRpcIo *m_io;
+public:
+	CRpcIoProfile() : m_io(0) {}
+	void Attach(CRpcIo &io) { m_io = &io; }
+
+	void Write(const void *buffer, uint32_t size)
+	{
+		CRpcCallProfile *call = CRpcCallProfile::Current();
+		if (call) call->sent += size;
+		m_io->Write(buffer, size);
+	}
+	void Flush()
+	{
+		CRpcCallProfile *call = CRpcCallProfile::Current();
+		if (call) call->flushes++;
+		m_io->Flush();
+	}
+	void Clear() { m_io->Clear(); }
+	void Read(void *buffer, uint32_t size)
+	{
+		CRpcCallProfile *call = CRpcCallProfile::Current();
+		if (call) call->received += size;
+		m_io->Read(buffer, size);
+	}
+	void Close() { m_io->Close(); }
+};
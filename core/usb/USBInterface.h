@@ -1,5 +1,5 @@
 // Class provides basic functionalities to use the USB interface
-// IMPORTANT: there are two implementations for this class, each using a different USB library.
+// IMPORTANT: there are three implementations for this class, each using a different USB library.
 // What implementation is being used is determined by the arguments to the configure script
 // and then passed through the makefiles to the compiler.
 // Please implement and test your modifications for both versions.
@@ -19,7 +19,9 @@ typedef uint32_t DWORD;
 #endif //WIN32
 #endif //WIN32 && CINT
 
-#ifdef HAVE_LIBFTDI
+#if (defined HAVE_LIBUSB)
+#include <libusb.h>
+#elif (defined HAVE_LIBFTDI)
 #include <ftdi.h>
 #else
 #include <ftd2xx.h>
@@ -35,13 +37,25 @@ typedef uint32_t DWORD;
 
 #define ESC_EXTENDED 0x8f
 
+#if (defined HAVE_LIBUSB)
+struct CUSBTransferEngine;
+#elif (defined HAVE_LIBFTDI)
+struct CUSBFtdiEngine;
+#endif
+
 class CUSB : public CRpcIo
 {
   bool isUSB_open;
 
   int ftdiStatus;
 
-#ifndef HAVE_LIBFTDI
+#if (defined HAVE_LIBUSB)
+  // asynchronous transfers, the ring buffer and the event thread:
+  CUSBTransferEngine *m_engine;
+#elif (defined HAVE_LIBFTDI)
+  // FTDI context, reader thread and its ring buffer:
+  CUSBFtdiEngine *m_engine;
+#else
   FT_HANDLE ftHandle;
 #endif
 
@@ -60,7 +74,7 @@ public:
   CUSB();
   ~CUSB();
   int32_t GetLastError() { return ftdiStatus; }
-#ifdef HAVE_LIBFTDI
+#if (defined HAVE_LIBFTDI) || (defined HAVE_LIBUSB)
   const char* GetErrorMsg();
   const char* GetErrorMsg(int){ return GetErrorMsg(); };
 #else
@@ -14,21 +14,9 @@
 
 // needed for threaded readout of FTDI
 #include <pthread.h> 
-#include <semaphore.h>
+#include "threading.h"
 
-static struct ftdi_context ftdic;
-
-// the read buffer needs to be accessable outside of our USB class
 #define BUFSIZE 0x200000
-static pthread_t readerthread;
-static sem_t buf_data, buf_space;
-static unsigned char read_buffer[BUFSIZE];
-static int32_t head, tail; // read buffer is used as ring buffer
-
-// cleanup is threaded to include a timeout on the calls to the device that sometimes hang
-pthread_mutex_t cleanup_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_t usbclose_thread, usbdeinit_thread;
-volatile bool usbclose_done, usbdeinit_done;
 
 const int32_t productID_FT232H = 0x6014; // new testboard FTDI chip product id (FT232H)
 const int32_t productID_OLD = 0x6001; //  single channel devices (R Chips) used in older test boards
@@ -37,43 +25,66 @@ const int32_t vendorID = 0x0403; // Future Technology Devices International, Ltd
 using namespace std;
 using namespace pxar;
 
-static void add_to_buf (unsigned char c) {
-    int32_t nh;
-
-    sem_wait (&buf_space);
-    if (head == (BUFSIZE -1)) nh = 0;
-    else                      nh = head + 1;
-
-    if (nh == tail) {
-        fprintf (stderr, "USBInterface (libftdi) FATAL: overflow of circular buffer in threaded read routine. Sorry -- will exit now.\n");
-        exit (1);
-    }
-    read_buffer[head] = c;
-    head = nh;
-    sem_post (&buf_data);
-}
+// Everything belonging to one connection lives in the engine of its CUSB
+// instance, so several testboards can be driven from one process.
+struct CUSBFtdiEngine {
+  struct ftdi_context ftdic;
+
+  // the read buffer is filled by the reader thread outside of our USB class
+  pthread_t readerthread;
+  unsigned char read_buffer[BUFSIZE];
+  // read buffer is used as ring buffer with a single writer (reader thread,
+  // advances head) and a single reader (CUSB::Read, advances tail). The data
+  // is copied outside of the lock, the lock only guards the index updates:
+  uint32_t head, tail;
+  pxar::mutex buf_mutex;
+  pxar::condition buf_data;
+
+  // cleanup is threaded to include a timeout on the calls to the device that sometimes hang
+  pxar::mutex cleanup_mutex;
+  bool usbclose_done, usbdeinit_done;
+  // a cleanup call that timed out may still use the context
+  bool hanging;
+
+  CUSBFtdiEngine() : head(0), tail(0), usbclose_done(false), usbdeinit_done(false), hanging(false) {}
+
+  // number of bytes the reader thread may write in one piece at head
+  uint32_t space_contiguous() {
+    pxar::lock_guard lock(buf_mutex);
+    // one byte is kept free to distinguish a full from an empty buffer
+    if (head >= tail) return (tail == 0 ? BUFSIZE - 1 - head : BUFSIZE - head);
+    return tail - head - 1;
+  }
+};
 
 static void *reader (void *arg) {
   // there is no non-blocking read command implemented in libftdi ->
-  // therefore we use multithreading and a static buffer to emulate
+  // therefore we use multithreading and a ring buffer to emulate
   // non-blocking calls
-    struct ftdi_context *handle = (struct ftdi_context *)(arg);
-    unsigned char buf[0x1000];
-    int32_t br, i;
+    CUSBFtdiEngine *e = static_cast<CUSBFtdiEngine*>(arg);
+    int32_t br = 0;
 
     while (1) {
-      usleep(100); // wait 0.1 ms
+      // only poll at full speed while data is coming in
+      if (br <= 0) usleep(100); // wait 0.1 ms
       pthread_testcancel();
-      br = ftdi_read_data (handle, buf, sizeof(buf));
+      // read directly into the free part of the ring buffer:
+      uint32_t space = e->space_contiguous();
+      if (space == 0) { // buffer full, wait for CUSB::Read to catch up
+	br = 0;
+	continue;
+      }
+      if (space > 0x1000) space = 0x1000;
+      br = ftdi_read_data (&e->ftdic, &e->read_buffer[e->head], space);
       pthread_testcancel();
       if (br< 0){
 	LOG(logCRITICAL)<< "ERROR during USB read polling: error code from libusb_bulk_transfer(): " << br;
 	throw UsbConnectionError("ERROR during USB read polling");
       }
       if (br > 0){
-	for (i=0; i<br; i++){
-	  add_to_buf (buf[i]);
-	}
+	pxar::lock_guard lock(e->buf_mutex);
+	e->head = (e->head + br) % BUFSIZE;
+	e->buf_data.notify_one();
       }
     }
     return NULL;
@@ -82,22 +93,35 @@ static void *reader (void *arg) {
 static void *usbclose (void *arg) {
   // on some circumstances, the ftdi_usb_close() call hangs;
   // this is a workaround to implement a timeout
-    struct ftdi_context *handle = (struct ftdi_context *)(arg);
-    ftdi_usb_close(handle);
-    pthread_mutex_lock(&cleanup_mutex); usbclose_done = true; pthread_mutex_unlock(&cleanup_mutex);
+    CUSBFtdiEngine *e = static_cast<CUSBFtdiEngine*>(arg);
+    ftdi_usb_close(&e->ftdic);
+    pxar::lock_guard lock(e->cleanup_mutex);
+    e->usbclose_done = true;
     return NULL;
 }
 
 static void *usbdeinit (void *arg) {
   // on some circumstances, the ftdi_deinit() call hangs;
   // this is a workaround to implement a timeout
-    struct ftdi_context *handle = (struct ftdi_context *)(arg);
-    ftdi_deinit(handle);
-    pthread_mutex_lock(&cleanup_mutex); usbdeinit_done = true; pthread_mutex_unlock(&cleanup_mutex);
+    CUSBFtdiEngine *e = static_cast<CUSBFtdiEngine*>(arg);
+    ftdi_deinit(&e->ftdic);
+    pxar::lock_guard lock(e->cleanup_mutex);
+    e->usbdeinit_done = true;
     return NULL;
 }
 
-uint32_t FindAllUSB(struct ftdi_device_list ** devlist){
+// wait up to one second for a cleanup thread to set its flag
+static bool waitForCleanup(CUSBFtdiEngine *e, bool &flag) {
+  for (int time = 0; time<1000;time++){
+    usleep(1000); // wait 1ms
+    // check status and break if the call returned
+    pxar::lock_guard lock(e->cleanup_mutex);
+    if (flag) return true;
+  }
+  return false;
+}
+
+static int32_t FindAllUSB(struct ftdi_context *ftdic, struct ftdi_device_list ** devlist){
   int status;
   uint32_t nDevices = 0;
   struct ftdi_device_list *  	devlist_atb;
@@ -107,7 +131,7 @@ uint32_t FindAllUSB(struct ftdi_device_list ** devlist){
   // This first checks explicitly for DTB boards, then for ATB ones and merges the device lists
 
   // DTB
-  status =  ftdi_usb_find_all(&ftdic, devlist,vendorID,productID_FT232H);
+  status =  ftdi_usb_find_all(ftdic, devlist,vendorID,productID_FT232H);
   if( status < 0) {
     return status;
   }
@@ -116,7 +140,7 @@ uint32_t FindAllUSB(struct ftdi_device_list ** devlist){
   }
 
   // ATB
-  status =  ftdi_usb_find_all(&ftdic, &devlist_atb,vendorID,productID_OLD);
+  status =  ftdi_usb_find_all(ftdic, &devlist_atb,vendorID,productID_OLD);
   if( status < 0) {
     return status;
   }
@@ -139,33 +163,36 @@ CUSB::CUSB(){
       isUSB_open = false;
       ftdiStatus = 0;
       enumPos = enumCount = 0;
-      ftdiStatus = ftdi_init(&ftdic);
+      m_engine = new CUSBFtdiEngine();
+      ftdiStatus = ftdi_init(&m_engine->ftdic);
       if ( ftdiStatus < 0)
 	{
 	  LOG(logCRITICAL) <<  "USBInterface constructor: ftdi_init failed";
+	  delete m_engine;
 	  throw UsbConnectionError("USBInterface constructor: ftdi_init failed");
 	}
 }
 
 CUSB::~CUSB(){ 
   if (isUSB_open) Close(); 
-  pthread_mutex_lock(&cleanup_mutex); usbdeinit_done = false; pthread_mutex_unlock(&cleanup_mutex);
-  // create cleanup thread to allow timeout freeing the USB handle (might hang sometimes)
-  pthread_create (&usbdeinit_thread, NULL, usbdeinit, &ftdic);
-  bool done = false;
-  for (int time = 0; time<1000;time++){
-    usleep(1000); // wait 1ms
-    // check status and break if usbdevice is closed
-    pthread_mutex_lock(&cleanup_mutex); 
-    if (usbdeinit_done) {
-      done = true;    }
-    pthread_mutex_unlock(&cleanup_mutex);
-    if (done) break;  }
+  if (!m_engine->hanging) {
+    // create cleanup thread to allow timeout freeing the USB handle (might hang sometimes)
+    pthread_t usbdeinit_thread;
+    pthread_create (&usbdeinit_thread, NULL, usbdeinit, m_engine);
+    pthread_detach(usbdeinit_thread);
+    if (!waitForCleanup(m_engine, m_engine->usbdeinit_done)) m_engine->hanging = true;
+  }
+  // the engine has to outlive a cleanup call that did not return
+  if (m_engine->hanging) {
+    LOG(logWARNING) << "USBInterface: releasing the FTDI context timed out, leaving it allocated.";
+    return;
+  }
+  delete m_engine;
 }
 
 const char* CUSB::GetErrorMsg()
 {
-  return ftdi_get_error_string(&ftdic);
+  return ftdi_get_error_string(&m_engine->ftdic);
 }
 
 
@@ -173,7 +200,7 @@ bool CUSB::EnumFirst(uint32_t &nDevices)
 {
   struct ftdi_device_list *  	devlist;
 
-  ftdiStatus = FindAllUSB(&devlist);
+  ftdiStatus = FindAllUSB(&m_engine->ftdic, &devlist);
   if( ftdiStatus <= 0) {
     nDevices = enumCount = enumPos = 0;
     return false;
@@ -193,7 +220,7 @@ bool CUSB::EnumNext(char name[])
     return false;
   }
   struct ftdi_device_list *  	devlist;
-  ftdiStatus =  FindAllUSB(&devlist);
+  ftdiStatus =  FindAllUSB(&m_engine->ftdic, &devlist);
   if( ftdiStatus <= 0) {
     enumCount = enumPos = 0;
     return false;
@@ -206,7 +233,7 @@ bool CUSB::EnumNext(char name[])
   
   char manufacturer[128], description[128], serial[128];
 
-  if ((ftdiStatus = ftdi_usb_get_strings(&ftdic,devlist->dev, manufacturer, 128, description, 128, serial, 128)) < 0)
+  if ((ftdiStatus = ftdi_usb_get_strings(&m_engine->ftdic,devlist->dev, manufacturer, 128, description, 128, serial, 128)) < 0)
     {
       LOG(logCRITICAL) << " USBInterface::EnumNext(): Error polling USB device number " << enumPos;
       throw UsbConnectionError(" USBInterface::EnumNext(): Error polling USB device");
@@ -227,7 +254,7 @@ bool CUSB::Enum(char name[], uint32_t pos)
   }
 
   struct ftdi_device_list *  	devlist;
-  ftdiStatus =  FindAllUSB(&devlist);
+  ftdiStatus =  FindAllUSB(&m_engine->ftdic, &devlist);
   if( ftdiStatus <= 0) {
     enumCount = enumPos = 0;
     return false;
@@ -239,7 +266,7 @@ bool CUSB::Enum(char name[], uint32_t pos)
   for (uint32_t i=0; i<pos; i++) devlist = devlist->next;
   
   char manufacturer[128], description[128], serial[128];
-  if ((ftdiStatus = ftdi_usb_get_strings(&ftdic,devlist->dev, manufacturer, 128, description, 128, serial, 128)) < 0)
+  if ((ftdiStatus = ftdi_usb_get_strings(&m_engine->ftdic,devlist->dev, manufacturer, 128, description, 128, serial, 128)) < 0)
     {
       LOG(logCRITICAL) << " USBInterface::EnumNext(): Error polling USB device number " << pos;
       throw UsbConnectionError(" USBInterface::EnumNext(): Error polling USB device");
@@ -267,7 +294,7 @@ bool CUSB::Open(char serialNumber[])
 
   // open list of usb devices with the expected vendor and product ids
   struct ftdi_device_list *  	devlist;
-  ftdiStatus =  FindAllUSB(&devlist);
+  ftdiStatus =  FindAllUSB(&m_engine->ftdic, &devlist);
   
   if( ftdiStatus <= 0) {
     LOG(logCRITICAL) << " USBInterface::Open(): Error searching attached USB devices! ftdiStatus: " << ftdiStatus;
@@ -280,7 +307,7 @@ bool CUSB::Open(char serialNumber[])
   for (int32_t i=0; i<ndevices; i++) {
     char manufacturer[128], description[128], serial[128];
     if ((ftdiStatus = 
-	 ftdi_usb_get_strings(&ftdic,devlist->dev, manufacturer, 
+	 ftdi_usb_get_strings(&m_engine->ftdic,devlist->dev, manufacturer, 
 			      128, description, 128, serial, 128)) < 0){
       LOG(logDEBUGUSB) << " USBInterface::Open(): Error polling USB device number " << i;
       devlist = devlist->next;
@@ -295,7 +322,7 @@ bool CUSB::Open(char serialNumber[])
       // found the device
       LOG(logDEBUGUSB) << " USBInterface::Open(): found device with serial " << serial;
       // now open it
-      ftdiStatus = ftdi_usb_open_dev(&ftdic, devlist->dev);
+      ftdiStatus = ftdi_usb_open_dev(&m_engine->ftdic, devlist->dev);
       if( ftdiStatus < 0) {
 	/* maybe the ftdi_sio and usbserial kernel modules are attached to the device */
 	/* try to detach them using the libusb library directly */
@@ -320,7 +347,7 @@ bool CUSB::Open(char serialNumber[])
 	libusb_close(handle);
 
 	// now open it again
-	ftdiStatus = ftdi_usb_open_dev(&ftdic, devlist->dev);
+	ftdiStatus = ftdi_usb_open_dev(&m_engine->ftdic, devlist->dev);
 	if( ftdiStatus < 0) {
 	  LOG(logCRITICAL) << "FTDI returned status code " << ftdiStatus << " after attempt to detach kernel drivers ";
 	  ftdi_list_free(&devlist);
@@ -354,22 +381,21 @@ bool CUSB::Open(char serialNumber[])
 //     ftdi	pointer to ftdi_context
 //     bitmask	Bitmask to configure lines. HIGH/ON value configures a line as output.
 //     mode	Bitbang mode: use the values defined in ftdi_mpsse_mode
-  ftdiStatus = ftdi_set_bitmode(&ftdic, 0xFF, BITMODE_SYNCFF); //BITMODE_SYNCFF = 0x40, BITMODE_SYNCBB = 0x04
+  ftdiStatus = ftdi_set_bitmode(&m_engine->ftdic, 0xFF, BITMODE_SYNCFF); //BITMODE_SYNCFF = 0x40, BITMODE_SYNCBB = 0x04
   if (ftdiStatus < 0) UsbConnectionError("Error setting FTDI synchronous bit-bang mode.");
   // set the baud rate
-  ftdiStatus = ftdi_set_baudrate(&ftdic, 9600);
+  ftdiStatus = ftdi_set_baudrate(&m_engine->ftdic, 9600);
   if (ftdiStatus < 0) UsbConnectionError("Error setting FTDI baud rate.");
   // set usb transfer size parameters (see: http://www.ftdichip.com/Support/Knowledgebase/ft_setusbparameters.htm)
-  ftdiStatus = ftdi_read_data_set_chunksize(&ftdic, 4096); // default: 4096, must be multiple of 64
+  ftdiStatus = ftdi_read_data_set_chunksize(&m_engine->ftdic, 4096); // default: 4096, must be multiple of 64
   if (ftdiStatus < 0) UsbConnectionError("Error setting USB read size parameters.");
-  ftdiStatus = ftdi_write_data_set_chunksize(&ftdic, 4096); // default: 4096, must be multiple of 64
+  ftdiStatus = ftdi_write_data_set_chunksize(&m_engine->ftdic, 4096); // default: 4096, must be multiple of 64
   if (ftdiStatus < 0) UsbConnectionError("Error setting USB write size parameters.");
 
 
   // init threads for client-side data buffering
-  sem_init (&buf_data, 0, 0);
-  sem_init (&buf_space, 0, BUFSIZE);
-  pthread_create (&readerthread, NULL, reader, &ftdic);
+  m_engine->head = m_engine->tail = 0;
+  pthread_create (&m_engine->readerthread, NULL, reader, m_engine);
 
   return true;
 }
@@ -377,28 +403,24 @@ bool CUSB::Open(char serialNumber[])
 
 void CUSB::Close(){
   if( !isUSB_open) return;
-  pthread_cancel(readerthread);
+  pthread_cancel(m_engine->readerthread);
   usleep(10000);
-  // join reader thread and clean up semaphores
-  pthread_join(readerthread, NULL);
-  sem_destroy (&buf_data);
-  sem_destroy (&buf_space);
+  // join reader thread
+  pthread_join(m_engine->readerthread, NULL);
   usleep(10000);
   // set the flag (lock mutex first)
-  pthread_mutex_lock(&cleanup_mutex); usbclose_done = false; pthread_mutex_unlock(&cleanup_mutex);
+  {
+    pxar::lock_guard lock(m_engine->cleanup_mutex);
+    m_engine->usbclose_done = false;
+  }
   // create cleanup thread to allow timeout on call to device (might hang)
-  pthread_create (&usbclose_thread, NULL, usbclose, &ftdic);
-  bool done = false;
-  for (int time = 0; time<1000;time++){
-    usleep(1000); // wait 1ms
-    // check status and break if usbdevice is closed
-    pthread_mutex_lock(&cleanup_mutex);  // lock mutex
-    if (usbclose_done) {
-      //successfully closed usb connection
-      done = true; }
-    pthread_mutex_unlock(&cleanup_mutex); // unlock mutex
-    if (done) break;}
-  //WARNING: closing the USB connection timed out!
+  pthread_t usbclose_thread;
+  pthread_create (&usbclose_thread, NULL, usbclose, m_engine);
+  pthread_detach(usbclose_thread);
+  if (!waitForCleanup(m_engine, m_engine->usbclose_done)) {
+    LOG(logWARNING) << "USBInterface: closing the USB connection timed out!";
+    m_engine->hanging = true;
+  }
   isUSB_open = 0;
 }
 
@@ -429,7 +451,7 @@ void CUSB::Flush()
 
   if( !bytesToWrite) return;
 
-  ftdiStatus = ftdi_write_data(&ftdic, m_bufferW, bytesToWrite);
+  ftdiStatus = ftdi_write_data(&m_engine->ftdic, m_bufferW, bytesToWrite);
 
   if( ftdiStatus < 0)  throw UsbConnectionError("USB write failed");
   if( ftdiStatus != bytesToWrite) { 
@@ -449,34 +471,34 @@ void CUSB::Read(uint32_t bytesToRead, void *buffer, uint32_t &bytesRead)
 {
   if (!isUSB_open) throw UsbConnectionError("Attempt to read from USB without open connection.");
  
-   // Copy over data from the circular buffer
+   // Copy over data from the circular buffer in contiguous blocks
     uint32_t timewasted = 0; // time in ms wasted in this routine
 
     uint32_t bytesReadSoFar = 0;
-      for (uint32_t i=0; i<bytesToRead; i++) {
-	bool bufferready = true;
-	if (tail == head) bufferready = false;
-	if (!bufferready){
-	  while (!bufferready && timewasted<m_timeout){
+      while (bytesReadSoFar < bytesToRead) {
+	uint32_t available = 0;
+	{
+	  pxar::lock_guard lock(m_engine->buf_mutex);
+	  while (m_engine->tail == m_engine->head && timewasted<m_timeout){
 	    if (timewasted==(m_timeout/10)) {
 	      LOG(logWARNING) << "USBInterface: Read(): data not ready (got " << bytesReadSoFar << "b of "<< bytesToRead <<"b) after " << timewasted << "ms yet! Will wait for up to " << m_timeout << "ms";
 	    }
-	    usleep(1000); //wait 1 ms
-	    timewasted++;
-	    if (tail != head) bufferready = true;	    
+	    // wait up to 1 ms, woken up by the reader thread as soon as data arrives
+	    if (!m_engine->buf_data.wait(m_engine->buf_mutex, 1)) timewasted++;
 	  }
+	  available = (m_engine->head >= m_engine->tail ? m_engine->head - m_engine->tail : BUFSIZE - m_engine->tail);
 	}
-	if (bufferready){
-	  sem_wait (&buf_data);	
-	  ((unsigned char*)buffer)[i] = read_buffer[tail];
-	  if (tail == (BUFSIZE -1)) tail = 0;
-	  else                      tail++;
-	  sem_post (&buf_space);
-	  bytesReadSoFar++;
+	if (available > 0){
+	  uint32_t n = bytesToRead - bytesReadSoFar;
+	  if (n > available) n = available;
+	  memcpy((unsigned char*)buffer + bytesReadSoFar, &m_engine->read_buffer[m_engine->tail], n);
+	  bytesReadSoFar += n;
+	  pxar::lock_guard lock(m_engine->buf_mutex);
+	  m_engine->tail = (m_engine->tail + n) % BUFSIZE;
 	} 
 	else // buffer was not ready and reading it timed out so we stop attempting it now
 	  {
-	    bytesRead = i;
+	    bytesRead = bytesReadSoFar;
 	    LOG(logCRITICAL) << " Timeout reading from USB buffer after " << m_timeout << " ms ";
 	    if (bytesRead < bytesToRead) {
 	      LOG(logCRITICAL) << "Requested to read " << bytesToRead 
@@ -495,13 +517,12 @@ void CUSB::Clear()
 {
   if( !isUSB_open) return;
 
-  ftdiStatus = ftdi_usb_purge_buffers(&ftdic);
+  ftdiStatus = ftdi_usb_purge_buffers(&m_engine->ftdic);
 
   // drain our buffer.
-  while (head != tail) {
-    unsigned char t;
-    uint32_t n;
-    Read(1, &t, n);
+  {
+    pxar::lock_guard lock(m_engine->buf_mutex);
+    m_engine->tail = m_engine->head;
   }
 
   m_posR = m_sizeR = 0;
@@ -519,8 +540,9 @@ bool CUSB::Show()
   LOG(logINFO) << "  - max timeout for read calls set to " << m_timeout << "ms";
 
   unsigned char latency;
-  if (ftdi_get_latency_timer(&ftdic,&latency)==0){ LOG(logINFO) << "  - FTDI latency timer set to " << (int) latency;}
-  LOG(logINFO) << "  - data waiting in local read buffer: " << !(tail == head);
+  if (ftdi_get_latency_timer(&m_engine->ftdic,&latency)==0){ LOG(logINFO) << "  - FTDI latency timer set to " << (int) latency;}
+  pxar::lock_guard lock(m_engine->buf_mutex);
+  LOG(logINFO) << "  - data waiting in local read buffer: " << (m_engine->head >= m_engine->tail ? m_engine->head - m_engine->tail : BUFSIZE - m_engine->tail + m_engine->head) << "b";
  
   return true;
 }
@@ -0,0 +1,615 @@
+#include <libusb.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "log.h"
+#include "exceptions.h"
+#include "threading.h"
+
+#include "USBInterface.h"
+
+// This implementation talks to the FTDI chip of the testboard directly with
+// asynchronous libusb bulk transfers: several read transfers are kept in
+// flight at all times and an event thread moves their payload into a ring
+// buffer, from where CUSB::Read picks it up without polling delays.
+
+#define BUFSIZE 0x200000
+
+const uint16_t productID_FT232H = 0x6014; // new testboard FTDI chip product id (FT232H)
+const uint16_t productID_OLD = 0x6001; //  single channel devices (R Chips) used in older test boards
+const uint16_t vendorID = 0x0403; // Future Technology Devices International, Ltd
+
+// endpoints and index of FTDI interface A
+const unsigned char endpointIn = 0x81;
+const unsigned char endpointOut = 0x02;
+const uint16_t ftdiIndex = 1;
+
+// FTDI vendor requests (see libftdi ftdi.h)
+const uint8_t ftdiRequestOut = LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_OUT;
+const uint8_t SIO_RESET_REQUEST = 0x00;
+const uint8_t SIO_SET_LATENCY_TIMER_REQUEST = 0x09;
+const uint8_t SIO_SET_BITMODE_REQUEST = 0x0B;
+const uint16_t SIO_RESET_SIO = 0;
+const uint16_t SIO_RESET_PURGE_RX = 1;
+const uint16_t SIO_RESET_PURGE_TX = 2;
+const uint16_t BITMODE_RESET = 0x00;
+const uint16_t BITMODE_SYNCFF = 0x40;
+
+// the FTDI chip flushes short packets after this many ms
+const uint16_t latencyTimer = 2;
+// every packet read from the FTDI chip starts with two modem status bytes
+const uint32_t modemStatusSize = 2;
+
+// number and size of transfers in flight
+const unsigned int nReadTransfers = 8;
+const uint32_t readTransferSize = 0x4000;
+const unsigned int nWriteTransfers = 2;
+
+// control transfer timeout in ms
+const unsigned int controlTimeout = 1000;
+
+using namespace std;
+using namespace pxar;
+
+struct CUSBTransferEngine {
+  libusb_context *context;
+  libusb_device_handle *handle;
+  uint32_t packetSize;
+
+  pxar::thread eventThread;
+  // stop: no more read transfers are submitted, the event
+  // thread keeps running until quit is set
+  volatile bool stop, quit;
+
+  pxar::mutex m;
+  pxar::condition dataReady, transferDone;
+
+  // ring buffer with the payload of the read transfers
+  unsigned char ring[BUFSIZE];
+  uint32_t head, tail;
+
+  vector<libusb_transfer*> readTransfers;
+  // read transfers waiting for space in the ring buffer
+  vector<libusb_transfer*> parked;
+  unsigned int readsInFlight;
+  int readError;
+
+  vector<libusb_transfer*> writeTransfers;
+  vector<libusb_transfer*> freeWrites;
+  int writeError;
+
+  CUSBTransferEngine() : context(NULL), handle(NULL), packetSize(512), stop(false), quit(false),
+		     head(0), tail(0), readsInFlight(0), readError(0), writeError(0) {}
+
+  uint32_t filled() { return (head >= tail ? head - tail : BUFSIZE - tail + head); }
+  // space left in the ring buffer for read transfers not yet in flight
+  uint32_t unreserved() {
+    uint32_t space = BUFSIZE - 1 - filled();
+    uint32_t reserved = readsInFlight*readTransferSize;
+    return (space > reserved ? space - reserved : 0);
+  }
+};
+
+static void eventLoop(void *arg) {
+  CUSBTransferEngine *e = static_cast<CUSBTransferEngine*>(arg);
+  while (!e->quit) {
+    struct timeval tv = {0, 100000};
+    libusb_handle_events_timeout_completed(e->context, &tv, NULL);
+  }
+}
+
+// submit the given read transfers, the space in the ring buffer
+// has already been reserved for them
+static void submitReads(CUSBTransferEngine *e, const vector<libusb_transfer*> &transfers) {
+  for (size_t i = 0; i < transfers.size(); i++) {
+    int status = libusb_submit_transfer(transfers[i]);
+    if (status != 0) {
+      pxar::lock_guard lock(e->m);
+      e->readsInFlight--;
+      e->readError = status;
+      e->dataReady.notify_all();
+      e->transferDone.notify_all();
+    }
+  }
+}
+
+// take parked read transfers for which the ring buffer has space now
+static vector<libusb_transfer*> unpark(CUSBTransferEngine *e) {
+  vector<libusb_transfer*> resubmit;
+  while (!e->stop && !e->parked.empty() && e->unreserved() >= readTransferSize) {
+    resubmit.push_back(e->parked.back());
+    e->parked.pop_back();
+    e->readsInFlight++;
+  }
+  return resubmit;
+}
+
+static void LIBUSB_CALL readCallback(libusb_transfer *t) {
+  CUSBTransferEngine *e = static_cast<CUSBTransferEngine*>(t->user_data);
+  vector<libusb_transfer*> resubmit;
+  {
+    pxar::lock_guard lock(e->m);
+    e->readsInFlight--;
+
+    if (t->status == LIBUSB_TRANSFER_COMPLETED) {
+      // strip the modem status bytes from every packet:
+      for (int pos = 0; pos < t->actual_length; pos += e->packetSize) {
+	uint32_t packet = min(static_cast<uint32_t>(t->actual_length - pos), e->packetSize);
+	if (packet <= modemStatusSize) continue;
+	unsigned char *data = t->buffer + pos + modemStatusSize;
+	uint32_t n = packet - modemStatusSize;
+	uint32_t first = min(n, BUFSIZE - e->head);
+	memcpy(&e->ring[e->head], data, first);
+	if (n > first) memcpy(&e->ring[0], data + first, n - first);
+	e->head = (e->head + n) % BUFSIZE;
+      }
+      e->dataReady.notify_all();
+      if (!e->stop) e->parked.push_back(t);
+      resubmit = unpark(e);
+    }
+    else if (t->status != LIBUSB_TRANSFER_CANCELLED) {
+      e->readError = (t->status == LIBUSB_TRANSFER_NO_DEVICE ? LIBUSB_ERROR_NO_DEVICE : LIBUSB_ERROR_IO);
+      e->dataReady.notify_all();
+    }
+    e->transferDone.notify_all();
+  }
+  submitReads(e, resubmit);
+}
+
+static void LIBUSB_CALL writeCallback(libusb_transfer *t) {
+  CUSBTransferEngine *e = static_cast<CUSBTransferEngine*>(t->user_data);
+  pxar::lock_guard lock(e->m);
+  if (t->status != LIBUSB_TRANSFER_COMPLETED || t->actual_length != t->length) {
+    e->writeError = (t->status == LIBUSB_TRANSFER_TIMED_OUT ? LIBUSB_ERROR_TIMEOUT : LIBUSB_ERROR_IO);
+  }
+  e->freeWrites.push_back(t);
+  e->transferDone.notify_all();
+}
+
+static int ftdiControl(libusb_device_handle *handle, uint8_t request, uint16_t value) {
+  return libusb_control_transfer(handle, ftdiRequestOut, request, value, ftdiIndex, NULL, 0, controlTimeout);
+}
+
+// serial numbers of all attached testboards, with the devices in the same order
+static int FindAllUSB(libusb_context *context, vector<string> &serials, vector<libusb_device*> *devices = NULL) {
+  serials.clear();
+  libusb_device **list;
+  ssize_t ndev = libusb_get_device_list(context, &list);
+  if (ndev < 0) return static_cast<int>(ndev);
+
+  for (ssize_t i = 0; i < ndev; i++) {
+    libusb_device_descriptor desc;
+    if (libusb_get_device_descriptor(list[i], &desc) != 0) continue;
+    if (desc.idVendor != vendorID) continue;
+    if (desc.idProduct != productID_FT232H && desc.idProduct != productID_OLD) continue;
+
+    libusb_device_handle *handle;
+    if (libusb_open(list[i], &handle) != 0) {
+      LOG(logDEBUGUSB) << " USBInterface: could not open USB device " << i << " to read its serial number";
+      continue;
+    }
+    unsigned char serial[128];
+    int status = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial, sizeof(serial));
+    libusb_close(handle);
+    if (status < 0) continue;
+
+    serials.push_back(string(reinterpret_cast<char*>(serial), status));
+    if (devices) devices->push_back(libusb_ref_device(list[i]));
+  }
+  libusb_free_device_list(list, 1);
+  return static_cast<int>(serials.size());
+}
+
+
+
+CUSB::CUSB(){
+  m_posR = m_sizeR = m_posW = 0;
+  m_timeout = 150000; // maximum time to wait for read call in ms
+  isUSB_open = false;
+  enumPos = enumCount = 0;
+  m_engine = new CUSBTransferEngine();
+  ftdiStatus = libusb_init(&m_engine->context);
+  if (ftdiStatus < 0) {
+    LOG(logCRITICAL) <<  "USBInterface constructor: libusb_init failed";
+    delete m_engine;
+    throw UsbConnectionError("USBInterface constructor: libusb_init failed");
+  }
+}
+
+CUSB::~CUSB(){
+  if (isUSB_open) Close();
+  libusb_exit(m_engine->context);
+  delete m_engine;
+}
+
+const char* CUSB::GetErrorMsg()
+{
+  return libusb_error_name(ftdiStatus);
+}
+
+
+bool CUSB::EnumFirst(uint32_t &nDevices)
+{
+  vector<string> serials;
+  ftdiStatus = FindAllUSB(m_engine->context, serials);
+  if (ftdiStatus <= 0) {
+    nDevices = enumCount = enumPos = 0;
+    return false;
+  }
+  enumCount = nDevices = ftdiStatus;
+  enumPos = 0;
+  return true;
+}
+
+
+bool CUSB::EnumNext(char name[])
+{
+  if (isUSB_open) {
+    LOG(logWARNING) << " Warning: Trying to call USBInterface::EnumNext() while other USB device is still open";
+    return false;
+  }
+  if (!Enum(name, enumPos)) return false;
+  enumPos++;
+  return true;
+}
+
+
+bool CUSB::Enum(char name[], uint32_t pos)
+{
+  if (isUSB_open) {
+    LOG(logWARNING) << " Warning: Trying to call USBInterface::Enum() while other USB device still open";
+    return false;
+  }
+
+  vector<string> serials;
+  ftdiStatus = FindAllUSB(m_engine->context, serials);
+  if (ftdiStatus <= 0) {
+    enumCount = enumPos = 0;
+    return false;
+  }
+  enumCount = ftdiStatus;
+  if (pos >= enumCount) return false;
+
+  strcpy(name, serials[pos].c_str()); // return device string information for a single device
+  enumPos = pos;
+  return true;
+}
+
+
+
+bool CUSB::Open(char serialNumber[])
+{
+  if (isUSB_open) {
+    LOG(logWARNING) << " Warning: Trying to open new USB device while other device still open";
+    return false;
+  }
+
+  LOG(logDEBUGUSB) << " USBInterface::Open(): searching for device with serial number: '" << serialNumber << "'";
+
+  // reset buffer index positions
+  m_posR = m_sizeR = m_posW = 0;
+
+  vector<string> serials;
+  vector<libusb_device*> devices;
+  ftdiStatus = FindAllUSB(m_engine->context, serials, &devices);
+  if (ftdiStatus < 0) {
+    LOG(logCRITICAL) << " USBInterface::Open(): Error searching attached USB devices! libusb status: " << ftdiStatus;
+    throw UsbConnectionError(" USBInterface::Open(): Error searching attached USB devices!");
+  }
+
+  libusb_device *device = NULL;
+  for (size_t i = 0; i < serials.size(); i++) {
+    if (!device && (serials[i] == serialNumber || strcmp(serialNumber, "*") == 0)) {
+      LOG(logDEBUGUSB) << " USBInterface::Open(): found device with serial " << serials[i];
+      device = devices[i];
+    }
+    else {
+      LOG(logDEBUGUSB) << " USBInterface::Open(): found non-matching device with serial number: '" << serials[i] << "'";
+      libusb_unref_device(devices[i]);
+    }
+  }
+  if (!device) {
+    LOG(logWARNING) << "DTB with serial '" << serialNumber <<  "' not found! :-( ";
+    return false;
+  }
+
+  CUSBTransferEngine *e = m_engine;
+  ftdiStatus = libusb_open(device, &e->handle);
+  libusb_unref_device(device);
+  if (ftdiStatus != 0) {
+    LOG(logCRITICAL) << "libusb returned status code " << ftdiStatus << ", could not get USB device handle ";
+    throw UsbConnectionError("Could not get USB device handle, libusb returned error.");
+  }
+
+  // detach the ftdi_sio and usbserial kernel modules if they are attached to the device
+  if (libusb_kernel_driver_active(e->handle, 0) == 1) {
+    if (libusb_detach_kernel_driver(e->handle, 0) == 0) {
+      LOG(logDEBUGUSB) << " Detached kernel driver from selected testboard. ";
+    } else {
+      LOG(logDEBUGUSB) << "Unable to detach kernel driver from selected testboard.";
+    }
+  }
+
+  ftdiStatus = libusb_claim_interface(e->handle, 0);
+  if (ftdiStatus != 0) {
+    LOG(logCRITICAL) << "libusb returned status code " << ftdiStatus << " when claiming the FTDI interface";
+    libusb_close(e->handle);
+    throw UsbConnectionError("Could not claim USB interface, libusb returned error.");
+  }
+
+  // set synchronous FIFO mode (see: http://www.ftdichip.com/Support/Documents/DataSheets/ICs/DS_FT232H.pdf page 34ff)
+  if (ftdiControl(e->handle, SIO_RESET_REQUEST, SIO_RESET_SIO) < 0
+      || ftdiControl(e->handle, SIO_SET_LATENCY_TIMER_REQUEST, latencyTimer) < 0
+      || ftdiControl(e->handle, SIO_SET_BITMODE_REQUEST, 0xFF | (BITMODE_RESET << 8)) < 0
+      || ftdiControl(e->handle, SIO_SET_BITMODE_REQUEST, 0xFF | (BITMODE_SYNCFF << 8)) < 0
+      || ftdiControl(e->handle, SIO_RESET_REQUEST, SIO_RESET_PURGE_RX) < 0
+      || ftdiControl(e->handle, SIO_RESET_REQUEST, SIO_RESET_PURGE_TX) < 0) {
+    LOG(logCRITICAL) << "Error setting FTDI synchronous FIFO mode.";
+    libusb_release_interface(e->handle, 0);
+    libusb_close(e->handle);
+    throw UsbConnectionError("Error setting FTDI synchronous FIFO mode.");
+  }
+  int packetSize = libusb_get_max_packet_size(libusb_get_device(e->handle), endpointIn);
+  e->packetSize = (packetSize > 0 ? packetSize : 512);
+
+  // allocate the transfers and start the event thread
+  e->stop = e->quit = false;
+  e->head = e->tail = 0;
+  e->readError = e->writeError = 0;
+  e->parked.clear();
+  e->freeWrites.clear();
+  for (unsigned int i = 0; i < nReadTransfers; i++) {
+    libusb_transfer *t = libusb_alloc_transfer(0);
+    libusb_fill_bulk_transfer(t, e->handle, endpointIn, new unsigned char[readTransferSize], readTransferSize, readCallback, e, 0);
+    e->readTransfers.push_back(t);
+  }
+  for (unsigned int i = 0; i < nWriteTransfers; i++) {
+    libusb_transfer *t = libusb_alloc_transfer(0);
+    libusb_fill_bulk_transfer(t, e->handle, endpointOut, new unsigned char[USBWRITEBUFFERSIZE], 0, writeCallback, e, 0);
+    e->writeTransfers.push_back(t);
+    e->freeWrites.push_back(t);
+  }
+  if (!e->eventThread.start(&eventLoop, e)) {
+    LOG(logCRITICAL) << "Could not start the USB event thread.";
+    throw UsbConnectionError("Could not start the USB event thread.");
+  }
+
+  e->readsInFlight = nReadTransfers;
+  submitReads(e, e->readTransfers);
+
+  isUSB_open = true;
+  LOG(logDEBUGUSB) << " libusb successfully opened connection to device ";
+  return true;
+}
+
+
+void CUSB::Close(){
+  if (!isUSB_open) return;
+  CUSBTransferEngine *e = m_engine;
+
+  // cancel all transfers and give them up to 1 s to complete
+  {
+    pxar::lock_guard lock(e->m);
+    e->stop = true;
+    e->parked.clear();
+  }
+  for (int time = 0; time < 10; time++) {
+    // cancel again each time, a callback may have resubmitted a transfer meanwhile
+    for (size_t i = 0; i < e->readTransfers.size(); i++) libusb_cancel_transfer(e->readTransfers[i]);
+    pxar::lock_guard lock(e->m);
+    if (e->readsInFlight == 0 && e->freeWrites.size() == e->writeTransfers.size()) break;
+    e->transferDone.wait(e->m, 100);
+  }
+  if (e->readsInFlight != 0 || e->freeWrites.size() != e->writeTransfers.size()) {
+    LOG(logWARNING) << "Closing the USB connection timed out!";
+  }
+  e->quit = true;
+  e->eventThread.join();
+
+  // the transfers are only freed when they are no longer in flight
+  bool done = (e->readsInFlight == 0 && e->freeWrites.size() == e->writeTransfers.size());
+  libusb_release_interface(e->handle, 0);
+  libusb_close(e->handle);
+  e->handle = NULL;
+  if (done) {
+    for (size_t i = 0; i < e->readTransfers.size(); i++) {
+      delete[] e->readTransfers[i]->buffer;
+      libusb_free_transfer(e->readTransfers[i]);
+    }
+    for (size_t i = 0; i < e->writeTransfers.size(); i++) {
+      delete[] e->writeTransfers[i]->buffer;
+      libusb_free_transfer(e->writeTransfers[i]);
+    }
+  }
+  e->readTransfers.clear();
+  e->writeTransfers.clear();
+  e->freeWrites.clear();
+  isUSB_open = 0;
+}
+
+void CUSB::WriteCommand(unsigned char x){
+  const unsigned char CommandChar = ESC_EXTENDED;
+  Write(sizeof(char), &CommandChar); // ESC_EXTENDED
+  Write(sizeof(char),&x);
+}
+
+void CUSB::Write(uint32_t bytesToWrite, const void *buffer)
+{
+  if (!isUSB_open) throw UsbConnectionError("Attempt to write to USB without open connection.");
+  const unsigned char *p = static_cast<const unsigned char*>(buffer);
+  while (bytesToWrite > 0) {
+    if (m_posW >= USBWRITEBUFFERSIZE) { Flush(); }
+    uint32_t n = min(bytesToWrite, USBWRITEBUFFERSIZE - m_posW);
+    memcpy(&m_bufferW[m_posW], p, n);
+    m_posW += n;
+    p += n;
+    bytesToWrite -= n;
+  }
+}
+
+
+void CUSB::Flush()
+{
+  int32_t bytesToWrite = m_posW;
+  m_posW = 0;
+
+  if (!isUSB_open) throw UsbConnectionError("Attempt to write to USB without open connection.");
+
+  if (!bytesToWrite) return;
+
+  // the buffer is handed over to a write transfer, we only wait if both
+  // transfers are still busy with earlier data
+  CUSBTransferEngine *e = m_engine;
+  libusb_transfer *t = NULL;
+  {
+    pxar::lock_guard lock(e->m);
+    uint32_t timewasted = 0;
+    while (e->freeWrites.empty() && !e->writeError && timewasted < m_timeout) {
+      if (!e->transferDone.wait(e->m, 1)) timewasted++;
+    }
+    if (e->writeError) {
+      ftdiStatus = e->writeError;
+      e->writeError = 0;
+      throw UsbConnectionError("USB write failed");
+    }
+    if (e->freeWrites.empty()) {
+      LOG(logCRITICAL) << " Timeout writing to USB after " << m_timeout << " ms ";
+      throw UsbConnectionTimeout("Timeout writing to USB");
+    }
+    t = e->freeWrites.back();
+    e->freeWrites.pop_back();
+  }
+
+  memcpy(t->buffer, m_bufferW, bytesToWrite);
+  t->length = bytesToWrite;
+  t->timeout = m_timeout;
+  ftdiStatus = libusb_submit_transfer(t);
+  if (ftdiStatus != 0) {
+    pxar::lock_guard lock(e->m);
+    e->freeWrites.push_back(t);
+    throw UsbConnectionError("USB write failed");
+  }
+}
+
+bool CUSB::FillBuffer(uint32_t /*minBytesToRead*/)
+{
+  LOG(logWARNING) << " USBInterface: FillBuffer() called but this function is not implemented for libusb ";
+  return true;
+}
+
+
+void CUSB::Read(uint32_t bytesToRead, void *buffer, uint32_t &bytesRead)
+{
+  if (!isUSB_open) throw UsbConnectionError("Attempt to read from USB without open connection.");
+  CUSBTransferEngine *e = m_engine;
+
+  // Copy over data from the ring buffer in contiguous blocks
+  uint32_t timewasted = 0; // time in ms wasted in this routine
+
+  bytesRead = 0;
+  while (bytesRead < bytesToRead) {
+    uint32_t available = 0;
+    {
+      pxar::lock_guard lock(e->m);
+      while (e->tail == e->head && !e->readError && timewasted < m_timeout) {
+	if (timewasted == (m_timeout/10)) {
+	  LOG(logWARNING) << "USBInterface: Read(): data not ready (got " << bytesRead << "b of "<< bytesToRead <<"b) after " << timewasted << "ms yet! Will wait for up to " << m_timeout << "ms";
+	}
+	// wait up to 1 ms, woken up by the event thread as soon as data arrives
+	if (!e->dataReady.wait(e->m, 1)) timewasted++;
+      }
+      available = (e->head >= e->tail ? e->head - e->tail : BUFSIZE - e->tail);
+      if (available == 0 && e->readError) {
+	ftdiStatus = e->readError;
+	LOG(logCRITICAL) << "ERROR during USB read: " << libusb_error_name(ftdiStatus);
+	throw UsbConnectionError("ERROR during USB read");
+      }
+    }
+    if (available == 0) { // reading the buffer timed out so we stop attempting it now
+      LOG(logCRITICAL) << " Timeout reading from USB buffer after " << m_timeout << " ms ";
+      LOG(logCRITICAL) << "Requested to read " << bytesToRead
+		       << "b, actually read  " << bytesRead
+		       << "b - " << (bytesToRead-bytesRead) << "b missing!";
+      throw UsbConnectionTimeout("Timeout reading from USB");
+    }
+
+    uint32_t n = min(bytesToRead - bytesRead, available);
+    memcpy(static_cast<unsigned char*>(buffer) + bytesRead, &e->ring[e->tail], n);
+    bytesRead += n;
+
+    vector<libusb_transfer*> resubmit;
+    {
+      pxar::lock_guard lock(e->m);
+      e->tail = (e->tail + n) % BUFSIZE;
+      resubmit = unpark(e);
+    }
+    submitReads(e, resubmit);
+  }
+}
+
+//----------------------------------------------------------------------
+void CUSB::Clear()
+{
+  if (!isUSB_open) return;
+
+  ftdiStatus = ftdiControl(m_engine->handle, SIO_RESET_REQUEST, SIO_RESET_PURGE_RX);
+  ftdiStatus = ftdiControl(m_engine->handle, SIO_RESET_REQUEST, SIO_RESET_PURGE_TX);
+
+  // drain our buffer.
+  vector<libusb_transfer*> resubmit;
+  {
+    pxar::lock_guard lock(m_engine->m);
+    m_engine->tail = m_engine->head;
+    resubmit = unpark(m_engine);
+  }
+  submitReads(m_engine, resubmit);
+
+  m_posR = m_sizeR = 0;
+  m_posW = 0;
+}
+
+//----------------------------------------------------------------------
+bool CUSB::Show()
+{
+  LOG(logINFO) << " USB status: ";
+  if (!isUSB_open) {
+    LOG(logINFO) << "  - USB connection not open ";
+    return false;
+  }
+  LOG(logINFO) << "  - max timeout for read calls set to " << m_timeout << "ms";
+  LOG(logINFO) << "  - FTDI latency timer set to " << latencyTimer;
+
+  pxar::lock_guard lock(m_engine->m);
+  LOG(logINFO) << "  - read transfers in flight: " << m_engine->readsInFlight << " of " << nReadTransfers;
+  LOG(logINFO) << "  - data waiting in local read buffer: " << m_engine->filled() << "b";
+  return true;
+}
+
+void CUSB::SetTimeout(unsigned int timeout)
+{
+  m_timeout = timeout;
+}
+
+//----------------------------------------------------------------------
+void CUSB::Read_String(char *s, uint16_t maxlength)
+{
+  char ch = 0;
+  uint16_t i=0;
+  do {
+    Read_CHAR(ch);
+    if (i<maxlength) { s[i] = ch; i++; }
+  }
+  while (ch != 0);
+  if (i >= maxlength) s[maxlength-1] = 0;
+}
+
+
+void CUSB::Write_String(const char *s)
+{
+  do {
+    Write_CHAR(*s);
+    s++;
+  }
+  while (*s != 0);
+}
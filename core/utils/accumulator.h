@@ -0,0 +1,266 @@
+/* This file contains the dense per-pixel accumulator used by the API
+   to condense the pixel hits of repeated triggers and the dense edge
+   search used to extract thresholds from DAC scans */
+
+#ifndef PXAR_ACCUMULATOR_H
+#define PXAR_ACCUMULATOR_H
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include "datatypes.h"
+#include "constants.h"
+
+namespace pxar {
+
+  /** Flat per-pixel accumulator indexed by roc_id*4160 + column*80 + row
+   *
+   *  Stores the number of hits and the running mean and sum of squared
+   *  differences (Welford) of the pulse height for every pixel in contiguous
+   *  arrays, so filling a hit is O(1). The pixels touched since the last
+   *  Clear() are remembered in order of their first appearance, so Get()
+   *  returns them in the same order as the previous linear search did.
+   */
+  class pixelAccumulator {
+  public:
+  pixelAccumulator(uint8_t nrocs = MOD_NUMROCS) : _count(), _mean(), _m2(), _touched() { resize(nrocs); }
+
+    /** Add one pixel hit to the accumulator
+     */
+    void Fill(const pixel & px) {
+      if(px.column >= ROC_NUMCOLS || px.row >= ROC_NUMROWS) return;
+      if(px.roc_id >= _nrocs) resize(px.roc_id + 1);
+
+      size_t idx = index(px.roc_id, px.column, px.row);
+      double value = px.getValue();
+      if(_count[idx] == 0) {
+	_touched.push_back(static_cast<uint32_t>(idx));
+	_count[idx] = 1;
+	_mean[idx] = value;
+	_m2[idx] = 0;
+	return;
+      }
+      // Calculate the variance incrementally:
+      _count[idx]++;
+      double delta = value - _mean[idx];
+      _mean[idx] += delta/_count[idx];
+      _m2[idx] += delta*(value - _mean[idx]);
+    }
+
+    /** Add all pixel hits of an Event to the accumulator
+     */
+    void Fill(const Event & evt) {
+      for(std::vector<pixel>::const_iterator px = evt.pixels.begin(); px != evt.pixels.end(); ++px) { Fill(*px); }
+    }
+
+    /** Append all touched pixels to the given vector, in order of first
+     *  appearance. Efficiency returns the number of hits as value, otherwise
+     *  the mean pulse height and its variance are returned.
+     */
+    void Get(std::vector<pixel> & pixels, bool efficiency) const {
+      pixels.reserve(pixels.size() + _touched.size());
+      for(std::vector<uint32_t>::const_iterator it = _touched.begin(); it != _touched.end(); ++it) {
+	uint8_t roc = static_cast<uint8_t>(*it/(ROC_NUMCOLS*ROC_NUMROWS));
+	uint8_t column = static_cast<uint8_t>((*it/ROC_NUMROWS)%ROC_NUMCOLS);
+	uint8_t row = static_cast<uint8_t>(*it%ROC_NUMROWS);
+	if(efficiency) { pixels.push_back(pixel(roc,column,row,_count[*it])); }
+	else {
+	  pixel px(roc,column,row,_mean[*it]);
+	  px.setVariance(_count[*it] > 1 ? _m2[*it]/(_count[*it] - 1) : 0);
+	  pixels.push_back(px);
+	}
+      }
+    }
+
+    /** Reset all touched pixels, the cost scales with the number of
+     *  pixels filled and not with the size of the accumulator
+     */
+    void Clear() {
+      for(std::vector<uint32_t>::const_iterator it = _touched.begin(); it != _touched.end(); ++it) { _count[*it] = 0; }
+      _touched.clear();
+    }
+
+    /** Number of distinct pixels filled since the last Clear()
+     */
+    size_t size() const { return _touched.size(); }
+    bool empty() const { return _touched.empty(); }
+
+  private:
+    static size_t index(uint8_t roc, uint8_t column, uint8_t row) {
+      return (static_cast<size_t>(roc)*ROC_NUMCOLS + column)*ROC_NUMROWS + row;
+    }
+
+    void resize(size_t nrocs) {
+      _nrocs = nrocs;
+      _count.resize(nrocs*ROC_NUMCOLS*ROC_NUMROWS, 0);
+      _mean.resize(nrocs*ROC_NUMCOLS*ROC_NUMROWS, 0);
+      _m2.resize(nrocs*ROC_NUMCOLS*ROC_NUMROWS, 0);
+    }
+
+    size_t _nrocs;
+    std::vector<uint32_t> _count;
+    std::vector<double> _mean;
+    std::vector<double> _m2;
+    std::vector<uint32_t> _touched;
+  };
+
+  /** Dense per-pixel threshold edge search
+   *
+   *  Fed with the efficiency of all pixels DAC point by DAC point, in scan
+   *  order for a rising edge and reversed for a falling edge. For every
+   *  pixel the DAC value with the efficiency closest to the threshold level
+   *  on a positive slope is kept. The state is stored in flat arrays indexed
+   *  like the pixelAccumulator, so every hit is O(1). Pixels are returned in
+   *  order of their first appearance with the DAC value as value.
+   */
+  class thresholdSearch {
+  public:
+  thresholdSearch(uint16_t threshold, uint8_t nrocs = MOD_NUMROCS) : _threshold(threshold), _slot(), _found(), _level() { resize(nrocs); }
+
+    /** Add the efficiency of one pixel at the given DAC value
+     */
+    void Fill(const pixel & px, uint8_t dac) {
+      if(px.column >= ROC_NUMCOLS || px.row >= ROC_NUMROWS) return;
+      if(px.roc_id >= _nrocs) resize(px.roc_id + 1);
+
+      int32_t & slot = _slot[index(px.roc_id, px.column, px.row)];
+      int32_t value = static_cast<int32_t>(px.getValue());
+      // Pixel is new, store it with the current DAC:
+      if(slot < 0) {
+	slot = static_cast<int32_t>(_found.size());
+	_found.push_back(px);
+	_found.back().setValue(dac);
+	_level.push_back(value);
+	return;
+      }
+      // Only take the new DAC on a rising efficiency closer to the threshold:
+      int32_t & level = _level[slot];
+      if(value <= level) return;
+      if(abs(value - _threshold) >= abs(level - _threshold)) return;
+      _found[slot].setValue(dac);
+      level = value;
+    }
+
+    /** Append the pixels found so far with their threshold DAC value
+     */
+    void Get(std::vector<pixel> & pixels) const {
+      pixels.insert(pixels.end(), _found.begin(), _found.end());
+    }
+
+    /** Reset all pixels found, keeping the allocated memory
+     */
+    void Clear() {
+      for(std::vector<pixel>::const_iterator px = _found.begin(); px != _found.end(); ++px) {
+	_slot[index(px->roc_id, px->column, px->row)] = -1;
+      }
+      _found.clear();
+      _level.clear();
+    }
+
+    /** Number of distinct pixels found since the last Clear()
+     */
+    size_t size() const { return _found.size(); }
+
+  private:
+    static size_t index(uint8_t roc, uint8_t column, uint8_t row) {
+      return (static_cast<size_t>(roc)*ROC_NUMCOLS + column)*ROC_NUMROWS + row;
+    }
+
+    void resize(size_t nrocs) {
+      _nrocs = nrocs;
+      _slot.resize(nrocs*ROC_NUMCOLS*ROC_NUMROWS, -1);
+    }
+
+    int32_t _threshold;
+    size_t _nrocs;
+    std::vector<int32_t> _slot;
+    std::vector<pixel> _found;
+    std::vector<int32_t> _level;
+  };
+
+  /** Streaming trigger condenser
+   *
+   *  Folds consecutive groups of nTriggers Events into one condensed Event
+   *  each (number of hits or mean pulse height per pixel) and deletes the
+   *  original Events right away. Filled chunk by chunk while the data is
+   *  read out, so memory scales with the condensed result and not with the
+   *  number of triggers. Groups may span several chunks.
+   */
+  class triggerCondenser {
+  public:
+  triggerCondenser(uint16_t nTriggers, bool efficiency)
+    : _accumulator(), _packed(), _ntriggers(nTriggers > 0 ? nTriggers : 1), _efficiency(efficiency), _ingroup(0), _nevents(0), _errors(0) {}
+
+    /** Deletes all condensed Events not collected via Get()
+     */
+    ~triggerCondenser() {
+      for(std::vector<Event*>::iterator it = _packed.begin(); it != _packed.end(); ++it) { delete *it; }
+    }
+
+    /** Fold all Events of the chunk into the current trigger group, the
+     *  Events are deleted and the chunk is cleared.
+     */
+    void Fill(std::vector<Event*> & data) {
+      for(std::vector<Event*>::iterator it = data.begin(); it != data.end(); ++it) {
+	_accumulator.Fill(**it);
+	_errors += (*it)->numDecoderErrors;
+	delete *it;
+	_nevents++;
+	if(++_ingroup == _ntriggers) { Flush(); }
+      }
+      data.clear();
+    }
+
+    /** Fold all Events stored in the arena into the current trigger group
+     */
+    void Fill(const eventArena & events) {
+      for(size_t i = 0; i < events.size(); i++) {
+	for(std::vector<pixel>::const_iterator px = events.begin(i); px != events.end(i); ++px) { _accumulator.Fill(*px); }
+	_errors += events.numDecoderErrors(i);
+	_nevents++;
+	if(++_ingroup == _ntriggers) { Flush(); }
+      }
+    }
+
+    /** Total number of Events folded so far
+     */
+    size_t GetNEvents() const { return _nevents; }
+
+    /** Return the condensed Events, one per completed trigger group, and
+     *  hand over their ownership. An incomplete last group is dropped.
+     */
+    std::vector<Event*> Get() {
+      std::vector<Event*> packed;
+      packed.swap(_packed);
+      _accumulator.Clear();
+      _ingroup = 0;
+      _errors = 0;
+      return packed;
+    }
+
+  private:
+    void Flush() {
+      Event * evt = new Event();
+      _accumulator.Get(evt->pixels, _efficiency);
+      evt->numDecoderErrors = static_cast<uint16_t>(std::min(_errors, static_cast<uint32_t>(0xffff)));
+      _packed.push_back(evt);
+      _accumulator.Clear();
+      _ingroup = 0;
+      _errors = 0;
+    }
+
+    pixelAccumulator _accumulator;
+    std::vector<Event*> _packed;
+    uint16_t _ntriggers;
+    bool _efficiency;
+    uint16_t _ingroup;
+    size_t _nevents;
+    uint32_t _errors;
+
+    triggerCondenser(const triggerCondenser&);
+    triggerCondenser& operator=(const triggerCondenser&);
+  };
+
+}
+#endif
@@ -12,6 +12,10 @@ namespace pxar {
 // --- Data Transmission settings & flags --------------------------------------
 #define DTB_SOURCE_BLOCK_SIZE  8192
 #define DTB_SOURCE_BUFFER_SIZE 50000000
+#define DTB_HOST_BUFFER_SIZE   16777216 // host-side readout ring per channel, in words
+#define DTB_RECORD_HEADER_SIZE 16       // header of recorded raw data files, in bytes
+#define DTB_RECORD_VERSION     1
+#define DTB_RECORD_IOBUFFER    4194304  // stdio buffer of the raw data recorder, in bytes
 #define DTB_DAQ_FIFO_OVFL 4 // bit 2 = DAQ fast HW FIFO overflow
 #define DTB_DAQ_MEM_OVFL  2 // bit 1 = DAQ RAM FIFO overflow
 #define DTB_DAQ_STOPPED   1 // bit 0 = DAQ stopped (because of overflow)
@@ -24,10 +24,24 @@ typedef unsigned int uint32_t;
 #define __func__ __FUNCTION__
 #endif // WIN32
 
+/** Storage class for variables with one instance per thread */
+#if (defined __CINT__)
+#define PXAR_THREAD_LOCAL
+#elif (defined WIN32)
+#define PXAR_THREAD_LOCAL __declspec(thread)
+#else
+#define PXAR_THREAD_LOCAL __thread
+#endif
+
 #include <sstream>
 #include <iomanip>
 #include <cstdio>
+#include <cstdlib>
 #include <string.h>
+#include <vector>
+#ifndef __CINT__
+#include "threading.h"
+#endif
 
 
 namespace pxar {
@@ -58,6 +72,7 @@ namespace pxar {
     static TLogLevel FromString(const std::string& level);
   protected:
     std::ostringstream os;
+    TLogLevel lvl;
   private:
     pxarLog(const pxarLog&);
     pxarLog& operator =(const pxarLog&);
@@ -65,7 +80,7 @@ namespace pxar {
   };
 
   template <typename T>
-    pxarLog<T>::pxarLog() {}
+    pxarLog<T>::pxarLog() : lvl(logINFO) {}
 
 
 #ifdef WIN32
@@ -88,14 +103,18 @@ namespace pxar {
 
   template <typename T>
     std::string pxarLog<T>::NowTime() {
-    char buffer[11];
-    time_t t;
-    time(&t);
-    tm r = * localtime(&t);
-    strftime(buffer, sizeof(buffer), "%X", localtime_r(&t, &r));
+    // The formatted local time only changes once per second, so it is cached per thread:
+    static PXAR_THREAD_LOCAL time_t cachedSec = 0;
+    static PXAR_THREAD_LOCAL char buffer[11];
     struct timeval tv;
     gettimeofday(&tv, 0);
-    char result[100] = {0};
+    time_t t = tv.tv_sec;
+    if (t != cachedSec || !buffer[0]) {
+      tm r;
+      strftime(buffer, sizeof(buffer), "%X", localtime_r(&t, &r));
+      cachedSec = t;
+    }
+    char result[32] = {0};
     std::sprintf(result, "%s.%03ld", buffer, static_cast<long>(tv.tv_usec) / 1000); 
     return result;
   }
@@ -104,6 +123,7 @@ namespace pxar {
 
   template <typename T>
     std::ostringstream& pxarLog<T>::Get(TLogLevel level, std::string file, std::string function, uint32_t line) {
+    lvl = level;
     os << "[" << NowTime() << "] ";
     os << std::setw(8) << ToString(level) << ": ";
     
@@ -119,7 +139,7 @@ namespace pxar {
   template <typename T>
     pxarLog<T>::~pxarLog() {
     os << std::endl;
-    T::Output(os.str());
+    T::Output(os.str(), lvl);
   }
 
   template <typename T>
@@ -163,12 +183,125 @@ namespace pxar {
   }
 
 
+#ifndef __CINT__
+  /** Collects the log messages of all threads and writes them in batches
+   *  from a background thread, see SetLogOutput::Asynchronous(). Messages
+   *  are appended per output stream to buffers which keep their memory
+   *  between batches, so a message costs a short locked copy only.
+   */
+  class logWriter {
+  public:
+    logWriter() : pending(0), writing(false), urgent(false), stop(false) {
+      running = worker.start(&logWriter::Run, this);
+    }
+    ~logWriter() {
+      m.lock();
+      stop = true;
+      wake.notify_one();
+      m.unlock();
+      worker.join();
+    }
+    bool Running() const { return running; }
+
+    void Append(FILE* stream, const char* tag, const std::string& msg) {
+      lock_guard lock(m);
+      std::string & buf = Buffer(stream);
+      if (tag) { buf += tag; buf += ' '; }
+      buf += msg;
+      pending += msg.size();
+      if (pending >= batchSize) wake.notify_one();
+    }
+
+    /** Returns after everything appended so far has been written */
+    void Flush() {
+      lock_guard lock(m);
+      while (pending > 0 || writing) {
+	urgent = true;
+	wake.notify_one();
+	written.wait(m);
+      }
+    }
+
+  private:
+    struct chunk {
+      FILE* stream;
+      std::string text;
+    };
+    static const size_t batchSize = 64*1024;
+    static const uint32_t flushInterval = 100; // ms
+
+    std::string & Buffer(FILE* stream) {
+      for (size_t i = 0; i < fill.size(); i++) {
+	if (fill[i].stream == stream) return fill[i].text;
+      }
+      fill.push_back(chunk());
+      fill.back().stream = stream;
+      fill.back().text.reserve(batchSize);
+      return fill.back().text;
+    }
+
+    static void Run(void * arg) {
+      logWriter * self = static_cast<logWriter*>(arg);
+      self->m.lock();
+      while (true) {
+	if (!self->stop && !self->urgent && self->pending < batchSize) self->wake.wait(self->m, flushInterval);
+	bool last = self->stop;
+	self->fill.swap(self->drain);
+	self->pending = 0;
+	self->urgent = false;
+	self->writing = true;
+	self->m.unlock();
+
+	for (size_t i = 0; i < self->drain.size(); i++) {
+	  chunk & c = self->drain[i];
+	  if (c.text.empty()) continue;
+	  fwrite(c.text.data(), 1, c.text.size(), c.stream);
+	  fflush(c.stream);
+	  c.text.clear();
+	}
+
+	self->m.lock();
+	self->writing = false;
+	self->written.notify_all();
+	if (last && self->pending == 0) break;
+      }
+      self->m.unlock();
+    }
+
+    std::vector<chunk> fill, drain;
+    size_t pending;
+    bool writing, urgent, stop, running;
+    mutex m;
+    condition wake, written;
+    thread worker;
+  };
+#else
+  class logWriter;
+#endif
+
   class SetLogOutput
   {
   public:
     static FILE*& Stream();
     static bool& Duplicate();
-    static void Output(const std::string& msg);
+    /** Output stream of the calling thread only, replaces Stream() when set.
+     *  Lets several DUTs tested in parallel write to separate log files.
+     */
+    static FILE*& ThreadStream();
+    /** Tag prepended to every message of the calling thread, e.g. the testboard name */
+    static const char*& ThreadTag();
+    /** Write the log from a background thread in batches instead of with
+     *  fprintf and fflush per message. Messages of level ERROR and above
+     *  are written before LOG returns. Switch on and off only while no
+     *  other thread logs, and call Flush() before closing a log stream.
+     */
+    static void Asynchronous(bool async);
+    /** Write out all messages buffered for asynchronous output */
+    static void Flush();
+    static void Output(const std::string& msg, TLogLevel level = logINFO);
+  private:
+    static logWriter*& Writer();
+    static void StopAsynchronous();
   };
 
   inline bool& SetLogOutput::Duplicate()
@@ -183,15 +316,81 @@ namespace pxar {
     return pStream;
   }
 
-  inline void SetLogOutput::Output(const std::string& msg)
+  inline FILE*& SetLogOutput::ThreadStream()
+  {
+    static PXAR_THREAD_LOCAL FILE* pStream = 0;
+    return pStream;
+  }
+
+  inline const char*& SetLogOutput::ThreadTag()
+  {
+    static PXAR_THREAD_LOCAL const char* tag = 0;
+    return tag;
+  }
+
+  inline logWriter*& SetLogOutput::Writer()
+  {
+    static logWriter* writer = 0;
+    return writer;
+  }
+
+#ifndef __CINT__
+  inline void SetLogOutput::StopAsynchronous()
+  {
+    Asynchronous(false);
+  }
+
+  inline void SetLogOutput::Asynchronous(bool async)
+  {
+    logWriter*& writer = Writer();
+    if (async && !writer) {
+      writer = new logWriter();
+      if (!writer->Running()) {
+	delete writer;
+	writer = 0;
+	return;
+      }
+      // Write out what is still buffered when the program ends:
+      static bool registered = false;
+      if (!registered) registered = (atexit(&SetLogOutput::StopAsynchronous) == 0);
+    }
+    else if (!async && writer) {
+      logWriter* w = writer;
+      writer = 0;
+      delete w;
+    }
+  }
+
+  inline void SetLogOutput::Flush()
+  {
+    logWriter* writer = Writer();
+    if (writer) writer->Flush();
+  }
+#endif
+
+  inline void SetLogOutput::Output(const std::string& msg, TLogLevel level)
   {   
-    FILE* pStream = Stream();
+    FILE* pStream = ThreadStream();
+    if (!pStream)
+      pStream = Stream();
     if (!pStream)
       return;
+    const char* tag = ThreadTag();
+#ifndef __CINT__
+    logWriter* writer = Writer();
+    if (writer) {
+      if (Duplicate() && pStream != stderr)
+	writer->Append(stderr, tag, msg);
+      writer->Append(pStream, tag, msg);
+      if (level <= logERROR)
+	writer->Flush();
+      return;
+    }
+#endif
     // Check if duplication to stderr is needed:
     if (Duplicate() && pStream != stderr)
-      fprintf(stderr, "%s", msg.c_str());
-    fprintf(pStream, "%s", msg.c_str());
+      fprintf(stderr, "%s%s%s", (tag ? tag : ""), (tag ? " " : ""), msg.c_str());
+    fprintf(pStream, "%s%s%s", (tag ? tag : ""), (tag ? " " : ""), msg.c_str());
     fflush(pStream);
   }
 
@@ -0,0 +1,167 @@
+#ifndef PXAR_THREADING_H
+#define PXAR_THREADING_H
+
+#if (defined WIN32)
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <unistd.h>
+#endif //WIN32
+#include <stdint.h>
+
+namespace pxar {
+
+  /** Minimal portable mutex wrapper (pthreads on Linux/OSX,
+   *  critical sections on Windows). Not copyable.
+   */
+  class mutex {
+  public:
+#ifdef WIN32
+    mutex() { InitializeCriticalSection(&m); }
+    ~mutex() { DeleteCriticalSection(&m); }
+    void lock() { EnterCriticalSection(&m); }
+    void unlock() { LeaveCriticalSection(&m); }
+#else
+    mutex() { pthread_mutex_init(&m, NULL); }
+    ~mutex() { pthread_mutex_destroy(&m); }
+    void lock() { pthread_mutex_lock(&m); }
+    void unlock() { pthread_mutex_unlock(&m); }
+#endif
+  private:
+    friend class condition;
+#ifdef WIN32
+    CRITICAL_SECTION m;
+#else
+    pthread_mutex_t m;
+#endif
+    mutex(const mutex&);
+    mutex& operator=(const mutex&);
+  };
+
+  /** Scoped lock: locks the mutex on construction and releases it
+   *  when going out of scope.
+   */
+  class lock_guard {
+  public:
+    explicit lock_guard(mutex & mtx) : m(mtx) { m.lock(); }
+    ~lock_guard() { m.unlock(); }
+  private:
+    mutex & m;
+    lock_guard(const lock_guard&);
+    lock_guard& operator=(const lock_guard&);
+  };
+
+  /** Condition variable to be used together with pxar::mutex
+   */
+  class condition {
+  public:
+#ifdef WIN32
+    condition() { InitializeConditionVariable(&c); }
+    ~condition() {}
+    void wait(mutex & mtx) { SleepConditionVariableCS(&c, &mtx.m, INFINITE); }
+    /** Wait for at most ms milliseconds, returns false on timeout */
+    bool wait(mutex & mtx, uint32_t ms) { return SleepConditionVariableCS(&c, &mtx.m, ms); }
+    void notify_one() { WakeConditionVariable(&c); }
+    void notify_all() { WakeAllConditionVariable(&c); }
+#else
+    condition() { pthread_cond_init(&c, NULL); }
+    ~condition() { pthread_cond_destroy(&c); }
+    void wait(mutex & mtx) { pthread_cond_wait(&c, &mtx.m); }
+    /** Wait for at most ms milliseconds, returns false on timeout */
+    bool wait(mutex & mtx, uint32_t ms) {
+      struct timeval now;
+      gettimeofday(&now, NULL);
+      struct timespec until;
+      uint64_t nsec = static_cast<uint64_t>(now.tv_usec)*1000 + static_cast<uint64_t>(ms%1000)*1000000;
+      until.tv_sec = now.tv_sec + ms/1000 + nsec/1000000000;
+      until.tv_nsec = nsec%1000000000;
+      return (pthread_cond_timedwait(&c, &mtx.m, &until) != ETIMEDOUT);
+    }
+    void notify_one() { pthread_cond_signal(&c); }
+    void notify_all() { pthread_cond_broadcast(&c); }
+#endif
+  private:
+#ifdef WIN32
+    CONDITION_VARIABLE c;
+#else
+    pthread_cond_t c;
+#endif
+    condition(const condition&);
+    condition& operator=(const condition&);
+  };
+
+  /** Thin wrapper around a native thread running a static function
+   *  with a single void pointer argument.
+   */
+  class thread {
+  public:
+    typedef void (*function)(void *);
+    thread() : running(false) {}
+    ~thread() { join(); }
+
+    /** Start the thread, returns false if it could not be created */
+    bool start(function fn, void * arg) {
+      if(running) return false;
+      f = fn; a = arg;
+#ifdef WIN32
+      h = CreateThread(NULL, 0, &thread::entry, this, 0, NULL);
+      running = (h != NULL);
+#else
+      running = (pthread_create(&h, NULL, &thread::entry, this) == 0);
+#endif
+      return running;
+    }
+
+    /** Wait for the thread to finish */
+    void join() {
+      if(!running) return;
+#ifdef WIN32
+      WaitForSingleObject(h, INFINITE);
+      CloseHandle(h);
+#else
+      pthread_join(h, NULL);
+#endif
+      running = false;
+    }
+
+    bool joinable() const { return running; }
+
+  private:
+#ifdef WIN32
+    static DWORD WINAPI entry(LPVOID self) {
+      static_cast<thread*>(self)->f(static_cast<thread*>(self)->a);
+      return 0;
+    }
+    HANDLE h;
+#else
+    static void * entry(void * self) {
+      static_cast<thread*>(self)->f(static_cast<thread*>(self)->a);
+      return NULL;
+    }
+    pthread_t h;
+#endif
+    function f;
+    void * a;
+    bool running;
+    thread(const thread&);
+    thread& operator=(const thread&);
+  };
+
+  /** Number of processor cores available, at least one
+   */
+  inline unsigned int hardware_concurrency() {
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1);
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0 ? static_cast<unsigned int>(n) : 1);
+#endif
+  }
+
+} //namespace pxar
+
+#endif /* PXAR_THREADING_H */
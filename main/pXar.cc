@@ -21,6 +21,7 @@
 
 #include "PixTest.hh"
 #include "PixTestFactory.hh"
+#include "PixMultiDut.hh"
 #include "PixGui.hh"
 #include "PixSetup.hh"
 #include "PixUtil.hh"
@@ -34,6 +35,7 @@ using namespace pxar;
 
 void runGui(PixSetup &a, int argc = 0, char *argv[] = 0);
 void createBackup(string a, string b);  
+vector<string> splitList(string a);
 
 // ----------------------------------------------------------------------
 int main(int argc, char *argv[]){
@@ -43,12 +45,14 @@ int main(int argc, char *argv[]){
 
   // -- command line arguments
   string dir("."), cmdFile("nada"), rootfile("nada.root"), logfile("nada.log"), 
-    verbosity("INFO"), flashFile("nada"), runtest("fulltest"), trimVcal(""), testParameters("nada"); 
+    verbosity("INFO"), flashFile("nada"), runtest("fulltest"), trimVcal(""), testParameters("nada"), multiDirs(""); 
   bool doRunGui(false), 
     doRunScript(false), 
     doRunSingleTest(false), 
+    doRunMultiDut(false), 
     doUpdateFlash(false),
     doUpdateRootFile(false),
+    doAsyncLog(false),
     doMoreWebCloning(false), 
     doUseRootLogon(false)
     ;
@@ -59,10 +63,13 @@ int main(int argc, char *argv[]){
       cout << "-c filename           read in commands from filename" << endl;
       cout << "-d [--dir] path       directory with config files" << endl;
       cout << "-g                    start with GUI" << endl;
+      cout << "-l                    write the log from a background thread (for high verbosity levels)" << endl;
       cout << "-m                    clone pxar histograms into the histograms expected by moreweb" << endl;
+      cout << "-M dir1,dir2,...      run the test (-t, default fulltest) on the modules configured in these directories" << endl;
+      cout << "                      in parallel, each with the testboard given by testboardName in its configParameters.dat" << endl;
       cout << "-p \"p1=v1[;p2=v2]\"  set parameters for test" << endl;
       cout << "-r rootfilename       set rootfile (and logfile) name" << endl;
-      cout << "-t test               run test" << endl;
+      cout << "-t test               run test (with -M also a comma separated list of tests)" << endl;
       cout << "-T [--vcal] XX        read in DAC and Trim parameter files corresponding to trim VCAL = XX" << endl;
       cout << "-v verbositylevel     set verbosity level: QUIET CRITICAL ERROR WARNING DEBUG DEBUGAPI DEBUGHAL ..." << endl;
       return 0;
@@ -71,7 +78,9 @@ int main(int argc, char *argv[]){
     if (!strcmp(argv[i],"-d") || !strcmp(argv[i], "--dir"))   {dir  = string(argv[++i]); }               
     if (!strcmp(argv[i],"-f"))                                {doUpdateFlash = true; flashFile = string(argv[++i]);} 
     if (!strcmp(argv[i],"-g"))                                {doRunGui   = true; } 
+    if (!strcmp(argv[i],"-l"))                                {doAsyncLog = true; } 
     if (!strcmp(argv[i],"-m"))                                {doMoreWebCloning = true; } 
+    if (!strcmp(argv[i],"-M"))                                {doRunMultiDut = true; multiDirs = string(argv[++i]); } 
     if (!strcmp(argv[i],"-p"))                                {testParameters  = string(argv[++i]); }               
     if (!strcmp(argv[i],"-r"))                                {rootfile  = string(argv[++i]); }               
     if (!strcmp(argv[i],"-t"))                                {doRunSingleTest = true; runtest  = string(argv[++i]); }
@@ -80,6 +89,8 @@ int main(int argc, char *argv[]){
     if (!strcmp(argv[i],"-v"))                                {verbosity  = string(argv[++i]); }               
   }
 
+  if (doAsyncLog) SetLogOutput::Asynchronous(true);
+
   struct stat buffer;   
   if (stat("rootlogon.C", &buffer) == 0) {
     LOG(logINFO) << "reading rootlogon.C, will use gStyle settings from there";
@@ -112,6 +123,24 @@ int main(int argc, char *argv[]){
   }
 
 
+  if (doRunMultiDut) {
+    PixMultiDut multi(verbosity);
+    vector<string> dirs = splitList(multiDirs);
+    for (unsigned int i = 0; i < dirs.size(); ++i) {
+      if (!multi.addDut(dirs[i], (rootfile.compare("nada.root") ? rootfile : string("")))) return 1;
+      if (!doUpdateRootFile) createBackup(multi.getRootFile(i), multi.getLogFile(i)); 
+    }
+    multi.setMoreWebCloning(doMoreWebCloning); 
+    multi.setRootFileUpdate(doUpdateRootFile);
+    vector<string> tests = splitList(runtest);
+    if (testParameters.compare("nada")) {
+      for (unsigned int i = 0; i < tests.size(); ++i) multi.setTestParameters(tests[i], testParameters); 
+    }
+    unsigned int ndone = multi.run(tests);
+    LOG(logINFO) << "pXar: tests completed on " << ndone << " of " << multi.getNDuts() << " modules";
+    return (ndone == multi.getNDuts() ? 0 : 1);
+  }
+
   ConfigParameters *configParameters = ConfigParameters::Singleton();
   configParameters->setDirectory(dir);
   string cfgFile = configParameters->getDirectory() + string("/configParameters.dat");
@@ -291,4 +320,18 @@ void createBackup(string rootfile, string logfile) {
   
 }
 
+
+// ----------------------------------------------------------------------
+vector<string> splitList(string list) {
+  vector<string> result; 
+  string::size_type start(0); 
+  while (start <= list.size()) {
+    string::size_type end = list.find(",", start); 
+    if (end == string::npos) end = list.size(); 
+    if (end > start) result.push_back(list.substr(start, end - start)); 
+    start = end + 1; 
+  }
+  return result; 
+}
+
 #endif
@@ -0,0 +1,227 @@
+#include <iostream>
+#include <cstdio>
+
+#include <TFile.h>
+
+#include "PixMultiDut.hh"
+#include "PixTestFactory.hh"
+#include "PixSetup.hh"
+#include "PixUtil.hh"
+#include "ConfigParameters.hh"
+#include "PixTestParameters.hh"
+
+#include "api.h"
+#include "log.h"
+#include "threading.h"
+
+using namespace std;
+using namespace pxar;
+
+// ----------------------------------------------------------------------
+struct PixMultiDut::dutContext {
+  string directory, tbName, tag, rootfile, logfile;
+  ConfigParameters *config;
+  const PixMultiDut *parent;
+  const vector<string> *tests;
+  bool done;
+};
+
+
+// ----------------------------------------------------------------------
+PixMultiDut::PixMultiDut(string verbosity) {
+  fVerbosity        = verbosity;
+  fMoreWebCloning   = false;
+  fDoUpdateRootFile = false;
+}
+
+
+// ----------------------------------------------------------------------
+PixMultiDut::~PixMultiDut() {
+  for (unsigned int i = 0; i < fDuts.size(); ++i) {
+    delete fDuts[i]->config;
+    delete fDuts[i];
+  }
+}
+
+
+// ----------------------------------------------------------------------
+bool PixMultiDut::addDut(string directory, string rootfile) {
+  ConfigParameters *config = new ConfigParameters();
+  config->setDirectory(directory);
+  string cfgFile = config->getDirectory() + string("/configParameters.dat");
+  LOG(logINFO) << "PixMultiDut: reading config parameters from " << cfgFile;
+  if (!config->readConfigParameterFile(cfgFile)) {
+    delete config;
+    return false;
+  }
+
+  string tbName = config->getTBName();
+  if (tbName.empty()) tbName = "*";
+  for (unsigned int i = 0; i < fDuts.size(); ++i) {
+    if (fDuts[i]->tbName == tbName) {
+      LOG(logERROR) << "PixMultiDut: testboard " << tbName << " of " << directory
+		    << " is already used by " << fDuts[i]->directory;
+      delete config;
+      return false;
+    }
+  }
+
+  if (rootfile.empty()) {
+    rootfile = config->getRootFileName();
+  } else {
+    config->setRootFileName(rootfile);
+  }
+
+  dutContext *dut = new dutContext;
+  dut->directory = directory;
+  dut->tbName    = tbName;
+  dut->tag       = "[" + tbName + "]";
+  dut->rootfile  = config->getDirectory() + "/" + rootfile;
+  dut->logfile   = dut->rootfile;
+  PixUtil::replaceAll(dut->logfile, ".root", ".log");
+  dut->config    = config;
+  dut->parent    = this;
+  dut->tests     = 0;
+  dut->done      = false;
+  fDuts.push_back(dut);
+  return true;
+}
+
+
+// ----------------------------------------------------------------------
+string PixMultiDut::getRootFile(unsigned int i) {
+  return (i < fDuts.size() ? fDuts[i]->rootfile : string(""));
+}
+
+
+// ----------------------------------------------------------------------
+string PixMultiDut::getLogFile(unsigned int i) {
+  return (i < fDuts.size() ? fDuts[i]->logfile : string(""));
+}
+
+
+// ----------------------------------------------------------------------
+void PixMultiDut::setTestParameters(string test, string parameters) {
+  fTestParameters.push_back(make_pair(test, parameters));
+}
+
+
+// ----------------------------------------------------------------------
+unsigned int PixMultiDut::run(const vector<string> &tests) {
+  if (fDuts.empty()) return 0;
+  if (fDuts.size() > 1) {
+    for (unsigned int i = 0; i < fDuts.size(); ++i) {
+      if (fDuts[i]->tbName == "*") {
+	LOG(logERROR) << "PixMultiDut: no testboardName given in " << fDuts[i]->directory
+		      << ", cannot tell the testboards apart";
+	return 0;
+      }
+    }
+  }
+
+  // -- gFile and gDirectory are per thread from here on; the factory is created before the threads need it
+  PixUtil::enableThreads();
+  PixTestFactory::instance();
+
+  LOG(logINFO) << "PixMultiDut: running " << tests.size() << " test(s) on " << fDuts.size() << " DUT(s)";
+  vector<pxar::thread*> threads;
+  for (unsigned int i = 0; i < fDuts.size(); ++i) {
+    fDuts[i]->tests = &tests;
+    fDuts[i]->done  = false;
+    pxar::thread *t = new pxar::thread();
+    if (!t->start(&PixMultiDut::runDut, fDuts[i])) {
+      LOG(logERROR) << "PixMultiDut: could not start thread for " << fDuts[i]->tbName;
+      delete t;
+      continue;
+    }
+    threads.push_back(t);
+  }
+  for (unsigned int i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+    delete threads[i];
+  }
+
+  unsigned int ndone(0);
+  for (unsigned int i = 0; i < fDuts.size(); ++i) {
+    LOG(logINFO) << "PixMultiDut: " << fDuts[i]->tbName << " (" << fDuts[i]->directory << ") "
+		 << (fDuts[i]->done ? "done" : "FAILED");
+    if (fDuts[i]->done) ++ndone;
+  }
+  return ndone;
+}
+
+
+// ----------------------------------------------------------------------
+void PixMultiDut::runDut(void *arg) {
+  dutContext *dut = static_cast<dutContext*>(arg);
+  const PixMultiDut *p = dut->parent;
+  ConfigParameters *config = dut->config;
+
+  // -- everything this thread logs goes into the logfile of its DUT
+  FILE *lfile = fopen(dut->logfile.c_str(), "a");
+  SetLogOutput::ThreadStream() = lfile;
+  SetLogOutput::ThreadTag() = dut->tag.c_str();
+
+  TFile *rfile = TFile::Open(dut->rootfile.c_str(), (p->fDoUpdateRootFile ? "UPDATE" : "RECREATE"));
+  pxar::api *api(0);
+  PixTestParameters *ptp(0);
+  try {
+    if (!rfile || rfile->IsZombie()) throw pxar::InvalidConfig("cannot open rootfile " + dut->rootfile);
+    LOG(logINFO) << "PixMultiDut: dumping results into " << dut->rootfile << " logfile = " << dut->logfile;
+
+    api = new pxar::api(dut->tbName, p->fVerbosity);
+    api->initTestboard(config->getTbSigDelays(), config->getTbPowerSettings(), config->getTbPgSettings());
+    api->initDUT(config->getHubId(),
+		 config->getTbmType(), config->getTbmDacs(),
+		 config->getRocType(), config->getRocDacs(),
+		 config->getRocPixelConfig());
+    api->SignalProbe("a1", config->getProbe("a1"));
+    api->SignalProbe("a2", config->getProbe("a2"));
+    api->SignalProbe("d1", config->getProbe("d1"));
+    api->SignalProbe("d2", config->getProbe("d2"));
+    LOG(logINFO) << "DUT info: ";
+    api->_dut->info();
+
+    ptp = new PixTestParameters(config->getDirectory() + "/" + config->getTestParameterFileName());
+    for (unsigned int i = 0; i < p->fTestParameters.size(); ++i) {
+      ptp->setTestParameters(p->fTestParameters[i].first, p->fTestParameters[i].second);
+    }
+    PixSetup a(api, ptp, config);
+    a.setMoreWebCloning(p->fMoreWebCloning);
+    a.setRootFileUpdate(p->fDoUpdateRootFile);
+
+    if (config->getHvOn()) api->HVon();
+    PixTestFactory *factory = PixTestFactory::instance();
+    for (unsigned int i = 0; i < dut->tests->size(); ++i) {
+      PixTest *t = factory->createTest(dut->tests->at(i), &a);
+      if (!t) {
+	LOG(logWARNING) << "PixMultiDut: test ->" << dut->tests->at(i) << "<- not known, ignored";
+	continue;
+      }
+      t->doTest();
+      delete t;
+    }
+    dut->done = true;
+  }
+  catch (pxar::InvalidConfig &e){
+    LOG(logCRITICAL) << "PixMultiDut: invalid configuration settings: " << e.what();
+  }
+  catch (pxar::pxarException &e){
+    LOG(logCRITICAL) << "PixMultiDut: pxar internal exception: " << e.what();
+  }
+  catch (...) {
+    LOG(logCRITICAL) << "PixMultiDut: unknown exception";
+  }
+
+  if (rfile) {
+    rfile->Close();
+    delete rfile;
+  }
+  delete ptp;
+  delete api;
+
+  SetLogOutput::ThreadTag() = 0;
+  SetLogOutput::ThreadStream() = 0;
+  SetLogOutput::Flush();
+  if (lfile) fclose(lfile);
+}
@@ -0,0 +1,49 @@
+#ifndef PIXMULTIDUT_H
+#define PIXMULTIDUT_H
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "pxardllexport.h"
+
+// ----------------------------------------------------------------------
+/// Runs the same sequence of PixTests on several modules at once. Every
+/// DUT has its own configuration directory (and therein the testboard
+/// name), its own api/hal/dut, rootfile and logfile, and is tested in a
+/// thread of its own. Log messages of a DUT go to its logfile and are
+/// tagged with the testboard name on the console.
+class DLLEXPORT PixMultiDut {
+public:
+  PixMultiDut(std::string verbosity);
+  ~PixMultiDut();
+
+  /// read the configParameters.dat in directory, rootfile overrides the
+  /// rootfile name given there. Returns false if the configuration could
+  /// not be read or its testboard is already used by another DUT.
+  bool addDut(std::string directory, std::string rootfile = "");
+  unsigned int getNDuts() {return static_cast<unsigned int>(fDuts.size());}
+  std::string  getRootFile(unsigned int i);
+  std::string  getLogFile(unsigned int i);
+
+  /// parameters are applied to the test parameters of every DUT
+  void setTestParameters(std::string test, std::string parameters);
+  void setMoreWebCloning(bool x) {fMoreWebCloning = x;}
+  void setRootFileUpdate(bool x) {fDoUpdateRootFile = x;}
+
+  /// run the tests one after the other on every DUT, all DUTs in parallel.
+  /// Returns the number of DUTs on which the sequence completed.
+  unsigned int run(const std::vector<std::string> &tests);
+
+private:
+  struct dutContext;
+  static void runDut(void *);
+
+  std::string fVerbosity;
+  bool fMoreWebCloning;
+  bool fDoUpdateRootFile;
+  std::vector<dutContext*> fDuts;
+  std::vector<std::pair<std::string, std::string> > fTestParameters;
+};
+
+#endif
@@ -11,6 +11,7 @@
 
 #include "PixTest.hh"
 #include "PixUtil.hh"
+#include "PixScurveFitter.hh"
 #include "log.h"
 #include "helper.h"
 
@@ -29,6 +30,7 @@ PixTest::PixTest(PixSetup *a, string name) {
   fTimeStamp      = new TTimeStamp(); 
 
   fName = name;
+  fFastScurve = false; 
   setToolTips();
   fParameters = a->getPixTestParameters()->getTestParameters(name); 
   fTree = 0; 
@@ -47,6 +49,7 @@ PixTest::PixTest(PixSetup *a, string name) {
 PixTest::PixTest() {
   //  LOG(logINFO) << "PixTest ctor()";
   fTree = 0; 
+  fFastScurve = false; 
   
 }
 
@@ -153,39 +156,53 @@ int PixTest::pixelThreshold(string dac, int ntrig, int dacmin, int dacmax) {
 // result & 0x4 == 4 -> write to file: all pixel histograms with outlier threshold/sigma
 vector<TH1*> PixTest::scurveMaps(string dac, string name, int ntrig, int dacmin, int dacmax, int result, int ihit, int flag) {
 
+  vector<TH1*> resultMaps; 
+  scurveData data = scurveScan(dac, name, ntrig, dacmin, dacmax, ihit, flag); 
+  if (1 == ihit) {
+    TH1 *h2 = scurveAna(data, resultMaps, result); 
+    if (h2) h2->Draw("colz");
+    PixTest::update(); 
+  } 
+
+  return resultMaps; 
+}
+
+
+// ----------------------------------------------------------------------
+scurveData PixTest::scurveScan(string dac, string name, int ntrig, int dacmin, int dacmax, int ihit, int flag) {
+
   string type("hits"); 
   if (2 == ihit) type = string("pulseheight"); 
   print(Form("dac: %s name: %s ntrig: %d dacrange: %d .. %d %s flags = %d (plus default)",  
 	     dac.c_str(), name.c_str(), ntrig, dacmin, dacmax, type.c_str(), flag)); 
 
-  vector<TH1*>          rmaps; 
-  vector<vector<TH1*> > maps; 
-  vector<TH1*>          resultMaps; 
+  scurveData data; 
+  data.dac  = dac; 
+  data.name = name; 
+  vector<TH1*> rmaps; 
 
   TH1* h1(0); 
   fDirectory->cd();
 
-  vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs(); 
-  for (unsigned int iroc = 0; iroc < rocIds.size(); ++iroc) {
+  data.rocIds = fApi->_dut->getEnabledRocIDs(); 
+  for (unsigned int iroc = 0; iroc < data.rocIds.size(); ++iroc) {
     rmaps.clear();
     for (unsigned int ic = 0; ic < 52; ++ic) {
       for (unsigned int ir = 0; ir < 80; ++ir) {
-	h1 = bookTH1D(Form("%s_%s_c%d_r%d_C%d", name.c_str(), dac.c_str(), ic, ir, rocIds[iroc]), 
-		      Form("%s_%s_c%d_r%d_C%d", name.c_str(), dac.c_str(), ic, ir, rocIds[iroc]), 
+	h1 = bookTH1D(Form("%s_%s_c%d_r%d_C%d", name.c_str(), dac.c_str(), ic, ir, data.rocIds[iroc]), 
+		      Form("%s_%s_c%d_r%d_C%d", name.c_str(), dac.c_str(), ic, ir, data.rocIds[iroc]), 
 		      256, 0., 256.);
 	h1->Sumw2();
 	rmaps.push_back(h1); 
       }
     }
-    maps.push_back(rmaps); 
+    data.maps.push_back(rmaps); 
   }
   
-  dacScan(dac, ntrig, dacmin, dacmax, maps, ihit, flag); 
-  if (1 == ihit) {
-    scurveAna(dac, name, maps, resultMaps, result); 
-  } 
-
-  return resultMaps; 
+  dacScan(dac, ntrig, dacmin, dacmax, data.maps, ihit, flag); 
+  data.ntrig          = fNtrig; 
+  data.zeroSuppressed = (fApi->_dut->getNEnabledPixels(0) < 4000?true:false);
+  return data; 
 }
 
 // ----------------------------------------------------------------------
@@ -469,6 +486,12 @@ void PixTest::doTest() {
 }
 
 
+// ----------------------------------------------------------------------
+void PixTest::doMeasurement() {
+  doTest(); 
+}
+
+
 // ----------------------------------------------------------------------
 void PixTest::doAnalysis() {
   //  LOG(logINFO) << "PixTest::doAnalysis()";
@@ -558,47 +581,21 @@ int PixTest::simpleThreshold(TH1 *h) {
 // ----------------------------------------------------------------------
 bool PixTest::threshold(TH1 *h) {
 
-  TF1 *f = fPIF->errScurve(h); 
-
-  double lo, hi; 
-  f->GetRange(lo, hi); 
-
-  if (fPIF->doNotFit()) {
-    fThreshold  = f->GetParameter(0); 
-    //    cout << " nofit fThreshold = " << fThreshold << endl;
-    fThresholdE = 1.;
-    fSigma      = 0.5;
-    fSigmaE     = 0.5;
+  scurveResult r; 
+  if (fFastScurve) {
+    r = PixScurveFitter::estimateScurve(h); 
   } else {
-    h->Fit(f, "qr", "", lo, hi); 
-    fThreshold  = f->GetParameter(0); 
-    //    cout << " w/fit fThreshold = " << fThreshold << endl;
-    fThresholdE = f->GetParError(0); 
-    fSigma      = 1./(TMath::Sqrt(2.)*f->GetParameter(1)); 
-    fSigmaE     = fSigma * f->GetParError(1) / f->GetParameter(1);
-  }
-
-  fThresholdN = h->FindLastBinAbove(0.5*h->GetMaximum()); 
-  
-  if (fThreshold < h->GetBinLowEdge(1)) {
-    fThreshold  = 0.; 
-    fThresholdE = 0.; 
-    fSigma  = 0.; 
-    fSigmaE = 0.; 
-    fThresholdN = 0.;
-    return false;
-  }
-
-  if (fThreshold > h->GetBinLowEdge(h->GetNbinsX())) {
-    fThreshold  = h->GetBinLowEdge(h->GetNbinsX()); 
-    fThresholdE = 0.; 
-    fSigma  = 0.; 
-    fSigmaE = 0.; 
-    fThresholdN = fThreshold;
-    return false;
+    TF1 *f = fPIF->errScurve(h); 
+    r = PixScurveFitter::fitScurve(h, f, fPIF->doNotFit()); 
+    if (!fPIF->doNotFit()) PixScurveFitter::attach(h, r); 
   }
 
-  return true;
+  fThreshold  = r.threshold; 
+  fThresholdE = r.thresholdE; 
+  fSigma      = r.sigma; 
+  fSigmaE     = r.sigmaE; 
+  fThresholdN = r.thresholdN; 
+  return r.ok;
 }
 
 
@@ -631,10 +628,7 @@ void PixTest::restoreDacs(bool verbose) {
 
   vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs(); 
   for (unsigned int iroc = 0; iroc < rocIds.size(); ++iroc) {
-    vector<pair<string, uint8_t> >  rocDacs = fDacCache[iroc];
-    for (unsigned int idac = 0; idac < rocDacs.size(); ++idac) {
-      fApi->setDAC(rocDacs[idac].first, rocDacs[idac].second, rocIds[iroc]);
-    }
+    fApi->setDACs(fDacCache[iroc], rocIds[iroc]);
     if (verbose) fApi->_dut->printDACs(rocIds[iroc]);
   }
   fDacCache.clear();
@@ -1108,6 +1102,23 @@ void PixTest::dacScan(string dac, int ntrig, int dacmin, int dacmax, std::vector
 
 // ----------------------------------------------------------------------
 void PixTest::scurveAna(string dac, string name, vector<vector<TH1*> > maps, vector<TH1*> &resultMaps, int result) {
+  scurveData data; 
+  data.dac            = dac; 
+  data.name           = name; 
+  data.maps           = maps; 
+  data.rocIds         = fApi->_dut->getEnabledRocIDs(); 
+  data.ntrig          = fNtrig; 
+  data.zeroSuppressed = (fApi->_dut->getNEnabledPixels(0) < 4000?true:false);
+  TH1 *h2 = scurveAna(data, resultMaps, result); 
+  if (h2) h2->Draw("colz");
+  PixTest::update(); 
+}
+
+
+// ----------------------------------------------------------------------
+TH1* PixTest::scurveAna(const scurveData &data, vector<TH1*> &resultMaps, int result) {
+  string dac(data.dac), name(data.name); 
+  const vector<vector<TH1*> > &maps = data.maps; 
   vector<TH1*> rmaps; 
   TH1* h2(0), *h3(0), *h4(0); 
   string fname("SCurveData");
@@ -1115,8 +1126,26 @@ void PixTest::scurveAna(string dac, string name, vector<vector<TH1*> > maps, vec
   string line; 
   string empty("32  93   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0   0 ");
   bool dumpFile(false); 
-  vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs(); 
+  const vector<uint8_t> &rocIds = data.rocIds; 
   int ic(0), ir(0); 
+
+  // -- fit (or estimate) the s-curves of all pixels on all ROCs concurrently
+  vector<TH1*> fitHists; 
+  for (unsigned int iroc = 0; iroc < maps.size(); ++iroc) {
+    for (unsigned int i = 0; i < maps[iroc].size(); ++i) {
+      TH1 *h = maps[iroc][i]; 
+      if (h->GetSumOfWeights() < 1) continue;
+      // -- calculated "proper" errors
+      for (int ib = 1; ib <= h->GetNbinsX(); ++ib) {
+	h->SetBinError(ib, data.ntrig*PixUtil::dBinomial(static_cast<int>(h->GetBinContent(ib)), data.ntrig)); 
+      }
+      fitHists.push_back(h); 
+    }
+  }
+  PixScurveFitter fitter(0, fFastScurve ? PixScurveFitter::kMoments : PixScurveFitter::kFit); 
+  vector<scurveResult> fitResults = fitter.fit(fitHists); 
+  unsigned int ifit(0); 
+
   for (unsigned int iroc = 0; iroc < maps.size(); ++iroc) {
     rmaps.clear();
     rmaps = maps[iroc];
@@ -1147,30 +1176,25 @@ void PixTest::scurveAna(string dac, string name, vector<vector<TH1*> > maps, vec
 	OutputFile << empty << endl;
 	continue;
       }
-      
-      // -- calculated "proper" errors
-      for (int ib = 1; ib <= rmaps[i]->GetNbinsX(); ++ib) {
-	rmaps[i]->SetBinError(ib, fNtrig*PixUtil::dBinomial(static_cast<int>(rmaps[i]->GetBinContent(ib)), fNtrig)); 
-      }
 
-      bool ok = threshold(rmaps[i]); 
-      if (!ok) {
+      const scurveResult &fit = fitResults[ifit++]; 
+      if (!fit.ok) {
 	//	LOG(logINFO) << "  failed fit for " << rmaps[i]->GetName() << ", adding to list of hists";
       }
       ic = i/80; 
       ir = i%80; 
-      h2->SetBinContent(ic+1, ir+1, fThreshold); 
-      h2->SetBinError(ic+1, ir+1, fThresholdE); 
+      h2->SetBinContent(ic+1, ir+1, fit.threshold); 
+      h2->SetBinError(ic+1, ir+1, fit.thresholdE); 
 
-      h3->SetBinContent(ic+1, ir+1, fSigma); 
-      h3->SetBinError(ic+1, ir+1, fSigmaE); 
+      h3->SetBinContent(ic+1, ir+1, fit.sigma); 
+      h3->SetBinError(ic+1, ir+1, fit.sigmaE); 
 
-      h4->SetBinContent(ic+1, ir+1, fThresholdN); 
+      h4->SetBinContent(ic+1, ir+1, fit.thresholdN); 
 
       // -- write file
       if (dumpFile) {
 	int NSAMPLES(32); 
-	int ibin = rmaps[i]->FindBin(fThreshold); 
+	int ibin = rmaps[i]->FindBin(fit.threshold); 
 	int bmin = ibin - 15;
 	line = Form("%2d %3d", NSAMPLES, bmin); 
 	for (int ix = bmin; ix < bmin + NSAMPLES; ++ix) {
@@ -1181,6 +1205,7 @@ void PixTest::scurveAna(string dac, string name, vector<vector<TH1*> > maps, vec
 
       if (result & 0x4) {
 	//	cout << "add " << rmaps[i]->GetName() << endl;
+	PixScurveFitter::attach(rmaps[i], fit); 
 	fHistList.push_back(rmaps[i]);
       }
       // -- write all hists to file if requested
@@ -1201,7 +1226,7 @@ void PixTest::scurveAna(string dac, string name, vector<vector<TH1*> > maps, vec
       fHistList.push_back(h4); 
     }
 
-    bool zeroSuppressed(fApi->_dut->getNEnabledPixels(0) < 4000?true:false);
+    bool zeroSuppressed(data.zeroSuppressed);
     if (result & 0x2) {
       TH1* d1 = distribution((TH2D*)h2, 256, 0., 256., zeroSuppressed); 
       resultMaps.push_back(d1); 
@@ -1218,9 +1243,6 @@ void PixTest::scurveAna(string dac, string name, vector<vector<TH1*> > maps, vec
 
 
   fDisplayedHist = find(fHistList.begin(), fHistList.end(), h2);
-
-  if (h2) h2->Draw("colz");
-  PixTest::update(); 
   
   TH1 *h1(0); 
   if (!(result & 0x4)) {
@@ -1235,6 +1257,7 @@ void PixTest::scurveAna(string dac, string name, vector<vector<TH1*> > maps, vec
       }
     }
   }
+  return h2; 
 }
 
 // ----------------------------------------------------------------------
@@ -46,6 +46,17 @@ typedef struct {
   uint16_t pq[2000];
 } TreeEvent;
 
+/// raw data of an s-curve scan, together with what the analysis needs to know about the DUT 
+/// at the time of the scan. Filled by PixTest::scurveScan, so that PixTest::scurveAna can run 
+/// later without the api (e.g. in a thread of its own while the next test takes data)
+struct scurveData {
+  std::string dac, name; 
+  std::vector<std::vector<TH1*> > maps;  ///< per ROC and pixel (icol*80+irow) the hits vs dac
+  std::vector<uint8_t> rocIds;           ///< enabled ROCs, in the order of maps
+  int ntrig;                             ///< triggers per dac value actually used
+  bool zeroSuppressed;                   ///< less than 4000 pixels were enabled
+};
+
 
 ///
 /// PixTest
@@ -73,7 +84,10 @@ public:
   void bookHist(std::string name);
   /// book a minimal tree with pixel events
   void bookTree();
-  /// to be filled per test
+  /// data taking part of the test (everything that needs the api). The default runs the complete doTest()
+  virtual void doMeasurement();
+  /// analysis part of the test, after doMeasurement(). Must not use the api or draw: 
+  /// PixTestFullTest runs it in a separate thread while the next test takes data
   virtual void doAnalysis();
   /// function connected to "DoTest" button of PixTab
   virtual void doTest(); 
@@ -108,6 +122,8 @@ public:
   void dacScan(std::string dac, int ntrig, int dacmin, int dacmax, std::vector<std::vector<TH1*> > maps, int ihit, int flag = 0);
   /// do the scurve analysis
   void scurveAna(std::string dac, std::string name, std::vector<std::vector<TH1*> > maps, std::vector<TH1*> &resultMaps, int result);
+  /// do the scurve analysis of the data of scurveScan without the api and without drawing. Returns the threshold map to display
+  TH1* scurveAna(const scurveData &data, std::vector<TH1*> &resultMaps, int result);
   /// determine PH error interpolation
   void getPhError(std::string dac, int dacmin, int dacmax, int FLAGS, int ntrig);
   /// returns TH2D's with hit maps
@@ -118,6 +134,9 @@ public:
   /// flag allows to pass in other flags
   std::vector<TH1*> scurveMaps(std::string dac, std::string name, int ntrig = 10, int daclo = 0, int dachi = 255, 
 			       int result = 1, int ihit = 1, int flag = FLAG_FORCE_MASKED | FLAG_FORCE_SERIAL); 
+  /// the data taking part of scurveMaps: books the per-pixel histograms and fills them with dacScan
+  scurveData scurveScan(std::string dac, std::string name, int ntrig = 10, int daclo = 0, int dachi = 255, 
+			int ihit = 1, int flag = FLAG_FORCE_MASKED | FLAG_FORCE_SERIAL); 
   /// returns TH2D's for the threshold, the user flag argument is intended for selecting calS and will be OR'ed with other flags
   std::vector<TH1*> thrMaps(std::string dac, std::string name, uint8_t dacmin, uint8_t dachi, int ntrig, uint16_t flag = 0);
   std::vector<TH1*> thrMaps(std::string dac, std::string name, int ntrig, uint16_t flag = 0);
@@ -254,6 +273,7 @@ protected:
 
   double               fThreshold, fThresholdE, fSigma, fSigmaE;  ///< variables for passing back s-curve results
   double               fThresholdN; ///< variable for passing back the threshold where noise leads to loss of efficiency
+  bool                 fFastScurve; ///< use the moment estimate instead of the s-curve fit
   int                  fNtrig; 
   std::vector<double>  fPhErrP0, fPhErrP1; 
 
@@ -86,6 +86,15 @@ PixTestBBMap::~PixTestBBMap() {
 
 //------------------------------------------------------------------------------
 void PixTestBBMap::doTest() {
+  doMeasurement(); 
+  doAnalysis(); 
+
+  if (fDisplayedHist != fHistList.end()) (*fDisplayedHist)->Draw();
+  PixTest::update(); 
+}
+
+//------------------------------------------------------------------------------
+void PixTestBBMap::doMeasurement() {
 
   cacheDacs();
   PixTest::update();
@@ -100,18 +109,33 @@ void PixTestBBMap::doTest() {
   fApi->setDAC("ctrlreg", 4);     // high range
   fApi->setDAC("vcal", fParVcalS);    
 
-  int result(7);
-
   LOG(logDEBUG) << "taking CalS threshold maps";
-  vector<TH1*>  thrmapsCals = scurveMaps("VthrComp", "calSMap", fParNtrig, 0, 170, result, 1, flag);
+  fCalS = scurveScan("VthrComp", "calSMap", fParNtrig, 0, 170, 1, flag);
 
+  fXtalk = scurveData(); 
   if (fParXtalk) {
     LOG(logDEBUG) << "taking Xtalk maps";
-    vector<TH1*> thrmapsXtalk = scurveMaps("VthrComp", "calSMapXtalk", fParNtrig, 0, 170, result, 1, flag | FLAG_XTALK); 
+    fXtalk = scurveScan("VthrComp", "calSMapXtalk", fParNtrig, 0, 170, 1, flag | FLAG_XTALK); 
+  }
+  
+  restoreDacs();
+}
+
+//------------------------------------------------------------------------------
+void PixTestBBMap::doAnalysis() {
+
+  fDirectory->cd();
+  int result(7);
+
+  vector<TH1*>  thrmapsCals; 
+  scurveAna(fCalS, thrmapsCals, result);
+
+  if (fParXtalk) {
+    vector<TH1*> thrmapsXtalk; 
+    scurveAna(fXtalk, thrmapsXtalk, result); 
 
     LOG(logDEBUG) << "map analysis";
-    vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs(); 
-    for (unsigned int idx = 0; idx < rocIds.size(); ++idx){
+    for (unsigned int idx = 0; idx < fXtalk.rocIds.size(); ++idx){
       unsigned int rocId = getIdFromIdx(idx);
       TH2D* rocmapRaw = (TH2D*)thrmapsCals[idx];
       TH2D* rocmapBB(0); 
@@ -137,11 +161,11 @@ void PixTestBBMap::doTest() {
     }
 
   }
+  fCalS  = scurveData(); 
+  fXtalk = scurveData(); 
   
   TH1D *h(0);
   
-  restoreDacs();
-
   // -- summary printout
   string bbString(""), hname(""); 
   double bbprob(0.); 
@@ -153,9 +177,7 @@ void PixTestBBMap::doTest() {
     bbString += Form(" %6.4f", bbprob); 
   }
 
-  h->Draw();
   fDisplayedHist = find(fHistList.begin(), fHistList.end(), h);
-  PixTest::update(); 
   
   LOG(logINFO) << "PixTestBBMap::doTest() done";
   LOG(logINFO) << "number of dead bumps (per ROC): " << bbString;
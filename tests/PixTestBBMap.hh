@@ -14,12 +14,16 @@ public:
   void setToolTips();
 
   void doTest(); 
+  void doMeasurement(); 
+  void doAnalysis(); 
   void output4moreweb();
 
 private:
   int          fParNtrig; 
   int          fParVcalS; 
   int          fParXtalk; 
+
+  scurveData   fCalS, fXtalk; ///< raw data of doMeasurement() for doAnalysis()
   
   ClassDef(PixTestBBMap, 1); 
 
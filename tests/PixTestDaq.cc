@@ -381,8 +381,8 @@ void PixTestDaq::doTest() {
   	pgToDefault();
   	LOG(logINFO) << " Pattern generator set to default KUtest";
   }
-//Start the DAQ:
-  fApi->daqStart();
+//Start the DAQ with background readout, the DTB buffer is drained while triggering:
+  fApi->daqStart(true);
 //If using number of triggers
   if(fParNtrig > 0) {
 	uint32_t fLoopCount = 0;
@@ -434,6 +434,9 @@ void PixTestDaq::doTest() {
 			LOG(logINFO) << "Elapsed time: " << timeff / 1000 << " seconds.";
 		  	LOG(logINFO) << "buffer not full, at " << (int)perFull << "%";
 		}
+		//Collect the events fetched by the readout thread, triggers keep running:
+		ProcessData(0);
+		//Only pause if the trigger rate exceeds the readout bandwidth:
 		if( perFull > 80 ){
 			LOG(logINFO) << "Buffer almost full, pausing triggers.";
 			fApi->daqTriggerLoopHalt();
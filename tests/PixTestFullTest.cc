@@ -5,6 +5,8 @@
 #include "PixTestFactory.hh"
 #include "PixTestFullTest.hh"
 #include "log.h"
+#include "timer.h"
+#include "threading.h"
 
 #include <TH2.h>
 
@@ -14,7 +16,19 @@ using namespace pxar;
 ClassImp(PixTestFullTest)
 
 // ----------------------------------------------------------------------
-PixTestFullTest::PixTestFullTest(PixSetup *a, std::string name) : PixTest(a, name) {
+struct PixTestFullTest::analysisJob {
+  PixTest *test; 
+  string name; 
+  FILE *logStream;
+  const char *logTag; 
+  uint64_t duration; 
+  pxar::thread thr; 
+};
+
+
+// ----------------------------------------------------------------------
+PixTestFullTest::PixTestFullTest(PixSetup *a, std::string name) : PixTest(a, name), 
+  fParPipeline(1), fAnalysis(0), fAnalysisTime(0), fAnalysisWait(0) {
   PixTest::init();
   init(); 
   LOG(logDEBUG) << "PixTestFullTest ctor(PixSetup &a, string, TGTab *)";
@@ -22,12 +36,12 @@ PixTestFullTest::PixTestFullTest(PixSetup *a, std::string name) : PixTest(a, nam
 
 
 //----------------------------------------------------------
-PixTestFullTest::PixTestFullTest() : PixTest() {
+PixTestFullTest::PixTestFullTest() : PixTest(), fParPipeline(1), fAnalysis(0), fAnalysisTime(0), fAnalysisWait(0) {
   LOG(logDEBUG) << "PixTestFullTest ctor()";
 }
 
 // ----------------------------------------------------------------------
-bool PixTestFullTest::setParameter(string parName, string /*sval*/) {
+bool PixTestFullTest::setParameter(string parName, string sval) {
   bool found(false);
   string stripParName; 
   for (unsigned int i = 0; i < fParameters.size(); ++i) {
@@ -37,6 +51,10 @@ bool PixTestFullTest::setParameter(string parName, string /*sval*/) {
 	//	fDeadFace = static_cast<uint16_t>(atoi(sval.c_str())); 
 	setToolTips();
       }
+      if (!parName.compare("pipeline")) {
+	fParPipeline = atoi(sval.c_str()); 
+	setToolTips();
+      }
       break;
     }
   }
@@ -60,6 +78,7 @@ void PixTestFullTest::init() {
 // ----------------------------------------------------------------------
 void PixTestFullTest::setToolTips() {
   fTestTip    = string("run the complete FullTest")
+    + string("\nwith pipeline set, the analysis of a test runs while the next test takes data")
     ;
   fSummaryTip = string("to be implemented")
     ;
@@ -76,6 +95,7 @@ void PixTestFullTest::bookHist(string name) {
 //----------------------------------------------------------
 PixTestFullTest::~PixTestFullTest() {
   LOG(logDEBUG) << "PixTestFullTest dtor";
+  finishAnalysis(); 
 }
 
 
@@ -93,8 +113,20 @@ void PixTestFullTest::doTest() {
   suite.push_back("phoptimization"); 
   suite.push_back("gainpedestal"); 
 
+  // -- tests whose analysis must be finished before the data taking of a test can start, 
+  //    e.g. needs["trim"].push_back("scurves") if trim started from the VthrComp found by scurves. 
+  //    In this suite no data taking uses an earlier analysis: trim determines VthrComp itself and 
+  //    the trim vcal is set below from the trim parameters. The s-curve fits of the scurves 
+  //    analysis and of the trim data taking may run at the same time, PixScurveFitter 
+  //    serializes the ROOT function handling of concurrent fits.
+  map<string, vector<string> > needs; 
+
   PixTest *t(0); 
 
+  if (fParPipeline) PixUtil::enableThreads(); 
+  fAnalysisTime = fAnalysisWait = 0; 
+  timer tTotal; 
+
   string trimvcal(""); 
   PixTestFactory *factory = PixTestFactory::instance(); 
   for (unsigned int i = 0; i < suite.size(); ++i) {
@@ -105,12 +137,88 @@ void PixTestFullTest::doTest() {
       fPixSetup->getConfigParameters()->setTrimVcalSuffix(trimvcal); 
     }
 
-    t->doTest(); 
+    if (!fParPipeline) {
+      t->doTest(); 
+      delete t; 
+      continue;
+    }
+
+    if (fAnalysis) {
+      vector<string> &n = needs[suite[i]]; 
+      if (n.end() != find(n.begin(), n.end(), fAnalysis->name)) {
+	LOG(logINFO) << "PixTestFullTest: " << suite[i] << " waits for the analysis of " << fAnalysis->name; 
+	finishAnalysis(); 
+      }
+    }
 
-    delete t; 
+    try {
+      t->doMeasurement(); 
+    } catch (...) {
+      finishAnalysis(); 
+      delete t; 
+      throw;
+    }
+
+    finishAnalysis(); 
+    startAnalysis(t, suite[i]); 
+  }
+  finishAnalysis(); 
+
+  if (fParPipeline) {
+    LOG(logINFO) << "PixTestFullTest::doTest() done in " << tTotal.get()/1000. << " s, analysis " 
+		 << fAnalysisTime/1000. << " s of which " 
+		 << (fAnalysisTime > fAnalysisWait ? fAnalysisTime - fAnalysisWait : 0)/1000. 
+		 << " s overlapped with data taking"; 
   }
 
   //  fPixSetup->setMoreWebCloning(false);
 }
 
 
+// ----------------------------------------------------------------------
+void PixTestFullTest::startAnalysis(PixTest *test, string name) {
+  analysisJob *job = new analysisJob;
+  job->test      = test; 
+  job->name      = name; 
+  job->logStream = SetLogOutput::ThreadStream(); 
+  job->logTag    = SetLogOutput::ThreadTag(); 
+  job->duration  = 0; 
+  fAnalysis = job; 
+  if (!job->thr.start(&PixTestFullTest::runAnalysis, job)) {
+    LOG(logWARNING) << "PixTestFullTest: could not start analysis thread, analyzing " << name << " now"; 
+    runAnalysis(job); 
+  }
+}
+
+
+// ----------------------------------------------------------------------
+void PixTestFullTest::runAnalysis(void *arg) {
+  analysisJob *job = static_cast<analysisJob*>(arg); 
+  // -- log like the thread that started the analysis (e.g. into the logfile of the DUT)
+  SetLogOutput::ThreadStream() = job->logStream; 
+  SetLogOutput::ThreadTag() = job->logTag; 
+
+  timer t; 
+  try {
+    job->test->doAnalysis(); 
+  } catch (pxar::pxarException &e) {
+    LOG(logCRITICAL) << "PixTestFullTest: analysis of " << job->name << " failed: " << e.what(); 
+  } catch (...) {
+    LOG(logCRITICAL) << "PixTestFullTest: analysis of " << job->name << " failed"; 
+  }
+  job->duration = t.get(); 
+}
+
+
+// ----------------------------------------------------------------------
+void PixTestFullTest::finishAnalysis() {
+  if (!fAnalysis) return;
+  timer t; 
+  fAnalysis->thr.join(); 
+  fAnalysisWait += t.get(); 
+  fAnalysisTime += fAnalysis->duration; 
+  // -- the dtor writes the histograms of the test into the rootfile, not to be done concurrently
+  delete fAnalysis->test; 
+  delete fAnalysis; 
+  fAnalysis = 0; 
+}
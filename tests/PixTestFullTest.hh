@@ -16,7 +16,17 @@ public:
   void doTest(); 
 
 private:
-  
+  struct analysisJob;
+  /// thread function running doAnalysis() of a test
+  static void runAnalysis(void *); 
+  /// start doAnalysis() of test in the background
+  void startAnalysis(PixTest *test, std::string name); 
+  /// wait for the analysis in the background and delete its test (which writes its histograms)
+  void finishAnalysis(); 
+
+  int          fParPipeline; ///< analyze a test while the next one takes data
+  analysisJob *fAnalysis;    ///< the analysis running in the background, if any
+  uint64_t     fAnalysisTime, fAnalysisWait; ///< ms spent in doAnalysis() and waiting for it
   
   ClassDef(PixTestFullTest, 1)
 
@@ -108,12 +108,26 @@ PixTestGainPedestal::~PixTestGainPedestal() {
 // ----------------------------------------------------------------------
 void PixTestGainPedestal::doTest() {
 
+  doMeasurement(); 
+  fit();
+  saveGainPedestalParameters();
+}
+
+
+// ----------------------------------------------------------------------
+void PixTestGainPedestal::doMeasurement() {
+
   fDirectory->cd();
   PixTest::update(); 
   bigBanner(Form("PixTestGainPedestal::doTest() ntrig = %d", fParNtrig));
 
   measure();
-  fit();
+}
+
+
+// ----------------------------------------------------------------------
+void PixTestGainPedestal::doAnalysis() {
+  fit(false);
   saveGainPedestalParameters();
 }
 
@@ -148,6 +162,7 @@ void PixTestGainPedestal::measure() {
  
   TH1D *h1(0); 
   vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs(); 
+  fRocIds = rocIds; 
   string name; 
   fHists.clear();
   for (unsigned int iroc = 0; iroc < rocIds.size(); ++iroc){
@@ -170,92 +185,55 @@ void PixTestGainPedestal::measure() {
   fApi->_dut->testAllPixels(true);
   fApi->_dut->maskAllPixels(false);
 
-  // -- first low range 
-  fApi->setDAC("ctrlreg", 0);
-
+  // -- low range (ctrlreg 0) and high range (ctrlreg 4) points in one go
   //    OutputFile << "Low range:  50 100 150 200 250 " << endl;
   //    OutputFile << "High range:  30  50  70  90 200 " << endl;
-
-  vector<pair<uint8_t, vector<pixel> > > rresult, lresult, hresult; 
+  vector<uint8_t> vcal, ctrlreg; 
   for (unsigned int i = 0; i < fLpoints.size(); ++i) {
-    LOG(logINFO) << "scanning low vcal = " << fLpoints[i];
-    int cnt(0); 
-    bool done = false;
-    while (!done){
-      try {
-	rresult = fApi->getPulseheightVsDAC("vcal", fLpoints[i], fLpoints[i], FLAGS, fParNtrig);
-	copy(rresult.begin(), rresult.end(), back_inserter(lresult)); 
-	done = true; // got our data successfully
-      }
-      catch(pxar::DataMissingEvent &e){
-	LOG(logCRITICAL) << "problem with readout: "<< e.what() << " missing " << e.numberMissing << " events"; 
-	++cnt;
-	if (e.numberMissing > 10) done = true; 
-      } catch(pxarException &e) {
-	LOG(logCRITICAL) << "pXar execption: "<< e.what(); 
-	++cnt;
-      }
-      done = (cnt>5) || done;
-    }
+    vcal.push_back(static_cast<uint8_t>(fLpoints[i])); 
+    ctrlreg.push_back(0); 
   }
-
-  // -- and high range
-  fApi->setDAC("ctrlreg", 4);
   for (unsigned int i = 0; i < fHpoints.size(); ++i) {
-    LOG(logINFO) << "scanning high vcal = " << fHpoints[i] << " (= " << 7*fHpoints[i] << " in low range)";
-    int cnt(0); 
-    bool done = false;
-    while (!done){
-      try {
-	rresult = fApi->getPulseheightVsDAC("vcal", fHpoints[i], fHpoints[i], FLAGS, fParNtrig);
-	copy(rresult.begin(), rresult.end(), back_inserter(hresult)); 
-	done = true; // got our data successfully
-      }
-      catch(pxar::DataMissingEvent &e){
-	LOG(logCRITICAL) << "problem with readout: "<< e.what() << " missing " << e.numberMissing << " events"; 
-	++cnt;
-	if (e.numberMissing > 10) done = true; 
-      } catch(pxarException &e) {
-	LOG(logCRITICAL) << "pXar execption: "<< e.what(); 
-	++cnt;
-      }
-      done = (cnt>5) || done;
+    vcal.push_back(static_cast<uint8_t>(fHpoints[i])); 
+    ctrlreg.push_back(4); 
+  }
+  LOG(logINFO) << "scanning " << fLpoints.size() << " low and " << fHpoints.size() << " high vcal points";
+
+  pxar::dacScanResult result; 
+  int cnt(0); 
+  bool done = false;
+  while (!done){
+    try {
+      fApi->getPulseheightVsDACPoints(result, "vcal", vcal, "ctrlreg", ctrlreg, FLAGS, fParNtrig);
+      done = true; // got our data successfully
+    }
+    catch(pxar::DataMissingEvent &e){
+      LOG(logCRITICAL) << "problem with readout: "<< e.what() << " missing " << e.numberMissing << " events"; 
+      ++cnt;
+      if (e.numberMissing > 10) done = true; 
+    } catch(pxarException &e) {
+      LOG(logCRITICAL) << "pXar execption: "<< e.what(); 
+      ++cnt;
     }
+    done = (cnt>5) || done;
   }
 
-  double sf(2.), err(0.);
-  for (unsigned int i = 0; i < lresult.size(); ++i) {
-    int dac = lresult[i].first; 
-    vector<pixel> vpix = lresult[i].second;
-    for (unsigned int ipx = 0; ipx < vpix.size(); ++ipx) {
-      int roc = vpix[ipx].roc_id;
-      int ic = vpix[ipx].column;
-      int ir = vpix[ipx].row;
-      name = Form("gainPedestal_c%d_r%d_C%d", ic, ir, roc); 
-      h1 = fHists[name];
-      if (h1) {
-	h1->SetBinContent(dac+1, vpix[ipx].getValue());
-	h1->SetBinError(dac+1, (err>1?sf*err:sf)); //FIXME using variance as error
-      } else {
-	LOG(logDEBUG) << " histogram " << Form("gainPedestal_c%d_r%d_C%d", ic, ir, roc) << " not found";
-      }
-    } 
-  } 
-
+  // -- high range points are scaled to the low range
+  double sf(2.);
   int scaleLo(7); 
-  for (unsigned int i = 0; i < hresult.size(); ++i) {
-    int dac = hresult[i].first; 
-    vector<pixel> vpix = hresult[i].second;
-    for (unsigned int ipx = 0; ipx < vpix.size(); ++ipx) {
-      int roc = vpix[ipx].roc_id;
-      int ic = vpix[ipx].column;
-      int ir = vpix[ipx].row;
+  for (unsigned int i = 0; i < result.size(); ++i) {
+    bool hi = (result.dac2(i) == 4);
+    int bin = (hi ? scaleLo*result.dac1(i) : result.dac1(i)) + 1; 
+    for (vector<pixel>::const_iterator ipx = result.begin(i); ipx != result.end(i); ++ipx) {
+      int roc = ipx->roc_id;
+      int ic = ipx->column;
+      int ir = ipx->row;
       name = Form("gainPedestal_c%d_r%d_C%d", ic, ir, roc); 
       h1 = fHists[name];
       if (h1) {
-	h1->SetBinContent(scaleLo*dac+1, vpix[ipx].getValue());
-	err = vpix[ipx].getVariance();
-	h1->SetBinError(scaleLo*dac+1, (err>1?sf*err:sf)); //FIXME using variance as error
+	double err = (hi ? ipx->getVariance() : 0.);
+	h1->SetBinContent(bin, ipx->getValue());
+	h1->SetBinError(bin, (err>1?sf*err:sf)); //FIXME using variance as error
       } else {
 	LOG(logDEBUG) << " histogram " << Form("gainPedestal_c%d_r%d_C%d", ic, ir, roc) << " not found";
       }
@@ -278,8 +256,8 @@ void PixTestGainPedestal::measure() {
 
 
 // ----------------------------------------------------------------------
-void PixTestGainPedestal::fit() {
-  PixTest::update(); 
+void PixTestGainPedestal::fit(bool display) {
+  if (display) PixTest::update(); 
   fDirectory->cd();
 
 
@@ -287,7 +265,7 @@ void PixTestGainPedestal::fit() {
   TF1 *f = fPIF->gpTanH(h1); 
 
   vector<vector<gainPedestalParameters> > v;
-  vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs(); 
+  vector<uint8_t> rocIds = fRocIds; 
   gainPedestalParameters a; a.p0 = a.p1 = a.p2 = a.p3 = 0.;
   TH1D* h(0);
   vector<TH1D*> p1list; 
@@ -309,7 +287,7 @@ void PixTestGainPedestal::fit() {
     h1 = (*i).second; 
     if (h1->GetEntries() < 1) continue;
     string h1name = h1->GetName();
-    if (fParShowFits) {
+    if (fParShowFits && display) {
       LOG(logDEBUG) << h1name; 
       h1->Fit(f, "r");
       PixTest::update(); 
@@ -330,7 +308,7 @@ void PixTestGainPedestal::fit() {
 
   copy(p1list.begin(), p1list.end(), back_inserter(fHistList));
   h = (TH1D*)(fHistList.back());
-  h->Draw();
+  if (display) h->Draw();
 
   string p1MeanString(""), p1RmsString(""); 
   for (unsigned int i = 0; i < p1list.size(); ++i) {
@@ -339,7 +317,7 @@ void PixTestGainPedestal::fit() {
   }
 
   fDisplayedHist = find(fHistList.begin(), fHistList.end(), h);
-  PixTest::update(); 
+  if (display) PixTest::update(); 
 
   LOG(logINFO) << "PixTestGainPedestal::fit() done"; 
   LOG(logINFO) << "p1 mean: " << p1MeanString; 
@@ -17,10 +17,13 @@ public:
   
   void measure();
   void printHistograms();
-  void fit(); 
+  /// fit all pixels; without display the fits are not drawn and the canvas is not updated
+  void fit(bool display = true); 
   void saveGainPedestalParameters(); 
 
   void doTest(); 
+  void doMeasurement(); 
+  void doAnalysis(); 
   void output4moreweb();
 
 private:
@@ -29,6 +32,7 @@ private:
 
   std::map<std::string, TH1D*> fHists; 
   std::vector<int> fLpoints, fHpoints;
+  std::vector<uint8_t> fRocIds; ///< enabled ROCs at the time of measure()
 
   ClassDef(PixTestGainPedestal, 1)
 
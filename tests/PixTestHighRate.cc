@@ -436,7 +436,8 @@ void PixTestHighRate::doHitMap(int nseconds) {
   uint8_t perFull;
   fDaq_loop = true;
     
-  fApi->daqStart();
+  // -- background readout: the DTB buffer is drained while triggers keep running
+  fApi->daqStart(true);
 
   int finalPeriod = fApi->daqTriggerLoop(0);  //period is automatically set to the minimum by Api function
   LOG(logINFO) << "PixTestHighRate::doRateScan start TriggerLoop with period " << finalPeriod 
@@ -444,6 +445,8 @@ void PixTestHighRate::doHitMap(int nseconds) {
     
   while (fApi->daqStatus(perFull) && fDaq_loop) {
     gSystem->ProcessEvents();
+    readData();
+    // -- only happens if the trigger rate exceeds the USB readout bandwidth
     if (perFull > 80) {
       LOG(logINFO) << "Buffer almost full, pausing triggers.";
       fApi->daqTriggerLoopHalt();
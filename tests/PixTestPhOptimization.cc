@@ -3,6 +3,7 @@
 #include <sstream>   // parsing
 
 #include "PixTestPhOptimization.hh"
+#include "PixUtil.hh"
 #include "log.h"
 
 using namespace std;
@@ -12,7 +13,7 @@ ClassImp(PixTestPhOptimization)
 
 PixTestPhOptimization::PixTestPhOptimization() {}
 
-PixTestPhOptimization::PixTestPhOptimization( PixSetup *a, std::string name ) :  PixTest(a, name), fParNtrig(-1), fParDAC("nada"), fParDacVal(100),   fFlagSinglePix(true) {
+PixTestPhOptimization::PixTestPhOptimization( PixSetup *a, std::string name ) :  PixTest(a, name), fParNtrig(-1), fParDAC("nada"), fParDacVal(100),   fFlagSinglePix(true), fAdaptiveThr(false) {
   PixTest::init();
   init();
 }
@@ -39,6 +40,13 @@ bool PixTestPhOptimization::setParameter(string parName, string sval) {
 	LOG(logDEBUG) << "  setting fFlagSinglePix  ->" << fFlagSinglePix
 		      << "<- from sval = " << sval;
       }
+      if (!parName.compare("adaptivethr")) {
+	PixUtil::replaceAll(sval, "checkbox(", ""); 
+	PixUtil::replaceAll(sval, ")", ""); 
+	fAdaptiveThr = (atoi(sval.c_str()) != 0); 
+	LOG(logDEBUG) << "  setting fAdaptiveThr  ->" << fAdaptiveThr
+		      << "<- from sval = " << sval;
+      }
       if (!parName.compare("dac")) {
 	setTestParameter("dac", sval); 
 	fParDAC = sval;
@@ -112,7 +120,7 @@ void PixTestPhOptimization::doTest() {
   while (!done) {
     try {
       // Scanning the full VCal range, so no need to specify bounds:
-      thrmap = fApi->getThresholdMap("vcal", FLAG_RISING_EDGE, 10);
+      thrmap = fApi->getThresholdMap("vcal", FLAG_RISING_EDGE | (fAdaptiveThr ? FLAG_ADAPTIVE_THRESHOLD : 0), 10);
       done = true;
     } catch(pxarException &e) {
       LOG(logCRITICAL) << "pXar execption: "<< e.what(); 
@@ -159,13 +167,13 @@ void PixTestPhOptimization::doTest() {
   fApi->setDAC("vcal",255);
   fApi->setDAC("ctrlreg",4);
   //scanning through offset and scale for max pixel (or randpixel)
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > > dacdac_max;
+  pxar::dacScanResult dacdac_max;
 
   cnt = 0; 
   done = false;
   while (!done) {
     try {
-      dacdac_max = fApi->getPulseheightVsDACDAC("phoffset",0,255,"phscale",0,255,0,10);
+      fApi->getPulseheightVsDACDAC(dacdac_max,"phoffset",1,0,255,"phscale",1,0,255,0,10);
       done = true;
     } catch(pxarException &e) {
       LOG(logCRITICAL) << "pXar execption: "<< e.what(); 
@@ -183,12 +191,12 @@ void PixTestPhOptimization::doTest() {
   fApi->setDAC("ctrlreg",4);
   fApi->setDAC("vcal",minthr);
   //scanning through offset and scale for min pixel (or same randpixel)
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > > dacdac_min;
+  pxar::dacScanResult dacdac_min;
   cnt = 0; 
   done = false;
   while (!done) {
     try {
-      dacdac_min = fApi->getPulseheightVsDACDAC("phoffset",0,255,"phscale",0,255,0,10);
+      fApi->getPulseheightVsDACDAC(dacdac_min,"phoffset",1,0,255,"phscale",1,0,255,0,10);
       done = true;
     } catch(pxarException &e) {
       LOG(logCRITICAL) << "pXar execption: "<< e.what(); 
@@ -453,7 +461,7 @@ void PixTestPhOptimization::GetMinPixel(pxar::pixel &minpixel, std::vector<pxar:
 }
 
 
-int PixTestPhOptimization::InsideRangePH(int po_opt,  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > > &dacdac_max,   std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > > &dacdac_min){
+int PixTestPhOptimization::InsideRangePH(int po_opt,  pxar::dacScanResult &dacdac_max, pxar::dacScanResult &dacdac_min){
   //adjusting phscale so that the PH curve is fully inside the ADC range
   int ps_opt = 999;
   int maxPh(0);
@@ -463,27 +471,23 @@ int PixTestPhOptimization::InsideRangePH(int po_opt,  std::vector< std::pair<uin
   int safetyMargin = 50;
   int dist = 255;
   int bestDist = 255;
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > >::iterator dacit_max = dacdac_max.begin();
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > >::iterator dacit_min = dacdac_min.begin();
   //or two for cycles??
   LOG(logDEBUG) << "dacdac at max vcal has size "<<dacdac_max.size()<<endl;
   LOG(logDEBUG) << "dacdac at min vcal has size "<<dacdac_min.size()<<endl;
-  while(dacit_max != dacdac_max.end() || dacit_min != dacdac_min.end()){
-    if(dacit_max->first == po_opt && dacit_min->first == po_opt && dacit_min->second.second.size() && dacit_max->second.second.size()) {
-      maxPh=dacit_max->second.second[0].getValue();
-      minPh=dacit_min->second.second[0].getValue();
+  for(size_t i = 0; i < dacdac_max.size() && i < dacdac_min.size(); ++i){
+    if(dacdac_max.dac1(i) == po_opt && dacdac_min.dac1(i) == po_opt && dacdac_min.nPixels(i) && dacdac_max.nPixels(i)) {
+      maxPh=dacdac_max.begin(i)->getValue();
+      minPh=dacdac_min.begin(i)->getValue();
       lowEd = (minPh > safetyMargin);
       upEd = (maxPh < 255 - safetyMargin);
       upEd_dist = abs(maxPh - (255 - safetyMargin));
       lowEd_dist = abs(minPh - safetyMargin);
       dist = (upEd_dist > lowEd_dist ) ? (upEd_dist) : (lowEd_dist);
       if(dist < bestDist && upEd && lowEd){
-	ps_opt = dacit_max->second.first;
+	ps_opt = dacdac_max.dac2(i);
 	bestDist=dist;
       }
     }
-    dacit_max++;
-    dacit_min++;
   }
   LOG(logDEBUG)<<"opt step 1: po fixed to"<<po_opt<<" and scale adjusted to "<<ps_opt<<", with distance "<<bestDist;
   return ps_opt;
@@ -491,28 +495,24 @@ int PixTestPhOptimization::InsideRangePH(int po_opt,  std::vector< std::pair<uin
 
 
 
-int PixTestPhOptimization::CentrePhRange(int po_opt_in, int ps_opt,  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > > &dacdac_max,   std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > > &dacdac_min){
+int PixTestPhOptimization::CentrePhRange(int po_opt_in, int ps_opt,  pxar::dacScanResult &dacdac_max, pxar::dacScanResult &dacdac_min){
   //centring PH curve adjusting phoffset   
   int po_opt_out = po_opt_in;
   int maxPh(0);
   int minPh(0);
   int dist = 255;
   int bestDist = 255;
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > >::iterator dacit_max = dacdac_max.begin();
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > >::iterator dacit_min = dacdac_min.begin();
   //or two for cycles??
-  while(dacit_max != dacdac_max.end() || dacit_min != dacdac_min.end()){
-    if(dacit_max->second.first == ps_opt && dacit_min->second.first == ps_opt && dacit_min->second.second.size() && dacit_max->second.second.size()) {
-      maxPh=dacit_max->second.second.at(0).getValue();
-      minPh=dacit_min->second.second.at(0).getValue();
+  for(size_t i = 0; i < dacdac_max.size() && i < dacdac_min.size(); ++i){
+    if(dacdac_max.dac2(i) == ps_opt && dacdac_min.dac2(i) == ps_opt && dacdac_min.nPixels(i) && dacdac_max.nPixels(i)) {
+      maxPh=dacdac_max.begin(i)->getValue();
+      minPh=dacdac_min.begin(i)->getValue();
       dist = abs(minPh - (255 - maxPh));
       if (dist < bestDist){
-	po_opt_out = dacit_max->first;
+	po_opt_out = dacdac_max.dac1(i);
 	bestDist = dist;
       } 
     }
-    dacit_max++;
-    dacit_min++;
   }
   LOG(logDEBUG)<<"opt centring step: po "<<po_opt_out<<" and scale "<<ps_opt<<", with distance "<<bestDist;
   return po_opt_out;
@@ -520,7 +520,7 @@ int PixTestPhOptimization::CentrePhRange(int po_opt_in, int ps_opt,  std::vector
 
 
 
-int PixTestPhOptimization::StretchPH(int po_opt, int ps_opt_in,  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > > &dacdac_max,   std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > > &dacdac_min){
+int PixTestPhOptimization::StretchPH(int po_opt, int ps_opt_in,  pxar::dacScanResult &dacdac_max, pxar::dacScanResult &dacdac_min){
   //stretching PH curve to exploit the full ADC range, adjusting phscale             
   int ps_opt_out = ps_opt_in;
   int maxPh(0);
@@ -530,24 +530,20 @@ int PixTestPhOptimization::StretchPH(int po_opt, int ps_opt_in,  std::vector< st
   int safetyMargin = 10;
   int dist = 255;
   int bestDist = 255;
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > >::iterator dacit_max = dacdac_max.begin();
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > >::iterator dacit_min = dacdac_min.begin();
-  while(dacit_max != dacdac_max.end() || dacit_min != dacdac_min.end()){
-    if(dacit_max->first == po_opt && dacit_min->first == po_opt && dacit_min->second.second.size() && dacit_max->second.second.size()) {
-      maxPh=dacit_max->second.second.at(0).getValue();
-      minPh=dacit_min->second.second.at(0).getValue();
+  for(size_t i = 0; i < dacdac_max.size() && i < dacdac_min.size(); ++i){
+    if(dacdac_max.dac1(i) == po_opt && dacdac_min.dac1(i) == po_opt && dacdac_min.nPixels(i) && dacdac_max.nPixels(i)) {
+      maxPh=dacdac_max.begin(i)->getValue();
+      minPh=dacdac_min.begin(i)->getValue();
       lowEd = (minPh > safetyMargin);
       upEd = (maxPh < 255 - safetyMargin);
       upEd_dist = abs(maxPh - (255 - safetyMargin));
       lowEd_dist = abs(minPh - safetyMargin);
       dist = (upEd_dist < lowEd_dist ) ? (upEd_dist) : (lowEd_dist);
       if(dist<bestDist && lowEd && upEd){
-	ps_opt_out = dacit_max->second.first;
+	ps_opt_out = dacdac_max.dac2(i);
 	bestDist=dist;
       }
     }
-    dacit_max++;
-    dacit_min++;
   }
   LOG(logDEBUG)<<"opt final step: po fixed to"<<po_opt<<" and scale adjusted to "<<ps_opt_out<<", with distance "<<bestDist;
   return ps_opt_out;
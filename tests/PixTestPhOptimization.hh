@@ -16,9 +16,9 @@ public:
   pxar::pixel* RandomPixel(std::vector<std::pair<int, int> > &badPixels);
   void GetMaxPhPixel(pxar::pixel &maxpixel, std::vector<std::pair<int, int> > &badPixels);
   void GetMinPixel(pxar::pixel &minpixel, std::vector<pxar::pixel> &thrmap, std::vector<std::pair<int, int> > &badPixels);
-  int InsideRangePH(int po_opt,  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > > &dacdac_max,   std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > > &dacdac_min);
-  int CentrePhRange(int po_opt, int ps_opt,  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > > &dacdac_max,   std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > > &dacdac_min);
-  int StretchPH(int po_opt, int ps_opt_in,  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > > &dacdac_max,   std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pxar::pixel> > > > &dacdac_min);
+  int InsideRangePH(int po_opt,  pxar::dacScanResult &dacdac_max, pxar::dacScanResult &dacdac_min);
+  int CentrePhRange(int po_opt, int ps_opt,  pxar::dacScanResult &dacdac_max, pxar::dacScanResult &dacdac_min);
+  int StretchPH(int po_opt, int ps_opt_in,  pxar::dacScanResult &dacdac_max, pxar::dacScanResult &dacdac_min);
   void doTest(); 
 
 private:
@@ -27,6 +27,7 @@ private:
   std::string fParDAC; 
   int     fParDacVal;
   bool fFlagSinglePix;
+  bool fAdaptiveThr;
 
   ClassDef(PixTestPhOptimization, 1)
 
@@ -18,7 +18,7 @@ using namespace pxar;
 ClassImp(PixTestScurves)
 
 // ----------------------------------------------------------------------
-PixTestScurves::PixTestScurves(PixSetup *a, std::string name) : PixTest(a, name), fParDac(""), fParNtrig(-1), fParNpix(-1), fParDacLo(-1), fParDacHi(-1), fAdjustVcal(1) {
+PixTestScurves::PixTestScurves(PixSetup *a, std::string name) : PixTest(a, name), fParDac(""), fParNtrig(-1), fParNpix(-1), fParDacLo(-1), fParDacHi(-1), fAdjustVcal(1), fAdaptiveThr(false) {
   PixTest::init();
   init(); 
 }
@@ -58,6 +58,18 @@ bool PixTestScurves::setParameter(string parName, string sval) {
 	LOG(logDEBUG) << "  setting fParDacHi  ->" << fParDacHi << "<- from sval = " << sval;
       }
 
+      if (!parName.compare("fastscurve")) {
+	PixUtil::replaceAll(sval, "checkbox(", ""); 
+	PixUtil::replaceAll(sval, ")", ""); 
+	fFastScurve = (atoi(sval.c_str()) != 0); 
+	LOG(logDEBUG) << "  setting fFastScurve  ->" << fFastScurve << "<- from sval = " << sval;
+      }
+      if (!parName.compare("adaptivethr")) {
+	PixUtil::replaceAll(sval, "checkbox(", ""); 
+	PixUtil::replaceAll(sval, ")", ""); 
+	fAdaptiveThr = (atoi(sval.c_str()) != 0); 
+	LOG(logDEBUG) << "  setting fAdaptiveThr  ->" << fAdaptiveThr << "<- from sval = " << sval;
+      }
       if (!parName.compare("adjustvcal")) {
 	PixUtil::replaceAll(sval, "checkbox(", ""); 
 	PixUtil::replaceAll(sval, ")", ""); 
@@ -117,22 +129,43 @@ PixTestScurves::~PixTestScurves() {
 
 // ----------------------------------------------------------------------
 void PixTestScurves::doTest() {
+  doMeasurement(); 
+  doAnalysis(); 
+
+  TH1 *h1 = (*fDisplayedHist); 
+  h1->Draw(getHistOption(h1).c_str());
+  PixTest::update(); 
+}
+
+
+// ----------------------------------------------------------------------
+void PixTestScurves::doMeasurement() {
 
   fDirectory->cd();
   PixTest::update(); 
   bigBanner(Form("PixTestScurves::doTest() ntrig = %d", fParNtrig));
 
+  fScurveData.clear(); 
   fParDac = "VthrComp"; 
   fParDacLo = 0; 
   fParDacHi = 250;
-  scurves();
+  fScurveData.push_back(scurvesScan());
 
   fParDac = "Vcal"; 
   fParDacLo = 0; 
   fParDacHi = 250;
-  scurves();
+  fScurveData.push_back(scurvesScan());
+
+}
 
 
+// ----------------------------------------------------------------------
+void PixTestScurves::doAnalysis() {
+  fDirectory->cd();
+  for (unsigned int i = 0; i < fScurveData.size(); ++i) {
+    scurvesAna(fScurveData[i]); 
+  }
+  fScurveData.clear(); 
 }
 
 
@@ -158,6 +191,16 @@ void PixTestScurves::runCommand(string command) {
 
 // ----------------------------------------------------------------------
 void PixTestScurves::scurves() {
+  scurveData data = scurvesScan(); 
+  scurvesAna(data); 
+  TH1 *h1 = (*fDisplayedHist); 
+  h1->Draw(getHistOption(h1).c_str());
+  PixTest::update(); 
+}
+
+
+// ----------------------------------------------------------------------
+scurveData PixTestScurves::scurvesScan() {
   cacheDacs();
 
   string command(fParDac);
@@ -171,12 +214,17 @@ void PixTestScurves::scurves() {
   fApi->_dut->testAllPixels(true);
   fApi->_dut->maskAllPixels(false);
 
-  int results(7); 
-  vector<TH1*> thr0 = scurveMaps(fParDac, "scurve"+fParDac, fParNtrig, fParDacLo, fParDacHi, results, 1); 
-  TH1 *h1 = (*fDisplayedHist); 
-  h1->Draw(getHistOption(h1).c_str());
-  PixTest::update(); 
+  scurveData data = scurveScan(fParDac, "scurve"+fParDac, fParNtrig, fParDacLo, fParDacHi, 1); 
   restoreDacs();
+  return data; 
+}
+
+
+// ----------------------------------------------------------------------
+void PixTestScurves::scurvesAna(const scurveData &data) {
+  int results(7); 
+  vector<TH1*> thr0; 
+  scurveAna(data, thr0, results); 
 
   string hname(""), scurvesMeanString(""), scurvesRmsString(""); 
   for (unsigned int i = 0; i < thr0.size(); ++i) {
@@ -188,8 +236,8 @@ void PixTestScurves::scurves() {
   }
 
   LOG(logINFO) << "PixTestScurves::scurves() done ";
-  LOG(logINFO) << Form("%s mean: ", fParDac.c_str()) << scurvesMeanString; 
-  LOG(logINFO) << Form("%s RMS:  ", fParDac.c_str()) << scurvesRmsString; 
+  LOG(logINFO) << Form("%s mean: ", data.dac.c_str()) << scurvesMeanString; 
+  LOG(logINFO) << Form("%s RMS:  ", data.dac.c_str()) << scurvesRmsString; 
 
 }
 
@@ -205,7 +253,7 @@ void PixTestScurves::thrMap() {
   LOG(logINFO) << "PixTestScurves::thrMap() start: " 
 	       << fParDac << ": " << fParDacLo << " .. " << fParDacHi
 	       << " ntrig = " << fParNtrig;
-  vector<TH1*> thr1 = thrMaps(fParDac, "thr"+fParDac, fParDacLo, fParDacHi, fParNtrig); 
+  vector<TH1*> thr1 = thrMaps(fParDac, "thr"+fParDac, fParDacLo, fParDacHi, fParNtrig, (fAdaptiveThr ? FLAG_ADAPTIVE_THRESHOLD : 0)); 
 
   PixTest::update(); 
   restoreDacs();
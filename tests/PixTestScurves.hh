@@ -20,12 +20,20 @@ public:
   void adjustVcal();
 
   void doTest(); 
+  void doMeasurement(); 
+  void doAnalysis(); 
   void output4moreweb();
 
 private:
+  /// cache DACs, enable all pixels, run the s-curve scan of fParDac and restore the DACs
+  scurveData scurvesScan(); 
+  /// s-curve analysis with a summary of the threshold distributions
+  void scurvesAna(const scurveData &data); 
 
   std::string fParDac;
   int         fParNtrig, fParNpix, fParDacLo, fParDacHi, fAdjustVcal;
+  bool        fAdaptiveThr; ///< threshold maps with FLAG_ADAPTIVE_THRESHOLD
+  std::vector<scurveData> fScurveData; ///< raw data of doMeasurement() for doAnalysis()
 
   ClassDef(PixTestScurves, 1)
 
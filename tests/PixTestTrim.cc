@@ -45,6 +45,12 @@ bool PixTestTrim::setParameter(string parName, string sval) {
 	fParNtrig = atoi(sval.c_str()); 
 	LOG(logDEBUG) << "  setting fParNtrig  ->" << fParNtrig << "<- from sval = " << sval;
       }
+      if (!parName.compare("fastscurve")) {
+	PixUtil::replaceAll(sval, "checkbox(", ""); 
+	PixUtil::replaceAll(sval, ")", ""); 
+	fFastScurve = (atoi(sval.c_str()) != 0); 
+	LOG(logDEBUG) << "  setting fFastScurve  ->" << fFastScurve << "<- from sval = " << sval;
+      }
       if (!parName.compare("vcal")) {
 	fParVcal = atoi(sval.c_str()); 
 	LOG(logDEBUG) << "  setting fParVcal  ->" << fParVcal << "<- from sval = " << sval;
@@ -0,0 +1,298 @@
+// Microbenchmark for the DTB event decoder
+//
+// Splits a raw DTB data buffer (as written by pxardaq -f), a recorded
+// channel stream (pxardaq -r, replayed via dtbFileSource) or a generated
+// buffer into events and decodes them repeatedly, once with the previous
+// word-by-word reference decoder and once with dtbEventDecoder. Reports the
+// decoding speed in words per second for both.
+
+#include "datapipe.h"
+#include "exceptions.h"
+#include "constants.h"
+#include "timer.h"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+
+using namespace pxar;
+
+// Simple checksum over all decoded pixels to compare the decoders:
+uint64_t checksum(const Event & evt) {
+  uint64_t sum = 0;
+  for(std::vector<pixel>::const_iterator px = evt.pixels.begin(); px != evt.pixels.end(); ++px) {
+    sum += ((static_cast<uint64_t>(px->roc_id) << 24) | (px->column << 16) | (px->row << 8)) + static_cast<uint64_t>(px->getValue());
+  }
+  return sum;
+}
+
+// Word source feeding a buffer into the event splitter:
+class wordSource : public dataSource<uint16_t> {
+  const std::vector<uint16_t> & data;
+  size_t pos;
+  uint16_t last;
+  bool tbm;
+  uint8_t roctype;
+  uint16_t ReadLast() { return last; }
+  uint16_t Read() {
+    if(pos >= data.size()) throw dsBufferEmpty();
+    return (last = data[pos++]);
+  }
+  bool ReadState() { return tbm; }
+  uint8_t ReadChannel() { return 0; }
+  uint8_t ReadDeviceType() { return roctype; }
+public:
+  wordSource(const std::vector<uint16_t> & buffer, bool module, uint8_t type)
+    : data(buffer), pos(0), last(0x4000), tbm(module), roctype(type) {}
+};
+
+// Source handing out already split events to the decoder:
+class rawEventSource : public dataSource<rawEvent*> {
+  std::vector<rawEvent> & data;
+  size_t pos;
+  bool tbm;
+  uint8_t roctype;
+  rawEvent* ReadLast() { return &data[pos-1]; }
+  rawEvent* Read() {
+    if(pos >= data.size()) throw dsBufferEmpty();
+    return &data[pos++];
+  }
+  bool ReadState() { return tbm; }
+  uint8_t ReadChannel() { return 0; }
+  uint8_t ReadDeviceType() { return roctype; }
+public:
+  rawEventSource(std::vector<rawEvent> & events, bool module, uint8_t type)
+    : data(events), pos(0), tbm(module), roctype(type) {}
+  void Rewind() { pos = 0; }
+};
+
+// Reference: the previous DESER160 decoder, bounds-checked access and
+// exceptions for invalid pixel addresses:
+void referenceDeser160(rawEvent & sample, bool invertedAddress, Event & evt) {
+  evt.Clear();
+  unsigned int n = sample.GetSize();
+  if (n > 0) {
+    if (n > 1) evt.pixels.reserve((n-1)/2);
+    evt.header = sample[0];
+    unsigned int pos = 1;
+    while (pos < n-1) {
+      uint32_t raw = sample[pos++] << 12;
+      raw += sample[pos++];
+      try {
+	pixel pix(raw,0,invertedAddress);
+	evt.pixels.push_back(pix);
+      }
+      catch(DataDecoderError &) { evt.numDecoderErrors++; }
+    }
+  }
+}
+
+// Reference: the previous DESER400 decoder state machine:
+void referenceDeser400(rawEvent & sample, bool invertedAddress, Event & evt) {
+  evt.Clear();
+  unsigned int raw = 0;
+  unsigned int pos = 0;
+  unsigned int size = sample.GetSize();
+  uint16_t v;
+  int16_t roc_n = -1;
+
+  v = (pos < size) ? sample[pos++] : 0x6000;
+  raw = (v & 0x00ff) << 8;
+  v = (pos < size) ? sample[pos++] : 0x6000;
+  raw += v & 0x00ff;
+  evt.header = raw;
+
+  v = (pos < size) ? sample[pos++] : 0x6000;
+  while ((v & 0xe000) == 0x4000) {
+    roc_n++;
+    v = (pos < size) ? sample[pos++] : 0x6000;
+    while ((v & 0xe000) <= 0x2000) {
+      for (unsigned int i = 0; i <= 1; i++) {
+	if ((v >> 13) != i && (v & 0x8000)) {
+	  v = (pos < size) ? sample[pos++] : 0x6000;
+	  goto trailer;
+	}
+	raw = (raw << 12) + (v & 0x0fff);
+	v = (pos < size) ? sample[pos++] : 0x6000;
+      }
+      try {
+	pixel pix(raw,static_cast<uint8_t>(roc_n),invertedAddress);
+	evt.pixels.push_back(pix);
+      }
+      catch(DataDecoderError &) { evt.numDecoderErrors++; }
+    }
+  }
+
+ trailer:
+  raw = (v & 0x00ff) << 8;
+  v = (pos < size) ? sample[pos++] : 0x6000;
+  raw += v & 0x00ff;
+  evt.trailer = raw;
+}
+
+// Encode a pixel hit into the 24bit raw format of the ROC:
+uint32_t encodePixel(unsigned int column, unsigned int row, unsigned int ph, bool invert) {
+  unsigned int c = column/2;
+  unsigned int r = 2*(80 - row) + (column & 1);
+  unsigned int r2 = r/36, r1 = (r/6)%6, r0 = r%6;
+  if(invert) { r2 ^= 7; r1 ^= 7; r0 ^= 7; }
+  return ((c/6) << 21) | ((c%6) << 18) | (r2 << 15) | (r1 << 12) | (r0 << 9)
+    | ((ph & 0xf0) << 1) | (ph & 0x0f);
+}
+
+// Generate a DTB data stream with nevents events and up to nhits random
+// pixel hits per ROC, nrocs ROCs behind a TBM (DESER400) or a single ROC.
+// About one percent of the hits get a corrupted pulse height fill bit:
+std::vector<uint16_t> generateBuffer(bool module, unsigned int nevents, unsigned int nrocs, unsigned int nhits, bool invert) {
+  std::vector<uint16_t> data;
+  srand(42);
+  for(unsigned int ev = 0; ev < nevents; ev++) {
+    if(module) {
+      data.push_back(0xa000 | (ev & 0xff));
+      data.push_back(0x8000);
+      for(unsigned int roc = 0; roc < nrocs; roc++) {
+	data.push_back(0x4000 | 0x07f8);
+	unsigned int hits = rand()%(nhits+1);
+	for(unsigned int h = 0; h < hits; h++) {
+	  uint32_t raw = encodePixel(rand()%ROC_NUMCOLS, rand()%ROC_NUMROWS, rand()%256, invert);
+	  if(rand()%100 == 0) { raw |= 0x10; }
+	  data.push_back(0x0000 | ((raw >> 12) & 0x0fff));
+	  data.push_back(0x2000 | (raw & 0x0fff));
+	}
+      }
+      data.push_back(0xe000);
+      data.push_back(0xc000);
+    }
+    else {
+      data.push_back(0x8000 | 0x07f8);
+      unsigned int hits = rand()%(nhits+1);
+      for(unsigned int h = 0; h < hits; h++) {
+	uint32_t raw = encodePixel(rand()%ROC_NUMCOLS, rand()%ROC_NUMROWS, rand()%256, invert);
+	if(rand()%100 == 0) { raw |= 0x10; }
+	data.push_back((raw >> 12) & 0x0fff);
+	data.push_back(raw & 0x0fff);
+      }
+      data.push_back(0x4000);
+    }
+  }
+  return data;
+}
+
+int main(int argc, char* argv[]) {
+
+  std::string filename;
+  bool module = false;
+  uint8_t roctype = ROC_PSI46DIGV2;
+  unsigned int nevents = 100000;
+  unsigned int repeat = 20;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-h")) {
+      std::cout << "Help:" << std::endl;
+      std::cout << "-f filename    raw DTB data file (pxardaq -f) or recorded channel (pxardaq -r), default: generated data" << std::endl;
+      std::cout << "-m             data taken with TBM (DESER400), default: single ROC (DESER160)" << std::endl;
+      std::cout << "-i             ROC with inverted row address (PSI46DIG)" << std::endl;
+      std::cout << "-n events      number of events to generate, default 100000" << std::endl;
+      std::cout << "-r repeat      number of decoding passes, default 20" << std::endl;
+      return 0;
+    }
+    else if (!strcmp(argv[i],"-f")) { filename = std::string(argv[++i]); }
+    else if (!strcmp(argv[i],"-m")) { module = true; }
+    else if (!strcmp(argv[i],"-i")) { roctype = ROC_PSI46DIG; }
+    else if (!strcmp(argv[i],"-n")) { nevents = atoi(argv[++i]); }
+    else if (!strcmp(argv[i],"-r")) { repeat = atoi(argv[++i]); }
+    else {
+      std::cout << "Unrecognized command line option " << argv[i] << std::endl;
+    }
+  }
+
+  // Recorded channel streams carry their own configuration:
+  dtbFileSource * recorded = NULL;
+  if(!filename.empty()) {
+    try {
+      recorded = new dtbFileSource(filename);
+      module = recorded->GetTbmPresent();
+      roctype = recorded->GetDeviceType();
+      std::cout << "Replaying channel " << static_cast<int>(recorded->GetChannel()) << " of recorded data" << std::endl;
+    }
+    catch(dsFileError &) {}
+  }
+  bool invert = (roctype == ROC_PSI46DIG);
+
+  // Read the raw data or generate it:
+  std::vector<uint16_t> data;
+  if(!filename.empty() && !recorded) {
+    std::ifstream fin(filename.c_str(), std::ios::in | std::ios::binary);
+    if(!fin.is_open()) {
+      std::cout << "Could not open file " << filename << std::endl;
+      return 1;
+    }
+    fin.seekg(0, std::ios::end);
+    data.resize(static_cast<size_t>(fin.tellg())/sizeof(uint16_t));
+    fin.seekg(0, std::ios::beg);
+    if(!data.empty()) { fin.read(reinterpret_cast<char*>(&data[0]), sizeof(uint16_t)*data.size()); }
+  }
+  else if(filename.empty()) { data = generateBuffer(module, nevents, module ? 8 : 1, 4, invert); }
+
+  // Split the stream into events once:
+  std::vector<rawEvent> events;
+  wordSource words(data, module, roctype);
+  dtbEventSplitter splitter;
+  dataSink<rawEvent*> rawpump;
+  if(recorded) { *recorded >> splitter >> rawpump; }
+  else { words >> splitter >> rawpump; }
+  try { while(1) { events.push_back(*rawpump.Get()); } }
+  catch(dsBufferEmpty &) {}
+  delete recorded;
+
+  size_t nwords = 0;
+  for(std::vector<rawEvent>::iterator it = events.begin(); it != events.end(); ++it) { nwords += it->GetSize(); }
+  std::cout << (module ? "DESER400" : "DESER160") << ": " << events.size() << " events, "
+	    << nwords << " words, " << repeat << " passes" << std::endl;
+
+  // Reference decoder:
+  size_t refpixels = 0, referrors = 0;
+  uint64_t refsum = 0;
+  Event evt;
+  timer t_ref;
+  for(unsigned int pass = 0; pass < repeat; pass++) {
+    for(std::vector<rawEvent>::iterator it = events.begin(); it != events.end(); ++it) {
+      if(module) referenceDeser400(*it, invert, evt);
+      else referenceDeser160(*it, invert, evt);
+      refpixels += evt.pixels.size();
+      referrors += evt.numDecoderErrors;
+      refsum += checksum(evt);
+    }
+  }
+  double ms_ref = static_cast<double>(t_ref.get());
+
+  // Table-driven decoder:
+  size_t newpixels = 0, newerrors = 0;
+  uint64_t newsum = 0;
+  rawEventSource source(events, module, roctype);
+  dtbEventDecoder decoder;
+  dataSink<Event*> pump;
+  source >> decoder >> pump;
+  timer t_new;
+  for(unsigned int pass = 0; pass < repeat; pass++) {
+    source.Rewind();
+    for(size_t i = 0; i < events.size(); i++) {
+      Event * e = pump.Get();
+      newpixels += e->pixels.size();
+      newerrors += e->numDecoderErrors;
+      newsum += checksum(*e);
+    }
+  }
+  double ms_new = static_cast<double>(t_new.get());
+
+  double total = static_cast<double>(nwords)*repeat;
+  std::cout << "reference: " << refpixels << " pixels, " << referrors << " errors, "
+	    << (ms_ref > 0 ? total/ms_ref*1000 : 0) << " words/s" << std::endl;
+  std::cout << "table:     " << newpixels << " pixels, " << newerrors << " errors, "
+	    << (ms_new > 0 ? total/ms_new*1000 : 0) << " words/s" << std::endl;
+  if(refpixels != newpixels || referrors != newerrors || refsum != newsum) {
+    std::cout << "Decoder results differ!" << std::endl;
+    return 1;
+  }
+  return 0;
+}
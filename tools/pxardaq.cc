@@ -47,7 +47,7 @@ int getspill() {
 int main(int argc, char* argv[]) {
 
   std::cout << argc << " arguments provided." << std::endl;
-  std::string verbosity, filename;
+  std::string verbosity, filename, recordname;
   uint32_t triggers = 0;
   bool testpulses = false;
   bool spills = false;
@@ -59,6 +59,7 @@ int main(int argc, char* argv[]) {
     if (!strcmp(argv[i],"-h")) {
       std::cout << "Help:" << std::endl;
       std::cout << "-f filename    file to store DAQ data in" << std::endl;
+      std::cout << "-r basename    record the raw stream of every DAQ channel to basename_ch<N>.dat" << std::endl;
       std::cout << "-n triggers    number of triggers to be sent" << std::endl;
       std::cout << "-v verbosity   verbosity level, default INFO" << std::endl;
       return 0;
@@ -67,6 +68,10 @@ int main(int argc, char* argv[]) {
       filename = std::string(argv[++i]);
       std::cout << "Writing to file " << filename << std::endl;
     }
+    else if (!strcmp(argv[i],"-r")) {
+      recordname = std::string(argv[++i]);
+      std::cout << "Recording raw channel data to " << recordname << "_ch*.dat" << std::endl;
+    }
     else if (!strcmp(argv[i],"-n")) {
       triggers = atoi(argv[++i]);
       std::cout << "Sending " << triggers << " triggers" << std::endl;
@@ -208,6 +213,9 @@ int main(int argc, char* argv[]) {
     // Read DUT info, should print above filled information:
     _api->_dut->info();
 
+    // Record all raw data read from the DTB during the DAQ sessions:
+    if(!recordname.empty()) { _api->daqRecord(recordname); }
+
     // Setup signal handlers to allow interruption:
     signal(SIGABRT, &sighandler);
     signal(SIGTERM, &sighandler);
@@ -0,0 +1,177 @@
+// Microbenchmark for the threshold edge search
+//
+// Generates synthetic efficiency curves (s-curves with Gaussian spread of
+// threshold and noise, binomial hit counts) for all pixels of a number of
+// ROCs and extracts the threshold of every pixel, once with the previous
+// search over the result vector and a std::map of efficiencies and once
+// with the dense thresholdSearch used by the API. Checks that both find the
+// same thresholds and reports the time per threshold map for both.
+
+#include "datatypes.h"
+#include "accumulator.h"
+#include "helper.h"
+#include "constants.h"
+#include "timer.h"
+#include <iostream>
+#include <algorithm>
+#include <map>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+
+using namespace pxar;
+
+// Small linear congruential generator, so the data does not depend on the platform:
+class lcg {
+  uint64_t state;
+public:
+  lcg(uint64_t seed) : state(seed) {}
+  double Uniform() {
+    state = state*6364136223846793005ULL + 1442695040888963407ULL;
+    return static_cast<double>(state >> 11)/9007199254740992.0;
+  }
+  double Gaus() {
+    double u1 = Uniform(), u2 = Uniform();
+    if(u1 < 1e-12) u1 = 1e-12;
+    return sqrt(-2*log(u1))*cos(2*acos(-1.0)*u2);
+  }
+};
+
+// Previous implementation of the edge search, kept as reference:
+std::vector<pixel> referenceSearch(const dacScanResult & scan, uint16_t threshold, bool rising) {
+  std::vector<pixel> result;
+  std::map<pixel,uint8_t> oldvalue;
+
+  for(size_t n = 0; n < scan.size(); n++) {
+    size_t point = (rising ? n : scan.size()-1-n);
+    uint8_t dac = scan.dac1(point);
+    for(std::vector<pixel>::const_iterator pixit = scan.begin(point); pixit != scan.end(point); ++pixit) {
+      std::vector<pixel>::iterator px = std::find_if(result.begin(),
+						     result.end(),
+						     findPixelXY(pixit->column, pixit->row, pixit->roc_id));
+      if(px != result.end()) {
+	uint8_t delta_old = abs(oldvalue[*px] - threshold);
+	uint8_t delta_new = abs(static_cast<int>(pixit->getValue()) - threshold);
+	bool positive_slope = (pixit->getValue()-oldvalue[*px] > 0 ? true : false);
+	if(!positive_slope) continue;
+	if(!(delta_new < delta_old)) continue;
+	px->setValue(dac);
+	oldvalue[*px] = static_cast<uint8_t>(pixit->getValue());
+      }
+      else {
+	oldvalue.insert(std::make_pair(*pixit,static_cast<uint8_t>(pixit->getValue())));
+	result.push_back(*pixit);
+	result.back().setValue(dac);
+      }
+    }
+  }
+  return result;
+}
+
+std::vector<pixel> denseSearch(const dacScanResult & scan, uint16_t threshold, bool rising) {
+  std::vector<pixel> result;
+  thresholdSearch search(threshold);
+
+  for(size_t n = 0; n < scan.size(); n++) {
+    size_t point = (rising ? n : scan.size()-1-n);
+    uint8_t dac = scan.dac1(point);
+    for(std::vector<pixel>::const_iterator pixit = scan.begin(point); pixit != scan.end(point); ++pixit) {
+      search.Fill(*pixit, dac);
+    }
+  }
+  search.Get(result);
+  return result;
+}
+
+bool identical(const std::vector<pixel> & a, const std::vector<pixel> & b) {
+  if(a.size() != b.size()) return false;
+  for(size_t i = 0; i < a.size(); i++) {
+    if(a[i].roc_id != b[i].roc_id || a[i].column != b[i].column || a[i].row != b[i].row || a[i].getValue() != b[i].getValue()) return false;
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+
+  unsigned int nrocs = 1;
+  unsigned int ntrig = 10;
+  unsigned int repeat = 5;
+  bool falling = false;
+  bool reference = true;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-h")) {
+      std::cout << "Help:" << std::endl;
+      std::cout << "-n rocs        number of ROCs with all pixels responding, default 1" << std::endl;
+      std::cout << "-t triggers    number of triggers per DAC point, default 10" << std::endl;
+      std::cout << "-r repeat      number of passes, default 5" << std::endl;
+      std::cout << "-f             search the falling edge, default rising edge" << std::endl;
+      std::cout << "-s             skip the reference search (slow for many ROCs)" << std::endl;
+      return 0;
+    }
+    else if (!strcmp(argv[i],"-n")) { nrocs = atoi(argv[++i]); }
+    else if (!strcmp(argv[i],"-t")) { ntrig = atoi(argv[++i]); }
+    else if (!strcmp(argv[i],"-r")) { repeat = atoi(argv[++i]); }
+    else if (!strcmp(argv[i],"-f")) { falling = true; }
+    else if (!strcmp(argv[i],"-s")) { reference = false; }
+    else {
+      std::cout << "Unrecognized command line option " << argv[i] << std::endl;
+    }
+  }
+  if(nrocs < 1 || nrocs > 255 || ntrig < 1 || ntrig > 255 || repeat < 1) {
+    std::cout << "Invalid parameters." << std::endl;
+    return 1;
+  }
+
+  // Threshold and noise of every pixel, 50% threshold level:
+  lcg random(42);
+  size_t npixels = nrocs*ROC_NUMCOLS*ROC_NUMROWS;
+  std::vector<double> pxthreshold(npixels), pxnoise(npixels);
+  for(size_t i = 0; i < npixels; i++) {
+    pxthreshold[i] = 100 + 10*random.Gaus();
+    pxnoise[i] = std::max(0.5, 2 + 0.5*random.Gaus());
+  }
+  uint16_t threshold = static_cast<uint16_t>(ceil(static_cast<float>(ntrig)*50/100));
+
+  // Efficiency of all pixels at every DAC value, pixels without hits are not stored:
+  dacScanResult scan;
+  std::vector<pixel> hits;
+  for(unsigned int dac = 0; dac < 256; dac++) {
+    hits.clear();
+    for(size_t i = 0; i < npixels; i++) {
+      double x = (static_cast<double>(dac) - pxthreshold[i])/(sqrt(2.0)*pxnoise[i]);
+      if(falling) x = -x;
+      double p = 0.5*erfc(-x);
+      unsigned int n = 0;
+      for(unsigned int t = 0; t < ntrig; t++) { if(random.Uniform() < p) n++; }
+      if(n == 0) continue;
+      hits.push_back(pixel(static_cast<uint8_t>(i/(ROC_NUMCOLS*ROC_NUMROWS)),
+			   static_cast<uint8_t>((i/ROC_NUMROWS)%ROC_NUMCOLS),
+			   static_cast<uint8_t>(i%ROC_NUMROWS), n));
+    }
+    scan.AddPoint(static_cast<uint8_t>(dac), 0, hits.size());
+    scan.AddPixels(dac, hits.begin(), hits.end());
+  }
+  std::cout << "Generated " << scan.size() << " DAC points with " << scan.pixels.size() << " pixel efficiencies for "
+	    << nrocs << " ROC(s), " << ntrig << " triggers, " << (falling ? "falling" : "rising") << " edge." << std::endl;
+
+  std::vector<pixel> dense, ref;
+  timer t1;
+  for(unsigned int r = 0; r < repeat; r++) { dense = denseSearch(scan, threshold, !falling); }
+  double tdense = static_cast<double>(t1.get())/repeat;
+  std::cout << "thresholdSearch: " << tdense << " ms per map, " << dense.size() << " pixels" << std::endl;
+
+  if(reference) {
+    timer t2;
+    for(unsigned int r = 0; r < repeat; r++) { ref = referenceSearch(scan, threshold, !falling); }
+    double tref = static_cast<double>(t2.get())/repeat;
+    std::cout << "reference:       " << tref << " ms per map, " << ref.size() << " pixels" << std::endl;
+    std::cout << "Results " << (identical(dense, ref) ? "identical" : "DIFFERENT")
+	      << ", speedup " << (tdense > 0 ? tref/tdense : 0) << std::endl;
+  }
+
+  double mean = 0;
+  for(std::vector<pixel>::iterator px = dense.begin(); px != dense.end(); ++px) { mean += px->getValue(); }
+  if(!dense.empty()) { std::cout << "Mean threshold: " << mean/dense.size() << std::endl; }
+  return 0;
+}
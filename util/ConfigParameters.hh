@@ -72,6 +72,7 @@ public:
   std::string getDirectory()              {return fDirectory;}
   std::string getRocType()                {return fRocType;}
   std::string getTbmType()                {return fTbmType;}
+  std::string getTBName()                 {return fTBName;}
 
   std::vector<std::pair<std::string,uint8_t> >  getTbParameters();
   std::vector<std::pair<std::string,double> >  getTbPowerSettings();